@@ -0,0 +1,479 @@
+// Driver hot path microbenchmark.
+//
+// Runs controlled syscall storms with and without the kernel module attached
+// and reports the per-syscall cost of the probe, along with the ring counters
+// the driver maintains for each CPU. Every configured combination of consumer
+// count, snaplen and dropping mode is measured against a baseline taken with
+// no consumer attached (the module doesn't register its tracepoints until the
+// first consumer opens a device).
+//
+// Needs root and a loaded module.
+
+#include <core/logger.h>
+#include <core/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/types.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "ppm_ringbuffer.h"
+#include "ppm_events_public.h"
+
+using namespace deepsys::core;
+
+namespace {
+
+struct RingCounters {
+    uint64_t n_evts = 0;
+    uint64_t n_drops_buffer = 0;
+    uint64_t n_preemptions = 0;
+
+    RingCounters& operator+=(const RingCounters& other) {
+        n_evts += other.n_evts;
+        n_drops_buffer += other.n_drops_buffer;
+        n_preemptions += other.n_preemptions;
+        return *this;
+    }
+};
+
+struct CaptureSettings {
+    std::string device_prefix;
+    uint32_t snaplen = RW_SNAPLEN_DEFAULT;
+    uint32_t sampling_ratio = 0;  // 0 disables dropping mode
+
+    static constexpr uint32_t RW_SNAPLEN_DEFAULT = 80;
+};
+
+// A consumer, as the driver sees it, is the thread that opened the devices.
+// Each Consumer therefore owns a thread that opens one device per CPU, keeps
+// the rings drained until stopped, and collects the counters on the way out.
+class Consumer {
+public:
+    explicit Consumer(CaptureSettings settings) : settings_(std::move(settings)) {}
+
+    ~Consumer() { stop(); }
+
+    Result<bool> start() {
+        thread_ = std::thread([this] { run(); });
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_cv_.wait(lock, [this] { return ready_; });
+        if (error_ != ErrorCode::Success) {
+            lock.unlock();
+            stop();
+            return error_;
+        }
+        return true;
+    }
+
+    void stop() {
+        stopping_ = true;
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    const RingCounters& counters() const { return counters_; }
+
+private:
+    struct Ring {
+        int fd = -1;
+        ppm_ring_buffer_info* info = nullptr;
+    };
+
+    void signal_ready(ErrorCode error) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = error;
+        ready_ = true;
+        ready_cv_.notify_one();
+    }
+
+    ErrorCode open_rings() {
+        long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+
+        for (long cpu = 0; cpu < ncpus; ++cpu) {
+            std::string path = settings_.device_prefix + std::to_string(cpu);
+            int fd = open(path.c_str(), O_RDWR | O_SYNC);
+            if (fd < 0) {
+                if (errno == ENODEV) {
+                    // Offline CPU
+                    continue;
+                }
+                LOG_ERROR("can't open " << path << ": " << strerror(errno));
+                return errno == EACCES || errno == EPERM ? ErrorCode::PermissionDenied : ErrorCode::SystemError;
+            }
+
+            void* info = mmap(nullptr, sizeof(ppm_ring_buffer_info), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (info == MAP_FAILED) {
+                LOG_ERROR("can't map the ring info of " << path << ": " << strerror(errno));
+                close(fd);
+                return ErrorCode::SystemError;
+            }
+
+            rings_.push_back({fd, static_cast<ppm_ring_buffer_info*>(info)});
+        }
+
+        if (rings_.empty()) {
+            return ErrorCode::NotFound;
+        }
+
+        // Snaplen and dropping mode are per consumer, any fd will do
+        int fd = rings_.front().fd;
+        if (ioctl(fd, PPM_IOCTL_SET_SNAPLEN, settings_.snaplen) < 0) {
+            LOG_ERROR("PPM_IOCTL_SET_SNAPLEN failed: " << strerror(errno));
+            return ErrorCode::SystemError;
+        }
+
+        if (settings_.sampling_ratio != 0) {
+            if (ioctl(fd, PPM_IOCTL_ENABLE_DROPPING_MODE, settings_.sampling_ratio) < 0) {
+                LOG_ERROR("PPM_IOCTL_ENABLE_DROPPING_MODE failed: " << strerror(errno));
+                return ErrorCode::InvalidArgument;
+            }
+        }
+
+        for (const Ring& ring : rings_) {
+            if (ioctl(ring.fd, PPM_IOCTL_ENABLE_CAPTURE) < 0) {
+                LOG_ERROR("PPM_IOCTL_ENABLE_CAPTURE failed: " << strerror(errno));
+                return ErrorCode::SystemError;
+            }
+        }
+
+        return ErrorCode::Success;
+    }
+
+    void close_rings() {
+        for (Ring& ring : rings_) {
+            ioctl(ring.fd, PPM_IOCTL_DISABLE_CAPTURE);
+
+            counters_.n_evts += ring.info->n_evts;
+            counters_.n_drops_buffer += ring.info->n_drops_buffer;
+            counters_.n_preemptions += ring.info->n_preemptions;
+
+            munmap(ring.info, sizeof(ppm_ring_buffer_info));
+            close(ring.fd);
+        }
+        rings_.clear();
+    }
+
+    void run() {
+        ErrorCode error = open_rings();
+        signal_ready(error);
+
+        if (error == ErrorCode::Success) {
+            // Keep the rings empty, so the benchmark measures the probe and
+            // not a ring that stopped accepting events
+            while (!stopping_) {
+                for (Ring& ring : rings_) {
+                    ring.info->tail = ring.info->head;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+        }
+
+        close_rings();
+    }
+
+    CaptureSettings settings_;
+    std::thread thread_;
+    std::vector<Ring> rings_;
+    RingCounters counters_;
+    std::atomic<bool> stopping_{false};
+
+    std::mutex mutex_;
+    std::condition_variable ready_cv_;
+    bool ready_ = false;
+    ErrorCode error_ = ErrorCode::Success;
+};
+
+struct Workload {
+    std::string name;
+    uint32_t syscalls_per_iteration;
+    std::function<bool()> setup;
+    std::function<void(uint64_t)> run;
+    std::function<void()> teardown;
+};
+
+std::vector<Workload> make_workloads() {
+    static int zero_fd = -1;
+    static int udp_fd = -1;
+    static sockaddr_in loopback{};
+
+    std::vector<Workload> workloads;
+
+    workloads.push_back({"getpid", 1,
+        [] { return true; },
+        [](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                // Bypass any libc caching
+                syscall(SYS_getpid);
+            }
+        },
+        [] {}});
+
+    workloads.push_back({"read", 1,
+        [] {
+            zero_fd = open("/dev/zero", O_RDONLY);
+            return zero_fd >= 0;
+        },
+        [](uint64_t iterations) {
+            char buf[64];
+            for (uint64_t i = 0; i < iterations; ++i) {
+                if (read(zero_fd, buf, sizeof(buf)) < 0) {
+                    break;
+                }
+            }
+        },
+        [] { close(zero_fd); }});
+
+    workloads.push_back({"openclose", 2,
+        [] { return true; },
+        [](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                int fd = open("/dev/null", O_RDONLY);
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+        },
+        [] {}});
+
+    // A connected UDP socket can be connected again and again, which keeps
+    // connect() on loopback repeatable without an accept side
+    workloads.push_back({"connect", 1,
+        [] {
+            udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+            loopback.sin_family = AF_INET;
+            loopback.sin_port = htons(9);
+            loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            return udp_fd >= 0;
+        },
+        [](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                connect(udp_fd, reinterpret_cast<const sockaddr*>(&loopback), sizeof(loopback));
+            }
+        },
+        [] { close(udp_fd); }});
+
+    return workloads;
+}
+
+struct Options {
+    std::string device_prefix = "/dev/deepsys";
+    uint64_t iterations = 1000000;
+    std::vector<uint32_t> consumers = {1};
+    std::vector<uint32_t> snaplens = {80};
+    std::vector<uint32_t> sampling_ratios = {0};
+    std::vector<std::string> workloads;
+    int cpu = -1;
+};
+
+void usage() {
+    std::cerr <<
+        "Usage: deepsys_driver_bench [options]\n"
+        "  -d, --device PREFIX      device prefix (default /dev/deepsys)\n"
+        "  -n, --iterations N       iterations per measurement (default 1000000)\n"
+        "  -c, --consumers LIST     consumer counts, e.g. 1,2,4 (default 1)\n"
+        "  -s, --snaplen LIST       snaplens, e.g. 80,4096 (default 80)\n"
+        "  -r, --dropping LIST      sampling ratios, 0 disables dropping mode (default 0)\n"
+        "  -w, --workload LIST      getpid,read,openclose,connect (default all)\n"
+        "  -p, --cpu N              pin the workload to CPU N\n";
+}
+
+template<typename T>
+bool parse_list(const std::string& arg, std::vector<T>& out) {
+    out.clear();
+    std::istringstream in(arg);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (item.empty()) {
+            return false;
+        }
+        if constexpr (std::is_same_v<T, std::string>) {
+            out.push_back(item);
+        } else {
+            out.push_back(static_cast<T>(std::stoul(item)));
+        }
+    }
+    return !out.empty();
+}
+
+bool parse_options(int argc, char** argv, Options& opts) {
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "-h" || arg == "--help" || i + 1 >= argc) {
+                return false;
+            }
+            std::string value = argv[++i];
+
+            if (arg == "-d" || arg == "--device") {
+                opts.device_prefix = value;
+            } else if (arg == "-n" || arg == "--iterations") {
+                opts.iterations = std::stoull(value);
+            } else if (arg == "-c" || arg == "--consumers") {
+                if (!parse_list(value, opts.consumers)) return false;
+            } else if (arg == "-s" || arg == "--snaplen") {
+                if (!parse_list(value, opts.snaplens)) return false;
+            } else if (arg == "-r" || arg == "--dropping") {
+                if (!parse_list(value, opts.sampling_ratios)) return false;
+            } else if (arg == "-w" || arg == "--workload") {
+                if (!parse_list(value, opts.workloads)) return false;
+            } else if (arg == "-p" || arg == "--cpu") {
+                opts.cpu = std::stoi(value);
+            } else {
+                return false;
+            }
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+double measure_ns_per_syscall(const Workload& workload, uint64_t iterations) {
+    // Warm up caches and the dentry/socket paths before timing
+    workload.run(iterations / 100 + 1);
+
+    auto start = std::chrono::steady_clock::now();
+    workload.run(iterations);
+    auto end = std::chrono::steady_clock::now();
+
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    return static_cast<double>(ns) / static_cast<double>(iterations * workload.syscalls_per_iteration);
+}
+
+void print_header() {
+    std::cout << std::left
+              << std::setw(10) << "workload"
+              << std::right
+              << std::setw(10) << "consumers"
+              << std::setw(9) << "snaplen"
+              << std::setw(9) << "dropping"
+              << std::setw(12) << "ns/syscall"
+              << std::setw(12) << "overhead"
+              << std::setw(14) << "n_evts"
+              << std::setw(14) << "drops_buffer"
+              << std::setw(13) << "preemptions"
+              << "\n";
+}
+
+void print_row(const std::string& workload, uint32_t consumers, uint32_t snaplen, uint32_t sampling_ratio,
+               double ns, double baseline_ns, const RingCounters& counters) {
+    std::cout << std::left
+              << std::setw(10) << workload
+              << std::right
+              << std::setw(10) << consumers
+              << std::setw(9) << (consumers ? std::to_string(snaplen) : "-")
+              << std::setw(9) << (consumers && sampling_ratio ? "1/" + std::to_string(sampling_ratio) : "-")
+              << std::setw(12) << std::fixed << std::setprecision(1) << ns
+              << std::setw(12) << std::fixed << std::setprecision(1) << ns - baseline_ns
+              << std::setw(14) << counters.n_evts
+              << std::setw(14) << counters.n_drops_buffer
+              << std::setw(13) << counters.n_preemptions
+              << "\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        usage();
+        return 1;
+    }
+
+    if (opts.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(opts.cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            LOG_WARNING("can't pin to CPU " << opts.cpu << ": " << strerror(errno));
+        }
+    }
+
+    std::vector<Workload> workloads;
+    for (Workload& workload : make_workloads()) {
+        if (opts.workloads.empty() ||
+            std::find(opts.workloads.begin(), opts.workloads.end(), workload.name) != opts.workloads.end()) {
+            workloads.push_back(std::move(workload));
+        }
+    }
+    if (workloads.empty()) {
+        usage();
+        return 1;
+    }
+
+    print_header();
+
+    for (const Workload& workload : workloads) {
+        if (!workload.setup()) {
+            LOG_ERROR("can't set up the " << workload.name << " workload: " << strerror(errno));
+            return 1;
+        }
+
+        double baseline_ns = measure_ns_per_syscall(workload, opts.iterations);
+        print_row(workload.name, 0, 0, 0, baseline_ns, baseline_ns, RingCounters{});
+
+        for (uint32_t nconsumers : opts.consumers) {
+            for (uint32_t snaplen : opts.snaplens) {
+                for (uint32_t sampling_ratio : opts.sampling_ratios) {
+                    CaptureSettings settings;
+                    settings.device_prefix = opts.device_prefix;
+                    settings.snaplen = snaplen;
+                    settings.sampling_ratio = sampling_ratio;
+
+                    std::vector<std::unique_ptr<Consumer>> consumers;
+                    for (uint32_t i = 0; i < nconsumers; ++i) {
+                        consumers.push_back(std::make_unique<Consumer>(settings));
+                        auto res = consumers.back()->start();
+                        if (!res) {
+                            LOG_ERROR("can't attach consumer " << i << ": "
+                                      << make_error_code(res.error()).message());
+                            return 1;
+                        }
+                    }
+
+                    double ns = measure_ns_per_syscall(workload, opts.iterations);
+
+                    RingCounters counters;
+                    for (auto& consumer : consumers) {
+                        consumer->stop();
+                        counters += consumer->counters();
+                    }
+
+                    print_row(workload.name, nconsumers, snaplen, sampling_ratio, ns, baseline_ns, counters);
+                }
+            }
+        }
+
+        workload.teardown();
+    }
+
+    return 0;
+}
@@ -0,0 +1,593 @@
+// Filler test bench.
+//
+// Runs the driver fillers in userspace through the shim in shim/, either to
+// measure how fast each one serializes its event (bench) or to feed them
+// random arguments and check every event they produce against the event
+// table (fuzz).
+//
+// Random arguments are drawn from a pool of plausible values: small integers,
+// errnos, and pointers to strings, argv tables, iovecs, msghdrs and
+// sockaddrs laid out in a fake user memory arena, plus pointers the shim
+// reports as faulting.
+
+#include <core/logger.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "ppm_events_public.h"
+#include "filler_host.h"
+
+extern "C" const struct ppm_event_info g_event_info[];
+
+namespace {
+
+// Return codes of ppm_events.h, which can't be included from here
+constexpr int PPM_SUCCESS = 0;
+constexpr int PPM_FAILURE_BUFFER_FULL = -1;
+constexpr int PPM_FAILURE_INVALID_USER_MEMORY = -2;
+constexpr int PPM_FAILURE_BUG = -3;
+
+constexpr uint32_t FULL_BUFFER_SIZE = 64 * 1024;
+constexpr uint32_t GUARD_SIZE = 64;
+constexpr uint8_t GUARD_BYTE = 0xa5;
+
+std::string event_name(uint16_t type) {
+    return std::string(g_event_info[type].name) + ((type & 1) ? "_x" : "_e");
+}
+
+// Size of a fixed size parameter type, 0 for the variable size ones
+uint32_t param_size(ppm_param_type type) {
+    switch (type) {
+    case PT_INT8: case PT_UINT8: case PT_FLAGS8: case PT_SIGTYPE: case PT_L4PROTO: case PT_SOCKFAMILY:
+        return 1;
+    case PT_INT16: case PT_UINT16: case PT_FLAGS16: case PT_SYSCALLID: case PT_PORT:
+        return 2;
+    case PT_INT32: case PT_UINT32: case PT_FLAGS32: case PT_UID: case PT_GID: case PT_SIGSET: case PT_BOOL:
+    case PT_IPV4ADDR:
+        return 4;
+    case PT_INT64: case PT_UINT64: case PT_ERRNO: case PT_FD: case PT_PID: case PT_RELTIME: case PT_ABSTIME:
+    case PT_DOUBLE:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// Fake user memory the fillers copy from. Everything outside of it faults.
+class UserArena {
+public:
+    explicit UserArena(uint64_t seed) : mem_(256 * 1024), rng_(seed) {
+        std::uniform_int_distribution<int> byte(0, 255);
+        for (auto& b : mem_) {
+            b = static_cast<uint8_t>(byte(rng_));
+        }
+
+        size_t off = 0;
+        raw_ = {off, 64 * 1024};
+        off += raw_.size;
+
+        // NUL terminated strings, from empty to longer than a path
+        size_t strings_start = off;
+        std::uniform_int_distribution<int> len(0, 600);
+        std::uniform_int_distribution<int> printable('!', '~');
+        while (off < strings_start + 64 * 1024 - 700) {
+            int n = len(rng_);
+            strings_.push_back(off);
+            for (int i = 0; i < n; ++i) {
+                mem_[off++] = static_cast<uint8_t>(printable(rng_));
+            }
+            mem_[off++] = 0;
+        }
+        off = strings_start + 64 * 1024;
+
+        // NULL terminated string pointer tables, like argv and envp
+        for (int t = 0; t < 64; ++t) {
+            tables_.push_back(off);
+            int n = std::uniform_int_distribution<int>(0, 24)(rng_);
+            for (int i = 0; i < n; ++i) {
+                put<uint64_t>(off, addr(random_string()));
+                off += sizeof(uint64_t);
+            }
+            put<uint64_t>(off, 0);
+            off += sizeof(uint64_t);
+        }
+
+        // iovec arrays into the raw region
+        for (int t = 0; t < 64; ++t) {
+            iovecs_.push_back(off);
+            for (int i = 0; i < 8; ++i) {
+                iovec iov;
+                size_t base = std::uniform_int_distribution<size_t>(0, raw_.size - 1)(rng_);
+                iov.iov_base = reinterpret_cast<void*>(addr(raw_.off + base));
+                iov.iov_len = std::uniform_int_distribution<size_t>(0, raw_.size - base)(rng_);
+                put(off, iov);
+                off += sizeof(iov);
+            }
+        }
+
+        // sockaddrs of every family the fillers decode
+        for (int t = 0; t < 48; ++t) {
+            sockaddrs_.push_back(off);
+            sockaddr_storage ss;
+            memset(&ss, 0, sizeof(ss));
+            switch (t % 3) {
+            case 0: {
+                auto* sin = reinterpret_cast<sockaddr_in*>(&ss);
+                sin->sin_family = AF_INET;
+                sin->sin_port = htons(static_cast<uint16_t>(rng_()));
+                sin->sin_addr.s_addr = static_cast<uint32_t>(rng_());
+                break;
+            }
+            case 1: {
+                auto* sin6 = reinterpret_cast<sockaddr_in6*>(&ss);
+                sin6->sin6_family = AF_INET6;
+                sin6->sin6_port = htons(static_cast<uint16_t>(rng_()));
+                for (auto& b : sin6->sin6_addr.s6_addr) {
+                    b = static_cast<uint8_t>(rng_());
+                }
+                break;
+            }
+            default: {
+                auto* sun = reinterpret_cast<sockaddr_un*>(&ss);
+                sun->sun_family = AF_UNIX;
+                snprintf(sun->sun_path, sizeof(sun->sun_path), "/tmp/sock.%u", static_cast<unsigned>(rng_()));
+                break;
+            }
+            }
+            put(off, ss);
+            off += sizeof(ss);
+        }
+
+        // msghdrs pointing at the above
+        for (int t = 0; t < 32; ++t) {
+            msghdrs_.push_back(off);
+            msghdr mh;
+            memset(&mh, 0, sizeof(mh));
+            if (t & 1) {
+                mh.msg_name = reinterpret_cast<void*>(addr(sockaddrs_[t % sockaddrs_.size()]));
+                mh.msg_namelen = sizeof(sockaddr_storage);
+            }
+            mh.msg_iov = reinterpret_cast<iovec*>(addr(iovecs_[t % iovecs_.size()]));
+            mh.msg_iovlen = std::uniform_int_distribution<size_t>(0, 8)(rng_);
+            put(off, mh);
+            off += sizeof(mh);
+        }
+    }
+
+    const uint8_t* base() const { return mem_.data(); }
+    size_t size() const { return mem_.size(); }
+
+    uint64_t addr(size_t off) const { return reinterpret_cast<uint64_t>(mem_.data() + off); }
+    size_t random_string() { return strings_[rng_() % strings_.size()]; }
+
+    // Pointers
+    uint64_t raw_ptr(std::mt19937_64& rng) const { return addr(raw_.off + rng() % raw_.size); }
+    uint64_t string_ptr(std::mt19937_64& rng) const { return addr(strings_[rng() % strings_.size()]); }
+    uint64_t table_ptr(std::mt19937_64& rng) const { return addr(tables_[rng() % tables_.size()]); }
+    uint64_t iovec_ptr(std::mt19937_64& rng) const { return addr(iovecs_[rng() % iovecs_.size()]); }
+    uint64_t sockaddr_ptr(std::mt19937_64& rng) const { return addr(sockaddrs_[rng() % sockaddrs_.size()]); }
+    uint64_t msghdr_ptr(std::mt19937_64& rng) const { return addr(msghdrs_[rng() % msghdrs_.size()]); }
+    uint64_t faulting_ptr(std::mt19937_64& rng) const {
+        // Either side of the arena, or straddling its end
+        switch (rng() % 3) {
+        case 0: return 0x1000 + rng() % 0x1000;
+        case 1: return addr(mem_.size()) + rng() % 0x10000;
+        default: return addr(mem_.size()) - 1 - rng() % 8;
+        }
+    }
+
+    // Fills in the argument/environment area of the fake process
+    void set_task_strings(filler_host_task& task) {
+        size_t a = random_string();
+        task.arg_start = addr(a);
+        task.arg_end = addr(a + std::min<size_t>(strlen(reinterpret_cast<const char*>(mem_.data() + a)) + 1, 4096));
+        size_t e = random_string();
+        task.env_start = addr(e);
+        task.env_end = addr(e + std::min<size_t>(strlen(reinterpret_cast<const char*>(mem_.data() + e)) + 1, 4096));
+    }
+
+private:
+    struct Region {
+        size_t off;
+        size_t size;
+    };
+
+    template<typename T>
+    void put(size_t off, const T& value) {
+        memcpy(mem_.data() + off, &value, sizeof(value));
+    }
+
+    std::vector<uint8_t> mem_;
+    std::mt19937_64 rng_;
+    Region raw_{};
+    std::vector<size_t> strings_;
+    std::vector<size_t> tables_;
+    std::vector<size_t> iovecs_;
+    std::vector<size_t> sockaddrs_;
+    std::vector<size_t> msghdrs_;
+};
+
+uint64_t random_value(const UserArena& arena, std::mt19937_64& rng) {
+    switch (rng() % 11) {
+    case 0: return rng() % 64;
+    case 1: return rng();
+    case 2: return static_cast<uint64_t>(-static_cast<int64_t>(1 + rng() % 133));
+    case 3: return arena.raw_ptr(rng);
+    case 4: return arena.string_ptr(rng);
+    case 5: return arena.table_ptr(rng);
+    case 6: return arena.iovec_ptr(rng);
+    case 7: return arena.sockaddr_ptr(rng);
+    case 8: return arena.msghdr_ptr(rng);
+    case 9: return 0;
+    default: return arena.faulting_ptr(rng);
+    }
+}
+
+int64_t random_retval(std::mt19937_64& rng) {
+    switch (rng() % 5) {
+    case 0: return 0;
+    case 1: return static_cast<int64_t>(rng() % 4096);
+    case 2: return -static_cast<int64_t>(1 + rng() % 133);
+    case 3: return static_cast<int64_t>(rng() % 70000);
+    default: return static_cast<int64_t>(rng());
+    }
+}
+
+filler_host_call random_call(uint16_t type, const UserArena& arena, std::mt19937_64& rng) {
+    filler_host_call call{};
+    call.event_type = type;
+    call.syscall_id = type <= PPME_GENERIC_X ? static_cast<int32_t>(rng() % 512) : -1;
+    for (auto& arg : call.args) {
+        arg = random_value(arena, rng);
+    }
+    call.retval = random_retval(rng);
+    call.snaplen = (rng() & 1) ? 80 : static_cast<uint32_t>(rng() % 65536);
+    call.dynamic_snaplen = (rng() % 4) == 0;
+    return call;
+}
+
+// Checks a successfully filled event against its g_event_info entry.
+// Returns an empty string if it's well formed.
+std::string check_event(const uint8_t* buf, uint32_t buf_size, uint32_t event_len, uint16_t type) {
+    std::ostringstream err;
+    ppm_evt_hdr hdr;
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    const ppm_event_info& info = g_event_info[type];
+    uint32_t params_start = sizeof(ppm_evt_hdr) + info.nparams * sizeof(uint16_t);
+
+    if (event_len > buf_size) {
+        err << "event len " << event_len << " exceeds the buffer size " << buf_size;
+    } else if (hdr.len != event_len || hdr.type != type) {
+        err << "bad header: len " << hdr.len << " type " << hdr.type;
+    } else if (event_len < params_start) {
+        err << "event len " << event_len << " too short for " << info.nparams << " params";
+    }
+    if (!err.str().empty()) {
+        return err.str();
+    }
+
+    const uint8_t* lens = buf + sizeof(ppm_evt_hdr);
+    uint32_t off = params_start;
+    for (uint32_t j = 0; j < info.nparams; ++j) {
+        uint16_t len;
+        memcpy(&len, lens + j * sizeof(uint16_t), sizeof(len));
+
+        if (off + len > event_len) {
+            err << "param " << j << " (" << info.params[j].name << ") overflows the event";
+            return err.str();
+        }
+
+        const ppm_param_info* pinfo = &info.params[j];
+        const uint8_t* data = buf + off;
+        uint32_t data_len = len;
+
+        if (pinfo->type == PT_DYN && pinfo->info != nullptr) {
+            if (len < 1 || data[0] >= pinfo->ninfo) {
+                err << "param " << j << " (" << pinfo->name << ") has a bad dynamic index";
+                return err.str();
+            }
+            pinfo = &static_cast<const ppm_param_info*>(pinfo->info)[data[0]];
+            ++data;
+            --data_len;
+        }
+
+        uint32_t expected = param_size(pinfo->type);
+        if (expected != 0 && data_len != expected) {
+            err << "param " << j << " (" << info.params[j].name << ") is " << data_len
+                << " bytes, expected " << expected;
+            return err.str();
+        }
+
+        if ((pinfo->type == PT_CHARBUF || pinfo->type == PT_FSPATH) && data_len > 0 && data[data_len - 1] != 0) {
+            err << "param " << j << " (" << info.params[j].name << ") is not NUL terminated";
+            return err.str();
+        }
+
+        off += len;
+    }
+
+    if (off != event_len) {
+        err << "params add up to " << off << " bytes, event len is " << event_len;
+    }
+    return err.str();
+}
+
+std::string describe_call(const filler_host_call& call, uint32_t buf_size) {
+    std::ostringstream out;
+    out << event_name(call.event_type) << " syscall=" << call.syscall_id << " args=";
+    for (size_t j = 0; j < 6; ++j) {
+        out << (j ? "," : "") << "0x" << std::hex << call.args[j] << std::dec;
+    }
+    out << " retval=" << call.retval << " snaplen=" << call.snaplen << " buf=" << buf_size;
+    return out.str();
+}
+
+struct Options {
+    std::string mode;
+    uint64_t seed = 1;
+    uint64_t iterations = 0;
+    std::vector<std::string> events;
+    bool verbose = false;
+};
+
+void usage() {
+    std::cerr <<
+        "Usage: deepsys_filler_bench bench|fuzz [options]\n"
+        "  -n, --iterations N   calls per event (default 100000 for bench, 10000 for fuzz)\n"
+        "  -e, --event LIST     event names, e.g. open,read_x (default all)\n"
+        "  -s, --seed N         fuzz seed (default 1)\n"
+        "  -v, --verbose        show the driver log messages\n";
+}
+
+bool parse_options(int argc, char** argv, Options& opts) {
+    if (argc < 2) {
+        return false;
+    }
+    opts.mode = argv[1];
+    if (opts.mode != "bench" && opts.mode != "fuzz") {
+        return false;
+    }
+
+    try {
+        for (int i = 2; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "-v" || arg == "--verbose") {
+                opts.verbose = true;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                return false;
+            }
+            std::string value = argv[++i];
+
+            if (arg == "-n" || arg == "--iterations") {
+                opts.iterations = std::stoull(value);
+            } else if (arg == "-s" || arg == "--seed") {
+                opts.seed = std::stoull(value);
+            } else if (arg == "-e" || arg == "--event") {
+                std::istringstream in(value);
+                std::string item;
+                while (std::getline(in, item, ',')) {
+                    opts.events.push_back(item);
+                }
+            } else {
+                return false;
+            }
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    if (opts.iterations == 0) {
+        opts.iterations = opts.mode == "bench" ? 100000 : 10000;
+    }
+    return true;
+}
+
+std::vector<uint16_t> select_events(const Options& opts) {
+    std::vector<uint16_t> events;
+    for (uint32_t type = 0; type < filler_host_max_event(); ++type) {
+        if (!filler_host_has_filler(static_cast<uint16_t>(type))) {
+            continue;
+        }
+        if (!opts.events.empty()) {
+            std::string base = g_event_info[type].name;
+            std::string full = event_name(static_cast<uint16_t>(type));
+            if (std::none_of(opts.events.begin(), opts.events.end(),
+                             [&](const std::string& e) { return e == base || e == full; })) {
+                continue;
+            }
+        }
+        events.push_back(static_cast<uint16_t>(type));
+    }
+    return events;
+}
+
+int run_fuzz(const Options& opts, const std::vector<uint16_t>& events) {
+    UserArena arena(opts.seed);
+    filler_host_set_user_memory(arena.base(), arena.size());
+
+    std::vector<uint8_t> buf(FULL_BUFFER_SIZE + GUARD_SIZE);
+    uint64_t findings = 0;
+
+    std::cout << std::left << std::setw(28) << "event" << std::right
+              << std::setw(10) << "ok" << std::setw(10) << "full" << std::setw(10) << "fault"
+              << std::setw(10) << "error" << std::setw(10) << "findings" << "\n";
+
+    for (uint16_t type : events) {
+        uint64_t ok = 0, full = 0, fault = 0, error = 0, bad = 0;
+
+        // Seeded per event, so that a finding reproduces with --event alone
+        std::mt19937_64 rng(opts.seed * 1000003 + type);
+
+        for (uint64_t i = 0; i < opts.iterations; ++i) {
+            filler_host_task task{};
+            task.pid = 1000 + static_cast<int32_t>(rng() % 1000);
+            task.tgid = task.pid;
+            task.ppid = 1;
+            task.comm = "filler_bench";
+            task.total_vm = rng() % 100000;
+            task.rss = rng() % 10000;
+            arena.set_task_strings(task);
+            filler_host_set_task(&task);
+
+            filler_host_call call = random_call(type, arena, rng);
+
+            // Mostly a roomy buffer, sometimes one that is too small
+            uint32_t buf_size = (rng() % 8) ? FULL_BUFFER_SIZE : static_cast<uint32_t>(rng() % 512);
+            memset(buf.data() + buf_size, GUARD_BYTE, GUARD_SIZE);
+
+            uint32_t event_len;
+            int res = filler_host_fill(&call, buf.data(), buf_size, &event_len);
+
+            std::string problem;
+            if (std::any_of(buf.begin() + buf_size, buf.begin() + buf_size + GUARD_SIZE,
+                            [](uint8_t b) { return b != GUARD_BYTE; })) {
+                problem = "wrote past the end of the buffer";
+            }
+
+            switch (res) {
+            case PPM_SUCCESS:
+                ++ok;
+                if (problem.empty()) {
+                    problem = check_event(buf.data(), buf_size, event_len, type);
+                }
+                break;
+            case PPM_FAILURE_BUFFER_FULL:
+                ++full;
+                break;
+            case PPM_FAILURE_INVALID_USER_MEMORY:
+                ++fault;
+                break;
+            case PPM_FAILURE_BUG:
+                if (problem.empty()) {
+                    problem = "filler reported PPM_FAILURE_BUG";
+                }
+                break;
+            default:
+                // Fillers pass some kernel errors straight through
+                ++error;
+                break;
+            }
+
+            if (!problem.empty()) {
+                if (bad++ < 5) {
+                    LOG_ERROR(problem << " (res " << res << "): " << describe_call(call, buf_size));
+                }
+            }
+        }
+
+        findings += bad;
+        std::cout << std::left << std::setw(28) << event_name(type) << std::right
+                  << std::setw(10) << ok << std::setw(10) << full << std::setw(10) << fault
+                  << std::setw(10) << error << std::setw(10) << bad << "\n";
+    }
+
+    std::cout << "seed " << opts.seed << ", " << findings << " findings\n";
+    return findings ? 1 : 0;
+}
+
+int run_bench(const Options& opts, const std::vector<uint16_t>& events) {
+    UserArena arena(opts.seed);
+    filler_host_set_user_memory(arena.base(), arena.size());
+
+    filler_host_task task{};
+    task.pid = 1000;
+    task.tgid = 1000;
+    task.ppid = 1;
+    task.comm = "filler_bench";
+    task.total_vm = 25000;
+    task.rss = 2500;
+    arena.set_task_strings(task);
+    filler_host_set_task(&task);
+
+    std::mt19937_64 rng(opts.seed);
+    std::vector<uint8_t> buf(FULL_BUFFER_SIZE);
+
+    std::cout << std::left << std::setw(28) << "event" << std::right
+              << std::setw(12) << "ns/event" << std::setw(12) << "bytes" << std::setw(12) << "MB/s" << "\n";
+
+    for (uint16_t type : events) {
+        // Benchmark the call that produced the largest event among a few
+        // successful random ones, so that every filler is measured on its
+        // most complete path rather than on an early error exit
+        filler_host_call call{};
+        uint32_t event_len = 0;
+        int found = 0;
+        for (int attempt = 0; attempt < 10000 && found < 200; ++attempt) {
+            filler_host_call candidate = random_call(type, arena, rng);
+            uint32_t len;
+            if (filler_host_fill(&candidate, buf.data(), FULL_BUFFER_SIZE, &len) == PPM_SUCCESS) {
+                if (len > event_len) {
+                    call = candidate;
+                    event_len = len;
+                }
+                ++found;
+            }
+        }
+        if (!found) {
+            std::cout << std::left << std::setw(28) << event_name(type) << std::right
+                      << std::setw(12) << "-" << "\n";
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < opts.iterations; ++i) {
+            filler_host_fill(&call, buf.data(), FULL_BUFFER_SIZE, &event_len);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count())
+                    / static_cast<double>(opts.iterations);
+        double mbs = ns > 0 ? event_len / ns * 1e9 / (1024 * 1024) : 0;
+
+        std::cout << std::left << std::setw(28) << event_name(type) << std::right
+                  << std::setw(12) << std::fixed << std::setprecision(1) << ns
+                  << std::setw(12) << event_len
+                  << std::setw(12) << std::fixed << std::setprecision(1) << mbs << "\n";
+    }
+
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        usage();
+        return 1;
+    }
+
+    filler_host_init();
+    filler_host_set_log(opts.verbose);
+
+    std::vector<uint16_t> events = select_events(opts);
+    if (events.empty()) {
+        LOG_ERROR("no matching events");
+        return 1;
+    }
+
+    int res = opts.mode == "bench" ? run_bench(opts, events) : run_fuzz(opts, events);
+
+    if (filler_host_log_count() != 0 && !opts.verbose) {
+        LOG_INFO(filler_host_log_count() << " driver log messages suppressed, use -v to see them");
+    }
+    return res;
+}
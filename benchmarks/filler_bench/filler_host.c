@@ -0,0 +1,226 @@
+/*
+ * Drives the fillers the way record_event_consumer() in main.c does,
+ * minus the ring buffer.
+ */
+
+#include "ppm_ringbuffer.h"
+#include "ppm_events_public.h"
+#include "ppm_events.h"
+#include "ppm.h"
+
+#include "filler_host.h"
+
+static struct task_struct g_task;
+static struct task_struct g_parent;
+static struct mm_struct g_mm;
+static struct signal_struct g_signal;
+static struct ppm_consumer_t g_consumer;
+static char g_str_storage[STR_STORAGE_SIZE];
+static u32 g_nevents;
+
+static int32_t g_event_syscall[PPM_EVENT_MAX];
+
+void filler_host_init(void)
+{
+	struct filler_host_task task = {
+		.pid = 1000,
+		.tgid = 1000,
+		.ppid = 1,
+		.comm = "filler_bench",
+	};
+	int j;
+
+	for (j = 0; j < RLIM_NLIMITS; ++j) {
+		g_signal.rlim[j].rlim_cur = RLIM_INFINITY;
+		g_signal.rlim[j].rlim_max = RLIM_INFINITY;
+	}
+	g_signal.rlim[RLIMIT_NOFILE].rlim_cur = 1024;
+
+	g_task.mm = &g_mm;
+	g_task.signal = &g_signal;
+	g_task.real_parent = &g_parent;
+	g_task.parent = &g_parent;
+	ppm_shim_current = &g_task;
+
+	filler_host_set_task(&task);
+
+	for (j = 0; j < PPM_EVENT_MAX; ++j)
+		g_event_syscall[j] = -1;
+
+	for (j = SYSCALL_TABLE_SIZE - 1; j >= 0; --j) {
+		const struct syscall_evt_pair *pair = &g_syscall_table[j];
+
+		if (!(pair->flags & UF_USED))
+			continue;
+
+		g_event_syscall[pair->enter_event_type] = j + SYSCALL_TABLE_ID0;
+		g_event_syscall[pair->exit_event_type] = j + SYSCALL_TABLE_ID0;
+	}
+
+	dpi_lookahead_init();
+}
+
+void filler_host_set_task(const struct filler_host_task *task)
+{
+	g_task.pid = task->pid;
+	g_task.tgid = task->tgid;
+	g_task.min_flt = task->min_flt;
+	g_task.maj_flt = task->maj_flt;
+	strlcpy(g_task.comm, task->comm ? task->comm : "", sizeof(g_task.comm));
+	g_parent.pid = task->ppid;
+	g_parent.tgid = task->ppid;
+
+	g_mm.arg_start = task->arg_start;
+	g_mm.arg_end = task->arg_end;
+	g_mm.env_start = task->env_start;
+	g_mm.env_end = task->env_end;
+	g_mm.total_vm = task->total_vm;
+	g_mm.rss_stat.count[MM_ANONPAGES].counter = task->rss;
+}
+
+void filler_host_set_user_memory(const void *base, uint64_t size)
+{
+	ppm_shim_set_user_memory(base, size);
+}
+
+void filler_host_set_log(bool enabled)
+{
+	ppm_shim_set_log(enabled);
+}
+
+uint64_t filler_host_log_count(void)
+{
+	return ppm_shim_log_count();
+}
+
+uint32_t filler_host_max_event(void)
+{
+	return PPM_EVENT_MAX;
+}
+
+bool filler_host_has_filler(uint16_t event_type)
+{
+	const struct ppm_event_entry *entry;
+
+	if (event_type >= PPM_EVENT_MAX || (g_event_info[event_type].flags & EF_UNUSED))
+		return false;
+
+	entry = &g_ppm_events[event_type];
+	return entry->filler_callback != PPM_AUTOFILL || entry->n_autofill_args != 0;
+}
+
+int32_t filler_host_syscall_for_event(uint16_t event_type)
+{
+	if (event_type >= PPM_EVENT_MAX)
+		return -1;
+
+	return g_event_syscall[event_type];
+}
+
+static void set_event_data(struct event_filler_arguments *args, const struct filler_host_call *call,
+			   struct pt_regs *regs)
+{
+	switch (call->event_type) {
+	case PPME_SIGNALDELIVER_E:
+		args->signo = (int)call->args[0];
+		args->spid = (__kernel_pid_t)call->args[1];
+		args->dpid = current->pid;
+		break;
+	case PPME_PAGE_FAULT_E:
+		regs->ip = call->args[2];
+		args->fault_data.address = call->args[0];
+		args->fault_data.error_code = call->args[1];
+		args->fault_data.regs = regs;
+		break;
+	case PPME_CPU_HOTPLUG_E:
+		args->sched_prev = (struct task_struct *)(unsigned long)call->args[0];
+		args->sched_next = (struct task_struct *)(unsigned long)call->args[1];
+		break;
+	case PPME_SYSCALL_COALESCED_E:
+		args->coalesce_data.tid = (pid_t)call->args[0];
+		args->coalesce_data.event_type = (enum ppm_event_type)call->args[1];
+		args->coalesce_data.res = (long)call->args[2];
+		args->coalesce_data.count = (u32)call->args[3];
+		args->coalesce_data.duration = call->args[4];
+		break;
+	case PPME_PAGE_FAULT_SUMMARY_E:
+		args->pf_summary_data.tgid = (pid_t)call->args[0];
+		args->pf_summary_data.user = call->args[1];
+		args->pf_summary_data.kernel = call->args[2];
+		args->pf_summary_data.not_present = call->args[3];
+		args->pf_summary_data.protection = call->args[4];
+		args->pf_summary_data.interval = call->args[5];
+		break;
+	default:
+		break;
+	}
+}
+
+int filler_host_fill(const struct filler_host_call *call, void *buf, uint32_t buf_size, uint32_t *event_len)
+{
+	struct event_filler_arguments args;
+	struct ppm_evt_hdr *hdr = buf;
+	struct pt_regs regs;
+	const struct ppm_event_entry *entry;
+	int j;
+	int cbres;
+
+	*event_len = 0;
+
+	if (!filler_host_has_filler(call->event_type))
+		return PPM_FAILURE_BUG;
+
+	memset(&args, 0, sizeof(args));
+	memset(&regs, 0, sizeof(regs));
+
+	for (j = 0; j < 6; ++j)
+		regs.args[j] = call->args[j];
+	regs.ret = call->retval;
+
+	g_consumer.snaplen = call->snaplen;
+	g_consumer.do_dynamic_snaplen = call->dynamic_snaplen;
+
+	args.nargs = g_event_info[call->event_type].nparams;
+	args.arg_data_offset = args.nargs * sizeof(u16);
+
+	if (buf_size < sizeof(struct ppm_evt_hdr) + args.arg_data_offset)
+		return PPM_FAILURE_BUFFER_FULL;
+
+	hdr->ts = 0;
+	hdr->tid = current->pid;
+	hdr->type = call->event_type;
+
+	args.consumer = &g_consumer;
+	args.buffer = (char *)buf + sizeof(struct ppm_evt_hdr);
+	args.buffer_size = buf_size - sizeof(struct ppm_evt_hdr);
+	args.event_type = call->event_type;
+	args.regs = &regs;
+	args.syscall_id = call->syscall_id >= 0 ? call->syscall_id : g_event_syscall[call->event_type];
+	args.cur_g_syscall_code_routing_table = g_syscall_code_routing_table;
+	args.sched_prev = current;
+	args.sched_next = current;
+	args.dpid = current->pid;
+	set_event_data(&args, call, &regs);
+
+	args.curarg = 0;
+	args.arg_data_size = args.buffer_size - args.arg_data_offset;
+	args.nevents = g_nevents++;
+	args.str_storage = g_str_storage;
+	args.enforce_snaplen = false;
+
+	entry = &g_ppm_events[call->event_type];
+	if (entry->filler_callback == PPM_AUTOFILL)
+		cbres = f_sys_autofill(&args, entry);
+	else
+		cbres = entry->filler_callback(&args);
+
+	if (cbres != PPM_SUCCESS)
+		return cbres;
+
+	if (args.curarg != args.nargs)
+		return PPM_FAILURE_BUG;
+
+	*event_len = sizeof(struct ppm_evt_hdr) + args.arg_data_offset;
+	hdr->len = *event_len;
+	return PPM_SUCCESS;
+}
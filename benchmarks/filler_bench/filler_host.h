@@ -0,0 +1,75 @@
+/*
+ * Host side entry point into the driver fillers built against the
+ * userspace shim. Plain C so that it can be used from the C++ bench
+ * without dragging the kernel types along.
+ */
+
+#ifndef FILLER_HOST_H_
+#define FILLER_HOST_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * One invocation of a filler. For syscall events, args are the syscall
+ * arguments and retval its return value. The other events take their
+ * data from args, in the order of their parameters:
+ *
+ * - PPME_SIGNALDELIVER_E: signo, source pid
+ * - PPME_PAGE_FAULT_E: address, error code, instruction pointer
+ * - PPME_CPU_HOTPLUG_E: cpu, action
+ * - PPME_SYSCALL_COALESCED_E: tid, event type, res, count, duration
+ * - PPME_PAGE_FAULT_SUMMARY_E: tgid, user, kernel, not present, protection, interval
+ */
+struct filler_host_call {
+	uint16_t event_type;
+	int32_t syscall_id;	/* -1 picks the first syscall that generates event_type */
+	uint64_t args[6];
+	int64_t retval;
+	uint32_t snaplen;
+	bool dynamic_snaplen;
+};
+
+/*
+ * The process the fillers see as current. Addresses are in the user
+ * memory registered with filler_host_set_user_memory().
+ */
+struct filler_host_task {
+	int32_t pid;
+	int32_t tgid;
+	int32_t ppid;
+	const char *comm;
+	uint64_t arg_start, arg_end;
+	uint64_t env_start, env_end;
+	uint64_t total_vm;	/* Pages */
+	uint64_t rss;		/* Pages */
+	uint64_t min_flt, maj_flt;
+};
+
+void filler_host_init(void);
+void filler_host_set_task(const struct filler_host_task *task);
+void filler_host_set_user_memory(const void *base, uint64_t size);
+void filler_host_set_log(bool enabled);
+uint64_t filler_host_log_count(void);
+
+uint32_t filler_host_max_event(void);
+bool filler_host_has_filler(uint16_t event_type);
+int32_t filler_host_syscall_for_event(uint16_t event_type);
+
+/*
+ * Writes a complete event, header included, to buf. Returns one of the
+ * PPM_SUCCESS/PPM_FAILURE_* codes of ppm_events.h, with a filler that
+ * reports success but adds the wrong number of parameters mapped to
+ * PPM_FAILURE_BUG like the driver does.
+ */
+int filler_host_fill(const struct filler_host_call *call, void *buf, uint32_t buf_size, uint32_t *event_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FILLER_HOST_H_ */
@@ -0,0 +1,2 @@
+#include <ppm_shim.h>
+#include_next <asm/unistd.h>
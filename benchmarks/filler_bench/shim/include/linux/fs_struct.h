@@ -0,0 +1 @@
+#include <ppm_shim.h>
@@ -0,0 +1,57 @@
+/*
+ * Runtime half of the userspace shim, see ppm_shim.h
+ */
+
+#include <stdarg.h>
+
+#include "ppm_shim.h"
+
+struct task_struct *ppm_shim_current;
+
+/* Normally set by main.c when the tracers are enabled */
+bool g_tracers_enabled;
+
+static const char *g_user_base;
+static unsigned long g_user_size;
+static bool g_log_enabled;
+static unsigned long g_log_count;
+
+void ppm_shim_set_user_memory(const void *base, unsigned long size)
+{
+	g_user_base = base;
+	g_user_size = size;
+}
+
+bool ppm_shim_access_ok(const void __user *addr, unsigned long size)
+{
+	const char *p = (const char *)addr;
+
+	if (!g_user_base || p < g_user_base)
+		return false;
+
+	return size <= g_user_size && (unsigned long)(p - g_user_base) <= g_user_size - size;
+}
+
+void ppm_shim_set_log(bool enabled)
+{
+	g_log_enabled = enabled;
+}
+
+unsigned long ppm_shim_log_count(void)
+{
+	return g_log_count;
+}
+
+void ppm_shim_log(const char *fmt, ...)
+{
+	va_list ap;
+
+	++g_log_count;
+
+	if (!g_log_enabled)
+		return;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
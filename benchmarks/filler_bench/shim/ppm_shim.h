@@ -0,0 +1,424 @@
+/*
+ * Userspace stand-ins for the kernel facilities used by ppm_events.c and
+ * ppm_fillers.c, so that the fillers can be built into a host binary.
+ *
+ * Every kernel header the driver includes is shadowed by a stub under
+ * include/ that pulls in this file. The model is deliberately small:
+ *
+ * - current is a fake task_struct owned by the host, with an mm whose
+ *   arg/env ranges the host points wherever it likes
+ * - user memory is a single arena registered by the host; access_ok()
+ *   rejects everything outside of it, so fuzzed pointers fault cleanly
+ *   instead of crashing the process
+ * - syscall arguments and the return value live in a fake pt_regs
+ * - there are no open files or sockets: fd lookups always fail, which
+ *   exercises the fallback paths of the socket fillers
+ */
+
+#ifndef PPM_SHIM_H_
+#define PPM_SHIM_H_
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/ipc.h>
+#include <sys/resource.h>
+#include <sys/sem.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <linux/dqblk_xfs.h>
+#include <linux/types.h>
+
+#define PPM_SHIM_KERNEL_VERSION KERNEL_VERSION(4, 14, 0)
+
+/*
+ * Build configuration the fillers are compiled for
+ */
+#define CONFIG_64BIT 1
+#define CONFIG_X86 1
+#define CONFIG_X86_64 1
+
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE PPM_SHIM_KERNEL_VERSION
+
+/*
+ * Types and annotations
+ */
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef uint64_t cputime_t;
+typedef struct { int counter; } atomic_t;
+typedef struct { long counter; } atomic_long_t;
+typedef struct { uid_t val; } kuid_t;
+typedef struct { gid_t val; } kgid_t;
+typedef struct { unsigned long seg; } mm_segment_t;
+
+#define __user
+#define __percpu
+#define __force
+#define __kernel
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#ifndef min
+#define min(x, y) ((x) < (y) ? (x) : (y))
+#endif
+#ifndef max
+#define max(x, y) ((x) > (y) ? (x) : (y))
+#endif
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+
+/*
+ * Constants the kernel has and glibc either lacks or spells differently
+ */
+#ifndef F_CANCELLK
+#define F_CANCELLK 1029
+#endif
+#define PTRACE_PEEKUSR PTRACE_PEEKUSER
+#define PTRACE_POKEUSR PTRACE_POKEUSER
+#define PROT_SEM 0x8
+#define MAY_EXEC 0x1
+#define MAY_WRITE 0x2
+#define MAY_READ 0x4
+
+#define MINORBITS 20
+#define MKDEV(ma, mi) (((ma) << MINORBITS) | (mi))
+
+static inline u32 new_encode_dev(u32 dev)
+{
+	unsigned major = dev >> MINORBITS;
+	unsigned minor = dev & ((1U << MINORBITS) - 1);
+
+	return (minor & 0xff) | (major << 8) | ((minor & ~0xffU) << 12);
+}
+
+/*
+ * Logging
+ */
+#define KBUILD_MODNAME "deepsys"
+#define KERN_ERR ""
+#define KERN_INFO ""
+#define printk(fmt, ...) ppm_shim_log(fmt, ##__VA_ARGS__)
+#define pr_err(fmt, ...) ppm_shim_log(KERN_ERR pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_info(fmt, ...) ppm_shim_log(KERN_INFO pr_fmt(fmt), ##__VA_ARGS__)
+#define WARN_ON(x) (!!(x))
+
+/* Not printf-checked, the kernel has its own format extensions */
+void ppm_shim_log(const char *fmt, ...);
+void ppm_shim_set_log(bool enabled);
+unsigned long ppm_shim_log_count(void);
+
+/*
+ * Strings
+ */
+static inline size_t ppm_shim_strlcpy(char *dest, const char *src, size_t size)
+{
+	size_t ret = strlen(src);
+
+	if (size) {
+		size_t len = (ret >= size) ? size - 1 : ret;
+
+		memcpy(dest, src, len);
+		dest[len] = '\0';
+	}
+	return ret;
+}
+
+#define strlcpy ppm_shim_strlcpy
+
+/*
+ * Lists, only needed for the layout of ppm_consumer_t
+ */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+/*
+ * Work items, same
+ */
+struct work_struct {
+	unsigned long data;
+	struct list_head entry;
+	void (*func)(struct work_struct *work);
+};
+
+struct delayed_work {
+	struct work_struct work;
+	unsigned long expires;
+};
+
+/*
+ * Tasks
+ */
+#define TASK_COMM_LEN 16
+#define MM_FILEPAGES 0
+#define MM_ANONPAGES 1
+#define MM_SWAPENTS 2
+#define NR_MM_COUNTERS 3
+
+struct mm_rss_stat {
+	atomic_long_t count[NR_MM_COUNTERS];
+};
+
+struct mm_struct {
+	unsigned long arg_start, arg_end;
+	unsigned long env_start, env_end;
+	unsigned long total_vm;
+	struct mm_rss_stat rss_stat;
+};
+
+struct tty_driver {
+	int major;
+	int minor_start;
+};
+
+struct tty_struct {
+	struct tty_driver *driver;
+	int index;
+};
+
+struct signal_struct {
+	struct tty_struct *tty;
+	struct rlimit rlim[RLIM_NLIMITS];
+};
+
+struct task_struct {
+	pid_t pid;
+	pid_t tgid;
+	struct task_struct *real_parent;
+	struct task_struct *parent;
+	struct mm_struct *mm;
+	struct signal_struct *signal;
+	unsigned long min_flt, maj_flt;
+	int exit_code;
+	kuid_t euid;
+	kgid_t egid;
+	char comm[TASK_COMM_LEN];
+};
+
+extern struct task_struct *ppm_shim_current;
+#define current ppm_shim_current
+
+#define current_user_ns() NULL
+#define current_euid() (current->euid)
+#define current_egid() (current->egid)
+#define from_kuid_munged(ns, uid) ((uid).val)
+#define from_kgid_munged(ns, gid) ((gid).val)
+
+static inline pid_t task_pid_vnr(struct task_struct *task)
+{
+	return task->pid;
+}
+
+static inline pid_t task_tgid_vnr(struct task_struct *task)
+{
+	return task->tgid;
+}
+
+static inline unsigned long rlimit(unsigned int limit)
+{
+	return current->signal->rlim[limit].rlim_cur;
+}
+
+static inline long atomic_long_read(const atomic_long_t *v)
+{
+	return v->counter;
+}
+
+static inline unsigned long get_mm_counter(struct mm_struct *mm, int member)
+{
+	long val = atomic_long_read(&mm->rss_stat.count[member]);
+
+	return val < 0 ? 0 : val;
+}
+
+static inline unsigned long get_mm_rss(struct mm_struct *mm)
+{
+	return get_mm_counter(mm, MM_FILEPAGES) + get_mm_counter(mm, MM_ANONPAGES);
+}
+
+static inline u64 cputime64_to_clock_t(u64 t)
+{
+	return t;
+}
+
+#define smp_processor_id() 0
+#define rcu_read_lock() do { } while (0)
+#define rcu_read_unlock() do { } while (0)
+#define rcu_dereference(p) (p)
+
+/*
+ * Syscall registers
+ */
+struct pt_regs {
+	unsigned long args[6];
+	long ret;
+	unsigned long ip;
+};
+
+static inline void syscall_get_arguments(struct task_struct *task, struct pt_regs *regs,
+					 unsigned int i, unsigned int n, unsigned long *args)
+{
+	(void)task;
+	memcpy(args, &regs->args[i], n * sizeof(args[0]));
+}
+
+static inline long syscall_get_return_value(struct task_struct *task, struct pt_regs *regs)
+{
+	(void)task;
+	return regs->ret;
+}
+
+/*
+ * User memory
+ */
+#define VERIFY_READ 0
+#define VERIFY_WRITE 1
+#define KERNEL_DS ((mm_segment_t) { 0 })
+#define get_fs() ((mm_segment_t) { 0 })
+#define set_fs(x) ((void)(x))
+
+void ppm_shim_set_user_memory(const void *base, unsigned long size);
+bool ppm_shim_access_ok(const void __user *addr, unsigned long size);
+
+#define access_ok(type, addr, size) ppm_shim_access_ok((const void __user *)(addr), (size))
+#define pagefault_disable() do { } while (0)
+#define pagefault_enable() do { } while (0)
+
+static inline unsigned long __copy_from_user_inatomic(void *to, const void __user *from, unsigned long n)
+{
+	memcpy(to, (const void *)from, n);
+	return 0;
+}
+
+static inline long probe_kernel_read(void *dst, const void *src, size_t size)
+{
+	memcpy(dst, src, size);
+	return 0;
+}
+
+/*
+ * Files and sockets. There are none, see above.
+ */
+struct inode {
+	unsigned long i_ino;
+	dev_t i_rdev;
+};
+
+struct dentry {
+	struct inode *d_inode;
+};
+
+struct path {
+	struct dentry *dentry;
+};
+
+struct file {
+	struct path f_path;
+	struct inode *f_inode;
+};
+
+struct fd {
+	struct file *file;
+	unsigned int flags;
+};
+
+#define UNIX_PATH_MAX 108
+
+/* Same layout as the kernel's, only the name differs */
+#define user_msghdr msghdr
+
+struct socket;
+
+struct proto_ops {
+	int (*getname)(struct socket *sock, struct sockaddr *addr, int *sockaddr_len, int peer);
+};
+
+struct sock {
+	unsigned short sk_family;
+	u32 sk_ack_backlog;
+	u32 sk_max_ack_backlog;
+};
+
+struct unix_sock {
+	struct sock sk;
+	struct sock *peer;
+};
+
+struct socket {
+	struct sock *sk;
+	const struct proto_ops *ops;
+};
+
+static inline struct fd fdget(unsigned int fd)
+{
+	(void)fd;
+	return (struct fd) { NULL, 0 };
+}
+
+static inline void fdput(struct fd f)
+{
+	(void)f;
+}
+
+static inline struct file *fget(unsigned int fd)
+{
+	(void)fd;
+	return NULL;
+}
+
+static inline void fput(struct file *file)
+{
+	(void)file;
+}
+
+static inline struct socket *sockfd_lookup(int fd, int *err)
+{
+	(void)fd;
+	*err = -EBADF;
+	return NULL;
+}
+
+static inline void sockfd_put(struct socket *sock)
+{
+	(void)sock;
+}
+
+static inline struct socket *sock_from_file(struct file *file, int *err)
+{
+	(void)file;
+	*err = -ENOTSOCK;
+	return NULL;
+}
+
+static inline struct unix_sock *unix_sk(const struct sock *sk)
+{
+	return (struct unix_sock *)sk;
+}
+
+#endif /* PPM_SHIM_H_ */
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <core/types.h>
+
+#include <string>
+#include <vector>
+
+namespace deepsys {
+namespace cli {
+
+// "filterbench": measures what each of a set of filters costs per event,
+// on thread and fd state from a checkpoint or a synthetic one and a
+// synthetic event stream drawn from it, and prints a JSON report on
+// stdout: ns/event, match rate, and the split between field extraction
+// and comparisons, for each filter and for all of them as one Ruleset.
+// Meant for CI to catch rule changes that regress cost.
+//
+// Takes the arguments after the command name, returns the exit code: 0,
+// 1 when a filter didn't compile, 2 on bad usage or an unreadable input.
+// Matches the handler signature of ICLI::register_command().
+core::Result<int> filterbench(const std::vector<std::string>& arguments);
+
+} // namespace cli
+} // namespace deepsys
@@ -1,19 +1,52 @@
-#include <iostream>
+#include <cli/filterbench.h>
 #include <core/logger.h>
 
-using namespace deepsys::core;
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace deepsys;
+
+namespace {
+
+struct Command {
+    const char* name;
+    const char* description;
+    core::Result<int> (*handler)(const std::vector<std::string>& arguments);
+};
+
+const Command COMMANDS[] = {
+    {"filterbench", "Measure the per-event cost of filters, as JSON", cli::filterbench},
+};
+
+void usage() {
+    std::cerr << "Usage: deepsys_cli COMMAND [options]\n";
+    for (const Command& command : COMMANDS) {
+        std::cerr << "  " << command.name << std::string(16 - std::string(command.name).size(), ' ')
+                  << command.description << "\n";
+    }
+}
+
+} // namespace
 
 int main(int argc, char** argv) {
-    LOG_INFO("DeepSys CLI - Placeholder implementation");
+    if (argc < 2) {
+        usage();
+        return 2;
+    }
 
-    if (argc > 1) {
-        LOG_INFO("Arguments provided:");
-        for (int i = 1; i < argc; ++i) {
-            LOG_INFO("  " << argv[i]);
+    std::string name = argv[1];
+    for (const Command& command : COMMANDS) {
+        if (name == command.name) {
+            auto status = command.handler(std::vector<std::string>(argv + 2, argv + argc));
+            if (!status) {
+                LOG_ERROR(name << " failed: " << core::make_error_code(status.error()).message());
+                return 1;
+            }
+            return status.value();
         }
-    } else {
-        LOG_INFO("No arguments provided");
     }
 
-    return 0;
+    usage();
+    return 2;
 }
@@ -0,0 +1,360 @@
+#include "cli/filterbench.h"
+
+#include <core/logger.h>
+#include <core/string_pool.h>
+#include <sinsp/checkpoint.h>
+#include <sinsp/event_table.h>
+#include <sinsp/filter.h>
+#include <sinsp/ruleset.h>
+#include <sinsp/string_match.h>
+#include <sinsp/thread_table.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace deepsys {
+namespace cli {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using sinsp::FilterEvent;
+
+// Events whose fields are cached for the compare-only pass at a time
+constexpr size_t CACHE_CHUNK = 4096;
+
+struct Options {
+    std::vector<std::string> filters;   // "name: expression" or an expression
+    std::string state;
+    size_t events = 100000;
+    uint32_t passes = 5;
+    uint32_t processes = 200;
+    uint64_t seed = 1;
+};
+
+struct NamedFilter {
+    std::string name;
+    std::string expression;
+};
+
+void usage() {
+    std::cerr <<
+        "Usage: deepsys_cli filterbench [options] [FILTER...]\n"
+        "  -f, --rules FILE         filters, one per line as \"name: expression\" or just the expression;\n"
+        "                           blank lines and lines starting with # are skipped\n"
+        "  -s, --state FILE         thread and fd state from a checkpoint instead of a synthetic one\n"
+        "  -n, --events N           synthetic events (default 100000)\n"
+        "  -p, --passes N           timed passes, the fastest counts (default 5)\n"
+        "  -P, --processes N        synthetic processes (default 200)\n"
+        "  -r, --seed N             random seed (default 1)\n";
+}
+
+bool read_rules(const std::string& path, std::vector<std::string>& out) {
+    std::ifstream in(path);
+    if (!in) {
+        LOG_ERROR("can't read " << path);
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        out.push_back(line.substr(start));
+    }
+    return true;
+}
+
+bool parse_options(const std::vector<std::string>& args, Options& opts) {
+    try {
+        for (size_t i = 0; i < args.size(); ++i) {
+            const std::string& arg = args[i];
+            if (arg == "-h" || arg == "--help") {
+                return false;
+            }
+            if (arg.empty() || arg[0] != '-') {
+                opts.filters.push_back(arg);
+                continue;
+            }
+            if (i + 1 >= args.size()) {
+                return false;
+            }
+            const std::string& value = args[++i];
+
+            if (arg == "-f" || arg == "--rules") {
+                if (!read_rules(value, opts.filters)) return false;
+            } else if (arg == "-s" || arg == "--state") {
+                opts.state = value;
+            } else if (arg == "-n" || arg == "--events") {
+                opts.events = std::stoull(value);
+            } else if (arg == "-p" || arg == "--passes") {
+                opts.passes = static_cast<uint32_t>(std::stoul(value));
+            } else if (arg == "-P" || arg == "--processes") {
+                opts.processes = static_cast<uint32_t>(std::stoul(value));
+            } else if (arg == "-r" || arg == "--seed") {
+                opts.seed = std::stoull(value);
+            } else {
+                return false;
+            }
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return !opts.filters.empty() && opts.events > 0 && opts.passes > 0;
+}
+
+NamedFilter split_name(const std::string& line, size_t index) {
+    // A name is a leading word followed by ": "; filter fields never are
+    size_t colon = line.find(": ");
+    if (colon != std::string::npos && line.find_first_of(" \t()=") >= colon) {
+        return {line.substr(0, colon), line.substr(colon + 2)};
+    }
+    return {"filter" + std::to_string(index), line};
+}
+
+// A few hundred processes with files and sockets, enough variety for
+// filters to be selective
+void make_state(sinsp::ThreadTable& table, uint32_t processes, std::mt19937_64& rng) {
+    static const char* EXES[] = {"/usr/bin/bash", "/usr/bin/python3", "/usr/sbin/nginx", "/usr/bin/curl",
+                                 "/usr/sbin/sshd", "/usr/bin/java", "/usr/lib/systemd/systemd", "/usr/bin/node"};
+    static const char* USERS[] = {"root", "www-data", "postgres", "nobody"};
+    static const char* DIRS[] = {"/etc", "/usr/lib", "/tmp", "/var/log", "/home/user", "/proc/self"};
+    auto& pool = core::StringPool::instance();
+
+    for (uint32_t i = 0; i < processes; ++i) {
+        core::ThreadID tid = 1000 + static_cast<core::ThreadID>(i);
+        sinsp::ThreadInfo* thread = table.get_or_add(tid);
+        thread->pid = static_cast<core::ProcessID>(tid);
+        thread->ppid = i ? 1000 + static_cast<core::ProcessID>(rng() % i) : 1;
+        const char* exe = EXES[rng() % 8];
+        pool.assign(thread->exe, exe);
+        pool.assign(thread->args, std::string(exe) + std::string("\0--config\0/etc/app.conf", 23));
+        pool.assign(thread->cwd, DIRS[rng() % 6]);
+        pool.assign(thread->user, USERS[rng() % 4]);
+        pool.assign(thread->group, USERS[rng() % 4]);
+
+        sinsp::FdTable* fds = table.fd_table(tid);
+        for (core::FileDescriptor fd = 3; fd < 3 + static_cast<core::FileDescriptor>(rng() % 24); ++fd) {
+            bool socket = rng() % 4 == 0;
+            sinsp::FdInfo* info = fds->add(fd, socket ? sinsp::FdType::IPv4Socket : sinsp::FdType::File);
+            if (socket) {
+                info->l4proto = rng() % 3 ? sinsp::L4Proto::Tcp : sinsp::L4Proto::Udp;
+                info->sip = {10, 0, static_cast<uint8_t>(rng() % 4), static_cast<uint8_t>(rng())};
+                info->dip = {static_cast<uint8_t>(rng()), static_cast<uint8_t>(rng()), static_cast<uint8_t>(rng()),
+                             static_cast<uint8_t>(rng())};
+                info->sport = static_cast<uint16_t>(32768 + rng() % 28000);
+                info->dport = rng() % 2 ? 443 : static_cast<uint16_t>(rng());
+            } else {
+                pool.assign(info->name, std::string(DIRS[rng() % 6]) + "/file" + std::to_string(rng() % 100));
+            }
+        }
+    }
+}
+
+// Events over the threads of table, with the fd of fd events picked among
+// the thread's
+std::vector<FilterEvent> make_events(const sinsp::ThreadTable& table, size_t count, std::mt19937_64& rng) {
+    static const char* TYPES[] = {"open", "openat", "read", "write", "close", "connect", "execve", "clone"};
+    std::vector<sinsp::EventType> types;
+    for (const char* name : TYPES) {
+        std::vector<sinsp::EventType> found;
+        if (sinsp::find_event_types(name, found)) {
+            types.push_back(found[0]);
+        }
+    }
+
+    struct Source {
+        core::ThreadID tid;
+        core::ProcessID pid;
+        std::vector<core::FileDescriptor> fds;
+    };
+    std::vector<Source> sources;
+    table.for_each([&](const sinsp::ThreadInfo& thread) {
+        Source source{thread.tid, thread.pid, {}};
+        if (const sinsp::FdTable* fds = table.fd_table(thread.tid)) {
+            fds->for_each([&](core::FileDescriptor fd, const sinsp::FdInfo&) { source.fds.push_back(fd); });
+        }
+        sources.push_back(std::move(source));
+    });
+
+    std::vector<FilterEvent> events;
+    events.reserve(count);
+    for (size_t i = 0; i < count && !sources.empty() && !types.empty(); ++i) {
+        const Source& source = sources[rng() % sources.size()];
+        core::Event event;
+        event.id = types[rng() % types.size()];
+        event.timestamp = i * 1000;
+        event.pid = source.pid;
+        event.tid = source.tid;
+        bool has_fd = (sinsp::event_flags(event.id) & sinsp::EVENT_HAS_FD) && !source.fds.empty();
+        core::FileDescriptor fd = has_fd ? source.fds[rng() % source.fds.size()] : -1;
+        int64_t res = rng() % 10 ? static_cast<int64_t>(rng() % 4096) : -static_cast<int64_t>(1 + rng() % 40);
+        events.push_back(sinsp::make_filter_event(event, table, res, fd));
+    }
+    return events;
+}
+
+// Fastest of passes runs of fn, in ns
+template<typename F>
+double fastest(uint32_t passes, F&& fn) {
+    double best = 0;
+    for (uint32_t pass = 0; pass < passes; ++pass) {
+        auto start = Clock::now();
+        fn();
+        double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        best = pass == 0 ? ns : std::min(best, ns);
+    }
+    return best;
+}
+
+std::string json_string(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out + "\"";
+}
+
+std::string json_number(double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.2f", value);
+    return text;
+}
+
+} // namespace
+
+core::Result<int> filterbench(const std::vector<std::string>& arguments) {
+    Options opts;
+    if (!parse_options(arguments, opts)) {
+        usage();
+        return 2;
+    }
+
+    std::mt19937_64 rng(opts.seed);
+    sinsp::ThreadTable table;
+    if (!opts.state.empty()) {
+        auto checkpoint = sinsp::Checkpoint::open(opts.state);
+        if (!checkpoint) {
+            LOG_ERROR("can't load " << opts.state << ": " << core::make_error_code(checkpoint.error()).message());
+            return 2;
+        }
+        checkpoint.value()->restore(table);
+    } else {
+        make_state(table, opts.processes, rng);
+    }
+    std::vector<FilterEvent> events = make_events(table, opts.events, rng);
+    if (events.empty()) {
+        LOG_ERROR("no threads to make events from");
+        return 2;
+    }
+    double count = static_cast<double>(events.size());
+
+    int status = 0;
+    sinsp::Ruleset rules;
+    std::vector<sinsp::FieldCache> caches(std::min(events.size(), CACHE_CHUNK));
+    std::vector<uint64_t> bits;
+    std::ostringstream out;
+    out << "{\n  \"events\": " << events.size() << ",\n  \"threads\": " << table.size()
+        << ",\n  \"passes\": " << opts.passes << ",\n  \"string_match_isa\": " << json_string(sinsp::string_match_isa())
+        << ",\n  \"filters\": [";
+
+    for (size_t i = 0; i < opts.filters.size(); ++i) {
+        NamedFilter named = split_name(opts.filters[i], i);
+        out << (i ? ",\n" : "\n") << "    {\"name\": " << json_string(named.name)
+            << ", \"expression\": " << json_string(named.expression);
+
+        auto compiled = sinsp::Filter::compile(named.expression);
+        if (!compiled || !rules.add(named.name, named.expression)) {
+            out << ", \"error\": \"invalid filter\"}";
+            status = 1;
+            continue;
+        }
+        const sinsp::Filter& filter = compiled.value();
+
+        size_t matched = 0;
+        double total = fastest(opts.passes, [&] {
+            matched = 0;
+            for (const FilterEvent& event : events) {
+                matched += filter.matches(event);
+            }
+        });
+
+        // The same again with every field the filter reads already in the
+        // cache leaves the comparisons; the difference is extraction
+        double compare = 0;
+        for (size_t base = 0; base < events.size(); base += CACHE_CHUNK) {
+            size_t chunk = std::min(CACHE_CHUNK, events.size() - base);
+            for (size_t k = 0; k < chunk; ++k) {
+                caches[k].reset(events[base + k]);
+                filter.matches(caches[k]);
+            }
+            compare += fastest(opts.passes, [&] {
+                for (size_t k = 0; k < chunk; ++k) {
+                    filter.matches(caches[k]);
+                }
+            });
+        }
+        compare = std::min(compare, total);
+
+        double batch = fastest(opts.passes, [&] { filter.matches_batch(events, bits); });
+
+        out << ", \"instructions\": " << filter.program().code().size()
+            << ", \"ns_per_event\": " << json_number(total / count)
+            << ", \"extract_ns_per_event\": " << json_number((total - compare) / count)
+            << ", \"compare_ns_per_event\": " << json_number(compare / count)
+            << ", \"batch_ns_per_event\": " << json_number(batch / count)
+            << ", \"match_rate\": " << json_number(100.0 * static_cast<double>(matched) / count) << "}";
+    }
+
+    // All of them at once, sharing predicates and extractions. The first
+    // pass also warms up the operand order.
+    std::vector<sinsp::RuleId> matches;
+    double ruleset = fastest(opts.passes + 1, [&] {
+        for (const FilterEvent& event : events) {
+            matches.clear();
+            rules.evaluate(event, matches);
+        }
+    });
+    sinsp::Ruleset::Stats stats = rules.get_stats();
+    out << "\n  ],\n  \"ruleset\": {\"rules\": " << stats.rules << ", \"nodes\": " << stats.nodes
+        << ", \"predicates\": " << stats.predicates << ", \"shared\": " << stats.shared
+        << ", \"reorders\": " << stats.reorders << ", \"ns_per_event\": " << json_number(ruleset / count)
+        << ", \"per_rule\": [";
+    for (sinsp::RuleId id = 0; id < rules.size(); ++id) {
+        const sinsp::Ruleset::RuleStats& rule = rules.rule_stats(id);
+        double evaluations = static_cast<double>(std::max<uint64_t>(rule.evaluations, 1));
+        out << (id ? ",\n" : "\n") << "    {\"name\": " << json_string(rules.name(id))
+            << ", \"evaluations\": " << rule.evaluations
+            << ", \"hit_rate\": " << json_number(100.0 * static_cast<double>(rule.hits) / evaluations)
+            << ", \"mean_ns\": " << json_number(rule.mean_ns()) << "}";
+    }
+    out << (rules.size() ? "\n  ]}\n}\n" : "]}\n}\n");
+
+    std::cout << out.str();
+    return status;
+}
+
+} // namespace cli
+} // namespace deepsys
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace deepsys {
+namespace core {
+
+// Epoch-based reclamation.
+//
+// Lets readers walk structures that a writer replaces copy-on-write without
+// taking any lock. A reader pins the current epoch for the duration of a
+// Guard; the writer unlinks an object, retire()s it, and collect() frees it
+// once every reader pinned at or before the epoch it was retired in is gone.
+// Readers never wait on the writer, and the writer never waits on readers:
+// a slow reader only delays frees.
+//
+// Pinning is a compare-and-swap on a free reader slot plus an exchange. The
+// number of simultaneous guards is bounded by MAX_READERS; past that, pin()
+// spins until one is released.
+class EpochDomain {
+public:
+    static constexpr uint32_t MAX_READERS = 256;
+
+    static EpochDomain& instance();
+
+    EpochDomain();
+    ~EpochDomain();
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    class Guard {
+    public:
+        explicit Guard(EpochDomain& domain);
+        ~Guard();
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+    private:
+        EpochDomain& domain_;
+        uint32_t slot_;
+    };
+
+    Guard pin() { return Guard(*this); }
+
+    // object must already be unreachable for new readers
+    void retire(void* object, void (*deleter)(void*));
+
+    template<typename T>
+    void retire(const T* object) {
+        retire(const_cast<T*>(object), [](void* p) { delete static_cast<T*>(p); });
+    }
+
+    // Advances the epoch and frees what no reader can still see. Returns the
+    // number of objects freed.
+    size_t collect();
+
+    size_t pending() const;
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<bool> used{false};
+        std::atomic<uint64_t> epoch{0};   // 0 when not pinned
+    };
+
+    struct Retired {
+        void* object;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    uint32_t acquire_slot();
+
+    std::atomic<uint64_t> epoch_{1};
+    std::unique_ptr<Slot[]> slots_;
+
+    mutable std::mutex retired_mutex_;
+    std::vector<Retired> retired_;
+};
+
+} // namespace core
+} // namespace deepsys
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace deepsys {
+namespace core {
+
+// Handle to an interned string. Handles are stable for as long as a
+// reference is held, and 0 is always the empty string.
+using StringHandle = uint32_t;
+constexpr StringHandle EMPTY_STRING_HANDLE = 0;
+
+// Process-wide, reference counted string interning pool.
+//
+// Every intern() returns a handle holding one reference, which is dropped
+// with release(); the entry is reclaimed, and its handle reused, when the
+// last reference goes away. get() doesn't lock, and the view it returns is
+// valid while the caller holds a reference.
+//
+// The pool is split in shards, each with its own lock, so that interning
+// from several threads rarely contends. Entries live in chunks that never
+// move, which is what makes lock-free reads possible.
+class StringPool {
+public:
+    static StringPool& instance();
+
+    StringPool();
+    ~StringPool();
+
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    StringHandle intern(std::string_view str);
+    void retain(StringHandle handle);
+    void release(StringHandle handle);
+
+    std::string_view get(StringHandle handle) const;
+    uint32_t ref_count(StringHandle handle) const;
+
+    // Points slot at str, dropping the reference slot held before
+    void assign(StringHandle& slot, std::string_view str);
+
+    struct Stats {
+        uint64_t strings = 0;
+        uint64_t bytes = 0;          // String payloads
+        uint64_t memory_usage = 0;   // Everything the pool allocated
+        uint64_t interned = 0;       // intern() calls
+        uint64_t reclaimed = 0;      // Entries freed by their last release()
+    };
+    Stats get_stats() const;
+
+private:
+    static constexpr uint32_t SHARD_BITS = 6;
+    static constexpr uint32_t SHARD_COUNT = 1u << SHARD_BITS;
+    static constexpr uint32_t INDEX_BITS = 32 - SHARD_BITS;
+    static constexpr uint32_t FIRST_CHUNK_BITS = 10;
+    static constexpr uint32_t MAX_CHUNKS = INDEX_BITS - FIRST_CHUNK_BITS + 1;
+
+    struct Entry {
+        std::atomic<uint32_t> refs{0};
+        bool live = false;
+        std::string str;
+    };
+
+    // Chunk c holds 2^(FIRST_CHUNK_BITS + c) entries, so a handful of chunks
+    // covers the whole index space and the directory can be a fixed array
+    struct Shard {
+        std::mutex mutex;
+        std::array<std::atomic<Entry*>, MAX_CHUNKS> chunks{};
+        std::unordered_map<std::string_view, uint32_t> index;
+        std::vector<uint32_t> free_list;
+        uint32_t next = 0;
+        uint64_t bytes = 0;
+        uint64_t interned = 0;
+        uint64_t reclaimed = 0;
+    };
+
+    static void locate(uint32_t index, uint32_t& chunk, uint32_t& offset);
+    Entry* entry(StringHandle handle) const;
+    Entry& allocate(Shard& shard, uint32_t& index);
+
+    std::unique_ptr<Shard[]> shards_;
+};
+
+} // namespace core
+} // namespace deepsys
@@ -61,6 +61,21 @@ private:
     ErrorCode error_ = ErrorCode::Success;
 };
 
+template<>
+class Result<void> {
+public:
+    Result() : error_(ErrorCode::Success) {}
+    Result(ErrorCode ec) : error_(ec) {}
+
+    bool ok() const { return error_ == ErrorCode::Success; }
+    explicit operator bool() const { return ok(); }
+
+    ErrorCode error() const { return error_; }
+
+private:
+    ErrorCode error_ = ErrorCode::Success;
+};
+
 // Common event structure
 struct Event {
     EventID id{0};
@@ -0,0 +1,107 @@
+#include "core/epoch.h"
+
+#include <thread>
+
+namespace deepsys {
+namespace core {
+
+namespace {
+
+// Where this thread found a free slot last time; threads that pin
+// repeatedly tend to get the same slot back with a single CAS
+thread_local uint32_t slot_hint = 0;
+
+} // namespace
+
+EpochDomain& EpochDomain::instance() {
+    static EpochDomain instance;
+    return instance;
+}
+
+EpochDomain::EpochDomain() : slots_(std::make_unique<Slot[]>(MAX_READERS)) {}
+
+EpochDomain::~EpochDomain() {
+    // No guard may outlive the domain, so everything can go
+    for (const Retired& retired : retired_) {
+        retired.deleter(retired.object);
+    }
+}
+
+uint32_t EpochDomain::acquire_slot() {
+    for (uint32_t attempt = 0;; ++attempt) {
+        uint32_t slot = (slot_hint + attempt) % MAX_READERS;
+        bool expected = false;
+        if (!slots_[slot].used.load(std::memory_order_relaxed) &&
+            slots_[slot].used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            slot_hint = slot;
+            return slot;
+        }
+        if (attempt % MAX_READERS == MAX_READERS - 1) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+EpochDomain::Guard::Guard(EpochDomain& domain) : domain_(domain), slot_(domain.acquire_slot()) {
+    // An RMW, paired with the one in collect(): either collect() sees this
+    // slot pinned, or this synchronizes with it and the reads that follow
+    // see everything unlinked before it
+    Slot& slot = domain_.slots_[slot_];
+    slot.epoch.exchange(domain_.epoch_.load(std::memory_order_acquire), std::memory_order_acq_rel);
+}
+
+EpochDomain::Guard::~Guard() {
+    Slot& slot = domain_.slots_[slot_];
+    slot.epoch.store(0, std::memory_order_release);
+    slot.used.store(false, std::memory_order_release);
+}
+
+void EpochDomain::retire(void* object, void (*deleter)(void*)) {
+    std::lock_guard<std::mutex> lock(retired_mutex_);
+    retired_.push_back(Retired{object, deleter, epoch_.load(std::memory_order_relaxed)});
+}
+
+size_t EpochDomain::collect() {
+    std::vector<Retired> ready;
+    {
+        std::lock_guard<std::mutex> lock(retired_mutex_);
+        if (retired_.empty()) {
+            return 0;
+        }
+
+        // Readers pinning from now on can't reach anything retired so far
+        uint64_t current = epoch_.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+        uint64_t oldest = current;
+        for (uint32_t i = 0; i < MAX_READERS; ++i) {
+            uint64_t pinned = slots_[i].epoch.fetch_add(0, std::memory_order_acq_rel);
+            if (pinned != 0 && pinned < oldest) {
+                oldest = pinned;
+            }
+        }
+
+        // A reader pinned at epoch e may hold objects retired at e or later
+        size_t kept = 0;
+        for (const Retired& retired : retired_) {
+            if (retired.epoch < oldest) {
+                ready.push_back(retired);
+            } else {
+                retired_[kept++] = retired;
+            }
+        }
+        retired_.resize(kept);
+    }
+
+    for (const Retired& retired : ready) {
+        retired.deleter(retired.object);
+    }
+    return ready.size();
+}
+
+size_t EpochDomain::pending() const {
+    std::lock_guard<std::mutex> lock(retired_mutex_);
+    return retired_.size();
+}
+
+} // namespace core
+} // namespace deepsys
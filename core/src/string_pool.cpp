@@ -0,0 +1,178 @@
+#include "core/string_pool.h"
+
+namespace deepsys {
+namespace core {
+
+StringPool& StringPool::instance() {
+    static StringPool instance;
+    return instance;
+}
+
+StringPool::StringPool() : shards_(std::make_unique<Shard[]>(SHARD_COUNT)) {
+    // Index 0 of shard 0 is handle 0, the empty string. It's pinned and
+    // never goes through the index.
+    uint32_t index;
+    Entry& empty = allocate(shards_[0], index);
+    empty.live = true;
+}
+
+StringPool::~StringPool() {
+    for (uint32_t s = 0; s < SHARD_COUNT; ++s) {
+        for (uint32_t c = 0; c < MAX_CHUNKS; ++c) {
+            delete[] shards_[s].chunks[c].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void StringPool::locate(uint32_t index, uint32_t& chunk, uint32_t& offset) {
+    uint32_t v = (index >> FIRST_CHUNK_BITS) + 1;
+    chunk = 31 - static_cast<uint32_t>(__builtin_clz(v));
+    offset = index - (((1u << chunk) - 1) << FIRST_CHUNK_BITS);
+}
+
+StringPool::Entry* StringPool::entry(StringHandle handle) const {
+    uint32_t index = handle >> SHARD_BITS;
+    uint32_t chunk;
+    uint32_t offset;
+    locate(index, chunk, offset);
+    if (chunk >= MAX_CHUNKS) {
+        return nullptr;
+    }
+
+    Entry* entries = shards_[handle & (SHARD_COUNT - 1)].chunks[chunk].load(std::memory_order_acquire);
+    return entries ? &entries[offset] : nullptr;
+}
+
+StringPool::Entry& StringPool::allocate(Shard& shard, uint32_t& index) {
+    if (!shard.free_list.empty()) {
+        index = shard.free_list.back();
+        shard.free_list.pop_back();
+    } else {
+        index = shard.next++;
+    }
+
+    uint32_t chunk;
+    uint32_t offset;
+    locate(index, chunk, offset);
+
+    Entry* entries = shard.chunks[chunk].load(std::memory_order_relaxed);
+    if (!entries) {
+        entries = new Entry[size_t(1) << (FIRST_CHUNK_BITS + chunk)];
+        shard.chunks[chunk].store(entries, std::memory_order_release);
+    }
+    return entries[offset];
+}
+
+StringHandle StringPool::intern(std::string_view str) {
+    if (str.empty()) {
+        return EMPTY_STRING_HANDLE;
+    }
+
+    size_t hash = std::hash<std::string_view>{}(str);
+    uint32_t shard_id = static_cast<uint32_t>(hash ^ (hash >> 32)) & (SHARD_COUNT - 1);
+    Shard& shard = shards_[shard_id];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    ++shard.interned;
+
+    auto it = shard.index.find(str);
+    if (it != shard.index.end()) {
+        StringHandle handle = (it->second << SHARD_BITS) | shard_id;
+        entry(handle)->refs.fetch_add(1, std::memory_order_relaxed);
+        return handle;
+    }
+
+    uint32_t index;
+    Entry& e = allocate(shard, index);
+    e.str.assign(str);
+    e.live = true;
+    e.refs.store(1, std::memory_order_relaxed);
+    shard.bytes += str.size();
+
+    // The key views the entry's own storage, which never moves
+    shard.index.emplace(e.str, index);
+    return (index << SHARD_BITS) | shard_id;
+}
+
+void StringPool::retain(StringHandle handle) {
+    if (handle == EMPTY_STRING_HANDLE) {
+        return;
+    }
+    if (Entry* e = entry(handle)) {
+        e->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void StringPool::release(StringHandle handle) {
+    if (handle == EMPTY_STRING_HANDLE) {
+        return;
+    }
+
+    Entry* e = entry(handle);
+    if (!e || e->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    // Dropped the last reference. Between the decrement and taking the lock
+    // another thread may have found the entry through intern() and revived
+    // it, or revived and released it and already reclaimed it, so check
+    // again under the lock.
+    uint32_t shard_id = handle & (SHARD_COUNT - 1);
+    Shard& shard = shards_[shard_id];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (!e->live || e->refs.load(std::memory_order_relaxed) != 0) {
+        return;
+    }
+
+    shard.index.erase(e->str);
+    shard.bytes -= e->str.size();
+    ++shard.reclaimed;
+
+    e->live = false;
+    e->str.clear();
+    e->str.shrink_to_fit();
+    shard.free_list.push_back(handle >> SHARD_BITS);
+}
+
+std::string_view StringPool::get(StringHandle handle) const {
+    Entry* e = entry(handle);
+    return e ? std::string_view(e->str) : std::string_view();
+}
+
+uint32_t StringPool::ref_count(StringHandle handle) const {
+    Entry* e = entry(handle);
+    return e ? e->refs.load(std::memory_order_relaxed) : 0;
+}
+
+void StringPool::assign(StringHandle& slot, std::string_view str) {
+    StringHandle old = slot;
+    slot = intern(str);
+    release(old);
+}
+
+StringPool::Stats StringPool::get_stats() const {
+    Stats stats;
+    for (uint32_t s = 0; s < SHARD_COUNT; ++s) {
+        Shard& shard = shards_[s];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        stats.strings += shard.index.size();
+        stats.bytes += shard.bytes;
+        stats.interned += shard.interned;
+        stats.reclaimed += shard.reclaimed;
+
+        stats.memory_usage += shard.index.bucket_count() * sizeof(void*) +
+                              shard.index.size() * (sizeof(std::string_view) + sizeof(uint32_t) + 2 * sizeof(void*)) +
+                              shard.free_list.capacity() * sizeof(uint32_t) + shard.bytes;
+        for (uint32_t c = 0; c < MAX_CHUNKS; ++c) {
+            if (shard.chunks[c].load(std::memory_order_relaxed)) {
+                stats.memory_usage += (size_t(1) << (FIRST_CHUNK_BITS + c)) * sizeof(Entry);
+            }
+        }
+    }
+    return stats;
+}
+
+} // namespace core
+} // namespace deepsys
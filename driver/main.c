@@ -46,6 +46,7 @@ along with deepsys.  If not, see <http://www.gnu.org/licenses/>.
 #endif
 #include <linux/vmalloc.h>
 #include <linux/wait.h>
+#include <linux/workqueue.h>
 #include <linux/tracepoint.h>
 #include <linux/cpu.h>
 #include <linux/jiffies.h>
@@ -110,6 +111,10 @@ struct event_data_t {
 		} signal_data;
 
 		struct fault_data_t fault_data;
+
+		struct coalesce_data_t coalesce_data;
+
+		struct pf_summary_data_t pf_summary_data;
 	} event_info;
 };
 
@@ -128,7 +133,9 @@ static int record_event_consumer(struct ppm_consumer_t *consumer,
 static void record_event_all_consumers(enum ppm_event_type event_type,
 	enum syscall_flags drop_flags,
 	struct event_data_t *event_datap);
-static int init_ring_buffer(struct ppm_ring_buffer_context *ring);
+static inline u64 pf_period(struct ppm_consumer_t *consumer);
+static void pf_flush_work_fn(struct work_struct *work);
+static int init_ring_buffer(struct ppm_ring_buffer_context *ring, unsigned int cpu);
 static void free_ring_buffer(struct ppm_ring_buffer_context *ring);
 static void reset_ring_buffer(struct ppm_ring_buffer_context *ring);
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 4, 0))
@@ -180,6 +187,8 @@ static const struct file_operations g_ppm_fops = {
  */
 LIST_HEAD(g_consumer_list);
 static DEFINE_MUTEX(g_consumer_mutex);
+static void alloc_hotplugged_rings(struct work_struct *work);
+static DECLARE_WORK(g_hotplug_ring_work, alloc_hotplugged_rings);
 static bool g_tracepoint_registered;
 
 #if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 20)
@@ -273,6 +282,9 @@ static void check_remove_consumer(struct ppm_consumer_t *consumer, int remove_fr
 			synchronize_rcu();
 		}
 
+		/* Rearms itself, which the _sync variant copes with */
+		cancel_delayed_work_sync(&consumer->pf_flush_work);
+
 		for_each_possible_cpu(cpu) {
 			struct ppm_ring_buffer_context *ring = per_cpu_ptr(consumer->ring_buffers, cpu);
 			free_ring_buffer(ring);
@@ -336,6 +348,7 @@ static int ppm_open(struct inode *inode, struct file *filp)
 		}
 
 		consumer->consumer_id = consumer_id;
+		INIT_DELAYED_WORK(&consumer->pf_flush_work, pf_flush_work_fn);
 
 		/*
 		 * Initialize the ring buffers array
@@ -367,19 +380,17 @@ static int ppm_open(struct inode *inode, struct file *filp)
 		}
 
 		/*
-		 * If a cpu is offline when the consumer is first created, we
-		 * will never get events for that cpu even if it later comes
-		 * online via hotplug. We could allocate these rings on-demand
-		 * later in this function if needed for hotplug, but that
-		 * requires the consumer to know to call open again, and deepsys
-		 * doesn't support that.
+		 * Only online cpus get a ring now. The rings of cpus that are
+		 * offline when the consumer is created are allocated by
+		 * alloc_hotplugged_rings() when the cpu comes up, and the
+		 * consumer can then open the matching device.
 		 */
 		for_each_online_cpu(cpu) {
 			ring = per_cpu_ptr(consumer->ring_buffers, cpu);
 
 			pr_info("initializing ring buffer for CPU %u\n", cpu);
 
-			if (!init_ring_buffer(ring)) {
+			if (!init_ring_buffer(ring, cpu)) {
 				pr_err("can't initialize the ring buffer for CPU %u\n", cpu);
 				ret = -ENOMEM;
 				goto err_init_ring_buffer;
@@ -426,6 +437,9 @@ static int ppm_open(struct inode *inode, struct file *filp)
 	consumer->snaplen = RW_SNAPLEN;
 	consumer->sampling_ratio = 1;
 	consumer->sampling_interval = 0;
+	consumer->coalesce_window_ns = 0;
+	consumer->pf_rate_limit = 0;
+	consumer->pf_summary_interval_ns = 0;
 	consumer->is_dropping = 0;
 	consumer->do_dynamic_snaplen = false;
 	consumer->need_to_insert_drop_e = 0;
@@ -865,6 +879,8 @@ cleanup_ioctl_procinfo:
 		/* Used for dropping events so they must stay on */
 		set_bit(PPME_DROP_E, g_events_mask);
 		set_bit(PPME_DROP_X, g_events_mask);
+		set_bit(PPME_SYSCALL_COALESCED_E, g_events_mask);
+		set_bit(PPME_PAGE_FAULT_SUMMARY_E, g_events_mask);
 
 		ret = 0;
 		goto cleanup_ioctl;
@@ -903,6 +919,59 @@ cleanup_ioctl_procinfo:
 		ret = 0;
 		goto cleanup_ioctl;
 	}
+	case PPM_IOCTL_SET_COALESCE_WINDOW:
+	{
+		u64 new_window_ns = (u64)arg;
+
+		vpr_info("PPM_IOCTL_SET_COALESCE_WINDOW, consumer %p\n", consumer_id);
+
+		if (new_window_ns > NSEC_PER_SEC) {
+			pr_err("invalid coalescing window %llu\n", new_window_ns);
+			ret = -EINVAL;
+			goto cleanup_ioctl;
+		}
+
+		consumer->coalesce_window_ns = new_window_ns;
+
+		vpr_info("new coalescing window: %lluns\n", consumer->coalesce_window_ns);
+
+		ret = 0;
+		goto cleanup_ioctl;
+	}
+	case PPM_IOCTL_SET_PAGE_FAULT_RATE:
+	{
+		vpr_info("PPM_IOCTL_SET_PAGE_FAULT_RATE, consumer %p\n", consumer_id);
+
+		consumer->pf_rate_limit = (u32)arg;
+		if (consumer->pf_rate_limit)
+			mod_delayed_work(system_wq, &consumer->pf_flush_work, nsecs_to_jiffies(pf_period(consumer)));
+
+		vpr_info("new page fault rate limit: %u/s\n", consumer->pf_rate_limit);
+
+		ret = 0;
+		goto cleanup_ioctl;
+	}
+	case PPM_IOCTL_SET_PAGE_FAULT_SUMMARY:
+	{
+		u32 new_interval_ms = (u32)arg;
+
+		vpr_info("PPM_IOCTL_SET_PAGE_FAULT_SUMMARY, consumer %p\n", consumer_id);
+
+		if (new_interval_ms > 60 * MSEC_PER_SEC) {
+			pr_err("invalid page fault summary interval %u\n", new_interval_ms);
+			ret = -EINVAL;
+			goto cleanup_ioctl;
+		}
+
+		consumer->pf_summary_interval_ns = (u64)new_interval_ms * NSEC_PER_MSEC;
+		if (consumer->pf_summary_interval_ns)
+			mod_delayed_work(system_wq, &consumer->pf_flush_work, nsecs_to_jiffies(pf_period(consumer)));
+
+		vpr_info("new page fault summary interval: %ums\n", new_interval_ms);
+
+		ret = 0;
+		goto cleanup_ioctl;
+	}
 	case PPM_IOCTL_DISABLE_DYNAMIC_SNAPLEN:
 	{
 		consumer->do_dynamic_snaplen = false;
@@ -1424,6 +1493,368 @@ static inline int drop_event(struct ppm_consumer_t *consumer,
 	return 0;
 }
 
+/*
+ * Failing syscall coalescing.
+ *
+ * Programs retrying a failing syscall in a tight loop (EAGAIN reads on
+ * non-blocking sockets, ENOENT stats while searching a path, connect()
+ * retry loops) fill the ring with identical events. When the consumer sets
+ * a coalescing window, each ring keeps a small direct-mapped table keyed by
+ * (tid, syscall). The first PPM_COALESCE_PASSTHROUGH identical failures go
+ * through untouched, then the following enter/exit pairs are swallowed and
+ * counted. The count is emitted as a single PPME_SYSCALL_COALESCED_E once the
+ * run ends: the call returns something else, another thread takes the slot,
+ * or the window expires.
+ *
+ * The enter event is swallowed before the outcome of the call is known, so
+ * when a swallowed call turns out to be different, or its run expired
+ * meanwhile, we record its enter event late, from the exit tracepoint. The
+ * syscall arguments are still in regs. Only the exit can do that, so a slot
+ * with a swallowed enter in flight is neither swept nor taken by another
+ * thread until the exit comes, or PPM_COALESCE_IN_FLIGHT_NS passes. A thread
+ * migrating to another CPU mid-call, or blocking for longer than that, just
+ * gets an unpaired exit, the same as with sampling drops.
+ */
+static inline struct ppm_coalesce_entry *coalesce_slot(struct ppm_ring_buffer_context *ring,
+						       pid_t tid,
+						       long syscall_id)
+{
+	return &ring->coalesce[((u32)tid * 31 + (u32)syscall_id) & (PPM_COALESCE_SLOTS - 1)];
+}
+
+static inline bool coalesce_expired(struct ppm_consumer_t *consumer,
+				    struct ppm_coalesce_entry *entry,
+				    u64 now)
+{
+	return now - entry->last_ts > consumer->coalesce_window_ns;
+}
+
+static inline bool coalesce_in_flight(struct ppm_coalesce_entry *entry, u64 now)
+{
+	return entry->enter_dropped && now - entry->enter_ts <= PPM_COALESCE_IN_FLIGHT_NS;
+}
+
+static void record_coalesced(struct ppm_consumer_t *consumer,
+			     struct ppm_coalesce_entry *entry,
+			     struct timespec *ts)
+{
+	struct event_data_t event_data;
+
+	event_data.category = PPMC_COALESCED_SYSCALL;
+	event_data.event_info.coalesce_data.tid = entry->tid;
+	event_data.event_info.coalesce_data.event_type = entry->event_type;
+	event_data.event_info.coalesce_data.res = entry->res;
+	event_data.event_info.coalesce_data.count = entry->count;
+	event_data.event_info.coalesce_data.duration = entry->last_ts - entry->first_ts;
+
+	record_event_consumer(consumer, PPME_SYSCALL_COALESCED_E, UF_NEVER_DROP, ts, &event_data);
+}
+
+/*
+ * Returns 1 if the event has been swallowed by the coalescer
+ */
+static int coalesce_event(struct ppm_consumer_t *consumer,
+			  enum ppm_event_type event_type,
+			  enum syscall_flags drop_flags,
+			  struct timespec *ts,
+			  struct event_data_t *event_datap)
+{
+	struct ppm_ring_buffer_context *ring;
+	struct ppm_coalesce_entry *entry;
+	struct ppm_coalesce_entry flushed[2];
+	int nflushed = 0;
+	bool late_enter = false;
+	int swallowed = 0;
+	pid_t tid = current->pid;
+	long syscall_id = event_datap->event_info.syscall_data.id;
+	u64 now = timespec_to_ns(ts);
+	long retval = 0;
+
+	if (syscall_id == event_datap->socketcall_syscall)
+		return 0;
+
+	if (PPME_IS_EXIT(event_type))
+		retval = syscall_get_return_value(current, event_datap->event_info.syscall_data.regs);
+
+	ring = per_cpu_ptr(consumer->ring_buffers, get_cpu());
+
+	/*
+	 * Age out one slot per call, so that the count of a run that nobody
+	 * else collides with doesn't linger in the table
+	 */
+	entry = &ring->coalesce[ring->coalesce_sweep++ & (PPM_COALESCE_SLOTS - 1)];
+	if (entry->tid && coalesce_expired(consumer, entry, now) && !coalesce_in_flight(entry, now)) {
+		if (entry->count)
+			flushed[nflushed++] = *entry;
+		entry->tid = 0;
+	}
+
+	entry = coalesce_slot(ring, tid, syscall_id);
+	if (entry->tid && entry->tid != tid && coalesce_in_flight(entry, now)) {
+		/* Someone else's call is in flight, this one isn't coalesced */
+		goto out;
+	}
+
+	if (entry->tid && (entry->tid != tid ||
+			   entry->syscall_id != syscall_id ||
+			   coalesce_expired(consumer, entry, now))) {
+		if (entry->count)
+			flushed[nflushed++] = *entry;
+		/* The run expired while a swallowed call was in flight */
+		late_enter = PPME_IS_EXIT(event_type) &&
+			     entry->tid == tid &&
+			     entry->syscall_id == syscall_id &&
+			     entry->enter_dropped;
+		entry->tid = 0;
+	}
+
+	if (entry->tid) {
+		if (PPME_IS_ENTER(event_type)) {
+			if (entry->hits >= PPM_COALESCE_PASSTHROUGH) {
+				entry->enter_dropped = true;
+				entry->enter_ts = now;
+				swallowed = 1;
+			}
+		} else if (retval == entry->res) {
+			if (entry->enter_dropped) {
+				++entry->count;
+				swallowed = 1;
+			} else {
+				++entry->hits;
+			}
+
+			entry->last_ts = now;
+			entry->enter_dropped = false;
+		} else {
+			if (entry->count)
+				flushed[nflushed++] = *entry;
+			late_enter = entry->enter_dropped;
+			entry->tid = 0;
+		}
+	}
+
+	if (!entry->tid && PPME_IS_EXIT(event_type) && retval < 0) {
+		entry->tid = tid;
+		entry->syscall_id = syscall_id;
+		entry->event_type = event_type;
+		entry->res = retval;
+		entry->hits = 1;
+		entry->count = 0;
+		entry->enter_dropped = false;
+		entry->first_ts = now;
+		entry->last_ts = now;
+	}
+
+out:
+	put_cpu();
+
+	while (nflushed)
+		record_coalesced(consumer, &flushed[--nflushed], ts);
+
+	if (late_enter)
+		record_event_consumer(consumer, PPME_MAKE_ENTER(event_type), drop_flags, ts, event_datap);
+
+	return swallowed;
+}
+
+/*
+ * Page fault throttling.
+ *
+ * A single process warming up can generate millions of page faults and
+ * evict everything else from the ring. Each ring keeps a small
+ * set-associative table keyed by tgid, counting the faults that are not
+ * sent as individual events:
+ * - with a rate limit, a process gets pf_rate_limit individual events per
+ *   second on each CPU, and the excess is counted
+ * - in summary mode, every fault is counted and nothing is sent individually
+ * At the end of each period (one second, or the summary interval) the
+ * counts are sent as a single PPME_PAGE_FAULT_SUMMARY_E, by the process's
+ * next fault on that CPU or else by pf_flush_work, which visits every CPU
+ * once a period. A process only loses its slot early, and gets a short
+ * summary, when PPM_PF_WAYS others on the same CPU are in its set.
+ *
+ * The tracepoint fires before the fault is handled, so there's no telling
+ * a major fault from a minor one here. The counts are split along the
+ * present/protection and user/kernel bits of the error code instead.
+ */
+static inline u64 pf_period(struct ppm_consumer_t *consumer)
+{
+	return consumer->pf_summary_interval_ns ? consumer->pf_summary_interval_ns : NSEC_PER_SEC;
+}
+
+/*
+ * The slot of tgid in its set, or else a free one, or else the one whose
+ * period started first
+ */
+static inline struct ppm_pf_entry *pf_slot(struct ppm_ring_buffer_context *ring, pid_t tgid)
+{
+	struct ppm_pf_entry *set = &ring->pf_stats[((u32)tgid * 31) & (PPM_PF_SLOTS - PPM_PF_WAYS)];
+	struct ppm_pf_entry *victim = NULL;
+	int i;
+
+	for (i = 0; i < PPM_PF_WAYS; ++i) {
+		if (set[i].tgid == tgid)
+			return &set[i];
+		if (!victim || (victim->tgid && (!set[i].tgid || set[i].first_ts < victim->first_ts)))
+			victim = &set[i];
+	}
+
+	return victim;
+}
+
+static void record_pf_summary(struct ppm_consumer_t *consumer,
+			      struct ppm_pf_entry *entry,
+			      u64 now,
+			      struct timespec *ts)
+{
+	struct event_data_t event_data;
+
+	event_data.category = PPMC_PAGE_FAULT_SUMMARY;
+	event_data.event_info.pf_summary_data.tgid = entry->tgid;
+	event_data.event_info.pf_summary_data.user = entry->user;
+	event_data.event_info.pf_summary_data.kernel = entry->kernel;
+	event_data.event_info.pf_summary_data.not_present = entry->not_present;
+	event_data.event_info.pf_summary_data.protection = entry->protection;
+	event_data.event_info.pf_summary_data.interval = now - entry->first_ts;
+
+	record_event_consumer(consumer, PPME_PAGE_FAULT_SUMMARY_E, UF_NEVER_DROP, ts, &event_data);
+}
+
+/*
+ * Returns 1 if the page fault must not be sent as an individual event
+ */
+static int throttle_page_fault(struct ppm_consumer_t *consumer,
+			       struct timespec *ts,
+			       struct event_data_t *event_datap)
+{
+	struct ppm_ring_buffer_context *ring;
+	struct ppm_pf_entry *entry;
+	struct ppm_pf_entry flushed[2];
+	int nflushed = 0;
+	int throttled;
+	pid_t tgid = current->tgid;
+	unsigned long error_code = event_datap->event_info.fault_data.error_code;
+	u64 now = timespec_to_ns(ts);
+	u64 period = pf_period(consumer);
+
+	ring = per_cpu_ptr(consumer->ring_buffers, get_cpu());
+
+	/*
+	 * Age out one slot per fault, so that processes that stop faulting
+	 * still get their last summary
+	 */
+	entry = &ring->pf_stats[ring->pf_sweep++ & (PPM_PF_SLOTS - 1)];
+	if (entry->tgid && now - entry->first_ts >= period) {
+		if (entry->user + entry->kernel)
+			flushed[nflushed++] = *entry;
+		entry->tgid = 0;
+	}
+
+	entry = pf_slot(ring, tgid);
+	if (entry->tgid && (entry->tgid != tgid || now - entry->first_ts >= period)) {
+		if (entry->user + entry->kernel)
+			flushed[nflushed++] = *entry;
+		entry->tgid = 0;
+	}
+
+	if (!entry->tgid) {
+		memset(entry, 0, sizeof(*entry));
+		entry->tgid = tgid;
+		entry->first_ts = now;
+	}
+
+	if (!consumer->pf_summary_interval_ns && entry->window_faults < consumer->pf_rate_limit) {
+		++entry->window_faults;
+		throttled = 0;
+	} else {
+		/* Same bits as pf_flags_to_scap() */
+		if (error_code & 0x1)
+			++entry->protection;
+		else
+			++entry->not_present;
+
+		if (error_code & 0x4)
+			++entry->user;
+		else
+			++entry->kernel;
+
+		throttled = 1;
+	}
+
+	put_cpu();
+
+	while (nflushed) {
+		--nflushed;
+		record_pf_summary(consumer, &flushed[nflushed], now, ts);
+	}
+
+	return throttled;
+}
+
+/*
+ * Sends the summaries whose period ended on the calling CPU
+ */
+static long flush_pf_summaries(void *arg)
+{
+	struct ppm_consumer_t *consumer = arg;
+	struct ppm_ring_buffer_context *ring;
+	struct ppm_pf_entry *entry;
+	struct ppm_pf_entry flushed;
+	struct timespec ts;
+	u64 now;
+	u64 period = pf_period(consumer);
+	bool flush;
+	int i;
+
+	getnstimeofday(&ts);
+	now = timespec_to_ns(&ts);
+
+	for (i = 0; i < PPM_PF_SLOTS; ++i) {
+		flush = false;
+		ring = per_cpu_ptr(consumer->ring_buffers, get_cpu());
+		entry = &ring->pf_stats[i];
+		if (entry->tgid && now - entry->first_ts >= period) {
+			flush = entry->user + entry->kernel;
+			flushed = *entry;
+			entry->tgid = 0;
+		}
+		put_cpu();
+
+		if (flush)
+			record_pf_summary(consumer, &flushed, now, &ts);
+	}
+
+	return 0;
+}
+
+/*
+ * Runs once a period while page faults are throttled. The tables are per
+ * CPU and lockless, so each is flushed from its own CPU.
+ */
+static void pf_flush_work_fn(struct work_struct *work)
+{
+	struct ppm_consumer_t *consumer = container_of(to_delayed_work(work), struct ppm_consumer_t, pf_flush_work);
+	unsigned int cpu;
+
+	if (!consumer->pf_rate_limit && !consumer->pf_summary_interval_ns)
+		return;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+	cpus_read_lock();
+#else
+	get_online_cpus();
+#endif
+	for_each_online_cpu(cpu)
+		work_on_cpu(cpu, flush_pf_summaries, consumer);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+	cpus_read_unlock();
+#else
+	put_online_cpus();
+#endif
+
+	schedule_delayed_work(&consumer->pf_flush_work, nsecs_to_jiffies(pf_period(consumer)));
+}
+
 static void record_event_all_consumers(enum ppm_event_type event_type,
 	enum syscall_flags drop_flags,
 	struct event_data_t *event_datap)
@@ -1473,9 +1904,23 @@ static int record_event_consumer(struct ppm_consumer_t *consumer,
 		else if (consumer->need_to_insert_drop_x == 1)
 			record_drop_x(consumer, ts);
 
+		/*
+		 * Throttled page faults are counted even in dropping mode, so
+		 * this goes before drop_event()
+		 */
+		if (event_datap->category == PPMC_PAGE_FAULT &&
+		    (consumer->pf_rate_limit || consumer->pf_summary_interval_ns) &&
+		    throttle_page_fault(consumer, ts, event_datap))
+			return res;
+
 		if (drop_event(consumer, event_type, drop_flags, ts,
 			       event_datap->event_info.syscall_data.regs))
 			return res;
+
+		if (consumer->coalesce_window_ns &&
+		    event_datap->category == PPMC_SYSCALL &&
+		    coalesce_event(consumer, event_type, drop_flags, ts, event_datap))
+			return res;
 	}
 
 	/*
@@ -1663,6 +2108,12 @@ static int record_event_consumer(struct ppm_consumer_t *consumer,
 		if (event_datap->category == PPMC_PAGE_FAULT)
 			args.fault_data = event_datap->event_info.fault_data;
 
+		if (event_datap->category == PPMC_COALESCED_SYSCALL)
+			args.coalesce_data = event_datap->event_info.coalesce_data;
+
+		if (event_datap->category == PPMC_PAGE_FAULT_SUMMARY)
+			args.pf_summary_data = event_datap->event_info.pf_summary_data;
+
 		args.curarg = 0;
 		args.arg_data_size = args.buffer_size - args.arg_data_offset;
 		args.nevents = ring->nevents;
@@ -2005,37 +2456,54 @@ TRACEPOINT_PROBE(page_fault_probe, unsigned long address, struct pt_regs *regs,
 }
 #endif
 
-static int init_ring_buffer(struct ppm_ring_buffer_context *ring)
+/*
+ * Zeroed vmalloc on the given NUMA node. The ring and its info page get
+ * mapped to user space, so they must never expose stale kernel memory.
+ */
+static void *ppm_vzalloc_node(unsigned long size, int node)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 37))
+	return vzalloc_node(size, node);
+#else
+	void *mem = vmalloc_node(size, node);
+
+	if (mem)
+		memset(mem, 0, size);
+
+	return mem;
+#endif
+}
+
+static int init_ring_buffer(struct ppm_ring_buffer_context *ring, unsigned int cpu)
 {
-	unsigned int j;
+	int node = cpu_to_node(cpu);
+	struct page *str_page;
 
 	/*
 	 * Allocate the string storage in the ring descriptor
 	 */
-	ring->str_storage = (char *)__get_free_page(GFP_USER);
-	if (!ring->str_storage) {
+	str_page = alloc_pages_node(node, GFP_USER, 0);
+	if (!str_page) {
 		pr_err("Error allocating the string storage\n");
 		goto init_ring_err;
 	}
+	ring->str_storage = (char *)page_address(str_page);
 
 	/*
-	 * Allocate the buffer.
+	 * Allocate the buffer on the node of the cpu that fills it.
 	 * Note how we allocate 2 additional pages: they are used as additional overflow space for
 	 * the event data generation functions, so that they always operate on a contiguous buffer.
 	 */
-	ring->buffer = vmalloc(RING_BUF_SIZE + 2 * PAGE_SIZE);
+	ring->buffer = ppm_vzalloc_node(RING_BUF_SIZE + 2 * PAGE_SIZE, node);
 	if (ring->buffer == NULL) {
 		pr_err("Error allocating ring memory\n");
 		goto init_ring_err;
 	}
 
-	for (j = 0; j < RING_BUF_SIZE + 2 * PAGE_SIZE; j++)
-		ring->buffer[j] = 0;
-
 	/*
 	 * Allocate the buffer info structure
 	 */
-	ring->info = vmalloc(sizeof(struct ppm_ring_buffer_info));
+	ring->info = ppm_vzalloc_node(sizeof(struct ppm_ring_buffer_info), node);
 	if (ring->info == NULL) {
 		pr_err("Error allocating ring memory\n");
 		goto init_ring_err;
@@ -2047,7 +2515,7 @@ static int init_ring_buffer(struct ppm_ring_buffer_context *ring)
 	reset_ring_buffer(ring);
 	atomic_set(&ring->preempt_count, 0);
 
-	pr_info("CPU buffer initialized, size=%d\n", RING_BUF_SIZE);
+	pr_info("CPU %u buffer initialized on node %d, size=%d\n", cpu, node, RING_BUF_SIZE);
 
 	return 1;
 
@@ -2090,6 +2558,10 @@ static void reset_ring_buffer(struct ppm_ring_buffer_context *ring)
 	ring->info->n_drops_pf = 0;
 	ring->info->n_preemptions = 0;
 	ring->info->n_context_switches = 0;
+	memset(ring->coalesce, 0, sizeof(ring->coalesce));
+	ring->coalesce_sweep = 0;
+	memset(ring->pf_stats, 0, sizeof(ring->pf_stats));
+	ring->pf_sweep = 0;
 	getnstimeofday(&ring->last_print_time);
 }
 
@@ -2185,6 +2657,37 @@ static char *ppm_devnode(struct device *dev, mode_t *mode)
 }
 #endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 20) */
 
+/*
+ * Allocate the rings of the cpus that came online after their consumer was
+ * created. This can sleep and needs g_consumer_mutex, which ppm_open() holds
+ * while registering tracepoints (and thus taking the cpu hotplug lock), so it
+ * runs from a work item rather than from the hotplug callback itself.
+ */
+static void alloc_hotplugged_rings(struct work_struct *work)
+{
+	struct ppm_consumer_t *consumer;
+	struct ppm_ring_buffer_context *ring;
+	unsigned int cpu;
+
+	mutex_lock(&g_consumer_mutex);
+
+	list_for_each_entry(consumer, &g_consumer_list, node) {
+		for_each_possible_cpu(cpu) {
+			ring = per_cpu_ptr(consumer->ring_buffers, cpu);
+
+			if (!ring->cpu_online || ring->buffer)
+				continue;
+
+			pr_info("initializing ring buffer for hotplugged CPU %u, consumer %p\n", cpu, consumer->consumer_id);
+
+			if (!init_ring_buffer(ring, cpu))
+				pr_err("can't initialize the ring buffer for CPU %u\n", cpu);
+		}
+	}
+
+	mutex_unlock(&g_consumer_mutex);
+}
+
 static int do_cpu_callback(unsigned long cpu, long sd_action)
 {
 	struct ppm_ring_buffer_context *ring;
@@ -2199,10 +2702,9 @@ static int do_cpu_callback(unsigned long cpu, long sd_action)
 			if (sd_action == 1) {
 				/*
 				 * If the cpu was offline when the consumer was created,
-				 * this won't do anything because we never created a ring
-				 * buffer. We can't safely create one here because we're
-				 * in atomic context, and the consumer needs to call open
-				 * on this device anyways, so do it in ppm_open.
+				 * it has no ring buffer yet. We can't allocate one here
+				 * because we're in atomic context, so it's deferred to
+				 * alloc_hotplugged_rings() below.
 				 */
 				ring->cpu_online = true;
 			} else if (sd_action == 2) {
@@ -2212,6 +2714,9 @@ static int do_cpu_callback(unsigned long cpu, long sd_action)
 
 		rcu_read_unlock();
 
+		if (sd_action == 1)
+			schedule_work(&g_hotplug_ring_work);
+
 		event_data.category = PPMC_CONTEXT_SWITCH;
 		event_data.event_info.context_data.sched_prev = (void *)cpu;
 		event_data.event_info.context_data.sched_next = (void *)sd_action;
@@ -2452,6 +2957,8 @@ void deepsys_exit(void)
 #else
 	unregister_cpu_notifier(&cpu_notifier);
 #endif
+
+	cancel_work_sync(&g_hotplug_ring_work);
 }
 
 module_init(deepsys_init);
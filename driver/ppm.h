@@ -28,6 +28,7 @@ along with deepsys.  If not, see <http://www.gnu.org/licenses/>.
 #endif
 
 #include <linux/time.h>
+#include <linux/workqueue.h>
 
 /*
  * Global defines
@@ -47,6 +48,11 @@ along with deepsys.  If not, see <http://www.gnu.org/licenses/>.
 #define PPM_PORT_MYSQL 3306
 #define PPM_PORT_POSTGRES 5432
 #define PPM_PORT_STATSD 8125
+#define PPM_COALESCE_SLOTS 16		/* Must be a power of 2 */
+#define PPM_COALESCE_PASSTHROUGH 2	/* Identical failures let through before coalescing kicks in */
+#define PPM_COALESCE_IN_FLIGHT_NS (10 * NSEC_PER_SEC)	/* Longest a swallowed enter keeps its slot */
+#define PPM_PF_SLOTS 32			/* Must be a power of 2 */
+#define PPM_PF_WAYS 4			/* Slots per set, a power of 2 up to PPM_PF_SLOTS */
 
 /*
  * Global enums
@@ -68,6 +74,37 @@ struct syscall_evt_pair {
 	enum ppm_event_type exit_event_type;
 };
 
+/*
+ * A run of identical failing syscalls from one thread.
+ * See coalesce_event() in main.c.
+ */
+struct ppm_coalesce_entry {
+	pid_t tid;
+	long syscall_id;
+	enum ppm_event_type event_type;	/* Exit event type of the syscall */
+	long res;			/* The (negative) return value being coalesced */
+	u32 hits;			/* Identical failures passed through so far */
+	u32 count;			/* Identical calls swallowed so far */
+	bool enter_dropped;		/* The enter event of the call in flight was swallowed */
+	u64 enter_ts;			/* When it was */
+	u64 first_ts;
+	u64 last_ts;
+};
+
+/*
+ * Page faults of one process that were not sent as individual events.
+ * See throttle_page_fault() in main.c.
+ */
+struct ppm_pf_entry {
+	pid_t tgid;
+	u32 window_faults;		/* Individual events sent in the current period */
+	u64 first_ts;			/* Start of the current period */
+	u64 user;
+	u64 kernel;
+	u64 not_present;
+	u64 protection;
+};
+
 /*
  * The ring descriptor.
  * We have one of these for each CPU.
@@ -82,6 +119,10 @@ struct ppm_ring_buffer_context {
 	u32 nevents;
 	atomic_t preempt_count;
 	char *str_storage;	/* String storage. Size is one page. */
+	struct ppm_coalesce_entry coalesce[PPM_COALESCE_SLOTS];
+	u32 coalesce_sweep;
+	struct ppm_pf_entry pf_stats[PPM_PF_SLOTS];
+	u32 pf_sweep;
 };
 
 struct ppm_consumer_t {
@@ -95,6 +136,10 @@ struct ppm_consumer_t {
 	u32 sampling_ratio;
 	bool do_dynamic_snaplen;
 	u32 sampling_interval;
+	u64 coalesce_window_ns;	/* 0 disables failing syscall coalescing */
+	u32 pf_rate_limit;	/* Page fault events per process per second per CPU, 0 is unlimited */
+	u64 pf_summary_interval_ns;	/* If set, page faults are only sent as periodic per process summaries */
+	struct delayed_work pf_flush_work;	/* Sends the summaries of processes that stopped faulting */
 	int is_dropping;
 	int dropping_mode;
 	volatile int need_to_insert_drop_e;
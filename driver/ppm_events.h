@@ -41,6 +41,23 @@ struct fault_data_t {
 	unsigned long error_code;
 };
 
+struct coalesce_data_t {
+	pid_t tid;
+	enum ppm_event_type event_type;
+	long res;
+	u32 count;
+	u64 duration;
+};
+
+struct pf_summary_data_t {
+	pid_t tgid;
+	u64 user;
+	u64 kernel;
+	u64 not_present;
+	u64 protection;
+	u64 interval;
+};
+
 struct event_filler_arguments {
 	struct ppm_consumer_t *consumer;
 	char *buffer; /* the buffer that will be filled with the data */
@@ -74,6 +91,8 @@ struct event_filler_arguments {
 	__kernel_pid_t spid; /* PID of source process */
 	__kernel_pid_t dpid; /* PID of destination process */
 	struct fault_data_t fault_data; /* For page faults */
+	struct coalesce_data_t coalesce_data; /* For coalesced failing syscalls */
+	struct pf_summary_data_t pf_summary_data; /* For page fault summaries */
 };
 
 /*
@@ -525,6 +525,8 @@ enum ppm_capture_category {
 	PPMC_CONTEXT_SWITCH = 2,
 	PPMC_SIGNAL = 3,
 	PPMC_PAGE_FAULT = 4,
+	PPMC_COALESCED_SYSCALL = 5,
+	PPMC_PAGE_FAULT_SUMMARY = 6,
 };
 
 /** @defgroup etypes Event Types
@@ -824,7 +826,11 @@ enum ppm_event_type {
 	PPME_SYSCALL_EXECVE_18_X = 289,
 	PPME_PAGE_FAULT_E = 290,
 	PPME_PAGE_FAULT_X = 291,
-	PPM_EVENT_MAX = 292
+	PPME_SYSCALL_COALESCED_E = 292,
+	PPME_SYSCALL_COALESCED_X = 293,
+	PPME_PAGE_FAULT_SUMMARY_E = 294,
+	PPME_PAGE_FAULT_SUMMARY_X = 295,
+	PPM_EVENT_MAX = 296
 };
 /*@}*/
 
@@ -1326,6 +1332,9 @@ struct ppm_evt_hdr {
 #define PPM_IOCTL_SET_TRACERS_CAPTURE _IO(PPM_IOCTL_MAGIC, 17)
 #define PPM_IOCTL_SET_SIMPLE_MODE _IO(PPM_IOCTL_MAGIC, 18)
 #define PPM_IOCTL_ENABLE_PAGE_FAULTS _IO(PPM_IOCTL_MAGIC, 19)
+#define PPM_IOCTL_SET_COALESCE_WINDOW _IO(PPM_IOCTL_MAGIC, 20)
+#define PPM_IOCTL_SET_PAGE_FAULT_RATE _IO(PPM_IOCTL_MAGIC, 21)
+#define PPM_IOCTL_SET_PAGE_FAULT_SUMMARY _IO(PPM_IOCTL_MAGIC, 22)
 
 extern const struct ppm_name_value socket_families[];
 extern const struct ppm_name_value file_flags[];
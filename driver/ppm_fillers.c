@@ -140,6 +140,8 @@ static int f_sys_setns_e(struct event_filler_arguments *args);
 static int f_sys_unshare_e(struct event_filler_arguments *args);
 static int f_sys_flock_e(struct event_filler_arguments *args);
 static int f_cpu_hotplug_e(struct event_filler_arguments *args);
+static int f_sys_coalesced_e(struct event_filler_arguments *args);
+static int f_sys_pagefault_summary_e(struct event_filler_arguments *args);
 static int f_sys_semop_e(struct event_filler_arguments *args);
 static int f_sys_semop_x(struct event_filler_arguments *args);
 static int f_sys_semget_e(struct event_filler_arguments *args);
@@ -392,6 +394,10 @@ const struct ppm_event_entry g_ppm_events[PPM_EVENT_MAX] = {
 	[PPME_PAGE_FAULT_E] = {f_sys_pagefault_e},
 	[PPME_PAGE_FAULT_X] = {f_sys_empty},
 #endif
+	[PPME_SYSCALL_COALESCED_E] = {f_sys_coalesced_e},
+	[PPME_SYSCALL_COALESCED_X] = {f_sys_empty},
+	[PPME_PAGE_FAULT_SUMMARY_E] = {f_sys_pagefault_summary_e},
+	[PPME_PAGE_FAULT_SUMMARY_X] = {f_sys_empty},
 };
 
 #define merge_64(hi, lo) ((((unsigned long long)(hi)) << 32) + ((lo) & 0xffffffffUL))
@@ -5326,6 +5332,97 @@ static int f_cpu_hotplug_e(struct event_filler_arguments *args)
 	return add_sentinel(args);
 }
 
+static int f_sys_coalesced_e(struct event_filler_arguments *args)
+{
+	int res;
+
+	/*
+	 * tid
+	 */
+	res = val_to_ring(args, (s64)args->coalesce_data.tid, 0, false, 0);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * evt_type
+	 */
+	res = val_to_ring(args, args->coalesce_data.event_type, 0, false, 0);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * res
+	 */
+	res = val_to_ring(args, (s64)args->coalesce_data.res, 0, false, 0);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * count
+	 */
+	res = val_to_ring(args, args->coalesce_data.count, 0, false, 0);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * duration
+	 */
+	res = val_to_ring(args, args->coalesce_data.duration, 0, false, 0);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	return add_sentinel(args);
+}
+
+static int f_sys_pagefault_summary_e(struct event_filler_arguments *args)
+{
+	int res;
+
+	/*
+	 * pid
+	 */
+	res = val_to_ring(args, (s64)args->pf_summary_data.tgid, 0, false, 0);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * user
+	 */
+	res = val_to_ring(args, args->pf_summary_data.user, 0, false, 0);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * kernel
+	 */
+	res = val_to_ring(args, args->pf_summary_data.kernel, 0, false, 0);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * not_present
+	 */
+	res = val_to_ring(args, args->pf_summary_data.not_present, 0, false, 0);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * protection
+	 */
+	res = val_to_ring(args, args->pf_summary_data.protection, 0, false, 0);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	/*
+	 * interval
+	 */
+	res = val_to_ring(args, args->pf_summary_data.interval, 0, false, 0);
+	if (unlikely(res != PPM_SUCCESS))
+		return res;
+
+	return add_sentinel(args);
+}
+
 static inline u16 semop_flags_to_scap(short flags)
 {
 	u16 res = 0;
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <core/types.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace deepsys {
+namespace scap {
+
+// Has the driver capture only the given event types (enum ppm_event_type),
+// through an open device fd: the mask is cleared, which leaves the driver's
+// own drop and summary events on, then each type is set in turn. The mask
+// is global to the driver, shared by every consumer.
+core::Result<void> set_driver_event_mask(int device_fd, const std::vector<uint16_t>& event_types);
+
+} // namespace scap
+} // namespace deepsys
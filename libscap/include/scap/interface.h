@@ -63,6 +63,13 @@ public:
     virtual core::Result<void> set_event_filter(const std::string& filter) = 0;
     virtual core::Result<std::string> get_event_filter() const = 0;
 
+    // Event types to capture (enum ppm_event_type), the others are dropped
+    // in the kernel before they take ring space. Engines on the driver
+    // implement it with set_driver_event_mask(), see scap/event_mask.h.
+    virtual core::Result<void> set_event_mask(const std::vector<uint16_t>& /*event_types*/) {
+        return core::ErrorCode::NotImplemented;
+    }
+
     // PPM (Process Performance Monitoring) specific
     virtual core::Result<void> enable_ppm_sc() = 0;
     virtual core::Result<void> disable_ppm_sc() = 0;
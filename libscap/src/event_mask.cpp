@@ -0,0 +1,38 @@
+#include "scap/event_mask.h"
+
+#include <core/logger.h>
+
+#include <sys/ioctl.h>
+
+#include <cerrno>
+#include <cstring>
+
+extern "C" {
+#include "ppm_events_public.h"
+}
+
+namespace deepsys {
+namespace scap {
+
+core::Result<void> set_driver_event_mask(int device_fd, const std::vector<uint16_t>& event_types) {
+    for (uint16_t type : event_types) {
+        if (type >= PPM_EVENT_MAX) {
+            return core::ErrorCode::InvalidArgument;
+        }
+    }
+
+    if (ioctl(device_fd, PPM_IOCTL_MASK_ZERO_EVENTS) != 0) {
+        LOG_WARNING("Cannot clear the driver event mask: " << std::strerror(errno));
+        return core::ErrorCode::SystemError;
+    }
+    for (uint16_t type : event_types) {
+        if (ioctl(device_fd, PPM_IOCTL_MASK_SET_EVENT, static_cast<unsigned long>(type)) != 0) {
+            LOG_WARNING("Cannot set event " << type << " in the driver event mask: " << std::strerror(errno));
+            return core::ErrorCode::SystemError;
+        }
+    }
+    return {};
+}
+
+} // namespace scap
+} // namespace deepsys
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <core/string_pool.h>
+#include <core/types.h>
+#include <sinsp/proc_scan.h>
+#include <sinsp/thread_table.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+// Checkpoint file format.
+//
+// A header followed by flat arrays of fixed-size records, each section
+// 8-byte aligned, so a loader maps the file and reads the records in place.
+// Integers are in the writer's byte order, recorded in the header; strings
+// are referenced by index into the string section, since pool handles mean
+// nothing to another process.
+constexpr char CHECKPOINT_MAGIC[8] = {'D', 'S', 'Y', 'S', 'C', 'K', 'P', 'T'};
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+constexpr uint32_t CHECKPOINT_BYTE_ORDER = 0x01020304;
+constexpr uint32_t CHECKPOINT_NO_FD_TABLE = UINT32_MAX;
+
+struct CheckpointSection {
+    uint64_t offset;
+    uint64_t count;      // Records, or bytes for the string data
+};
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t timestamp_ns;         // Wall clock at capture
+    char boot_id[40];              // Pids only mean something within one boot
+    CheckpointSection strings;     // CheckpointString
+    CheckpointSection string_data;
+    CheckpointSection threads;     // CheckpointThread
+    CheckpointSection fd_tables;   // CheckpointFdTable
+    CheckpointSection fds;         // CheckpointFd
+    uint64_t checksum;             // FNV-1a of everything after the header
+};
+
+struct CheckpointString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct CheckpointThread {
+    int64_t tid;
+    int32_t pid;
+    int32_t ppid;
+    uint64_t start_time;
+    uint32_t exe;
+    uint32_t args;
+    uint32_t cwd;
+    uint32_t user;
+    uint32_t group;
+    uint32_t env;
+    uint32_t fd_table;             // Index in fd_tables, or CHECKPOINT_NO_FD_TABLE
+    uint32_t reserved;
+};
+
+struct CheckpointFdTable {
+    uint32_t first_fd;             // Index in fds
+    uint32_t fd_count;
+};
+
+struct CheckpointFd {
+    int32_t fd;
+    uint32_t name;
+    uint32_t flags;
+    uint8_t type;
+    uint8_t l4proto;
+    uint16_t sport;
+    uint16_t dport;
+    uint16_t reserved;
+    uint32_t reserved2;
+    uint64_t ino;
+    uint8_t sip[16];
+    uint8_t dip[16];
+};
+
+static_assert(sizeof(CheckpointHeader) == 152, "checkpoint header layout changed");
+static_assert(sizeof(CheckpointThread) == 56, "checkpoint thread layout changed");
+static_assert(sizeof(CheckpointFd) == 64, "checkpoint fd layout changed");
+
+// A checkpoint file mapped read-only.
+class Checkpoint {
+public:
+    // Maps and validates path: magic, version, byte order, section bounds
+    // and checksum
+    static core::Result<std::unique_ptr<Checkpoint>> open(const std::string& path);
+
+    ~Checkpoint();
+    Checkpoint(const Checkpoint&) = delete;
+    Checkpoint& operator=(const Checkpoint&) = delete;
+
+    const CheckpointHeader& header() const { return *header_; }
+    std::string_view boot_id() const;
+
+    size_t thread_count() const { return header_->threads.count; }
+    const CheckpointThread& thread(size_t i) const { return threads_[i]; }
+    size_t fd_table_count() const { return header_->fd_tables.count; }
+    const CheckpointFdTable& fd_table(size_t i) const { return fd_tables_[i]; }
+    const CheckpointFd& fd(size_t i) const { return fds_[i]; }
+    std::string_view string(uint32_t index) const;
+
+    // Adds the checkpointed threads and fds to table, as they were when
+    // captured; reconcile with a ProcScanner afterwards
+    void restore(ThreadTable& table) const;
+
+private:
+    Checkpoint(const void* data, size_t size);
+
+    const void* data_;
+    size_t size_;
+    const CheckpointHeader* header_;
+    const CheckpointString* strings_;
+    const char* string_data_;
+    const CheckpointThread* threads_;
+    const CheckpointFdTable* fd_tables_;
+    const CheckpointFd* fds_;
+};
+
+// Writes checkpoints of a ThreadTable in the background.
+//
+// checkpoint() runs on the thread that owns the table and only copies its
+// records into flat arrays. Strings are kept in a dictionary across
+// checkpoints, so each one only copies the strings that are new since the
+// last; the dictionary is rebuilt when most of it has gone stale. A
+// background thread then writes the file to a temporary name and renames it
+// over the previous one, so a crash leaves either the old checkpoint or the
+// new one. If the disk falls behind, a newer capture replaces the one still
+// waiting.
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(std::string path, std::string proc_root = "/proc");
+    ~CheckpointWriter();
+
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    void checkpoint(const ThreadTable& table);
+
+    // Waits until every capture so far is on disk, or was replaced by one
+    // that is
+    core::Result<void> flush();
+
+    struct Stats {
+        uint64_t captures = 0;
+        uint64_t written = 0;
+        uint64_t failed = 0;
+        uint64_t last_bytes = 0;
+        uint64_t last_capture_ns = 0;
+        uint64_t last_write_ns = 0;
+        uint64_t strings = 0;        // Dictionary size
+    };
+    Stats get_stats() const;
+
+private:
+    struct Image {
+        uint64_t sequence = 0;
+        uint64_t timestamp_ns = 0;
+        bool reset_strings = false;
+        std::vector<CheckpointString> new_strings;
+        std::string new_string_data;
+        std::vector<CheckpointThread> threads;
+        std::vector<CheckpointFdTable> fd_tables;
+        std::vector<CheckpointFd> fds;
+    };
+
+    struct DictionaryEntry {
+        uint32_t index;
+        uint64_t generation;
+    };
+
+    uint32_t string_index(core::StringHandle handle, Image& image);
+    void capture(const ThreadTable& table, Image& image);
+    void reset_dictionary();
+    void run();
+    bool write(const Image& image);
+
+    std::string path_;
+    std::string boot_id_;
+
+    // Owned by the capturing thread
+    std::unordered_map<core::StringHandle, DictionaryEntry> dictionary_;
+    uint32_t dictionary_bytes_ = 0;
+    uint64_t generation_ = 0;
+    uint64_t used_strings_ = 0;
+
+    // Owned by the writer thread
+    std::vector<CheckpointString> strings_;
+    std::string string_data_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::unique_ptr<Image> pending_;
+    uint64_t captured_ = 0;
+    uint64_t flushed_ = 0;
+    bool last_failed_ = false;
+    bool stop_ = false;
+    Stats stats_;
+    std::thread thread_;
+};
+
+// Restores the checkpoint at path into table, when there is a valid one
+// from this boot, then reconciles it with a scan of config.proc_root. Falls
+// back to a plain scan otherwise.
+core::Result<ProcScanStats> warm_start(const std::string& path, ThreadTable& table, ProcScanConfig config = {});
+
+} // namespace sinsp
+} // namespace deepsys
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+// Event types as the driver numbers them (enum ppm_event_type), which is
+// what core::Event::id holds. Most syscalls have an entry and an exit type,
+// and some have had several versions, all with the same name.
+using EventType = uint16_t;
+
+// The driver's EF_* event flags
+enum EventFlag : uint32_t {
+    EVENT_CREATES_FD = 1u << 0,
+    EVENT_DESTROYS_FD = 1u << 1,
+    EVENT_USES_FD = 1u << 2,
+    EVENT_READS_FROM_FD = 1u << 3,
+    EVENT_WRITES_TO_FD = 1u << 4,
+    EVENT_MODIFIES_STATE = 1u << 5,   // State tracking needs it, never filter it out
+    EVENT_UNUSED = 1u << 6,
+    EVENT_OLD_VERSION = 1u << 9,
+};
+
+// Events that refer to an fd, and so can have fd fields
+constexpr uint32_t EVENT_HAS_FD = EVENT_CREATES_FD | EVENT_DESTROYS_FD | EVENT_USES_FD;
+
+// Lookups in the driver's event table, driver/event_table.c
+size_t event_type_count();
+const char* event_name(EventType type);      // "unknown" past the table
+uint32_t event_flags(EventType type);        // 0 past the table
+
+// Appends every type called name, returns false if there is none
+bool find_event_types(std::string_view name, std::vector<EventType>& out);
+
+// A set of event types, e.g. those a filter can match
+class EventTypeSet {
+public:
+    static constexpr size_t CAPACITY = 512;
+
+    // Every type in the table
+    static EventTypeSet all();
+
+    // The types with any of flags set
+    static EventTypeSet with_flags(uint32_t flags);
+
+    void set(EventType type) { bits_.set(type); }
+    void reset(EventType type) { bits_.reset(type); }
+    bool test(EventType type) const { return type < CAPACITY && bits_.test(type); }
+
+    size_t count() const { return bits_.count(); }
+    bool empty() const { return bits_.none(); }
+
+    // Every type in the table that isn't in this set
+    EventTypeSet complement() const;
+
+    std::vector<EventType> types() const;
+
+    EventTypeSet& operator|=(const EventTypeSet& other) {
+        bits_ |= other.bits_;
+        return *this;
+    }
+    EventTypeSet& operator&=(const EventTypeSet& other) {
+        bits_ &= other.bits_;
+        return *this;
+    }
+    bool operator==(const EventTypeSet& other) const { return bits_ == other.bits_; }
+    bool operator!=(const EventTypeSet& other) const { return bits_ != other.bits_; }
+
+private:
+    std::bitset<CAPACITY> bits_;
+};
+
+} // namespace sinsp
+} // namespace deepsys
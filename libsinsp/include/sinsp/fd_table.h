@@ -0,0 +1,147 @@
+#pragma once
+
+#include <core/string_pool.h>
+#include <core/types.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+// What an fd refers to, as told by the event that created it. The driver
+// reports the fd itself as PT_FD and, for sockets, the endpoints as a
+// PT_SOCKTUPLE; the finer kinds (pipe, eventfd, ...) come from the event type.
+enum class FdType : uint8_t {
+    None = 0,       // Free slot
+    Unknown,
+    File,
+    Directory,
+    IPv4Socket,
+    IPv6Socket,
+    UnixSocket,
+    NetlinkSocket,
+    Pipe,
+    EventFd,
+    SignalFd,
+    EventPoll,
+    Inotify,
+    TimerFd
+};
+
+enum class L4Proto : uint8_t {
+    Unknown = 0,
+    Tcp,
+    Udp,
+    Icmp,
+    Raw
+};
+
+// One open fd. 64 bytes and free of owning members, so a table is a flat
+// array of these; the name is a StringPool handle owned by the table.
+struct FdInfo {
+    core::StringHandle name{core::EMPTY_STRING_HANDLE};   // Path, or unix socket path
+    uint32_t flags{0};                                    // Open flags as reported by the event
+    uint64_t ino{0};
+    std::array<uint8_t, 16> sip{};                        // IPv4 addresses use the first 4 bytes
+    std::array<uint8_t, 16> dip{};
+    uint16_t sport{0};
+    uint16_t dport{0};
+    FdType type{FdType::None};
+    L4Proto l4proto{L4Proto::Unknown};
+    uint32_t last_used{0};                                // Seconds, see ThreadTable::find_fd()
+
+    bool is_socket() const {
+        return type == FdType::IPv4Socket || type == FdType::IPv6Socket ||
+               type == FdType::UnixSocket || type == FdType::NetlinkSocket;
+    }
+};
+
+static_assert(sizeof(FdInfo) == 64, "FdInfo should stay one cache line");
+
+const char* fd_type_to_string(FdType type);
+
+// Human readable description of an fd: the path for files, the endpoints for
+// sockets and "<type>:[ino]" for anonymous kinds
+std::string format_fd(const FdInfo& info);
+
+// Open fds of one process, indexed by fd number.
+//
+// Processes mostly use small fds, so fds below DENSE_LIMIT index straight
+// into an array; larger ones (dup2 to a high fd, raised RLIMIT_NOFILE) go to
+// an open-addressing hash with the same layout as the ThreadTable. Both only
+// allocate when they grow, so once a process has reached its working set,
+// adding and removing fds on EF_CREATES_FD/EF_DESTROYS_FD events is O(1) and
+// allocation free.
+//
+// FdInfo pointers are invalidated by add(). The table isn't thread safe.
+class FdTable {
+public:
+    static constexpr core::FileDescriptor DENSE_LIMIT = 1024;
+
+    FdTable() = default;
+    ~FdTable();
+
+    FdTable(FdTable&& other) noexcept;
+    FdTable& operator=(FdTable&& other) noexcept;
+    FdTable(const FdTable&) = delete;
+    FdTable& operator=(const FdTable&) = delete;
+
+    FdInfo* find(core::FileDescriptor fd);
+    const FdInfo* find(core::FileDescriptor fd) const;
+
+    // Returns a zeroed entry of the given type for fd. An fd still open is
+    // replaced, like dup2() onto it would do.
+    FdInfo* add(core::FileDescriptor fd, FdType type);
+
+    bool erase(core::FileDescriptor fd);
+    void clear();
+
+    // Gives back storage beyond what the open fds need, after an eviction
+    void shrink_to_fit();
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t memory_usage() const;
+
+    // Visits dense fds in order, then the large ones in no particular order
+    template<typename F>
+    void for_each(F&& fn) const {
+        for (size_t fd = 0; fd < dense_.size(); ++fd) {
+            if (dense_[fd].type != FdType::None) {
+                fn(static_cast<core::FileDescriptor>(fd), dense_[fd]);
+            }
+        }
+        for (const SparseSlot& slot : sparse_) {
+            if (slot.fd != EMPTY_FD) {
+                fn(slot.fd, slot.info);
+            }
+        }
+    }
+
+private:
+    struct SparseSlot {
+        core::FileDescriptor fd;
+        FdInfo info;
+    };
+
+    static constexpr core::FileDescriptor EMPTY_FD = -1;
+
+    size_t sparse_home(core::FileDescriptor fd) const;
+    size_t sparse_find_slot(core::FileDescriptor fd) const;
+    void sparse_grow();
+    void sparse_rehash(size_t capacity);
+
+    std::vector<FdInfo> dense_;
+    std::vector<SparseSlot> sparse_;
+    size_t sparse_mask_ = 0;
+    uint32_t sparse_shift_ = 0;
+    size_t sparse_size_ = 0;
+    size_t size_ = 0;
+};
+
+} // namespace sinsp
+} // namespace deepsys
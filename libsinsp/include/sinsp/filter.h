@@ -0,0 +1,225 @@
+#pragma once
+
+#include <core/types.h>
+#include <scap/interface.h>
+#include <sinsp/event_table.h>
+#include <sinsp/filter_ast.h>
+#include <sinsp/filter_fields.h>
+#include <sinsp/ip_match.h>
+#include <sinsp/string_match.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+// Filter bytecode.
+//
+// A program is a flat array of 8-byte instructions over a register per
+// field and a single boolean flag. Loads are typed and fill their register
+// once per event: a later load of the same field is a no-op, so a field
+// compared several times is extracted once. Comparisons set the flag from a
+// register and a constant of the program, and "and"/"or" become jumps on
+// the flag that skip the rest of the chain once its outcome is known.
+// List and pattern tests run against matchers built at compile time (see
+// string_match.h), so their cost hardly depends on the list's length.
+enum class FilterOp : uint8_t {
+    LoadInt,            // reg = field
+    LoadString,
+    LoadAddr,
+    IntEq,              // flag = reg <op> ints[arg]
+    IntNe,
+    IntLt,
+    IntLe,
+    IntGt,
+    IntGe,
+    IntIn,              // flag = reg in sets[arg], a sorted range of ints
+    StrEq,              // flag = reg <op> strings[arg]
+    StrNe,
+    StrContains,
+    StrIContains,       // Constant stored lower case
+    StrStartsWith,
+    StrEndsWith,
+    StrGlob,            // flag = globs[arg] matches reg
+    StrIn,              // flag = reg in string_sets[arg]
+    StrPMatch,          // flag = reg is or lies below one of prefix_sets[arg]
+    StrContainsAny,     // flag = reg contains one of automata[arg]
+    AddrIn,             // flag = reg in networks[arg]
+    AddrNotIn,
+    Exists,             // flag = reg is present
+    Not,                // flag = !flag
+    JumpIfFalse,        // Go to arg
+    JumpIfTrue,
+    Return              // Result is the flag
+};
+
+struct FilterInstr {
+    FilterOp op;
+    uint8_t reg;
+    FieldId field;      // Loads
+    uint32_t arg;
+};
+
+static_assert(sizeof(FilterInstr) == 8, "FilterInstr should stay 8 bytes");
+
+// A compiled filter. Immutable once built, and run() neither allocates nor
+// calls through pointers, so one program can be shared by any number of
+// threads.
+class FilterProgram {
+public:
+    static constexpr size_t MAX_REGISTERS = 64;
+
+    // An empty program matches everything. Fields come from the cache, so
+    // programs run on the same event share their extractions.
+    bool run(FieldCache& fields) const;
+    bool run(const FilterEvent& event) const {
+        FieldCache fields(event);
+        return run(fields);
+    }
+
+    bool empty() const { return code_.empty(); }
+    const std::vector<FilterInstr>& code() const { return code_; }
+    uint32_t registers() const { return registers_; }
+
+    // Runs the program on count events at once, setting bit i % 64 of
+    // out[i / 64] when event i matches; out holds (count + 63) / 64 words.
+    // Events go 64 at a time, one per lane of a 64-bit mask: loads fill a
+    // column per field for the lanes still undecided, comparisons test a
+    // whole column (with AVX2 for numbers, where available), and jumps park
+    // decided lanes until their target. For offline analysis, where
+    // throughput matters more than latency; the result is the same as
+    // run() on each event.
+    void run_batch(const FilterEvent* events, size_t count, uint64_t* out) const;
+
+    // One instruction per line, for debugging
+    std::string disassemble() const;
+
+private:
+    friend class FilterCompiler;
+
+    struct StringConst {
+        uint32_t offset;    // In string_data_
+        uint32_t size;
+    };
+
+    struct ConstSet {
+        uint32_t first;     // In ints_
+        uint32_t count;
+    };
+
+    std::string_view string(uint32_t index) const {
+        return std::string_view(string_data_.data() + strings_[index].offset, strings_[index].size);
+    }
+
+    std::vector<FilterInstr> code_;
+    std::vector<int64_t> ints_;
+    std::vector<StringConst> strings_;
+    std::string string_data_;
+    std::vector<ConstSet> sets_;
+    std::vector<StringSet> string_sets_;
+    std::vector<PathPrefixSet> prefix_sets_;
+    std::vector<MultiMatcher> automata_;
+    std::vector<GlobMatcher> globs_;
+    std::vector<NetworkSet> networks_;
+    uint32_t registers_ = 0;
+};
+
+// Lowers a parsed expression into a program. Type errors (an ordering on a
+// string, a non-numeric value for a numeric field, an unknown event type)
+// are logged and reported as InvalidArgument.
+class FilterCompiler {
+public:
+    static core::Result<FilterProgram> compile(const FilterNode& root);
+
+    // "or" of this many contains on one field or more runs as one automaton
+    static constexpr size_t CONTAINS_ANY_MIN = 3;
+
+private:
+    static constexpr uint8_t NO_REGISTER = 0xff;
+
+    FilterCompiler() { registers_.fill(NO_REGISTER); }
+
+    bool emit(const FilterNode& node);
+    bool emit_chain(const FilterNode& node);
+    bool emit_contains_any(const std::vector<const FilterNode*>& group);
+    bool emit_compare(const FilterNode& node);
+    bool emit_int_compare(const FilterNode& node, uint8_t reg);
+    bool emit_string_compare(const FilterNode& node, uint8_t reg);
+    bool add_networks(const FilterNode& node, uint32_t& index);
+    void emit_addr_compare(const FilterNode& node, FieldId field, uint32_t networks);
+    void emit_op(FilterOp op, uint8_t reg = 0, uint32_t arg = 0, FieldId field = FieldId::Count);
+    uint8_t register_of(FieldId field);
+    uint32_t add_int(int64_t value);
+    uint32_t add_string(std::string_view value);
+    uint32_t add_int_set(std::vector<int64_t> values);
+    void thread_jumps();
+
+    FilterProgram program_;
+    std::array<uint8_t, FIELD_COUNT> registers_;
+};
+
+// Event types an event must have for root to possibly match it. Tests of
+// evt.type are exact, and fields only some events have (fd.*) narrow it to
+// those; anything else leaves it open.
+EventTypeSet filter_event_types(const FilterNode& root);
+
+// What compiling an expression gives, shared read-only by every Filter and
+// Ruleset that uses it, see FilterCache
+struct CompiledFilter {
+    std::string normalized;         // to_string() of the parsed expression
+    FilterProgram program;
+    EventTypeSet event_types = EventTypeSet::all();
+};
+
+// A filter expression and its program, what an inspector's set_filter()
+// keeps. Copies share the program.
+class Filter {
+public:
+    // Matches everything
+    Filter() : compiled_(match_everything()) {}
+
+    // A blank expression gives the match-everything filter. Compiled
+    // through FilterCache::instance(), so the same expression, however
+    // it's spaced or parenthesized, is compiled once per process.
+    static core::Result<Filter> compile(std::string_view expression);
+
+    bool matches(const FilterEvent& event) const { return compiled_->program.run(event); }
+    bool matches(FieldCache& fields) const { return compiled_->program.run(fields); }
+
+    // out gets one bit per event, see FilterProgram::run_batch()
+    void matches_batch(const std::vector<FilterEvent>& events, std::vector<uint64_t>& out) const {
+        out.assign((events.size() + 63) / 64, 0);
+        compiled_->program.run_batch(events.data(), events.size(), out.data());
+    }
+
+    bool empty() const { return compiled_->program.empty(); }
+    const std::string& expression() const { return expression_; }
+    const FilterProgram& program() const { return compiled_->program; }
+    const std::shared_ptr<const CompiledFilter>& compiled() const { return compiled_; }
+
+    // See filter_event_types()
+    const EventTypeSet& event_types() const { return compiled_->event_types; }
+
+    // What the driver has to capture for this filter: the types it can
+    // match, and those state tracking needs whatever the filter says
+    EventTypeSet capture_event_types() const;
+
+private:
+    static const std::shared_ptr<const CompiledFilter>& match_everything();
+
+    std::string expression_;
+    std::shared_ptr<const CompiledFilter> compiled_;
+};
+
+// Narrows the engine's capture to filter.capture_event_types(), so events
+// the filter would drop anyway don't take ring space
+core::Result<void> apply_event_mask(scap::IScapEngine& engine, const Filter& filter);
+
+} // namespace sinsp
+} // namespace deepsys
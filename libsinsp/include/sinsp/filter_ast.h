@@ -0,0 +1,69 @@
+#pragma once
+
+#include <core/types.h>
+#include <sinsp/filter_fields.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+enum class CompareOp : uint8_t {
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    Contains,
+    IContains,
+    StartsWith,
+    EndsWith,
+    Glob,           // * and ? wildcards
+    In,             // Any of a list
+    PMatch,         // Equal to or below any of a list of paths
+    Exists
+};
+
+const char* compare_op_to_string(CompareOp op);
+
+// Parsed filter expression. And and Or have two or more children, flattened
+// so that "a and b and c" is one node; Not has one.
+struct FilterNode {
+    enum class Kind : uint8_t {
+        And,
+        Or,
+        Not,
+        Compare
+    };
+
+    Kind kind = Kind::Compare;
+    std::vector<std::unique_ptr<FilterNode>> children;
+
+    // Compare only
+    FieldId field = FieldId::Count;
+    CompareOp op = CompareOp::Exists;
+    std::vector<std::string> values;    // One, none for Exists, any number for In and PMatch
+};
+
+using FilterNodePtr = std::unique_ptr<FilterNode>;
+
+// Parses an expression like
+//
+//     proc.name contains firefox and not (fd.name startswith /etc or evt.res < 0)
+//
+// Values are bare words or quoted strings, lists are parenthesized and comma
+// separated: evt.type in (open, openat). "and" binds tighter than "or".
+// Syntax errors are logged and reported as InvalidArgument; types are
+// checked by the compiler.
+core::Result<FilterNodePtr> parse_filter(std::string_view text);
+
+// Canonical text of a tree, which parses back to the same tree
+std::string to_string(const FilterNode& node);
+
+} // namespace sinsp
+} // namespace deepsys
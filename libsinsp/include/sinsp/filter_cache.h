@@ -0,0 +1,70 @@
+#pragma once
+
+#include <core/types.h>
+#include <sinsp/filter.h>
+#include <sinsp/filter_ast.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace deepsys {
+namespace sinsp {
+
+// Compiled filters shared across the process.
+//
+// Chisels and sessions often set the same filter, and rulesets repeat the
+// same comparisons; each gets the one CompiledFilter for its expression
+// instead of compiling its own. Expressions are keyed as written and, on a
+// miss, by their canonical form (to_string() of the parse), so
+// "proc.pid=1" and "(proc.pid = 1)" share a program. Entries are reference
+// counted by their holders and go away with the last one; the cache only
+// keeps weak references.
+//
+// Thread safe. Compilation runs outside the lock, so two threads missing
+// on the same expression may both compile it, and the first to finish
+// wins.
+class FilterCache {
+public:
+    static FilterCache& instance();
+
+    FilterCache() = default;
+    FilterCache(const FilterCache&) = delete;
+    FilterCache& operator=(const FilterCache&) = delete;
+
+    // Errors are those of parse_filter() and FilterCompiler::compile()
+    core::Result<std::shared_ptr<const CompiledFilter>> get(std::string_view expression);
+    core::Result<std::shared_ptr<const CompiledFilter>> get(const FilterNode& root);
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;          // Compilations
+        uint64_t live = 0;            // Programs someone still holds
+    };
+    Stats get_stats() const;
+
+private:
+    using Entry = std::weak_ptr<const CompiledFilter>;
+
+    std::shared_ptr<const CompiledFilter> find(std::string_view text, const std::string& normalized);
+    std::shared_ptr<const CompiledFilter> insert(std::string_view text, std::shared_ptr<const CompiledFilter> compiled);
+    void sweep();
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> by_text_;         // As written
+    std::unordered_map<std::string, Entry> by_normalized_;
+    size_t sweep_at_ = SWEEP_MIN;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+
+    // Expired entries are dropped once the maps reach twice the size they
+    // had after the last sweep
+    static constexpr size_t SWEEP_MIN = 64;
+};
+
+} // namespace sinsp
+} // namespace deepsys
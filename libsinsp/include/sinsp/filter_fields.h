@@ -0,0 +1,189 @@
+#pragma once
+
+#include <core/types.h>
+#include <sinsp/event_table.h>
+#include <sinsp/fd_table.h>
+#include <sinsp/interface.h>
+#include <sinsp/thread_table.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+// What a filter sees of an event: the event and the state it refers to,
+// resolved by the caller. Fields that need a missing piece are absent, and
+// every comparison on an absent field is false.
+struct FilterEvent {
+    core::Event event;
+    int64_t res = 0;                        // Return value, on exit events
+    core::FileDescriptor fd = -1;           // The fd the event is about, only for EVENT_HAS_FD types
+    const ThreadInfo* thread = nullptr;
+    const FdInfo* fd_info = nullptr;
+};
+
+// Resolves the thread and fd of an event from the table
+FilterEvent make_filter_event(const core::Event& event, const ThreadTable& table, int64_t res = 0,
+                              core::FileDescriptor fd = -1);
+
+enum class FieldType : uint8_t {
+    Int,
+    String,
+    Addr            // IPv4 or IPv6 address, compared against networks
+};
+
+// Filter fields, numbered densely so compiled filters can refer to them by
+// id rather than by name
+enum class FieldId : uint16_t {
+    EvtType,
+    EvtTime,
+    EvtRes,
+    ProcPid,
+    ProcPpid,
+    ProcName,
+    ProcExe,
+    ProcCmdline,
+    ProcCwd,
+    ThreadTid,
+    UserName,
+    GroupName,
+    FdNum,
+    FdName,
+    FdType,
+    FdL4Proto,
+    FdSport,
+    FdDport,
+    FdSip,
+    FdDip,
+    FdNet,          // Either address; compiled as a test of fd.sip or fd.dip
+    Count
+};
+
+constexpr size_t FIELD_COUNT = static_cast<size_t>(FieldId::Count);
+
+struct FieldInfo {
+    const char* name;
+    FieldId id;
+    FieldType type;
+    FilterCheckType check_type;
+    uint32_t event_flags;       // Only events with one of these EventFlags have it, 0 for all
+    const char* description;
+};
+
+const FieldInfo& field_info(FieldId id);
+const FieldInfo* find_field(std::string_view name);
+
+// The fields as IInspector::get_available_filter_checks() reports them
+std::vector<FilterCheckInfo> filter_checks();
+
+// A field's value for the event, false when it's absent. Strings point into
+// the event's state and the string pool.
+bool extract_int(FieldId id, const FilterEvent& event, int64_t& out);
+bool extract_string(FieldId id, const FilterEvent& event, std::string_view& out);
+
+// Points out at the address bytes in the fd, size 4 or 16
+bool extract_addr(FieldId id, const FilterEvent& event, const uint8_t*& out, size_t& size);
+
+// Field values of one event, extracted on first use and kept for the rest
+// of it, so that every filter, rule and formatter asking for proc.name of
+// an event shares one extraction. reset() moves on to the next event by
+// clearing two bitmasks: nothing is freed or allocated, and the slots are
+// never touched until a field is asked for. The event has to stay alive
+// until the next reset().
+class FieldCache {
+public:
+    static_assert(FIELD_COUNT <= 64, "FieldCache keeps one bit per field");
+
+    FieldCache() = default;
+    explicit FieldCache(const FilterEvent& event) { reset(event); }
+
+    FieldCache(const FieldCache&) = delete;
+    FieldCache& operator=(const FieldCache&) = delete;
+
+    void reset(const FilterEvent& event) {
+        event_ = &event;
+        loaded_ = 0;
+        present_ = 0;
+    }
+
+    const FilterEvent& event() const { return *event_; }
+
+    // Same as the extract_*() functions, from the cache when possible
+    bool get_int(FieldId id, int64_t& out) {
+        Slot& slot = slots_[static_cast<size_t>(id)];
+        uint64_t bit = uint64_t(1) << static_cast<size_t>(id);
+        if (!(loaded_ & bit)) {
+            loaded_ |= bit;
+            ++extractions_;
+            if (extract_int(id, *event_, slot.num)) {
+                present_ |= bit;
+            }
+        }
+        out = slot.num;
+        return present_ & bit;
+    }
+
+    bool get_string(FieldId id, std::string_view& out) {
+        Slot& slot = slots_[static_cast<size_t>(id)];
+        uint64_t bit = uint64_t(1) << static_cast<size_t>(id);
+        if (!(loaded_ & bit)) {
+            loaded_ |= bit;
+            ++extractions_;
+            std::string_view value;
+            if (extract_string(id, *event_, value)) {
+                slot.str = value.data();
+                slot.size = value.size();
+                present_ |= bit;
+            }
+        }
+        if (!(present_ & bit)) {
+            return false;
+        }
+        out = std::string_view(static_cast<const char*>(slot.str), slot.size);
+        return true;
+    }
+
+    bool get_addr(FieldId id, const uint8_t*& out, size_t& size) {
+        Slot& slot = slots_[static_cast<size_t>(id)];
+        uint64_t bit = uint64_t(1) << static_cast<size_t>(id);
+        if (!(loaded_ & bit)) {
+            loaded_ |= bit;
+            ++extractions_;
+            const uint8_t* addr;
+            if (extract_addr(id, *event_, addr, slot.size)) {
+                slot.str = addr;
+                present_ |= bit;
+            }
+        }
+        if (!(present_ & bit)) {
+            return false;
+        }
+        out = static_cast<const uint8_t*>(slot.str);
+        size = slot.size;
+        return true;
+    }
+
+    // Calls into extract_*() since construction
+    uint64_t extractions() const { return extractions_; }
+
+private:
+    // Plain data, left uninitialized until loaded
+    struct Slot {
+        int64_t num;
+        const void* str;
+        size_t size;
+    };
+
+    const FilterEvent* event_ = nullptr;
+    uint64_t loaded_ = 0;
+    uint64_t present_ = 0;
+    uint64_t extractions_ = 0;
+    std::array<Slot, FIELD_COUNT> slots_;
+};
+
+} // namespace sinsp
+} // namespace deepsys
@@ -1,9 +1,12 @@
 #pragma once
 
 #include <core/types.h>
+#include <sinsp/fd_table.h>
+#include <functional>
 #include <vector>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 namespace deepsys {
@@ -31,6 +34,7 @@ struct FilterCheckInfo {
 struct ProcessInfo {
     core::ProcessID pid;
     core::ThreadID tid;
+    core::ProcessID ppid;
     std::string exe;
     std::string args;
     std::string cwd;
@@ -38,7 +42,59 @@ struct ProcessInfo {
     std::string user;
     std::string group;
     std::unordered_map<std::string, std::string> env;
-    std::vector<std::string> open_fds;
+    std::vector<std::string> open_fds;   // "<fd> <description>"
+};
+
+// Fields a state visitor asks for. Pid, tid, ppid and start time always
+// come, the rest cost a lookup or a copy each and are left empty unless
+// asked for.
+enum class ProcessField : uint32_t {
+    Exe = 1u << 0,
+    Args = 1u << 1,
+    Cwd = 1u << 2,
+    User = 1u << 3,
+    Group = 1u << 4,
+    Env = 1u << 5,
+    Rss = 1u << 6,
+};
+
+// A set of ProcessField, built with |
+struct ProcessFields {
+    uint32_t bits = 0;
+
+    constexpr ProcessFields() = default;
+    constexpr ProcessFields(ProcessField field) : bits(static_cast<uint32_t>(field)) {}
+    constexpr explicit ProcessFields(uint32_t mask) : bits(mask) {}
+};
+
+constexpr ProcessFields ALL_PROCESS_FIELDS{~0u};
+
+constexpr ProcessFields operator|(ProcessFields a, ProcessFields b) {
+    return ProcessFields(a.bits | b.bits);
+}
+
+constexpr ProcessFields operator|(ProcessField a, ProcessField b) {
+    return ProcessFields(a) | ProcessFields(b);
+}
+
+constexpr bool has_field(ProcessFields fields, ProcessField field) {
+    return (fields.bits & static_cast<uint32_t>(field)) != 0;
+}
+
+// A process or thread as handed to a visitor. The views point into the
+// inspector's own state and only live for the visitor call.
+struct ProcessView {
+    core::ProcessID pid = 0;
+    core::ThreadID tid = 0;
+    core::ProcessID ppid = 0;
+    uint64_t start_time = 0;
+    std::string_view exe;
+    std::string_view args;    // NUL separated
+    std::string_view cwd;
+    std::string_view user;
+    std::string_view group;
+    std::string_view env;     // NUL separated KEY=VALUE pairs
+    uint64_t rss_bytes = 0;
 };
 
 struct EventDescription {
@@ -69,21 +125,45 @@ public:
 
     // File descriptor tracking
     virtual core::Result<std::vector<std::string>> get_process_fds(core::ProcessID pid) const = 0;
-    virtual core::Result<std::string> get_fd_info(core::FileDescriptor fd) const = 0;
+    virtual core::Result<std::string> get_fd_info(core::ProcessID pid, core::FileDescriptor fd) const = 0;
 
     // Network tracking
     virtual core::Result<std::vector<std::string>> get_network_connections(core::ProcessID pid) const = 0;
     virtual core::Result<std::string> get_connection_info(const std::string& connection_id) const = 0;
 
+    // Zero-copy state queries, for callers that would otherwise copy every
+    // env map and fd list just to read a few fields. The visitor gets each
+    // process (main threads) or thread in turn, with only the requested
+    // fields filled, and returns false to stop early. The defaults go
+    // through the queries above; implementations that hold the state
+    // themselves override them.
+    using ProcessVisitor = std::function<bool(const ProcessView& process)>;
+    using FdVisitor = std::function<bool(core::FileDescriptor fd, const FdInfo& info)>;
+
+    virtual core::Result<void> visit_processes(ProcessFields fields, const ProcessVisitor& visitor) const;
+    virtual core::Result<void> visit_threads(ProcessFields fields, const ProcessVisitor& visitor) const;
+    virtual core::Result<void> visit_process_fds(core::ProcessID pid, const FdVisitor& visitor) const;
+    virtual core::Result<void> visit_network_connections(core::ProcessID pid, const FdVisitor& visitor) const;
+
     // Memory tracking
     virtual core::Result<uint64_t> get_process_memory_usage(core::ProcessID pid) const = 0;
     virtual core::Result<std::unordered_map<std::string, uint64_t>> get_system_memory_info() const = 0;
 
-    // Filtering
+    // Filtering. Implementations compile the expression once with
+    // Filter::compile() (sinsp/filter.h), narrow the capture to it with
+    // apply_event_mask() and run its program per event; the filter checks
+    // are the fields of sinsp/filter_fields.h.
     virtual core::Result<void> set_filter(const std::string& filter) = 0;
     virtual core::Result<std::string> get_filter() const = 0;
     virtual core::Result<bool> matches_filter(const core::Event& event) const = 0;
 
+    // Sets bit i % 64 of out[i / 64] when events[i] matches. Meant for
+    // offline analysis; implementations running the filter's program hand
+    // it to FilterProgram::run_batch(), the default asks matches_filter()
+    // one event at a time.
+    virtual core::Result<void> matches_filter_batch(const std::vector<core::Event>& events,
+                                                    std::vector<uint64_t>& out) const;
+
     // Filter checks
     virtual core::Result<std::vector<FilterCheckInfo>> get_available_filter_checks() const = 0;
     virtual core::Result<FilterCheckInfo> get_filter_check_info(const std::string& check_name) const = 0;
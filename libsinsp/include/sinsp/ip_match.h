@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+// An address or network, as filters write them: 10.0.0.0/8, 192.168.1.7,
+// fe80::/10. A bare address is a network of one.
+struct IpNetwork {
+    uint8_t addr[16];           // IPv4 uses the first 4 bytes
+    uint8_t prefix;             // Bits, up to 32 or 128
+    bool v6;
+};
+
+// False on anything but an address with an optional prefix length in range
+bool parse_ip_network(std::string_view text, IpNetwork& out);
+
+// Membership of addresses in a list of networks, for network filters that
+// carry thousands of them.
+//
+// Each family is a path-compressed binary radix trie, laid out in one
+// vector: a node stores its whole prefix, so a lookup compares a node with
+// two masked 64-bit words and branches on the next bit, and stops at the
+// first network that covers the address, so a lookup visits at most one
+// node per distinct prefix length on its path, whatever the size of the
+// list, and networks inside another are never reached. IPv4 mapped IPv6
+// addresses (::ffff:a.b.c.d) are looked up as IPv4, and networks of them
+// (::ffff:a.b.c.d/96 and longer) are entered as IPv4.
+class NetworkSet {
+public:
+    explicit NetworkSet(const std::vector<IpNetwork>& networks);
+
+    // size is 4 or 16
+    bool contains(const uint8_t* addr, size_t size) const;
+
+    size_t size() const { return networks_; }
+    size_t nodes() const { return nodes_.size(); }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    // 128 bits, most significant first; IPv4 takes the top 32
+    struct Key {
+        uint64_t hi;
+        uint64_t lo;
+    };
+
+    struct Node {
+        Key key;                // Bits past length are zero
+        uint32_t child[2];
+        uint8_t length;
+        bool terminal;          // A network of the set ends here
+    };
+
+    static Key make_key(const uint8_t* addr, size_t size);
+    static Key mask(Key key, unsigned length);
+    static unsigned common_bits(Key a, Key b, unsigned limit);
+    static unsigned bit(Key key, unsigned index);
+
+    void insert(uint32_t& root, Key key, unsigned length);
+    uint32_t add_node(Key key, unsigned length, bool terminal);
+    bool lookup(uint32_t root, Key key) const;
+
+    std::vector<Node> nodes_;
+    uint32_t root4_ = NONE;
+    uint32_t root6_ = NONE;
+    size_t networks_ = 0;
+};
+
+} // namespace sinsp
+} // namespace deepsys
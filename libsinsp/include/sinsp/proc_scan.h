@@ -0,0 +1,69 @@
+#pragma once
+
+#include <core/types.h>
+#include <sinsp/thread_table.h>
+
+#include <cstdint>
+#include <string>
+
+namespace deepsys {
+namespace sinsp {
+
+struct ProcScanConfig {
+    std::string proc_root = "/proc";
+    uint32_t workers = 0;          // 0 uses every online CPU
+    bool scan_fds = true;
+    bool scan_sockets = true;      // Resolve socket fds through <proc_root>/net
+    bool read_environ = true;
+    bool read_rss = true;          // From <pid>/statm, known processes included
+
+    // Treat the table's content as a previous state (a restored checkpoint)
+    // rather than starting over: processes still running with the same start
+    // time keep their ppid, and their fds as long as they still name the
+    // same thing, while details, threads and other fds are read again; the
+    // ones that are gone are dropped unless a live process descends from them
+    bool reconcile = false;
+};
+
+struct ProcScanStats {
+    // Wall time of each phase, in nanoseconds
+    uint64_t list_ns = 0;          // Listing pids
+    uint64_t sockets_ns = 0;       // Parsing the socket tables
+    uint64_t processes_ns = 0;     // Reading /proc/<pid>, in parallel
+    uint64_t merge_ns = 0;         // Filling the ThreadTable
+    uint64_t total_ns = 0;
+
+    uint32_t workers = 0;
+    uint64_t processes = 0;
+    uint64_t threads = 0;
+    uint64_t fds = 0;
+    uint64_t sockets = 0;          // Entries read from the socket tables
+    uint64_t vanished = 0;         // Processes that exited while being scanned
+    uint64_t reused = 0;           // Processes kept from the table when reconciling
+    uint64_t pruned = 0;           // Threads dropped from the table when reconciling
+
+    std::string to_string() const;
+};
+
+// Builds the initial inspector state from /proc.
+//
+// Pids are listed with getdents64 and handed to a pool of workers through an
+// atomic cursor, so a process with thousands of fds doesn't hold up the
+// others. Workers read everything with openat() relative to the process
+// dirfd into reused buffers, and intern strings directly in the StringPool;
+// only the final merge into the (single threaded) ThreadTable is serial.
+//
+// Threads of a process get the process' command line, credentials and start
+// time, the per-task files are only listed.
+class ProcScanner {
+public:
+    explicit ProcScanner(ProcScanConfig config = {});
+
+    core::Result<ProcScanStats> scan(ThreadTable& table) const;
+
+private:
+    ProcScanConfig config_;
+};
+
+} // namespace sinsp
+} // namespace deepsys
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <core/types.h>
+#include <sinsp/event_table.h>
+#include <sinsp/filter.h>
+#include <sinsp/filter_ast.h>
+#include <sinsp/filter_fields.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+using RuleId = uint32_t;
+
+// Many filter expressions evaluated together.
+//
+// Rules are merged into one decision DAG: every comparison, not, and/or is
+// hash-consed on its canonical form, so a predicate that several rules
+// share ("proc.name = bash", or a whole "evt.type = execve and ...") is one
+// node, evaluated at most once per event and its result reused by every
+// rule that reaches it. And/or operands are kept in a canonical order so
+// that "a and b" and "b and a" are the same node too. The exception is an
+// "or" with several contains (or startswith) tests on one field: those
+// become one comparison node, whose program tests them all in one pass
+// over the string (see FilterCompiler), instead of one node each.
+//
+// Rules are also indexed by the event types they can match (see
+// filter_event_types()), so an event only visits the rules that care about
+// its type.
+//
+// Operands of an and/or are evaluated in the order that has paid off: every
+// node counts how often it was true and samples what it cost, and every
+// reorder interval each chain is sorted by expected cost over the chance an
+// operand ends it (false for and, true for or), so cheap, decisive tests go
+// first. The counts are halved then, so the order follows the workload.
+// Operands have no side effects, which makes any order give the same
+// result.
+//
+// Evaluation keeps per-event memo and counters, so a ruleset is used by one
+// thread at a time.
+class Ruleset {
+public:
+    Ruleset();
+
+    Ruleset(const Ruleset&) = delete;
+    Ruleset& operator=(const Ruleset&) = delete;
+
+    // Ids are handed out in order from 0. An invalid expression is logged
+    // and reported as InvalidArgument.
+    core::Result<RuleId> add(std::string_view name, std::string_view expression);
+
+    // Appends the ids of the rules event matches, in id order. Pass a
+    // FieldCache to share field extractions with whatever else looks at the
+    // event, e.g. the formatting of the matches.
+    void evaluate(FieldCache& fields, std::vector<RuleId>& matches);
+    void evaluate(const FilterEvent& event, std::vector<RuleId>& matches) {
+        FieldCache fields(event);
+        evaluate(fields, matches);
+    }
+
+    // Saves the rules in compiled form: the DAG, each rule's event types
+    // and the canonical text of each comparison. load() then skips parsing
+    // and interning whole rules and the type analysis, and takes the
+    // comparison programs from FilterCache, shared with any ruleset or
+    // filter already using them. Written to a temporary file renamed over
+    // path. And/or operands are saved in the order reorder() last gave them,
+    // so a loaded ruleset starts from what was learned; the statistics
+    // behind that order aren't saved and start from zero.
+    core::Result<void> save(const std::string& path) const;
+
+    // Into an empty ruleset. A file that isn't a ruleset saved against the
+    // same event table is logged and reported as InvalidArgument.
+    core::Result<void> load(const std::string& path);
+
+    size_t size() const { return rules_.size(); }
+    const std::string& name(RuleId id) const { return rules_[id].name; }
+    const std::string& expression(RuleId id) const { return rules_[id].expression; }
+    const EventTypeSet& event_types(RuleId id) const { return rules_[id].types; }
+
+    // Cost is timed on about one evaluation in COST_SAMPLE, and is what the
+    // rule added: shared nodes an earlier rule already evaluated are free.
+    // Rules and nodes are timed on different evaluations, so neither
+    // includes the other's clock reads.
+    static constexpr uint64_t COST_SAMPLE = 64;
+
+    // Events between reorderings of and/or operands, 0 to keep them as added
+    static constexpr uint64_t DEFAULT_REORDER_INTERVAL = 8192;
+    void set_reorder_interval(uint64_t events) { reorder_interval_ = events; }
+
+    struct RuleStats {
+        uint64_t evaluations = 0;
+        uint64_t hits = 0;
+        uint64_t cost_samples = 0;
+        uint64_t cost_ns = 0;
+
+        double mean_ns() const { return cost_samples ? double(cost_ns) / double(cost_samples) : 0.0; }
+    };
+    const RuleStats& rule_stats(RuleId id) const { return rules_[id].stats; }
+
+    struct Stats {
+        uint64_t rules = 0;
+        uint64_t nodes = 0;           // Distinct DAG nodes
+        uint64_t predicates = 0;      // Of which comparisons
+        uint64_t shared = 0;          // Nodes reused by add() instead of created
+        uint64_t events = 0;
+        uint64_t rule_evaluations = 0;
+        uint64_t node_evaluations = 0;
+        uint64_t reorders = 0;        // Chains whose operand order changed
+    };
+    Stats get_stats() const;
+
+private:
+    struct Node {
+        FilterNode::Kind kind;
+        uint32_t first;     // Compare: index in predicates_; else in children_
+        uint32_t count;     // Children
+    };
+
+    struct NodeStats {
+        uint64_t evaluations = 0;
+        uint64_t hits = 0;
+        uint64_t cost_samples = 0;
+        uint64_t cost_ns = 0;
+        uint32_t sample_in = 0;     // Evaluations until the next timed one
+    };
+
+    struct Rule {
+        std::string name;
+        std::string expression;
+        uint32_t root;
+        EventTypeSet types;
+        RuleStats stats;
+        uint32_t sample_in = 0;
+    };
+
+    uint32_t intern(const FilterNode& node);
+    static std::vector<std::vector<const FilterNode*>> match_groups(const FilterNode& node);
+    uint32_t intern_group(const std::vector<const FilterNode*>& group);
+    uint32_t add_node(std::string key, Node node);
+    void index_rule(RuleId id);
+    bool eval(uint32_t node, FieldCache& fields);
+    bool start_sample(uint32_t& sample_in);
+    void reorder();
+
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> children_;
+    std::vector<std::shared_ptr<const CompiledFilter>> predicates_;   // From FilterCache
+    std::unordered_map<std::string, uint32_t> index_;   // Canonical form to node
+
+    std::vector<Rule> rules_;
+    std::vector<std::vector<RuleId>> by_type_;          // Event type to the rules that can match it
+    std::vector<RuleId> any_type_;                      // For types past the table
+
+    // Per-event memo: a node's value is valid when its stamp is the epoch
+    std::vector<uint32_t> memo_epoch_;
+    std::vector<uint8_t> memo_value_;
+    uint32_t epoch_ = 0;
+
+    std::vector<NodeStats> node_stats_;
+    bool timing_ = false;                               // A rule or node clock is running
+    uint64_t reorder_interval_ = DEFAULT_REORDER_INTERVAL;
+    uint64_t reorders_ = 0;
+
+    uint64_t shared_ = 0;
+    uint64_t events_ = 0;
+    uint64_t node_evaluations_ = 0;
+};
+
+} // namespace sinsp
+} // namespace deepsys
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <core/string_pool.h>
+#include <core/types.h>
+#include <sinsp/spsc_queue.h>
+#include <sinsp/thread_table.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+// What an event does to the thread table, as far as the pipeline cares;
+// everything else is up to the handler
+enum class EventKind : uint8_t {
+    Other,
+    Clone,      // child_tid and child_pid are the new thread and its tgid
+    Exec,       // exe and args are the new image
+    Exit        // tid exits; child_pid adopts its children if it was the last, 0 for init
+};
+
+struct ShardedEvent {
+    core::Event event;                  // event.pid is the tgid events are sharded by
+    EventKind kind = EventKind::Other;
+    core::ThreadID child_tid = 0;
+    core::ProcessID child_pid = 0;
+
+    // Exec only. The inspector takes over one reference of each, and they
+    // belong to the thread once the event is processed.
+    core::StringHandle exe = core::EMPTY_STRING_HANDLE;
+    core::StringHandle args = core::EMPTY_STRING_HANDLE;
+
+    uint64_t sequence = 0;              // Dispatch order, set by inspect_event()
+};
+
+struct ShardedInspectorConfig {
+    size_t shards = 0;                  // 0 for one per hardware thread but the dispatcher's; at most 64
+    size_t queue_capacity = 16384;      // Events per shard, input and output each
+    bool ordered_output = false;        // poll() returns outputs in dispatch order
+    ThreadTableLimits limits;           // Split evenly between the shards
+};
+
+// Multi-core event inspection.
+//
+// Thread state is partitioned by tgid over N shards, each a worker thread
+// with its own ThreadTable, fed by the dispatcher (the thread calling
+// inspect_event()) through an SPSC queue. All events of a process go to the
+// same shard in dispatch order, so per-process order holds and the tables
+// need no locks.
+//
+// Only clone and exit cross shards. A fork whose child hashes elsewhere is
+// queued on both shards with a shared handoff: the parent's shard copies
+// the parent's state into it, and the child's shard waits for it before
+// creating the child, so none of the child's events can run ahead. This
+// can't deadlock, since each shard handles events in dispatch order. The
+// dispatcher remembers which shards hold children of each process, and on
+// exit queues the exit to those too, so they reparent them. Exec changes
+// only the exec'ing process and stays in its shard.
+//
+// The handler runs on the shard's worker for each event, after the
+// built-in state changes, and returns whether to output the event. poll()
+// drains the outputs, merged back into dispatch order when configured:
+// each shard publishes how far it got, and an output is released once no
+// shard can still produce an earlier one.
+//
+// A shard with a full output queue stops, and its input queue then fills
+// up. A dispatcher that also polls has to pass its sink to inspect_event()
+// and flush(), which poll into it while they wait; otherwise they would
+// wait for a poll() that never comes.
+class ShardedInspector {
+public:
+    using Handler = std::function<bool(const ShardedEvent& event, ThreadTable& table)>;
+    using Sink = std::function<void(const ShardedEvent& event)>;
+
+    explicit ShardedInspector(ShardedInspectorConfig config = {}, Handler handler = {});
+    ~ShardedInspector();
+
+    ShardedInspector(const ShardedInspector&) = delete;
+    ShardedInspector& operator=(const ShardedInspector&) = delete;
+
+    // Copies the threads and fds of table into the shards, e.g. after a
+    // scan. Call before the first event.
+    void load(const ThreadTable& table);
+
+    // Dispatcher side. Waits while the shard's queue is full, polling into
+    // sink if given. Events without a pid, and clones without a child, are
+    // InvalidArgument; the exe and args of a rejected event stay the
+    // caller's.
+    core::Result<void> inspect_event(const ShardedEvent& event, const Sink& sink = {});
+
+    // Hands out up to max outputs to fn, returning how many. Call from one
+    // thread at a time, and often enough that shards don't stall on a full
+    // output queue.
+    size_t poll(const Sink& fn, size_t max = SIZE_MAX);
+
+    // Waits until every event dispatched so far has been handled, polling
+    // into sink if given
+    void flush(const Sink& sink = {});
+
+    size_t shard_count() const { return shards_.size(); }
+    size_t shard_of(core::ProcessID pid) const {
+        uint64_t hash = (static_cast<uint64_t>(pid) * 0x9E3779B97F4A7C15ULL) >> 32;
+        return static_cast<size_t>((hash * shards_.size()) >> 32);
+    }
+
+    // A shard's table. Only while the pipeline is quiet: after flush() and
+    // before the next inspect_event().
+    const ThreadTable& table(size_t shard) const { return shards_[shard]->table; }
+
+    struct ShardStats {
+        uint64_t events = 0;
+        uint64_t ghosts = 0;         // Clone and exit copies queued for another shard's process
+        uint64_t handoffs = 0;       // Children received from another shard
+        uint64_t handoff_waits = 0;  // Times the parent's shard wasn't done yet
+        uint64_t outputs = 0;
+        uint64_t output_stalls = 0;
+    };
+
+    struct Stats {
+        uint64_t dispatched = 0;
+        uint64_t input_stalls = 0;   // Times the dispatcher found a queue full
+        std::vector<ShardStats> shards;
+    };
+    // From the dispatcher
+    Stats get_stats() const;
+
+private:
+    struct Handoff;
+
+    enum class Role : uint8_t {
+        Own,            // The event's own process lives here
+        CloneSource,    // Fills the handoff for a child in another shard
+        CloneTarget,    // Creates the child from the handoff
+        ExitNotice,     // Reparents children of a process in another shard
+        Stop
+    };
+
+    struct Entry {
+        ShardedEvent event;
+        Role role = Role::Own;
+        Handoff* handoff = nullptr;
+    };
+
+    struct Shard {
+        explicit Shard(size_t capacity) : input(capacity), output(capacity) {}
+
+        SpscQueue<Entry> input;
+        SpscQueue<ShardedEvent> output;
+        ThreadTable table;
+        std::thread worker;
+
+        size_t index = 0;
+
+        // Parents in other shards, to the children they have here
+        std::unordered_map<core::ProcessID, std::unordered_set<core::ProcessID>> foreign_children;
+
+        alignas(64) std::atomic<uint64_t> dispatched{0};   // Last sequence queued, by the dispatcher
+        alignas(64) std::atomic<uint64_t> done{0};         // Last sequence handled, by the worker
+        std::atomic<uint64_t> horizon{0};                  // No output at or below it can come anymore
+
+        std::atomic<uint64_t> events{0};
+        std::atomic<uint64_t> ghosts{0};
+        std::atomic<uint64_t> handoffs{0};
+        std::atomic<uint64_t> handoff_waits{0};
+        std::atomic<uint64_t> outputs{0};
+        std::atomic<uint64_t> output_stalls{0};
+    };
+
+    void push(size_t shard, const Entry& entry, const Sink& sink);
+    void run(Shard& shard);
+    void handle(Shard& shard, Entry& entry);
+    void clone_local(Shard& shard, const ShardedEvent& event);
+    void reparent_children(Shard& shard, core::ProcessID pid, core::ProcessID reaper);
+    void emit(Shard& shard, const ShardedEvent& event);
+    size_t poll_ordered(const Sink& fn, size_t max);
+
+    ShardedInspectorConfig config_;
+    Handler handler_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<bool> stopping_{false};
+
+    // Owned by the dispatcher
+    uint64_t sequence_ = 0;
+    uint64_t input_stalls_ = 0;
+    std::unordered_map<core::ProcessID, uint64_t> child_shards_;   // Bit per shard holding children
+
+    size_t next_poll_ = 0;
+};
+
+} // namespace sinsp
+} // namespace deepsys
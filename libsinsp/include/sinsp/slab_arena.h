@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+// Fixed-size record allocator. Records live in slabs of SlabSize elements
+// that are never moved or freed while the arena lives, so both the 32-bit
+// index handed out by allocate() and the address of the record stay valid
+// until release(). Released slots are reused LIFO, which keeps the working
+// set small under thread churn.
+template<typename T, size_t SlabSize = 1024>
+class SlabArena {
+    static_assert((SlabSize & (SlabSize - 1)) == 0, "SlabSize must be a power of 2");
+
+public:
+    static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+
+    uint32_t allocate() {
+        uint32_t index;
+        if (!free_list_.empty()) {
+            index = free_list_.back();
+            free_list_.pop_back();
+        } else {
+            if (next_ == slabs_.size() * SlabSize) {
+                slabs_.push_back(std::make_unique<T[]>(SlabSize));
+            }
+            index = next_++;
+        }
+        (*this)[index] = T{};
+        ++live_;
+        return index;
+    }
+
+    void release(uint32_t index) {
+        free_list_.push_back(index);
+        --live_;
+    }
+
+    T& operator[](uint32_t index) { return slabs_[index / SlabSize][index % SlabSize]; }
+    const T& operator[](uint32_t index) const { return slabs_[index / SlabSize][index % SlabSize]; }
+
+    size_t size() const { return live_; }
+    size_t capacity() const { return slabs_.size() * SlabSize; }
+    size_t memory_usage() const {
+        return capacity() * sizeof(T) + free_list_.capacity() * sizeof(uint32_t) +
+               slabs_.capacity() * sizeof(std::unique_ptr<T[]>);
+    }
+
+    void clear() {
+        slabs_.clear();
+        free_list_.clear();
+        next_ = 0;
+        live_ = 0;
+    }
+
+private:
+    std::vector<std::unique_ptr<T[]>> slabs_;
+    std::vector<uint32_t> free_list_;
+    uint32_t next_ = 0;
+    size_t live_ = 0;
+};
+
+} // namespace sinsp
+} // namespace deepsys
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace deepsys {
+namespace sinsp {
+
+// Bounded single-producer single-consumer ring.
+//
+// Each side owns one index and keeps a cached copy of the other's, on its
+// own cache line, so it only reads the other side's line when the ring
+// looks full (producer) or empty (consumer). Capacity is rounded up to a
+// power of 2.
+template<typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) {
+        size_t rounded = 2;
+        while (rounded < capacity) {
+            rounded *= 2;
+        }
+        buffer_ = std::make_unique<T[]>(rounded);
+        mask_ = rounded - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer side
+    bool try_push(const T& value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cached_head_ > mask_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail - cached_head_ > mask_) {
+                return false;
+            }
+        }
+        buffer_[tail & mask_] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: the oldest entry, or nullptr, valid until pop()
+    T* front() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == cached_tail_) {
+                return nullptr;
+            }
+        }
+        return &buffer_[head & mask_];
+    }
+
+    void pop() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    bool try_pop(T& value) {
+        T* entry = front();
+        if (!entry) {
+            return false;
+        }
+        value = std::move(*entry);
+        pop();
+        return true;
+    }
+
+    // Either side; exact only on a quiet queue
+    size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    alignas(64) std::atomic<size_t> head_{0};
+    size_t cached_tail_ = 0;
+
+    alignas(64) std::atomic<size_t> tail_{0};
+    size_t cached_head_ = 0;
+
+    alignas(64) std::unique_ptr<T[]> buffer_;
+    size_t mask_ = 0;
+};
+
+} // namespace sinsp
+} // namespace deepsys
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <core/epoch.h>
+#include <core/string_pool.h>
+#include <core/types.h>
+#include <sinsp/fd_table.h>
+#include <sinsp/interface.h>
+#include <sinsp/thread_table.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+// A thread as last published by StateView. Immutable once published; the
+// string handles hold their own references, so they stay readable after the
+// thread is gone from the ThreadTable.
+struct ThreadRecord {
+    core::ThreadID tid;
+    core::ProcessID pid;
+    core::ProcessID ppid;
+    uint64_t start_time;
+    core::StringHandle exe;
+    core::StringHandle args;
+    core::StringHandle cwd;
+    core::StringHandle user;
+    core::StringHandle group;
+    core::StringHandle env;
+    uint32_t rss_kb;
+};
+
+// 64 consecutive fds of a process, the unit StateView copies when an fd
+// changes
+struct FdPage {
+    static constexpr uint32_t SIZE = 64;
+
+    core::FileDescriptor base;
+    uint64_t present;                  // Bit i set when base + i is open
+    std::array<FdInfo, SIZE> fds;
+};
+
+// Lock-free read access to thread and fd state for API and exporter threads.
+//
+// The event loop keeps sole ownership of the ThreadTable and never shares
+// it. Instead it tells the view which threads and fds it changed, and
+// publish() copies just those into immutable records, RCU style: records
+// live in 256 shards, each a sorted array that is replaced as a whole when
+// one of its records changes, and a process's fds are a sorted array of
+// FdPages that shares unchanged pages with the previous version. Replaced
+// versions are retired to an EpochDomain and freed once no reader can
+// still see them.
+//
+// Readers take a Guard, which pins an epoch slot of their own, and then look
+// records up without locks, with one acquire load per shard: they can't
+// stall the writer, and see the state as of the last publish(), with each
+// shard consistent. Pointers they get stay valid until the guard goes.
+class StateView {
+public:
+    using Guard = core::EpochDomain::Guard;
+
+    static constexpr size_t SHARDS = 256;
+
+    // On EpochDomain::instance(). A domain of the caller's must outlive
+    // StringPool::instance(), since freeing records releases strings.
+    StateView();
+    explicit StateView(core::EpochDomain& epochs);
+    ~StateView();
+
+    StateView(const StateView&) = delete;
+    StateView& operator=(const StateView&) = delete;
+
+    // Writer side, on the thread that owns the table. touch() when a thread
+    // changes or exits, touch_fd() when one of a process's fds is opened,
+    // changed or closed; publish() applies them all in one go.
+    void touch(core::ThreadID tid);
+    void touch_fd(core::ProcessID pid, core::FileDescriptor fd);
+    void publish(const ThreadTable& table);
+
+    // Republishes everything, e.g. after a scan, a restore or a
+    // ThreadTable::trim() that evicted something
+    void publish_all(const ThreadTable& table);
+
+    // Reader side, from any thread
+    Guard read() const { return epochs_.pin(); }
+
+    const ThreadRecord* find(const Guard& guard, core::ThreadID tid) const;
+    const FdInfo* find_fd(const Guard& guard, core::ProcessID pid, core::FileDescriptor fd) const;
+    ProcessInfo to_process_info(const Guard& guard, const ThreadRecord& record) const;
+
+    // Projection with only the requested fields, see ThreadTable::view();
+    // valid while the guard lives
+    ProcessView view(const Guard& guard, const ThreadRecord& record, ProcessFields fields) const;
+
+    template<typename F>
+    void visit_processes(const Guard& guard, ProcessFields fields, F&& fn) const {
+        for (const auto& shard : threads_) {
+            const ThreadShard* current = shard.load(std::memory_order_acquire);
+            if (!current) {
+                continue;
+            }
+            for (const ThreadRecord* record : current->records) {
+                if (record->tid == record->pid && !fn(view(guard, *record, fields))) {
+                    return;
+                }
+            }
+        }
+    }
+
+    template<typename F>
+    void for_each(const Guard&, F&& fn) const {
+        for (const auto& shard : threads_) {
+            const ThreadShard* current = shard.load(std::memory_order_acquire);
+            if (current) {
+                for (const ThreadRecord* record : current->records) {
+                    fn(*record);
+                }
+            }
+        }
+    }
+
+    template<typename F>
+    void for_each_fd(const Guard&, core::ProcessID pid, F&& fn) const {
+        const FdSnapshot* fds = find_fds(pid);
+        if (!fds) {
+            return;
+        }
+        for (const FdPage* page : fds->pages) {
+            for (uint64_t bits = page->present; bits; bits &= bits - 1) {
+                uint32_t i = static_cast<uint32_t>(__builtin_ctzll(bits));
+                fn(page->base + static_cast<core::FileDescriptor>(i), page->fds[i]);
+            }
+        }
+    }
+
+    // Published threads
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+    // From the writer thread
+    struct Stats {
+        uint64_t publishes = 0;
+        uint64_t threads_copied = 0;
+        uint64_t pages_copied = 0;
+        uint64_t shards_replaced = 0;
+        uint64_t freed = 0;
+    };
+    Stats get_stats() const { return stats_; }
+
+private:
+    struct ThreadShard {
+        std::vector<const ThreadRecord*> records;   // Sorted by tid
+    };
+
+    struct FdSnapshot {
+        core::ProcessID pid;
+        std::vector<const FdPage*> pages;           // Sorted by base
+    };
+
+    struct FdShard {
+        std::vector<const FdSnapshot*> processes;   // Sorted by pid
+    };
+
+    static size_t shard_of(int64_t key) {
+        return static_cast<size_t>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL) >> 56);
+    }
+
+    const FdSnapshot* find_fds(core::ProcessID pid) const;
+
+    void publish_threads(const ThreadTable& table);
+    void publish_fds(const ThreadTable& table);
+    const FdSnapshot* copy_fds(const ThreadTable& table, const FdSnapshot* old, core::ProcessID pid,
+                               const std::vector<core::FileDescriptor>& bases);
+    static void destroy_record(void* record);
+    static void destroy_page(void* page);
+
+    core::EpochDomain& epochs_;
+    std::array<std::atomic<const ThreadShard*>, SHARDS> threads_;
+    std::array<std::atomic<const FdShard*>, SHARDS> fds_;
+    std::atomic<size_t> size_{0};
+
+    // Owned by the writer
+    std::vector<core::ThreadID> dirty_threads_;
+    std::unordered_map<core::ProcessID, std::vector<core::FileDescriptor>> dirty_pages_;
+    Stats stats_;
+};
+
+} // namespace sinsp
+} // namespace deepsys
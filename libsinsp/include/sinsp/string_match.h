@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+// String matching for filter predicates. Substring search compares the
+// first and last byte of the needle against 32 (AVX2) or 16 (SSE2) haystack
+// positions at once and only verifies the candidates, picked at runtime by
+// CPU; elsewhere it's scalar. The list matchers are built once, when a
+// filter is compiled, so that a test against hundreds of values costs
+// about as much as against one.
+
+// Position of needle in haystack, or npos
+size_t find_substring(std::string_view haystack, std::string_view needle);
+
+inline bool contains(std::string_view haystack, std::string_view needle) {
+    return find_substring(haystack, needle) != std::string_view::npos;
+}
+
+// ASCII case-insensitive; needle must be lower case already
+bool icontains(std::string_view haystack, std::string_view needle);
+
+// "avx2", "sse2" or "scalar", whichever find_substring() uses
+const char* string_match_isa();
+
+// A * and ? wildcard pattern. Patterns with only * are split into literal
+// segments matched with find_substring(); ? falls back to backtracking.
+class GlobMatcher {
+public:
+    explicit GlobMatcher(std::string_view pattern);
+
+    bool match(std::string_view text) const;
+    const std::string& pattern() const { return pattern_; }
+
+private:
+    std::string pattern_;
+    bool simple_;                       // No ?, so segments_ applies
+    bool anchored_start_;
+    bool anchored_end_;
+    std::vector<std::string> segments_; // Literal runs between *
+};
+
+// Exact membership, one hash probe per lookup
+class StringSet {
+public:
+    explicit StringSet(const std::vector<std::string>& values);
+
+    bool contains(std::string_view value) const;
+    size_t size() const { return offsets_.size(); }
+
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t index;                 // Into offsets_, plus 1; 0 for empty
+    };
+
+    std::string_view value(uint32_t index) const {
+        return std::string_view(data_.data() + offsets_[index], sizes_[index]);
+    }
+
+    std::string data_;
+    std::vector<uint32_t> offsets_;
+    std::vector<uint32_t> sizes_;
+    std::vector<Slot> slots_;
+    size_t mask_ = 0;
+};
+
+// Path prefixes: a path matches when it is one of them or lies below one,
+// so /etc matches /etc and /etc/passwd but not /etcd. Costs a hash probe
+// per directory level of the path within the prefix lengths.
+class PathPrefixSet {
+public:
+    explicit PathPrefixSet(const std::vector<std::string>& prefixes);
+
+    bool match(std::string_view path) const;
+    size_t size() const { return prefixes_.size(); }
+
+private:
+    StringSet prefixes_;
+    bool root_ = false;                 // "/" is one of them
+    size_t min_size_ = SIZE_MAX;
+    size_t max_size_ = 0;
+};
+
+// Aho-Corasick automaton for "contains any of" a literal list, compiled to
+// a DFA over the byte classes the literals use: one table lookup per
+// haystack byte, whatever the number of literals.
+class MultiMatcher {
+public:
+    explicit MultiMatcher(const std::vector<std::string>& needles);
+
+    bool search(std::string_view haystack) const;
+    size_t size() const { return needles_; }
+    size_t states() const { return matched_.size(); }
+
+private:
+    uint16_t classes_[256];             // 0 for bytes no needle uses, so 257 classes at most
+    uint32_t class_count_ = 1;
+    std::vector<uint32_t> next_;        // state * class_count_ + class
+    std::vector<uint8_t> matched_;      // A needle ends in the state
+    size_t needles_ = 0;
+    bool empty_needle_ = false;
+};
+
+} // namespace sinsp
+} // namespace deepsys
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <core/string_pool.h>
+#include <core/types.h>
+#include <sinsp/fd_table.h>
+#include <sinsp/interface.h>
+#include <sinsp/slab_arena.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+// Per-thread state. Kept small and free of owning members so that it can
+// live in a SlabArena; strings are StringPool handles, each holding one
+// reference that the table drops when the thread is erased. Set them with
+// StringPool::assign().
+struct ThreadInfo {
+    core::ThreadID tid{0};
+    core::ProcessID pid{0};
+    core::ProcessID ppid{0};
+    uint64_t start_time{0};
+    core::StringHandle exe{core::EMPTY_STRING_HANDLE};
+    core::StringHandle args{core::EMPTY_STRING_HANDLE};   // NUL separated, like /proc/<pid>/cmdline
+    core::StringHandle cwd{core::EMPTY_STRING_HANDLE};
+    core::StringHandle user{core::EMPTY_STRING_HANDLE};
+    core::StringHandle group{core::EMPTY_STRING_HANDLE};
+    core::StringHandle env{core::EMPTY_STRING_HANDLE};    // NUL separated KEY=VALUE pairs
+    uint32_t fd_table{NO_FD_TABLE};                        // Shared by the threads of a process
+    uint32_t exited_at{0};                                 // Seconds, 0 while the thread runs
+    uint32_t rss_kb{0};                                    // Main threads, as of the last scan
+
+    // Process tree links between main threads, as arena indices. Maintained
+    // by ThreadTable::set_parent(), don't write them directly.
+    uint32_t parent{NO_LINK};
+    uint32_t first_child{NO_LINK};
+    uint32_t next_sibling{NO_LINK};
+    uint32_t prev_sibling{NO_LINK};
+
+    static constexpr uint32_t NO_FD_TABLE = UINT32_MAX;
+    static constexpr uint32_t NO_LINK = UINT32_MAX;
+
+    bool is_main_thread() const { return tid == pid; }
+    bool has_exited() const { return exited_at != 0; }
+};
+
+// Bounds on the state a ThreadTable keeps, enforced by ThreadTable::trim()
+struct ThreadTableLimits {
+    // Bytes of live thread and fd records plus the tid index, 0 for no
+    // limit. Once over it, trim() evicts exited threads still in their grace
+    // window, oldest first, then the least recently used fds, until 10%
+    // under. Arenas keep their peak capacity for reuse, and an fd array
+    // keeps room up to its highest open fd, so allocated memory settles a
+    // little above the budget; get_stats() reports both.
+    size_t memory_budget = 0;
+
+    // How long exited threads stay in the table to resolve late events
+    uint64_t exit_grace_ns = 5000000000ULL;
+};
+
+// Calls fn(key, value) for each pair of a NUL separated block of KEY=VALUE
+// pairs, like ThreadInfo::env, without copying
+template<typename F>
+void for_each_environ(std::string_view block, F&& fn) {
+    while (!block.empty()) {
+        size_t end = block.find('\0');
+        std::string_view entry = block.substr(0, end);
+        size_t eq = entry.find('=');
+        if (eq != std::string_view::npos) {
+            fn(entry.substr(0, eq), entry.substr(eq + 1));
+        }
+        if (end == std::string_view::npos) {
+            break;
+        }
+        block.remove_prefix(end + 1);
+    }
+}
+
+// Fills env from such a block
+void parse_environ(std::string_view block, std::unordered_map<std::string, std::string>& env);
+
+// Thread table keyed by tid.
+//
+// An open-addressing hash with linear probing maps each tid to the index of
+// its ThreadInfo in a slab arena. A slot is 16 bytes, so a lookup usually
+// touches one cache line of the index and one of the arena. Deletions use
+// backward shifting, so there are no tombstones and probe sequences stay
+// short under churn. The last lookup is cached, since consecutive events
+// mostly come from the same thread.
+//
+// Exiting threads are kept for a grace window, since events from them can
+// still be in flight, and fds remember when they were last used, so that
+// trim() can keep the table within a byte budget.
+//
+// ThreadInfo pointers stay valid until the thread is erased. The table isn't
+// thread safe.
+class ThreadTable {
+public:
+    explicit ThreadTable(size_t expected_threads = 1024);
+    ~ThreadTable() { clear(); }
+
+    void set_limits(const ThreadTableLimits& limits) { limits_ = limits; }
+    const ThreadTableLimits& limits() const { return limits_; }
+
+    ThreadTable(const ThreadTable&) = delete;
+    ThreadTable& operator=(const ThreadTable&) = delete;
+
+    ThreadInfo* find(core::ThreadID tid);
+    const ThreadInfo* find(core::ThreadID tid) const;
+
+    // Returns the existing entry for tid, or a new zeroed one with tid set
+    ThreadInfo* get_or_add(core::ThreadID tid, bool* added = nullptr);
+
+    bool erase(core::ThreadID tid);
+    void clear();
+
+    // Keeps tid findable until its grace window ends; erase() it instead to
+    // drop it at once
+    bool mark_exited(core::ThreadID tid);
+
+    // Advances the table's clock to an event timestamp, and trims it about
+    // once a second of event time
+    void set_time(uint64_t now_ns) {
+        now_ns_ = now_ns;
+        if (now_ns >= next_trim_ns_) {
+            trim();
+        }
+    }
+
+    // Erases threads past their grace window, then evicts down to the budget
+    void trim();
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t memory_usage() const;
+
+    template<typename F>
+    void for_each(F&& fn) const {
+        for (const Slot& slot : slots_) {
+            if (slot.tid != EMPTY_TID) {
+                fn(arena_[slot.index]);
+            }
+        }
+    }
+
+    // Iterates the threads in table order. Invalidated by get_or_add() and
+    // erase().
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = ThreadInfo;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const ThreadInfo*;
+        using reference = const ThreadInfo&;
+
+        const_iterator(const ThreadTable* table, size_t slot) : table_(table), slot_(slot) { skip(); }
+
+        reference operator*() const { return table_->arena_[table_->slots_[slot_].index]; }
+        pointer operator->() const { return &**this; }
+        const_iterator& operator++() {
+            ++slot_;
+            skip();
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator old = *this;
+            ++*this;
+            return old;
+        }
+        bool operator==(const const_iterator& other) const { return slot_ == other.slot_; }
+        bool operator!=(const const_iterator& other) const { return slot_ != other.slot_; }
+
+    private:
+        void skip() {
+            while (slot_ < table_->slots_.size() && table_->slots_[slot_].tid == EMPTY_TID) {
+                ++slot_;
+            }
+        }
+
+        const ThreadTable* table_;
+        size_t slot_;
+    };
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, slots_.size()); }
+
+    // Projection of a thread with only the requested fields, viewing the
+    // pool's strings: valid as long as the thread is in the table
+    ProcessView view(const ThreadInfo& info, ProcessFields fields) const;
+
+    // Visits main threads, or all threads, as views; fn returns false to
+    // stop
+    template<typename F>
+    void visit_processes(ProcessFields fields, F&& fn) const {
+        for (const ThreadInfo& info : *this) {
+            if (info.is_main_thread() && !fn(view(info, fields))) {
+                return;
+            }
+        }
+    }
+
+    template<typename F>
+    void visit_threads(ProcessFields fields, F&& fn) const {
+        for (const ThreadInfo& info : *this) {
+            if (!fn(view(info, fields))) {
+                return;
+            }
+        }
+    }
+
+    // Process tree. Main threads are linked to their parent's main thread,
+    // so that children and ancestry queries cost O(children) and O(depth)
+    // instead of a scan of the table. Call set_parent() on clone and
+    // reparenting, erase() unlinks the exiting process and detaches its
+    // children until they're reparented. Links to a parent that isn't in the
+    // table yet (or would form a cycle after pid reuse) are skipped;
+    // rebuild_process_tree() relinks everything after a bulk load.
+    bool set_parent(core::ThreadID tid, core::ProcessID ppid);
+    void rebuild_process_tree();
+
+    // Whether tid's process is ancestor or one of its descendants
+    bool is_descendant_of(core::ThreadID tid, core::ProcessID ancestor) const;
+
+    template<typename F>
+    void for_each_child(core::ProcessID pid, F&& fn) const {
+        const ThreadInfo* parent = find(pid);
+        if (!parent || !parent->is_main_thread()) {
+            return;
+        }
+        for (uint32_t i = parent->first_child; i != ThreadInfo::NO_LINK; i = arena_[i].next_sibling) {
+            fn(arena_[i]);
+        }
+    }
+
+    // Visits every process below pid depth first, without allocating: the
+    // walk climbs back up through the parent links
+    template<typename F>
+    void for_each_descendant(core::ProcessID pid, F&& fn) const {
+        uint32_t root = index_of(pid);
+        if (root == ThreadInfo::NO_LINK || !arena_[root].is_main_thread()) {
+            return;
+        }
+
+        uint32_t i = arena_[root].first_child;
+        while (i != ThreadInfo::NO_LINK) {
+            fn(arena_[i]);
+            if (arena_[i].first_child != ThreadInfo::NO_LINK) {
+                i = arena_[i].first_child;
+                continue;
+            }
+            while (i != root && arena_[i].next_sibling == ThreadInfo::NO_LINK) {
+                i = arena_[i].parent;
+            }
+            i = i == root ? ThreadInfo::NO_LINK : arena_[i].next_sibling;
+        }
+    }
+
+    // The fd table of tid's process, created on first use. Threads share
+    // the table of their main thread, and it goes away with the last of them.
+    FdTable* fd_table(core::ThreadID tid);
+    const FdTable* fd_table(core::ThreadID tid) const;
+
+    // fd of tid's process, stamped as used now for the LRU eviction. Fds
+    // reached through fd_table() directly, like the ones a scan adds, stay
+    // unstamped and are the first to go.
+    FdInfo* find_fd(core::ThreadID tid, core::FileDescriptor fd);
+    FdInfo* add_fd(core::ThreadID tid, core::FileDescriptor fd, FdType type);
+
+    // Materializes the inspector-facing view of a thread
+    ProcessInfo to_process_info(const ThreadInfo& info) const;
+
+    struct Stats {
+        size_t threads = 0;
+        size_t exited_threads = 0;     // Still in their grace window
+        size_t fd_tables = 0;
+        size_t fds = 0;
+        size_t index_bytes = 0;        // Tid hash index
+        size_t thread_bytes = 0;       // Live ThreadInfo records
+        size_t fd_bytes = 0;           // Live fd tables and FdInfo records
+        size_t used_bytes = 0;         // The sum, checked against the budget
+        size_t reserved_bytes = 0;     // memory_usage(): allocated, free slots included
+        size_t memory_budget = 0;
+        uint64_t expired_threads = 0;  // Erased at the end of their grace window
+        uint64_t evicted_threads = 0;  // Erased early to meet the budget
+        uint64_t evicted_fds = 0;
+    };
+    Stats get_stats() const;
+
+private:
+    struct Slot {
+        core::ThreadID tid;
+        uint32_t index;
+    };
+
+    static constexpr core::ThreadID EMPTY_TID = -1;
+
+    size_t home(core::ThreadID tid) const;
+    size_t find_slot(core::ThreadID tid) const;
+    void grow();
+    static void release_strings(const ThreadInfo& info);
+    void release_fd_table(const ThreadInfo& info);
+    uint32_t index_of(core::ThreadID tid) const;
+    void link(uint32_t child, uint32_t parent);
+    void unlink(uint32_t child);
+    void detach_children(uint32_t parent);
+    size_t used_bytes(size_t* fd_count = nullptr) const;
+    size_t evict_fds(size_t bytes);
+
+    std::vector<Slot> slots_;
+    size_t mask_ = 0;
+    uint32_t shift_ = 0;
+    size_t size_ = 0;
+    SlabArena<ThreadInfo> arena_;
+
+    struct SharedFdTable {
+        FdTable table;
+        uint32_t refs = 0;
+    };
+    SlabArena<SharedFdTable, 256> fd_tables_;
+
+    mutable core::ThreadID last_tid_ = EMPTY_TID;
+    mutable ThreadInfo* last_info_ = nullptr;
+
+    struct ExitedThread {
+        core::ThreadID tid;
+        uint64_t exited_ns;
+    };
+
+    ThreadTableLimits limits_;
+    uint64_t now_ns_ = 0;
+    uint64_t next_trim_ns_ = 0;
+    std::deque<ExitedThread> exited_;   // In exit order
+    size_t exited_count_ = 0;
+    uint64_t expired_threads_ = 0;
+    uint64_t evicted_threads_ = 0;
+    uint64_t evicted_fds_ = 0;
+};
+
+} // namespace sinsp
+} // namespace deepsys
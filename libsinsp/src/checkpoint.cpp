@@ -0,0 +1,568 @@
+#include "sinsp/checkpoint.h"
+
+#include <core/logger.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t WRITE_BUFFER = 1 << 20;
+
+// Past this size, a dictionary with less than half of its strings in use is
+// rebuilt by the next checkpoint
+constexpr size_t DICTIONARY_COMPACT_MIN = 4096;
+
+constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+constexpr uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+uint64_t elapsed_ns(Clock::time_point since) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count());
+}
+
+std::string read_boot_id(const std::string& proc_root) {
+    std::string path = proc_root + "/sys/kernel/random/boot_id";
+    FILE* file = std::fopen(path.c_str(), "re");
+    if (!file) {
+        return "";
+    }
+
+    char buf[40] = {};
+    if (!std::fgets(buf, sizeof(buf), file)) {
+        buf[0] = '\0';
+    }
+    std::fclose(file);
+
+    std::string id(buf);
+    while (!id.empty() && (id.back() == '\n' || id.back() == ' ')) {
+        id.pop_back();
+    }
+    return id;
+}
+
+bool section_fits(const CheckpointSection& section, size_t record_size, size_t file_size) {
+    return section.offset % 8 == 0 && section.offset <= file_size &&
+           section.count <= (file_size - section.offset) / record_size;
+}
+
+// Buffers writes to fd and checksums everything that goes through it
+class FileWriter {
+public:
+    explicit FileWriter(int fd) : fd_(fd) { buf_.reserve(WRITE_BUFFER); }
+
+    void emit(const void* data, size_t size) {
+        hash_ = fnv1a(hash_, data, size);
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            size_t chunk = std::min(size, WRITE_BUFFER - buf_.size());
+            buf_.insert(buf_.end(), bytes, bytes + chunk);
+            bytes += chunk;
+            size -= chunk;
+            offset_ += chunk;
+            if (buf_.size() == WRITE_BUFFER) {
+                drain();
+            }
+        }
+    }
+
+    void pad_to(uint64_t offset) {
+        static const char zeros[8] = {};
+        if (offset > offset_) {
+            emit(zeros, offset - offset_);
+        }
+    }
+
+    template<typename T>
+    void emit_records(const std::vector<T>& records) {
+        emit(records.data(), records.size() * sizeof(T));
+    }
+
+    bool finish() {
+        drain();
+        return ok_;
+    }
+
+    uint64_t hash() const { return hash_; }
+
+private:
+    void drain() {
+        const char* data = buf_.data();
+        size_t size = buf_.size();
+        while (ok_ && size > 0) {
+            ssize_t n = ::write(fd_, data, size);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ok_ = false;
+                break;
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        buf_.clear();
+    }
+
+    int fd_;
+    std::vector<char> buf_;
+    uint64_t offset_ = sizeof(CheckpointHeader);
+    uint64_t hash_ = FNV_OFFSET;
+    bool ok_ = true;
+};
+
+} // namespace
+
+core::Result<std::unique_ptr<Checkpoint>> Checkpoint::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT ? core::ErrorCode::NotFound : core::ErrorCode::SystemError;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return core::ErrorCode::SystemError;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size < sizeof(CheckpointHeader)) {
+        close(fd);
+        return core::ErrorCode::InvalidArgument;
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return core::ErrorCode::SystemError;
+    }
+
+    // Owns the mapping from here on, including on the error paths
+    std::unique_ptr<Checkpoint> checkpoint(new Checkpoint(data, size));
+    const CheckpointHeader& header = *checkpoint->header_;
+
+    if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CHECKPOINT_VERSION || header.byte_order != CHECKPOINT_BYTE_ORDER) {
+        LOG_WARNING("Checkpoint " << path << " has an unsupported format");
+        return core::ErrorCode::InvalidArgument;
+    }
+
+    if (!section_fits(header.strings, sizeof(CheckpointString), size) ||
+        !section_fits(header.string_data, 1, size) ||
+        !section_fits(header.threads, sizeof(CheckpointThread), size) ||
+        !section_fits(header.fd_tables, sizeof(CheckpointFdTable), size) ||
+        !section_fits(header.fds, sizeof(CheckpointFd), size)) {
+        LOG_WARNING("Checkpoint " << path << " is truncated");
+        return core::ErrorCode::InvalidArgument;
+    }
+
+    const char* bytes = static_cast<const char*>(data);
+    if (fnv1a(FNV_OFFSET, bytes + sizeof(CheckpointHeader), size - sizeof(CheckpointHeader)) != header.checksum) {
+        LOG_WARNING("Checkpoint " << path << " is corrupted");
+        return core::ErrorCode::InvalidArgument;
+    }
+
+    checkpoint->strings_ = reinterpret_cast<const CheckpointString*>(bytes + header.strings.offset);
+    checkpoint->string_data_ = bytes + header.string_data.offset;
+    checkpoint->threads_ = reinterpret_cast<const CheckpointThread*>(bytes + header.threads.offset);
+    checkpoint->fd_tables_ = reinterpret_cast<const CheckpointFdTable*>(bytes + header.fd_tables.offset);
+    checkpoint->fds_ = reinterpret_cast<const CheckpointFd*>(bytes + header.fds.offset);
+    return checkpoint;
+}
+
+Checkpoint::Checkpoint(const void* data, size_t size)
+    : data_(data),
+      size_(size),
+      header_(static_cast<const CheckpointHeader*>(data)),
+      strings_(nullptr),
+      string_data_(nullptr),
+      threads_(nullptr),
+      fd_tables_(nullptr),
+      fds_(nullptr) {}
+
+Checkpoint::~Checkpoint() {
+    munmap(const_cast<void*>(data_), size_);
+}
+
+std::string_view Checkpoint::boot_id() const {
+    return std::string_view(header_->boot_id, strnlen(header_->boot_id, sizeof(header_->boot_id)));
+}
+
+std::string_view Checkpoint::string(uint32_t index) const {
+    if (index >= header_->strings.count) {
+        return {};
+    }
+    const CheckpointString& str = strings_[index];
+    if (str.offset > header_->string_data.count || str.length > header_->string_data.count - str.offset) {
+        return {};
+    }
+    return std::string_view(string_data_ + str.offset, str.length);
+}
+
+void Checkpoint::restore(ThreadTable& table) const {
+    core::StringPool& pool = core::StringPool::instance();
+
+    std::vector<core::StringHandle> handles(header_->strings.count);
+    for (uint32_t i = 0; i < handles.size(); ++i) {
+        handles[i] = pool.intern(string(i));
+    }
+    auto handle = [&](uint32_t index) {
+        return index < handles.size() ? handles[index] : core::EMPTY_STRING_HANDLE;
+    };
+    auto set = [&](core::StringHandle& field, uint32_t index) {
+        core::StringHandle value = handle(index);
+        pool.retain(value);
+        pool.release(field);
+        field = value;
+    };
+
+    for (size_t i = 0; i < thread_count(); ++i) {
+        const CheckpointThread& record = threads_[i];
+        ThreadInfo* info = table.get_or_add(record.tid);
+        if (!info) {
+            continue;
+        }
+        info->pid = record.pid;
+        info->ppid = record.ppid;
+        info->start_time = record.start_time;
+        set(info->exe, record.exe);
+        set(info->args, record.args);
+        set(info->cwd, record.cwd);
+        set(info->user, record.user);
+        set(info->group, record.group);
+        set(info->env, record.env);
+    }
+
+    // Once every thread is in, so that fd_table() finds the main threads
+    std::vector<bool> restored(fd_table_count());
+    for (size_t i = 0; i < thread_count(); ++i) {
+        const CheckpointThread& record = threads_[i];
+        if (record.fd_table >= fd_table_count() || restored[record.fd_table]) {
+            continue;
+        }
+        restored[record.fd_table] = true;
+
+        const CheckpointFdTable& fd_table = fd_tables_[record.fd_table];
+        if (fd_table.first_fd > header_->fds.count || fd_table.fd_count > header_->fds.count - fd_table.first_fd) {
+            continue;
+        }
+
+        FdTable* fds = table.fd_table(record.tid);
+        if (!fds) {
+            continue;
+        }
+        fds->clear();
+        for (uint32_t f = fd_table.first_fd; f < fd_table.first_fd + fd_table.fd_count; ++f) {
+            const CheckpointFd& fd = fds_[f];
+            if (fd.type == static_cast<uint8_t>(FdType::None) || fd.type > static_cast<uint8_t>(FdType::TimerFd)) {
+                continue;
+            }
+            FdInfo* info = fds->add(fd.fd, static_cast<FdType>(fd.type));
+            if (!info) {
+                continue;
+            }
+            info->name = handle(fd.name);
+            pool.retain(info->name);
+            info->flags = fd.flags;
+            info->ino = fd.ino;
+            std::memcpy(info->sip.data(), fd.sip, sizeof(fd.sip));
+            std::memcpy(info->dip.data(), fd.dip, sizeof(fd.dip));
+            info->sport = fd.sport;
+            info->dport = fd.dport;
+            info->l4proto = static_cast<L4Proto>(fd.l4proto);
+        }
+    }
+
+    for (core::StringHandle h : handles) {
+        pool.release(h);
+    }
+
+    table.rebuild_process_tree();
+}
+
+CheckpointWriter::CheckpointWriter(std::string path, std::string proc_root)
+    : path_(std::move(path)), boot_id_(read_boot_id(proc_root)), thread_([this] { run(); }) {}
+
+CheckpointWriter::~CheckpointWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+    reset_dictionary();
+}
+
+void CheckpointWriter::reset_dictionary() {
+    core::StringPool& pool = core::StringPool::instance();
+    for (const auto& entry : dictionary_) {
+        pool.release(entry.first);
+    }
+    dictionary_.clear();
+    dictionary_bytes_ = 0;
+}
+
+uint32_t CheckpointWriter::string_index(core::StringHandle handle, Image& image) {
+    if (handle == core::EMPTY_STRING_HANDLE) {
+        return 0;
+    }
+
+    auto it = dictionary_.find(handle);
+    if (it != dictionary_.end()) {
+        if (it->second.generation != generation_) {
+            it->second.generation = generation_;
+            ++used_strings_;
+        }
+        return it->second.index;
+    }
+
+    // The dictionary holds a reference, so the handle can't be reused for
+    // another string while it's in there
+    core::StringPool& pool = core::StringPool::instance();
+    pool.retain(handle);
+    std::string_view str = pool.get(handle);
+
+    // Index 0 is the empty string
+    uint32_t index = static_cast<uint32_t>(dictionary_.size() + 1);
+    image.new_strings.push_back(CheckpointString{dictionary_bytes_, static_cast<uint32_t>(str.size())});
+    image.new_string_data.append(str);
+    dictionary_bytes_ += static_cast<uint32_t>(str.size());
+    dictionary_.emplace(handle, DictionaryEntry{index, generation_});
+    ++used_strings_;
+    return index;
+}
+
+void CheckpointWriter::capture(const ThreadTable& table, Image& image) {
+    ++generation_;
+    used_strings_ = 0;
+
+    // Threads of a process share their fd table, it's written once
+    std::unordered_map<uint32_t, uint32_t> fd_tables;
+
+    table.for_each([&](const ThreadInfo& info) {
+        CheckpointThread record{};
+        record.tid = info.tid;
+        record.pid = info.pid;
+        record.ppid = info.ppid;
+        record.start_time = info.start_time;
+        record.exe = string_index(info.exe, image);
+        record.args = string_index(info.args, image);
+        record.cwd = string_index(info.cwd, image);
+        record.user = string_index(info.user, image);
+        record.group = string_index(info.group, image);
+        record.env = string_index(info.env, image);
+        record.fd_table = CHECKPOINT_NO_FD_TABLE;
+
+        if (info.fd_table != ThreadInfo::NO_FD_TABLE) {
+            auto [it, inserted] = fd_tables.emplace(info.fd_table, static_cast<uint32_t>(image.fd_tables.size()));
+            if (inserted) {
+                CheckpointFdTable fd_table{static_cast<uint32_t>(image.fds.size()), 0};
+                table.fd_table(info.tid)->for_each([&](core::FileDescriptor fd, const FdInfo& fdinfo) {
+                    CheckpointFd out{};
+                    out.fd = fd;
+                    out.name = string_index(fdinfo.name, image);
+                    out.flags = fdinfo.flags;
+                    out.type = static_cast<uint8_t>(fdinfo.type);
+                    out.l4proto = static_cast<uint8_t>(fdinfo.l4proto);
+                    out.sport = fdinfo.sport;
+                    out.dport = fdinfo.dport;
+                    out.ino = fdinfo.ino;
+                    std::memcpy(out.sip, fdinfo.sip.data(), sizeof(out.sip));
+                    std::memcpy(out.dip, fdinfo.dip.data(), sizeof(out.dip));
+                    image.fds.push_back(out);
+                });
+                fd_table.fd_count = static_cast<uint32_t>(image.fds.size()) - fd_table.first_fd;
+                image.fd_tables.push_back(fd_table);
+            }
+            record.fd_table = it->second;
+        }
+
+        image.threads.push_back(record);
+    });
+}
+
+void CheckpointWriter::checkpoint(const ThreadTable& table) {
+    Clock::time_point start = Clock::now();
+
+    auto image = std::make_unique<Image>();
+    image->timestamp_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+
+    bool compact = dictionary_.size() > DICTIONARY_COMPACT_MIN && used_strings_ * 2 < dictionary_.size();
+    if (generation_ == 0 || compact) {
+        reset_dictionary();
+        image->reset_strings = true;
+        image->new_strings.push_back(CheckpointString{0, 0});
+    }
+    capture(table, *image);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    image->sequence = ++captured_;
+
+    // The writer hasn't seen the pending capture's new strings yet, carry
+    // them over unless this capture starts a fresh dictionary anyway
+    if (pending_ && !image->reset_strings) {
+        pending_->new_strings.insert(pending_->new_strings.end(), image->new_strings.begin(), image->new_strings.end());
+        pending_->new_string_data += image->new_string_data;
+        image->new_strings.swap(pending_->new_strings);
+        image->new_string_data.swap(pending_->new_string_data);
+        image->reset_strings = pending_->reset_strings;
+    }
+    pending_ = std::move(image);
+
+    ++stats_.captures;
+    stats_.last_capture_ns = elapsed_ns(start);
+    stats_.strings = dictionary_.size();
+    cv_.notify_all();
+}
+
+core::Result<void> CheckpointWriter::flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return flushed_ == captured_; });
+    return last_failed_ ? core::ErrorCode::SystemError : core::ErrorCode::Success;
+}
+
+CheckpointWriter::Stats CheckpointWriter::get_stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void CheckpointWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        cv_.wait(lock, [this] { return pending_ || stop_; });
+        if (!pending_) {
+            return;
+        }
+        std::unique_ptr<Image> image = std::move(pending_);
+        lock.unlock();
+
+        if (image->reset_strings) {
+            strings_.clear();
+            string_data_.clear();
+        }
+        strings_.insert(strings_.end(), image->new_strings.begin(), image->new_strings.end());
+        string_data_ += image->new_string_data;
+
+        Clock::time_point start = Clock::now();
+        bool ok = write(*image);
+        uint64_t write_ns = elapsed_ns(start);
+
+        lock.lock();
+        flushed_ = image->sequence;
+        last_failed_ = !ok;
+        if (ok) {
+            ++stats_.written;
+            stats_.last_write_ns = write_ns;
+        } else {
+            ++stats_.failed;
+        }
+        cv_.notify_all();
+    }
+}
+
+bool CheckpointWriter::write(const Image& image) {
+    std::string tmp = path_ + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOG_WARNING("Cannot create checkpoint " << tmp << ": " << std::strerror(errno));
+        return false;
+    }
+
+    CheckpointHeader header{};
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.byte_order = CHECKPOINT_BYTE_ORDER;
+    header.timestamp_ns = image.timestamp_ns;
+    std::memcpy(header.boot_id, boot_id_.data(), std::min(boot_id_.size(), sizeof(header.boot_id) - 1));
+
+    uint64_t offset = sizeof(CheckpointHeader);
+    auto place = [&](CheckpointSection& section, uint64_t count, uint64_t bytes) {
+        offset = align8(offset);
+        section = CheckpointSection{offset, count};
+        offset += bytes;
+    };
+    place(header.strings, strings_.size(), strings_.size() * sizeof(CheckpointString));
+    place(header.string_data, string_data_.size(), string_data_.size());
+    place(header.threads, image.threads.size(), image.threads.size() * sizeof(CheckpointThread));
+    place(header.fd_tables, image.fd_tables.size(), image.fd_tables.size() * sizeof(CheckpointFdTable));
+    place(header.fds, image.fds.size(), image.fds.size() * sizeof(CheckpointFd));
+
+    // The header goes last, once the checksum is known
+    bool ok = lseek(fd, sizeof(CheckpointHeader), SEEK_SET) >= 0;
+    FileWriter out(fd);
+    out.pad_to(header.strings.offset);
+    out.emit_records(strings_);
+    out.pad_to(header.string_data.offset);
+    out.emit(string_data_.data(), string_data_.size());
+    out.pad_to(header.threads.offset);
+    out.emit_records(image.threads);
+    out.pad_to(header.fd_tables.offset);
+    out.emit_records(image.fd_tables);
+    out.pad_to(header.fds.offset);
+    out.emit_records(image.fds);
+    ok = out.finish() && ok;
+
+    header.checksum = out.hash();
+    ok = ok && pwrite(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp.c_str(), path_.c_str()) == 0;
+
+    if (!ok) {
+        LOG_WARNING("Cannot write checkpoint " << path_ << ": " << std::strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.last_bytes = offset;
+    return true;
+}
+
+core::Result<ProcScanStats> warm_start(const std::string& path, ThreadTable& table, ProcScanConfig config) {
+    auto checkpoint = Checkpoint::open(path);
+    if (checkpoint) {
+        const Checkpoint& loaded = *checkpoint.value();
+        // Without a boot id either side could be from any boot
+        std::string boot_id = read_boot_id(config.proc_root);
+        if (!boot_id.empty() && loaded.boot_id() == boot_id) {
+            loaded.restore(table);
+            config.reconcile = true;
+            LOG_INFO("Restored " << loaded.thread_count() << " threads from checkpoint " << path);
+        } else {
+            LOG_WARNING("Ignoring checkpoint " << path << " from another boot");
+        }
+    } else if (checkpoint.error() != core::ErrorCode::NotFound) {
+        LOG_WARNING("Ignoring unusable checkpoint " << path);
+    }
+
+    return ProcScanner(config).scan(table);
+}
+
+} // namespace sinsp
+} // namespace deepsys
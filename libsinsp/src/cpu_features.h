@@ -0,0 +1,27 @@
+#pragma once
+
+// Runtime CPU checks for the kernels that have a faster variant. Each is
+// resolved on first use; callers test a plain bool rather than call
+// through a pointer, which is cheaper for the short inputs they mostly see.
+
+namespace deepsys {
+namespace sinsp {
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DEEPSYS_X86 1
+
+inline bool cpu_has_avx2() {
+    static const bool has = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+    return has;
+}
+#else
+inline bool cpu_has_avx2() {
+    return false;
+}
+#endif
+
+} // namespace sinsp
+} // namespace deepsys
@@ -0,0 +1,44 @@
+/*
+ * Userspace build of the driver's event and flag tables.
+ *
+ * event_table.c includes ppm.h, which declares the driver's per-CPU state
+ * next to the tables; none of it is used by the tables themselves, but it
+ * has to parse. This file is force-included ahead of it and supplies the
+ * few kernel types and annotations it needs.
+ */
+
+#ifndef DRIVER_PRELUDE_H_
+#define DRIVER_PRELUDE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define __user
+#define __percpu
+
+typedef int pid_t;
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef struct {
+	int counter;
+} atomic_t;
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+struct work_struct {
+	unsigned long data;
+	struct list_head entry;
+	void (*func)(struct work_struct *work);
+};
+
+struct delayed_work {
+	struct work_struct work;
+	unsigned long expires;
+};
+
+#endif /* DRIVER_PRELUDE_H_ */
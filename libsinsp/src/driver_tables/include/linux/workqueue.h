@@ -0,0 +1,4 @@
+/*
+ * Kernel headers ppm.h includes that userspace doesn't have. The types it
+ * needs from them are in driver_prelude.h.
+ */
@@ -0,0 +1,89 @@
+#include "sinsp/event_table.h"
+
+#include <cstdint>
+
+extern "C" {
+#include "ppm_events_public.h"
+
+// Declared by ppm.h, which is kernel only
+extern const struct ppm_event_info g_event_info[];
+}
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+constexpr bool same(EventFlag ours, ppm_event_flags theirs) {
+    return static_cast<uint32_t>(ours) == static_cast<uint32_t>(theirs);
+}
+
+static_assert(same(EVENT_CREATES_FD, EF_CREATES_FD) && same(EVENT_DESTROYS_FD, EF_DESTROYS_FD) &&
+                  same(EVENT_USES_FD, EF_USES_FD) && same(EVENT_READS_FROM_FD, EF_READS_FROM_FD) &&
+                  same(EVENT_WRITES_TO_FD, EF_WRITES_TO_FD) && same(EVENT_MODIFIES_STATE, EF_MODIFIES_STATE) &&
+                  same(EVENT_UNUSED, EF_UNUSED) && same(EVENT_OLD_VERSION, EF_OLD_VERSION),
+              "EventFlag out of sync with the driver");
+static_assert(PPM_EVENT_MAX <= EventTypeSet::CAPACITY, "EventTypeSet too small for the event table");
+
+} // namespace
+
+size_t event_type_count() {
+    return PPM_EVENT_MAX;
+}
+
+const char* event_name(EventType type) {
+    return type < PPM_EVENT_MAX ? g_event_info[type].name : "unknown";
+}
+
+uint32_t event_flags(EventType type) {
+    return type < PPM_EVENT_MAX ? static_cast<uint32_t>(g_event_info[type].flags) : 0;
+}
+
+bool find_event_types(std::string_view name, std::vector<EventType>& out) {
+    bool found = false;
+    for (uint32_t type = 0; type < PPM_EVENT_MAX; ++type) {
+        if ((g_event_info[type].flags & EF_UNUSED) == 0 && name == g_event_info[type].name) {
+            out.push_back(static_cast<EventType>(type));
+            found = true;
+        }
+    }
+    return found;
+}
+
+EventTypeSet EventTypeSet::all() {
+    EventTypeSet set;
+    for (uint32_t type = 0; type < PPM_EVENT_MAX; ++type) {
+        set.bits_.set(type);
+    }
+    return set;
+}
+
+EventTypeSet EventTypeSet::with_flags(uint32_t flags) {
+    EventTypeSet set;
+    for (uint32_t type = 0; type < PPM_EVENT_MAX; ++type) {
+        if (g_event_info[type].flags & flags) {
+            set.bits_.set(type);
+        }
+    }
+    return set;
+}
+
+EventTypeSet EventTypeSet::complement() const {
+    EventTypeSet set = all();
+    set.bits_ &= ~bits_;
+    return set;
+}
+
+std::vector<EventType> EventTypeSet::types() const {
+    std::vector<EventType> out;
+    out.reserve(count());
+    for (uint32_t type = 0; type < CAPACITY; ++type) {
+        if (bits_.test(type)) {
+            out.push_back(static_cast<EventType>(type));
+        }
+    }
+    return out;
+}
+
+} // namespace sinsp
+} // namespace deepsys
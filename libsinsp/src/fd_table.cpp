@@ -0,0 +1,289 @@
+#include "sinsp/fd_table.h"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+constexpr size_t MIN_DENSE = 16;
+constexpr size_t MIN_SPARSE = 16;
+
+bool over_load_factor(size_t size, size_t capacity) {
+    return size * 10 >= capacity * 7;
+}
+
+std::string format_endpoint(int family, const std::array<uint8_t, 16>& addr, uint16_t port) {
+    char buf[INET6_ADDRSTRLEN];
+    if (!inet_ntop(family, addr.data(), buf, sizeof(buf))) {
+        return "?";
+    }
+    std::string out = family == AF_INET6 ? "[" + std::string(buf) + "]" : std::string(buf);
+    return out + ":" + std::to_string(port);
+}
+
+} // namespace
+
+const char* fd_type_to_string(FdType type) {
+    switch (type) {
+        case FdType::None: return "none";
+        case FdType::Unknown: return "unknown";
+        case FdType::File: return "file";
+        case FdType::Directory: return "directory";
+        case FdType::IPv4Socket: return "ipv4";
+        case FdType::IPv6Socket: return "ipv6";
+        case FdType::UnixSocket: return "unix";
+        case FdType::NetlinkSocket: return "netlink";
+        case FdType::Pipe: return "pipe";
+        case FdType::EventFd: return "eventfd";
+        case FdType::SignalFd: return "signalfd";
+        case FdType::EventPoll: return "eventpoll";
+        case FdType::Inotify: return "inotify";
+        case FdType::TimerFd: return "timerfd";
+    }
+    return "unknown";
+}
+
+std::string format_fd(const FdInfo& info) {
+    std::string_view name = core::StringPool::instance().get(info.name);
+
+    switch (info.type) {
+        case FdType::File:
+        case FdType::Directory:
+            return std::string(name);
+        case FdType::IPv4Socket:
+        case FdType::IPv6Socket: {
+            int family = info.type == FdType::IPv4Socket ? AF_INET : AF_INET6;
+            return format_endpoint(family, info.sip, info.sport) + "->" +
+                   format_endpoint(family, info.dip, info.dport);
+        }
+        case FdType::UnixSocket:
+            if (!name.empty()) {
+                return std::string(name);
+            }
+            break;
+        default:
+            break;
+    }
+
+    return std::string(fd_type_to_string(info.type)) + ":[" + std::to_string(info.ino) + "]";
+}
+
+FdTable::~FdTable() {
+    clear();
+}
+
+FdTable::FdTable(FdTable&& other) noexcept
+    : dense_(std::move(other.dense_)),
+      sparse_(std::move(other.sparse_)),
+      sparse_mask_(std::exchange(other.sparse_mask_, 0)),
+      sparse_shift_(std::exchange(other.sparse_shift_, 0)),
+      sparse_size_(std::exchange(other.sparse_size_, 0)),
+      size_(std::exchange(other.size_, 0)) {
+    other.dense_.clear();
+    other.sparse_.clear();
+}
+
+FdTable& FdTable::operator=(FdTable&& other) noexcept {
+    if (this != &other) {
+        clear();
+        dense_.swap(other.dense_);
+        sparse_.swap(other.sparse_);
+        std::swap(sparse_mask_, other.sparse_mask_);
+        std::swap(sparse_shift_, other.sparse_shift_);
+        std::swap(sparse_size_, other.sparse_size_);
+        std::swap(size_, other.size_);
+    }
+    return *this;
+}
+
+size_t FdTable::sparse_home(core::FileDescriptor fd) const {
+    return static_cast<size_t>((static_cast<uint64_t>(fd) * 0x9e3779b97f4a7c15ULL) >> sparse_shift_);
+}
+
+size_t FdTable::sparse_find_slot(core::FileDescriptor fd) const {
+    for (size_t i = sparse_home(fd);; i = (i + 1) & sparse_mask_) {
+        const SparseSlot& slot = sparse_[i];
+        if (slot.fd == fd || slot.fd == EMPTY_FD) {
+            return i;
+        }
+    }
+}
+
+FdInfo* FdTable::find(core::FileDescriptor fd) {
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    if (fd < DENSE_LIMIT) {
+        if (static_cast<size_t>(fd) >= dense_.size() || dense_[fd].type == FdType::None) {
+            return nullptr;
+        }
+        return &dense_[fd];
+    }
+
+    if (sparse_size_ == 0) {
+        return nullptr;
+    }
+    SparseSlot& slot = sparse_[sparse_find_slot(fd)];
+    return slot.fd == EMPTY_FD ? nullptr : &slot.info;
+}
+
+const FdInfo* FdTable::find(core::FileDescriptor fd) const {
+    return const_cast<FdTable*>(this)->find(fd);
+}
+
+FdInfo* FdTable::add(core::FileDescriptor fd, FdType type) {
+    if (fd < 0 || type == FdType::None) {
+        return nullptr;
+    }
+
+    FdInfo* info;
+    if (fd < DENSE_LIMIT) {
+        size_t needed = static_cast<size_t>(fd) + 1;
+        if (needed > dense_.size()) {
+            size_t capacity = std::max(dense_.size(), MIN_DENSE);
+            while (capacity < needed) {
+                capacity *= 2;
+            }
+            dense_.resize(std::min(capacity, static_cast<size_t>(DENSE_LIMIT)));
+        }
+        info = &dense_[fd];
+    } else {
+        if (sparse_.empty() || over_load_factor(sparse_size_ + 1, sparse_.size())) {
+            sparse_grow();
+        }
+        SparseSlot& slot = sparse_[sparse_find_slot(fd)];
+        if (slot.fd == EMPTY_FD) {
+            slot.fd = fd;
+            slot.info = FdInfo{};
+            ++sparse_size_;
+        }
+        info = &slot.info;
+    }
+
+    if (info->type == FdType::None) {
+        ++size_;
+    } else {
+        core::StringPool::instance().release(info->name);
+    }
+
+    *info = FdInfo{};
+    info->type = type;
+    return info;
+}
+
+bool FdTable::erase(core::FileDescriptor fd) {
+    if (fd < 0) {
+        return false;
+    }
+
+    if (fd < DENSE_LIMIT) {
+        if (static_cast<size_t>(fd) >= dense_.size() || dense_[fd].type == FdType::None) {
+            return false;
+        }
+        core::StringPool::instance().release(dense_[fd].name);
+        dense_[fd] = FdInfo{};
+        --size_;
+        return true;
+    }
+
+    if (sparse_size_ == 0) {
+        return false;
+    }
+
+    size_t i = sparse_find_slot(fd);
+    if (sparse_[i].fd == EMPTY_FD) {
+        return false;
+    }
+
+    core::StringPool::instance().release(sparse_[i].info.name);
+    --sparse_size_;
+    --size_;
+
+    // Backward shift, see ThreadTable::erase
+    size_t hole = i;
+    for (size_t j = (i + 1) & sparse_mask_; sparse_[j].fd != EMPTY_FD; j = (j + 1) & sparse_mask_) {
+        size_t h = sparse_home(sparse_[j].fd);
+        if (((j - h) & sparse_mask_) >= ((j - hole) & sparse_mask_)) {
+            sparse_[hole] = sparse_[j];
+            hole = j;
+        }
+    }
+    sparse_[hole].fd = EMPTY_FD;
+
+    return true;
+}
+
+void FdTable::clear() {
+    // Keeps the storage, a process that closes everything (exec with
+    // O_CLOEXEC fds) usually opens as many again
+    core::StringPool& pool = core::StringPool::instance();
+    for_each([&](core::FileDescriptor, const FdInfo& info) { pool.release(info.name); });
+
+    std::fill(dense_.begin(), dense_.end(), FdInfo{});
+    for (SparseSlot& slot : sparse_) {
+        slot.fd = EMPTY_FD;
+    }
+    sparse_size_ = 0;
+    size_ = 0;
+}
+
+void FdTable::shrink_to_fit() {
+    size_t used = dense_.size();
+    while (used > 0 && dense_[used - 1].type == FdType::None) {
+        --used;
+    }
+    size_t capacity = used == 0 ? 0 : MIN_DENSE;
+    while (capacity < used) {
+        capacity *= 2;
+    }
+    if (capacity < dense_.size()) {
+        dense_.resize(capacity);
+        dense_.shrink_to_fit();
+    }
+
+    if (sparse_size_ == 0) {
+        std::vector<SparseSlot>().swap(sparse_);
+        sparse_mask_ = 0;
+        sparse_shift_ = 0;
+        return;
+    }
+    capacity = MIN_SPARSE;
+    while (over_load_factor(sparse_size_, capacity)) {
+        capacity *= 2;
+    }
+    if (capacity < sparse_.size()) {
+        sparse_rehash(capacity);
+    }
+}
+
+void FdTable::sparse_grow() {
+    sparse_rehash(sparse_.empty() ? MIN_SPARSE : sparse_.size() * 2);
+}
+
+void FdTable::sparse_rehash(size_t capacity) {
+    std::vector<SparseSlot> old;
+    old.swap(sparse_);
+
+    sparse_.assign(capacity, SparseSlot{EMPTY_FD, FdInfo{}});
+    sparse_mask_ = capacity - 1;
+    sparse_shift_ = 64 - static_cast<uint32_t>(__builtin_ctzll(capacity));
+
+    for (const SparseSlot& slot : old) {
+        if (slot.fd != EMPTY_FD) {
+            sparse_[sparse_find_slot(slot.fd)] = slot;
+        }
+    }
+}
+
+size_t FdTable::memory_usage() const {
+    return dense_.capacity() * sizeof(FdInfo) + sparse_.capacity() * sizeof(SparseSlot);
+}
+
+} // namespace sinsp
+} // namespace deepsys
@@ -0,0 +1,257 @@
+#include "sinsp/filter.h"
+
+#include <sinsp/filter_cache.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+// Plain data, so the register file costs nothing to set up
+struct Register {
+    int64_t num;
+    const char* str;
+    size_t size;
+};
+
+const char* op_name(FilterOp op) {
+    switch (op) {
+        case FilterOp::LoadInt: return "load.int";
+        case FilterOp::LoadString: return "load.str";
+        case FilterOp::LoadAddr: return "load.addr";
+        case FilterOp::IntEq: return "int.eq";
+        case FilterOp::IntNe: return "int.ne";
+        case FilterOp::IntLt: return "int.lt";
+        case FilterOp::IntLe: return "int.le";
+        case FilterOp::IntGt: return "int.gt";
+        case FilterOp::IntGe: return "int.ge";
+        case FilterOp::IntIn: return "int.in";
+        case FilterOp::StrEq: return "str.eq";
+        case FilterOp::StrNe: return "str.ne";
+        case FilterOp::StrContains: return "str.contains";
+        case FilterOp::StrIContains: return "str.icontains";
+        case FilterOp::StrStartsWith: return "str.startswith";
+        case FilterOp::StrEndsWith: return "str.endswith";
+        case FilterOp::StrGlob: return "str.glob";
+        case FilterOp::StrIn: return "str.in";
+        case FilterOp::StrPMatch: return "str.pmatch";
+        case FilterOp::StrContainsAny: return "str.contains_any";
+        case FilterOp::AddrIn: return "addr.in";
+        case FilterOp::AddrNotIn: return "addr.notin";
+        case FilterOp::Exists: return "exists";
+        case FilterOp::Not: return "not";
+        case FilterOp::JumpIfFalse: return "jump.false";
+        case FilterOp::JumpIfTrue: return "jump.true";
+        case FilterOp::Return: return "ret";
+    }
+    return "?";
+}
+
+} // namespace
+
+bool FilterProgram::run(FieldCache& fields) const {
+    if (code_.empty()) {
+        return true;
+    }
+
+    Register regs[MAX_REGISTERS];
+    uint64_t loaded = 0;
+    uint64_t present = 0;
+    bool flag = false;
+
+    const FilterInstr* code = code_.data();
+    for (uint32_t pc = 0;; ++pc) {
+        const FilterInstr& in = code[pc];
+        Register& reg = regs[in.reg];
+        bool has = (present >> in.reg) & 1;
+        // Only for string comparisons, and only once has says it's loaded
+        auto str = [&reg] { return std::string_view(reg.str, reg.size); };
+
+        switch (in.op) {
+            case FilterOp::LoadInt:
+                if (!((loaded >> in.reg) & 1)) {
+                    loaded |= uint64_t(1) << in.reg;
+                    if (fields.get_int(in.field, reg.num)) {
+                        present |= uint64_t(1) << in.reg;
+                    }
+                }
+                break;
+            case FilterOp::LoadString:
+                if (!((loaded >> in.reg) & 1)) {
+                    loaded |= uint64_t(1) << in.reg;
+                    std::string_view value;
+                    if (fields.get_string(in.field, value)) {
+                        reg.str = value.data();
+                        reg.size = value.size();
+                        present |= uint64_t(1) << in.reg;
+                    }
+                }
+                break;
+            case FilterOp::LoadAddr:
+                if (!((loaded >> in.reg) & 1)) {
+                    loaded |= uint64_t(1) << in.reg;
+                    const uint8_t* addr;
+                    if (fields.get_addr(in.field, addr, reg.size)) {
+                        reg.str = reinterpret_cast<const char*>(addr);
+                        present |= uint64_t(1) << in.reg;
+                    }
+                }
+                break;
+            case FilterOp::IntEq: flag = has && reg.num == ints_[in.arg]; break;
+            case FilterOp::IntNe: flag = has && reg.num != ints_[in.arg]; break;
+            case FilterOp::IntLt: flag = has && reg.num < ints_[in.arg]; break;
+            case FilterOp::IntLe: flag = has && reg.num <= ints_[in.arg]; break;
+            case FilterOp::IntGt: flag = has && reg.num > ints_[in.arg]; break;
+            case FilterOp::IntGe: flag = has && reg.num >= ints_[in.arg]; break;
+            case FilterOp::IntIn: {
+                const int64_t* first = ints_.data() + sets_[in.arg].first;
+                flag = has && std::binary_search(first, first + sets_[in.arg].count, reg.num);
+                break;
+            }
+            case FilterOp::StrEq: flag = has && str() == string(in.arg); break;
+            case FilterOp::StrNe: flag = has && str() != string(in.arg); break;
+            case FilterOp::StrContains: flag = has && contains(str(), string(in.arg)); break;
+            case FilterOp::StrIContains: flag = has && icontains(str(), string(in.arg)); break;
+            case FilterOp::StrStartsWith: flag = has && str().substr(0, string(in.arg).size()) == string(in.arg); break;
+            case FilterOp::StrEndsWith: {
+                std::string_view suffix = string(in.arg);
+                flag = has && str().size() >= suffix.size() && str().substr(str().size() - suffix.size()) == suffix;
+                break;
+            }
+            case FilterOp::StrGlob: flag = has && globs_[in.arg].match(str()); break;
+            case FilterOp::StrIn: flag = has && string_sets_[in.arg].contains(str()); break;
+            case FilterOp::StrPMatch: flag = has && prefix_sets_[in.arg].match(str()); break;
+            case FilterOp::StrContainsAny: flag = has && automata_[in.arg].search(str()); break;
+            case FilterOp::AddrIn:
+                flag = has && networks_[in.arg].contains(reinterpret_cast<const uint8_t*>(reg.str), reg.size);
+                break;
+            case FilterOp::AddrNotIn:
+                flag = has && !networks_[in.arg].contains(reinterpret_cast<const uint8_t*>(reg.str), reg.size);
+                break;
+            case FilterOp::Exists: flag = has; break;
+            case FilterOp::Not: flag = !flag; break;
+            case FilterOp::JumpIfFalse:
+                if (!flag) {
+                    pc = in.arg - 1;
+                }
+                break;
+            case FilterOp::JumpIfTrue:
+                if (flag) {
+                    pc = in.arg - 1;
+                }
+                break;
+            case FilterOp::Return:
+                return flag;
+        }
+    }
+}
+
+std::string FilterProgram::disassemble() const {
+    std::string out;
+    char line[64];
+    for (size_t pc = 0; pc < code_.size(); ++pc) {
+        const FilterInstr& in = code_[pc];
+        std::snprintf(line, sizeof(line), "%3zu  %-15s", pc, op_name(in.op));
+        out += line;
+
+        switch (in.op) {
+            case FilterOp::LoadInt:
+            case FilterOp::LoadString:
+            case FilterOp::LoadAddr:
+                out += "r" + std::to_string(in.reg) + ", " + field_info(in.field).name;
+                break;
+            case FilterOp::IntEq:
+            case FilterOp::IntNe:
+            case FilterOp::IntLt:
+            case FilterOp::IntLe:
+            case FilterOp::IntGt:
+            case FilterOp::IntGe:
+                out += "r" + std::to_string(in.reg) + ", " + std::to_string(ints_[in.arg]);
+                break;
+            case FilterOp::IntIn:
+                out += "r" + std::to_string(in.reg) + ", set " + std::to_string(in.arg) + " (" +
+                       std::to_string(sets_[in.arg].count) + ")";
+                break;
+            case FilterOp::StrIn:
+                out += "r" + std::to_string(in.reg) + ", set " + std::to_string(in.arg) + " (" +
+                       std::to_string(string_sets_[in.arg].size()) + ")";
+                break;
+            case FilterOp::StrPMatch:
+                out += "r" + std::to_string(in.reg) + ", prefixes " + std::to_string(in.arg) + " (" +
+                       std::to_string(prefix_sets_[in.arg].size()) + ")";
+                break;
+            case FilterOp::StrContainsAny:
+                out += "r" + std::to_string(in.reg) + ", automaton " + std::to_string(in.arg) + " (" +
+                       std::to_string(automata_[in.arg].size()) + ")";
+                break;
+            case FilterOp::AddrIn:
+            case FilterOp::AddrNotIn:
+                out += "r" + std::to_string(in.reg) + ", networks " + std::to_string(in.arg) + " (" +
+                       std::to_string(networks_[in.arg].size()) + ")";
+                break;
+            case FilterOp::StrGlob:
+                out += "r" + std::to_string(in.reg) + ", \"" + globs_[in.arg].pattern() + "\"";
+                break;
+            case FilterOp::StrEq:
+            case FilterOp::StrNe:
+            case FilterOp::StrContains:
+            case FilterOp::StrIContains:
+            case FilterOp::StrStartsWith:
+            case FilterOp::StrEndsWith:
+                out += "r" + std::to_string(in.reg) + ", \"" + std::string(string(in.arg)) + "\"";
+                break;
+            case FilterOp::Exists:
+                out += "r" + std::to_string(in.reg);
+                break;
+            case FilterOp::JumpIfFalse:
+            case FilterOp::JumpIfTrue:
+                out += std::to_string(in.arg);
+                break;
+            case FilterOp::Not:
+            case FilterOp::Return:
+                break;
+        }
+        while (!out.empty() && out.back() == ' ') {
+            out.pop_back();
+        }
+        out += '\n';
+    }
+    return out;
+}
+
+core::Result<Filter> Filter::compile(std::string_view expression) {
+    Filter filter;
+    filter.expression_ = std::string(expression);
+    if (expression.find_first_not_of(" \t\r\n") == std::string_view::npos) {
+        return filter;
+    }
+
+    auto compiled = FilterCache::instance().get(expression);
+    if (!compiled) {
+        return compiled.error();
+    }
+    filter.compiled_ = std::move(compiled.value());
+    return filter;
+}
+
+const std::shared_ptr<const CompiledFilter>& Filter::match_everything() {
+    static const std::shared_ptr<const CompiledFilter> everything = std::make_shared<const CompiledFilter>();
+    return everything;
+}
+
+EventTypeSet Filter::capture_event_types() const {
+    EventTypeSet types = compiled_->event_types;
+    types |= EventTypeSet::with_flags(EVENT_MODIFIES_STATE);
+    return types;
+}
+
+core::Result<void> apply_event_mask(scap::IScapEngine& engine, const Filter& filter) {
+    return engine.set_event_mask(filter.capture_event_types().types());
+}
+
+} // namespace sinsp
+} // namespace deepsys
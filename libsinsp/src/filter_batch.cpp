@@ -0,0 +1,264 @@
+#include "sinsp/filter.h"
+
+#include "cpu_features.h"
+
+#ifdef DEEPSYS_X86
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+// Events per block, one per bit of a mask
+constexpr size_t LANES = 64;
+
+// Up to this many values, "in" on a number is a compare per value over the
+// whole column rather than a binary search per lane
+constexpr uint32_t SMALL_SET = 8;
+
+uint64_t bit(size_t lane) {
+    return uint64_t(1) << lane;
+}
+
+// Lanes of a column equal to and greater than a value; the six orderings
+// all derive from these two
+struct Compare {
+    uint64_t eq;
+    uint64_t gt;
+};
+
+Compare compare_scalar(const int64_t* column, int64_t value) {
+    Compare out{0, 0};
+    for (size_t i = 0; i < LANES; ++i) {
+        out.eq |= uint64_t(column[i] == value) << i;
+        out.gt |= uint64_t(column[i] > value) << i;
+    }
+    return out;
+}
+
+#ifdef DEEPSYS_X86
+
+__attribute__((target("avx2")))
+Compare compare_avx2(const int64_t* column, int64_t value) {
+    const __m256i v = _mm256_set1_epi64x(value);
+    Compare out{0, 0};
+    for (size_t i = 0; i < LANES; i += 4) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(column + i));
+        uint64_t eq = static_cast<uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(x, v))));
+        uint64_t gt = static_cast<uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, v))));
+        out.eq |= eq << i;
+        out.gt |= gt << i;
+    }
+    return out;
+}
+
+const bool HAS_AVX2 = cpu_has_avx2();
+
+#endif
+
+Compare compare(const int64_t* column, int64_t value) {
+#ifdef DEEPSYS_X86
+    if (HAS_AVX2) {
+        return compare_avx2(column, value);
+    }
+#endif
+    return compare_scalar(column, value);
+}
+
+uint64_t select(FilterOp op, Compare c) {
+    switch (op) {
+        case FilterOp::IntEq: return c.eq;
+        case FilterOp::IntNe: return ~c.eq;
+        case FilterOp::IntLt: return ~(c.eq | c.gt);
+        case FilterOp::IntLe: return ~c.gt;
+        case FilterOp::IntGt: return c.gt;
+        case FilterOp::IntGe: return c.eq | c.gt;
+        default: return 0;
+    }
+}
+
+// The lanes of mask for which pred(lane) holds
+template<typename Pred>
+uint64_t lanes_where(uint64_t mask, Pred&& pred) {
+    uint64_t out = 0;
+    for (; mask; mask &= mask - 1) {
+        size_t lane = static_cast<size_t>(__builtin_ctzll(mask));
+        if (pred(lane)) {
+            out |= bit(lane);
+        }
+    }
+    return out;
+}
+
+} // namespace
+
+void FilterProgram::run_batch(const FilterEvent* events, size_t count, uint64_t* out) const {
+    auto lanes_of = [count](size_t base) {
+        size_t lanes = std::min(LANES, count - base);
+        return lanes == LANES ? ~uint64_t(0) : bit(lanes) - 1;
+    };
+    if (code_.empty()) {
+        for (size_t base = 0; base < count; base += LANES) {
+            out[base / LANES] = lanes_of(base);
+        }
+        return;
+    }
+
+    // A column per register, reused by every block; zeroed once, so lanes
+    // that were never loaded compare against stale but defined values and
+    // are masked out
+    std::vector<int64_t> nums(registers_ * LANES);
+    std::vector<std::string_view> strs(registers_ * LANES);
+    std::vector<uint64_t> pending(code_.size() + 1);   // Lanes parked until they reach pc
+    uint64_t loaded[MAX_REGISTERS];
+    uint64_t present[MAX_REGISTERS];
+
+    for (size_t base = 0; base < count; base += LANES) {
+        const FilterEvent* block = events + base;
+        uint64_t active = lanes_of(base);
+        uint64_t flag = 0;
+        std::fill_n(loaded, registers_, 0);
+        std::fill_n(present, registers_, 0);
+        std::fill(pending.begin(), pending.end(), 0);
+
+        uint32_t pc = 0;
+        for (; code_[pc].op != FilterOp::Return; ++pc) {
+            active |= pending[pc];
+            const FilterInstr& in = code_[pc];
+            int64_t* num = nums.data() + in.reg * LANES;
+            std::string_view* str = strs.data() + in.reg * LANES;
+            uint64_t has = present[in.reg] & active;
+            uint64_t result = 0;
+
+            switch (in.op) {
+                case FilterOp::LoadInt:
+                case FilterOp::LoadString:
+                case FilterOp::LoadAddr: {
+                    uint64_t need = active & ~loaded[in.reg];
+                    loaded[in.reg] |= need;
+                    present[in.reg] |= lanes_where(need, [&](size_t i) {
+                        if (in.op == FilterOp::LoadInt) {
+                            return extract_int(in.field, block[i], num[i]);
+                        }
+                        if (in.op == FilterOp::LoadString) {
+                            return extract_string(in.field, block[i], str[i]);
+                        }
+                        const uint8_t* addr;
+                        size_t size;
+                        if (!extract_addr(in.field, block[i], addr, size)) {
+                            return false;
+                        }
+                        str[i] = std::string_view(reinterpret_cast<const char*>(addr), size);
+                        return true;
+                    });
+                    continue;
+                }
+                case FilterOp::IntEq:
+                case FilterOp::IntNe:
+                case FilterOp::IntLt:
+                case FilterOp::IntLe:
+                case FilterOp::IntGt:
+                case FilterOp::IntGe:
+                    result = has ? select(in.op, compare(num, ints_[in.arg])) & has : 0;
+                    break;
+                case FilterOp::IntIn: {
+                    const int64_t* first = ints_.data() + sets_[in.arg].first;
+                    uint32_t size = sets_[in.arg].count;
+                    if (!has) {
+                        break;
+                    }
+                    if (size <= SMALL_SET) {
+                        for (uint32_t k = 0; k < size; ++k) {
+                            result |= compare(num, first[k]).eq;
+                        }
+                        result &= has;
+                    } else {
+                        result = lanes_where(has, [&](size_t i) {
+                            return std::binary_search(first, first + size, num[i]);
+                        });
+                    }
+                    break;
+                }
+                case FilterOp::StrEq:
+                    result = lanes_where(has, [&](size_t i) { return str[i] == string(in.arg); });
+                    break;
+                case FilterOp::StrNe:
+                    result = lanes_where(has, [&](size_t i) { return str[i] != string(in.arg); });
+                    break;
+                case FilterOp::StrContains:
+                    result = lanes_where(has, [&](size_t i) { return contains(str[i], string(in.arg)); });
+                    break;
+                case FilterOp::StrIContains:
+                    result = lanes_where(has, [&](size_t i) { return icontains(str[i], string(in.arg)); });
+                    break;
+                case FilterOp::StrStartsWith:
+                    result = lanes_where(has, [&](size_t i) {
+                        return str[i].substr(0, string(in.arg).size()) == string(in.arg);
+                    });
+                    break;
+                case FilterOp::StrEndsWith:
+                    result = lanes_where(has, [&](size_t i) {
+                        std::string_view suffix = string(in.arg);
+                        return str[i].size() >= suffix.size() &&
+                               str[i].substr(str[i].size() - suffix.size()) == suffix;
+                    });
+                    break;
+                case FilterOp::StrGlob:
+                    result = lanes_where(has, [&](size_t i) { return globs_[in.arg].match(str[i]); });
+                    break;
+                case FilterOp::StrIn:
+                    result = lanes_where(has, [&](size_t i) { return string_sets_[in.arg].contains(str[i]); });
+                    break;
+                case FilterOp::StrPMatch:
+                    result = lanes_where(has, [&](size_t i) { return prefix_sets_[in.arg].match(str[i]); });
+                    break;
+                case FilterOp::StrContainsAny:
+                    result = lanes_where(has, [&](size_t i) { return automata_[in.arg].search(str[i]); });
+                    break;
+                case FilterOp::AddrIn:
+                case FilterOp::AddrNotIn: {
+                    bool want = in.op == FilterOp::AddrIn;
+                    result = lanes_where(has, [&](size_t i) {
+                        return networks_[in.arg].contains(reinterpret_cast<const uint8_t*>(str[i].data()),
+                                                          str[i].size()) == want;
+                    });
+                    break;
+                }
+                case FilterOp::Exists:
+                    result = has;
+                    break;
+                case FilterOp::Not:
+                    result = ~flag;
+                    break;
+                case FilterOp::JumpIfFalse:
+                case FilterOp::JumpIfTrue: {
+                    // Lanes the jump takes keep their flag and wait at the
+                    // target; with none left, skip to the nearest target
+                    uint64_t taken = active & (in.op == FilterOp::JumpIfTrue ? flag : ~flag);
+                    pending[in.arg] |= taken;
+                    active &= ~taken;
+                    if (!active) {
+                        while (!pending[pc + 1]) {
+                            ++pc;
+                        }
+                    }
+                    continue;
+                }
+                case FilterOp::Return:
+                    break;
+            }
+            // Only the active lanes take the result; parked ones keep theirs
+            flag = (flag & ~active) | (result & active);
+        }
+        out[base / LANES] = flag & lanes_of(base);
+    }
+}
+
+} // namespace sinsp
+} // namespace deepsys
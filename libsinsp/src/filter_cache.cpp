@@ -0,0 +1,135 @@
+#include "sinsp/filter_cache.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+core::Result<std::shared_ptr<const CompiledFilter>> compile(const FilterNode& root, std::string normalized) {
+    auto program = FilterCompiler::compile(root);
+    if (!program) {
+        return program.error();
+    }
+    auto compiled = std::make_shared<CompiledFilter>();
+    compiled->normalized = std::move(normalized);
+    compiled->program = std::move(program.value());
+    compiled->event_types = filter_event_types(root);
+    return std::shared_ptr<const CompiledFilter>(std::move(compiled));
+}
+
+} // namespace
+
+FilterCache& FilterCache::instance() {
+    static FilterCache instance;
+    return instance;
+}
+
+core::Result<std::shared_ptr<const CompiledFilter>> FilterCache::get(std::string_view expression) {
+    if (auto found = find(expression, std::string())) {
+        return found;
+    }
+
+    auto root = parse_filter(expression);
+    if (!root) {
+        return root.error();
+    }
+    std::string normalized = to_string(*root.value());
+    if (auto found = find(expression, normalized)) {
+        return found;
+    }
+
+    auto compiled = compile(*root.value(), std::move(normalized));
+    if (!compiled) {
+        return compiled.error();
+    }
+    return insert(expression, std::move(compiled.value()));
+}
+
+core::Result<std::shared_ptr<const CompiledFilter>> FilterCache::get(const FilterNode& root) {
+    std::string normalized = to_string(root);
+    if (auto found = find(normalized, normalized)) {
+        return found;
+    }
+    auto compiled = compile(root, std::move(normalized));
+    if (!compiled) {
+        return compiled.error();
+    }
+    std::shared_ptr<const CompiledFilter> program = std::move(compiled.value());
+    std::string_view text = program->normalized;
+    return insert(text, std::move(program));
+}
+
+// By text as written, and by normalized form when given, which then also
+// remembers text as a spelling of it
+std::shared_ptr<const CompiledFilter> FilterCache::find(std::string_view text, const std::string& normalized) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = by_text_.find(std::string(text));
+    if (it != by_text_.end()) {
+        if (auto compiled = it->second.lock()) {
+            ++hits_;
+            return compiled;
+        }
+    }
+    if (normalized.empty()) {
+        return nullptr;
+    }
+    auto canonical = by_normalized_.find(normalized);
+    if (canonical == by_normalized_.end()) {
+        return nullptr;
+    }
+    auto compiled = canonical->second.lock();
+    if (compiled) {
+        ++hits_;
+        by_text_[std::string(text)] = compiled;
+    }
+    return compiled;
+}
+
+std::shared_ptr<const CompiledFilter> FilterCache::insert(std::string_view text,
+                                                          std::shared_ptr<const CompiledFilter> compiled) {
+    // text may be compiled's own normalized form, which is dropped below
+    // when another thread got there first
+    std::string key(text);
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry& canonical = by_normalized_[compiled->normalized];
+    if (auto existing = canonical.lock()) {
+        // Another thread compiled it meanwhile
+        ++hits_;
+        compiled = std::move(existing);
+    } else {
+        ++misses_;
+        canonical = compiled;
+    }
+    by_text_[std::move(key)] = compiled;
+
+    if (by_text_.size() + by_normalized_.size() >= sweep_at_) {
+        sweep();
+    }
+    return compiled;
+}
+
+void FilterCache::sweep() {
+    for (auto* map : {&by_text_, &by_normalized_}) {
+        for (auto it = map->begin(); it != map->end();) {
+            it = it->second.expired() ? map->erase(it) : std::next(it);
+        }
+    }
+    sweep_at_ = std::max(SWEEP_MIN, 2 * (by_text_.size() + by_normalized_.size()));
+}
+
+FilterCache::Stats FilterCache::get_stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    for (const auto& entry : by_normalized_) {
+        stats.live += !entry.second.expired();
+    }
+    return stats;
+}
+
+} // namespace sinsp
+} // namespace deepsys
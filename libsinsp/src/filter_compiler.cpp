@@ -0,0 +1,465 @@
+#include "sinsp/filter.h"
+
+#include <core/logger.h>
+#include <sinsp/event_table.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <utility>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+// False for anything but a decimal or 0x number in int64 range, with range
+// telling which
+bool parse_int(std::string_view text, int64_t& out, bool& range) {
+    range = true;
+    bool negative = !text.empty() && text[0] == '-';
+    std::string_view digits = negative ? text.substr(1) : text;
+    int base = 10;
+    if (digits.size() > 2 && digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+        digits.remove_prefix(2);
+        base = 16;
+    }
+    uint64_t value = 0;
+    auto result = std::from_chars(digits.data(), digits.data() + digits.size(), value, base);
+    if (digits.empty() || result.ptr != digits.data() + digits.size()) {
+        return false;
+    }
+    // INT64_MIN is built without negating it
+    constexpr uint64_t MAX = static_cast<uint64_t>(INT64_MAX);
+    if (result.ec != std::errc() || value > MAX + (negative ? 1 : 0)) {
+        return range = false;
+    }
+    out = !negative ? static_cast<int64_t>(value) : value == MAX + 1 ? INT64_MIN : -static_cast<int64_t>(value);
+    return true;
+}
+
+bool is_jump(FilterOp op) {
+    return op == FilterOp::JumpIfFalse || op == FilterOp::JumpIfTrue;
+}
+
+void fail(const FilterNode& node, const char* message) {
+    LOG_WARNING("Invalid filter at \"" << to_string(node) << "\": " << message);
+}
+
+// The values of a comparison on a numeric field. Event types may be given
+// by name, and a name stands for all of its types: entry, exit and older
+// versions; named tells whether any was.
+bool resolve_ints(const FilterNode& node, std::vector<int64_t>& values, bool& named, bool log) {
+    named = false;
+    for (const std::string& text : node.values) {
+        int64_t value;
+        bool range;
+        if (parse_int(text, value, range)) {
+            values.push_back(value);
+            continue;
+        }
+        if (!range) {
+            if (log) {
+                fail(node, "number out of range");
+            }
+            return false;
+        }
+        std::vector<EventType> types;
+        if (node.field != FieldId::EvtType || !find_event_types(text, types)) {
+            if (log) {
+                fail(node, node.field == FieldId::EvtType ? "unknown event type" : "expected a number");
+            }
+            return false;
+        }
+        values.insert(values.end(), types.begin(), types.end());
+        named = true;
+    }
+    return true;
+}
+
+// What event types make a comparison on evt.type true, exactly
+EventTypeSet event_type_compare(const FilterNode& node) {
+    std::vector<int64_t> values;
+    bool named;
+    if (!resolve_ints(node, values, named, false)) {
+        return EventTypeSet::all();
+    }
+
+    EventTypeSet set;
+    for (EventType type : EventTypeSet::all().types()) {
+        int64_t t = type;
+        bool match = false;
+        switch (node.op) {
+            case CompareOp::Eq:
+            case CompareOp::In: match = std::find(values.begin(), values.end(), t) != values.end(); break;
+            case CompareOp::Ne: match = std::find(values.begin(), values.end(), t) == values.end(); break;
+            case CompareOp::Lt: match = t < values[0]; break;
+            case CompareOp::Le: match = t <= values[0]; break;
+            case CompareOp::Gt: match = t > values[0]; break;
+            case CompareOp::Ge: match = t >= values[0]; break;
+            default: match = true; break;
+        }
+        if (match) {
+            set.set(type);
+        }
+    }
+    return set;
+}
+
+// The types for which node may be true and those for which it surely is,
+// both needed to see through a not
+struct TypeBounds {
+    EventTypeSet may;
+    EventTypeSet must;
+};
+
+TypeBounds type_bounds(const FilterNode& node) {
+    switch (node.kind) {
+        case FilterNode::Kind::And:
+        case FilterNode::Kind::Or: {
+            bool is_and = node.kind == FilterNode::Kind::And;
+            TypeBounds bounds = type_bounds(*node.children[0]);
+            for (size_t i = 1; i < node.children.size(); ++i) {
+                TypeBounds child = type_bounds(*node.children[i]);
+                if (is_and) {
+                    bounds.may &= child.may;
+                    bounds.must &= child.must;
+                } else {
+                    bounds.may |= child.may;
+                    bounds.must |= child.must;
+                }
+            }
+            return bounds;
+        }
+        case FilterNode::Kind::Not: {
+            TypeBounds child = type_bounds(*node.children[0]);
+            return {child.must.complement(), child.may.complement()};
+        }
+        case FilterNode::Kind::Compare:
+            break;
+    }
+
+    if (node.field == FieldId::EvtType) {
+        EventTypeSet exact = event_type_compare(node);
+        return {exact, exact};
+    }
+    // Otherwise it depends on the event, but a field only some events have
+    // is false on the others
+    uint32_t flags = field_info(node.field).event_flags;
+    return {flags ? EventTypeSet::with_flags(flags) : EventTypeSet::all(), EventTypeSet()};
+}
+
+} // namespace
+
+EventTypeSet filter_event_types(const FilterNode& root) {
+    return type_bounds(root).may;
+}
+
+core::Result<FilterProgram> FilterCompiler::compile(const FilterNode& root) {
+    FilterCompiler compiler;
+    if (!compiler.emit(root)) {
+        return core::ErrorCode::InvalidArgument;
+    }
+    compiler.emit_op(FilterOp::Return);
+    compiler.thread_jumps();
+    return std::move(compiler.program_);
+}
+
+bool FilterCompiler::emit(const FilterNode& node) {
+    switch (node.kind) {
+        case FilterNode::Kind::And:
+        case FilterNode::Kind::Or:
+            return emit_chain(node);
+        case FilterNode::Kind::Not:
+            if (!emit(*node.children[0])) {
+                return false;
+            }
+            emit_op(FilterOp::Not);
+            return true;
+        case FilterNode::Kind::Compare:
+            return emit_compare(node);
+    }
+    return false;
+}
+
+bool FilterCompiler::emit_chain(const FilterNode& node) {
+    bool is_or = node.kind == FilterNode::Kind::Or;
+
+    // Operands are single children, except that in an "or" enough contains
+    // tests on one field make a group, tested in one pass over the string
+    // where the first of them was
+    std::vector<std::vector<const FilterNode*>> operands;
+    std::array<size_t, FIELD_COUNT> contains{};
+    std::array<size_t, FIELD_COUNT> group;
+    group.fill(SIZE_MAX);
+    auto groupable = [](const FilterNode& child) {
+        return child.kind == FilterNode::Kind::Compare && child.op == CompareOp::Contains &&
+               field_info(child.field).type == FieldType::String;
+    };
+    if (is_or) {
+        for (const auto& child : node.children) {
+            if (groupable(*child)) {
+                ++contains[static_cast<size_t>(child->field)];
+            }
+        }
+    }
+    for (const auto& child : node.children) {
+        size_t field = static_cast<size_t>(child->field);
+        if (!is_or || !groupable(*child) || contains[field] < CONTAINS_ANY_MIN) {
+            operands.push_back({child.get()});
+            continue;
+        }
+        if (group[field] == SIZE_MAX) {
+            group[field] = operands.size();
+            operands.emplace_back();
+        }
+        operands[group[field]].push_back(child.get());
+    }
+
+    // Each operand but the last leaves the chain as soon as it decides it,
+    // with the flag already holding the outcome
+    FilterOp exit = is_or ? FilterOp::JumpIfTrue : FilterOp::JumpIfFalse;
+    std::vector<size_t> exits;
+    for (size_t i = 0; i < operands.size(); ++i) {
+        bool ok = operands[i].size() == 1 ? emit(*operands[i][0]) : emit_contains_any(operands[i]);
+        if (!ok) {
+            return false;
+        }
+        if (i + 1 < operands.size()) {
+            exits.push_back(program_.code_.size());
+            emit_op(exit);
+        }
+    }
+    for (size_t at : exits) {
+        program_.code_[at].arg = static_cast<uint32_t>(program_.code_.size());
+    }
+    return true;
+}
+
+bool FilterCompiler::emit_contains_any(const std::vector<const FilterNode*>& group) {
+    FieldId field = group[0]->field;
+    uint8_t reg = register_of(field);
+    emit_op(FilterOp::LoadString, reg, 0, field);
+
+    std::vector<std::string> needles;
+    for (const FilterNode* node : group) {
+        needles.push_back(node->values[0]);
+    }
+    program_.automata_.emplace_back(needles);
+    emit_op(FilterOp::StrContainsAny, reg, static_cast<uint32_t>(program_.automata_.size() - 1));
+    return true;
+}
+
+bool FilterCompiler::emit_compare(const FilterNode& node) {
+    const FieldInfo& info = field_info(node.field);
+    if (node.field == FieldId::FdNet) {
+        // Either address: true if one is in the list, and for != if
+        // neither is. Both test the one set of networks.
+        bool negated = node.op == CompareOp::Ne;
+        uint32_t networks = 0;
+        if (!add_networks(node, networks)) {
+            return false;
+        }
+        emit_addr_compare(node, FieldId::FdSip, networks);
+        size_t exit = program_.code_.size();
+        emit_op(negated ? FilterOp::JumpIfFalse : FilterOp::JumpIfTrue);
+        emit_addr_compare(node, FieldId::FdDip, networks);
+        program_.code_[exit].arg = static_cast<uint32_t>(program_.code_.size());
+        return true;
+    }
+    if (info.type == FieldType::Addr) {
+        uint32_t networks = 0;
+        if (!add_networks(node, networks)) {
+            return false;
+        }
+        emit_addr_compare(node, node.field, networks);
+        return true;
+    }
+
+    uint8_t reg = register_of(node.field);
+    emit_op(info.type == FieldType::Int ? FilterOp::LoadInt : FilterOp::LoadString, reg, 0, node.field);
+
+    if (node.op == CompareOp::Exists) {
+        emit_op(FilterOp::Exists, reg);
+        return true;
+    }
+    return info.type == FieldType::Int ? emit_int_compare(node, reg) : emit_string_compare(node, reg);
+}
+
+bool FilterCompiler::emit_int_compare(const FilterNode& node, uint8_t reg) {
+    std::vector<int64_t> values;
+    bool named;
+    if (!resolve_ints(node, values, named, true)) {
+        return false;
+    }
+
+    switch (node.op) {
+        case CompareOp::Eq:
+        case CompareOp::Ne:
+            if (values.size() == 1) {
+                emit_op(node.op == CompareOp::Eq ? FilterOp::IntEq : FilterOp::IntNe, reg, add_int(values[0]));
+            } else {
+                emit_op(FilterOp::IntIn, reg, add_int_set(std::move(values)));
+                if (node.op == CompareOp::Ne) {
+                    emit_op(FilterOp::Not);
+                }
+            }
+            return true;
+        case CompareOp::Lt:
+        case CompareOp::Le:
+        case CompareOp::Gt:
+        case CompareOp::Ge: {
+            if (named) {
+                fail(node, "event types can't be ordered");
+                return false;
+            }
+            constexpr FilterOp ORDERED[] = {FilterOp::IntLt, FilterOp::IntLe, FilterOp::IntGt, FilterOp::IntGe};
+            emit_op(ORDERED[static_cast<size_t>(node.op) - static_cast<size_t>(CompareOp::Lt)], reg,
+                    add_int(values[0]));
+            return true;
+        }
+        case CompareOp::In:
+            emit_op(FilterOp::IntIn, reg, add_int_set(std::move(values)));
+            return true;
+        default:
+            fail(node, "operator needs a string field");
+            return false;
+    }
+}
+
+bool FilterCompiler::emit_string_compare(const FilterNode& node, uint8_t reg) {
+    switch (node.op) {
+        case CompareOp::Eq: emit_op(FilterOp::StrEq, reg, add_string(node.values[0])); return true;
+        case CompareOp::Ne: emit_op(FilterOp::StrNe, reg, add_string(node.values[0])); return true;
+        case CompareOp::Contains: emit_op(FilterOp::StrContains, reg, add_string(node.values[0])); return true;
+        case CompareOp::StartsWith: emit_op(FilterOp::StrStartsWith, reg, add_string(node.values[0])); return true;
+        case CompareOp::EndsWith: emit_op(FilterOp::StrEndsWith, reg, add_string(node.values[0])); return true;
+        case CompareOp::Glob:
+            program_.globs_.emplace_back(node.values[0]);
+            emit_op(FilterOp::StrGlob, reg, static_cast<uint32_t>(program_.globs_.size() - 1));
+            return true;
+        case CompareOp::IContains: {
+            std::string lower = node.values[0];
+            for (char& c : lower) {
+                if (c >= 'A' && c <= 'Z') {
+                    c = static_cast<char>(c - 'A' + 'a');
+                }
+            }
+            emit_op(FilterOp::StrIContains, reg, add_string(lower));
+            return true;
+        }
+        case CompareOp::In:
+            program_.string_sets_.emplace_back(node.values);
+            emit_op(FilterOp::StrIn, reg, static_cast<uint32_t>(program_.string_sets_.size() - 1));
+            return true;
+        case CompareOp::PMatch:
+            program_.prefix_sets_.emplace_back(node.values);
+            emit_op(FilterOp::StrPMatch, reg, static_cast<uint32_t>(program_.prefix_sets_.size() - 1));
+            return true;
+        default:
+            fail(node, "operator needs a numeric field");
+            return false;
+    }
+}
+
+bool FilterCompiler::add_networks(const FilterNode& node, uint32_t& index) {
+    if (node.op == CompareOp::Exists) {
+        return true;
+    }
+    if (node.op != CompareOp::Eq && node.op != CompareOp::Ne && node.op != CompareOp::In) {
+        fail(node, "addresses only compare with =, != and in");
+        return false;
+    }
+
+    std::vector<IpNetwork> networks;
+    for (const std::string& text : node.values) {
+        IpNetwork network;
+        if (!parse_ip_network(text, network)) {
+            fail(node, "expected an address or network");
+            return false;
+        }
+        networks.push_back(network);
+    }
+    program_.networks_.emplace_back(networks);
+    index = static_cast<uint32_t>(program_.networks_.size() - 1);
+    return true;
+}
+
+void FilterCompiler::emit_addr_compare(const FilterNode& node, FieldId field, uint32_t networks) {
+    uint8_t reg = register_of(field);
+    emit_op(FilterOp::LoadAddr, reg, 0, field);
+    if (node.op == CompareOp::Exists) {
+        emit_op(FilterOp::Exists, reg);
+    } else {
+        emit_op(node.op == CompareOp::Ne ? FilterOp::AddrNotIn : FilterOp::AddrIn, reg, networks);
+    }
+}
+
+void FilterCompiler::emit_op(FilterOp op, uint8_t reg, uint32_t arg, FieldId field) {
+    program_.code_.push_back({op, reg, field, arg});
+}
+
+uint8_t FilterCompiler::register_of(FieldId field) {
+    uint8_t& reg = registers_[static_cast<size_t>(field)];
+    if (reg == NO_REGISTER) {
+        reg = static_cast<uint8_t>(program_.registers_++);
+    }
+    return reg;
+}
+
+uint32_t FilterCompiler::add_int(int64_t value) {
+    auto it = std::find(program_.ints_.begin(), program_.ints_.end(), value);
+    if (it != program_.ints_.end()) {
+        return static_cast<uint32_t>(it - program_.ints_.begin());
+    }
+    program_.ints_.push_back(value);
+    return static_cast<uint32_t>(program_.ints_.size() - 1);
+}
+
+uint32_t FilterCompiler::add_string(std::string_view value) {
+    for (uint32_t i = 0; i < program_.strings_.size(); ++i) {
+        if (program_.string(i) == value) {
+            return i;
+        }
+    }
+    program_.strings_.push_back(
+        {static_cast<uint32_t>(program_.string_data_.size()), static_cast<uint32_t>(value.size())});
+    program_.string_data_.append(value);
+    return static_cast<uint32_t>(program_.strings_.size() - 1);
+}
+
+uint32_t FilterCompiler::add_int_set(std::vector<int64_t> values) {
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+
+    // Sets take a contiguous range of their own
+    uint32_t first = static_cast<uint32_t>(program_.ints_.size());
+    program_.ints_.insert(program_.ints_.end(), values.begin(), values.end());
+    program_.sets_.push_back({first, static_cast<uint32_t>(values.size())});
+    return static_cast<uint32_t>(program_.sets_.size() - 1);
+}
+
+// Nested chains jump to each other's exits: a jump landing on a jump of the
+// same kind would take it too, and one landing on the opposite kind would
+// fall through it, so both can go straight to where they end up
+void FilterCompiler::thread_jumps() {
+    std::vector<FilterInstr>& code = program_.code_;
+    for (FilterInstr& instr : code) {
+        if (!is_jump(instr.op)) {
+            continue;
+        }
+        for (size_t hops = 0; hops < code.size(); ++hops) {
+            const FilterInstr& target = code[instr.arg];
+            if (target.op == instr.op) {
+                instr.arg = target.arg;
+            } else if (is_jump(target.op)) {
+                ++instr.arg;
+            } else {
+                break;
+            }
+        }
+    }
+}
+
+} // namespace sinsp
+} // namespace deepsys
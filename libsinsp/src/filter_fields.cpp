@@ -0,0 +1,217 @@
+#include "sinsp/filter_fields.h"
+
+#include <core/string_pool.h>
+
+#include <array>
+#include <string>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+constexpr std::array<FieldInfo, FIELD_COUNT> FIELDS = {{
+    {"evt.type", FieldId::EvtType, FieldType::Int, FilterCheckType::Event, 0,
+     "Event type, by name (execve, open, ...) or number"},
+    {"evt.time", FieldId::EvtTime, FieldType::Int, FilterCheckType::Time, 0, "Event timestamp, in ns"},
+    {"evt.res", FieldId::EvtRes, FieldType::Int, FilterCheckType::Event, 0, "Return value of the syscall"},
+    {"proc.pid", FieldId::ProcPid, FieldType::Int, FilterCheckType::Process, 0, "Process id"},
+    {"proc.ppid", FieldId::ProcPpid, FieldType::Int, FilterCheckType::Process, 0, "Parent process id"},
+    {"proc.name", FieldId::ProcName, FieldType::String, FilterCheckType::Process, 0,
+     "Executable name, without its directory"},
+    {"proc.exe", FieldId::ProcExe, FieldType::String, FilterCheckType::Process, 0, "Executable path"},
+    {"proc.cmdline", FieldId::ProcCmdline, FieldType::String, FilterCheckType::Process, 0,
+     "Command line arguments, NUL separated"},
+    {"proc.cwd", FieldId::ProcCwd, FieldType::String, FilterCheckType::Process, 0, "Working directory"},
+    {"thread.tid", FieldId::ThreadTid, FieldType::Int, FilterCheckType::Thread, 0, "Thread id"},
+    {"user.name", FieldId::UserName, FieldType::String, FilterCheckType::Process, 0, "User of the process"},
+    {"group.name", FieldId::GroupName, FieldType::String, FilterCheckType::Process, 0, "Group of the process"},
+    {"fd.num", FieldId::FdNum, FieldType::Int, FilterCheckType::FileDescriptor, EVENT_HAS_FD,
+     "Fd number"},
+    {"fd.name", FieldId::FdName, FieldType::String, FilterCheckType::FileDescriptor, EVENT_HAS_FD,
+     "Path of a file, or name of a unix socket"},
+    {"fd.type", FieldId::FdType, FieldType::String, FilterCheckType::FileDescriptor, EVENT_HAS_FD,
+     "Fd kind: file, directory, ipv4, ipv6, unix, pipe, ..."},
+    {"fd.l4proto", FieldId::FdL4Proto, FieldType::String, FilterCheckType::Network, EVENT_HAS_FD,
+     "Socket protocol: tcp, udp, icmp, raw"},
+    {"fd.sport", FieldId::FdSport, FieldType::Int, FilterCheckType::Network, EVENT_HAS_FD,
+     "Source port of a socket"},
+    {"fd.dport", FieldId::FdDport, FieldType::Int, FilterCheckType::Network, EVENT_HAS_FD,
+     "Destination port of a socket"},
+    {"fd.sip", FieldId::FdSip, FieldType::Addr, FilterCheckType::Network, EVENT_HAS_FD,
+     "Source address of a socket"},
+    {"fd.dip", FieldId::FdDip, FieldType::Addr, FilterCheckType::Network, EVENT_HAS_FD,
+     "Destination address of a socket"},
+    {"fd.net", FieldId::FdNet, FieldType::Addr, FilterCheckType::Network, EVENT_HAS_FD,
+     "Either address of a socket"},
+}};
+
+constexpr bool fields_in_order() {
+    for (size_t i = 0; i < FIELDS.size(); ++i) {
+        if (static_cast<size_t>(FIELDS[i].id) != i) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(fields_in_order(), "FIELDS must be in FieldId order");
+
+const char* l4proto_to_string(L4Proto proto) {
+    switch (proto) {
+        case L4Proto::Tcp: return "tcp";
+        case L4Proto::Udp: return "udp";
+        case L4Proto::Icmp: return "icmp";
+        case L4Proto::Raw: return "raw";
+        case L4Proto::Unknown: break;
+    }
+    return "unknown";
+}
+
+bool has_endpoints(const FdInfo& fd) {
+    return fd.type == FdType::IPv4Socket || fd.type == FdType::IPv6Socket;
+}
+
+std::string_view pooled(core::StringHandle handle) {
+    return core::StringPool::instance().get(handle);
+}
+
+} // namespace
+
+FilterEvent make_filter_event(const core::Event& event, const ThreadTable& table, int64_t res,
+                              core::FileDescriptor fd) {
+    FilterEvent out;
+    out.event = event;
+    out.res = res;
+    out.fd = fd;
+    out.thread = table.find(event.tid);
+    if (fd >= 0) {
+        if (const FdTable* fds = table.fd_table(event.tid)) {
+            out.fd_info = fds->find(fd);
+        }
+    }
+    return out;
+}
+
+const FieldInfo& field_info(FieldId id) {
+    return FIELDS[static_cast<size_t>(id)];
+}
+
+const FieldInfo* find_field(std::string_view name) {
+    for (const FieldInfo& field : FIELDS) {
+        if (name == field.name) {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+
+std::vector<FilterCheckInfo> filter_checks() {
+    std::vector<FilterCheckInfo> checks;
+    checks.reserve(FIELDS.size());
+    for (const FieldInfo& field : FIELDS) {
+        std::string name = field.name;
+        checks.push_back({name, field.check_type, field.description, {name.substr(0, name.find('.'))}, {}});
+    }
+    return checks;
+}
+
+bool extract_int(FieldId id, const FilterEvent& event, int64_t& out) {
+    const ThreadInfo* thread = event.thread;
+    const FdInfo* fd = event.fd_info;
+
+    switch (id) {
+        case FieldId::EvtType: out = event.event.id; return true;
+        case FieldId::EvtTime: out = static_cast<int64_t>(event.event.timestamp); return true;
+        case FieldId::EvtRes: out = event.res; return true;
+        case FieldId::ProcPid: out = event.event.pid; return true;
+        case FieldId::ThreadTid: out = event.event.tid; return true;
+        case FieldId::ProcPpid:
+            if (!thread) {
+                return false;
+            }
+            out = thread->ppid;
+            return true;
+        case FieldId::FdNum:
+            if (event.fd < 0) {
+                return false;
+            }
+            out = event.fd;
+            return true;
+        case FieldId::FdSport:
+        case FieldId::FdDport:
+            if (!fd || !has_endpoints(*fd)) {
+                return false;
+            }
+            out = id == FieldId::FdSport ? fd->sport : fd->dport;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool extract_string(FieldId id, const FilterEvent& event, std::string_view& out) {
+    const ThreadInfo* thread = event.thread;
+    const FdInfo* fd = event.fd_info;
+
+    switch (id) {
+        case FieldId::ProcName:
+        case FieldId::ProcExe:
+        case FieldId::ProcCmdline:
+        case FieldId::ProcCwd:
+        case FieldId::UserName:
+        case FieldId::GroupName:
+            if (!thread) {
+                return false;
+            }
+            break;
+        case FieldId::FdName:
+        case FieldId::FdType:
+        case FieldId::FdL4Proto:
+            if (!fd) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+    }
+
+    switch (id) {
+        case FieldId::ProcName: {
+            std::string_view exe = pooled(thread->exe);
+            size_t slash = exe.rfind('/');
+            out = slash == std::string_view::npos ? exe : exe.substr(slash + 1);
+            return true;
+        }
+        case FieldId::ProcExe: out = pooled(thread->exe); return true;
+        case FieldId::ProcCmdline: out = pooled(thread->args); return true;
+        case FieldId::ProcCwd: out = pooled(thread->cwd); return true;
+        case FieldId::UserName: out = pooled(thread->user); return true;
+        case FieldId::GroupName: out = pooled(thread->group); return true;
+        case FieldId::FdName: out = pooled(fd->name); return true;
+        case FieldId::FdType: out = fd_type_to_string(fd->type); return true;
+        case FieldId::FdL4Proto:
+            if (!fd->is_socket()) {
+                return false;
+            }
+            out = l4proto_to_string(fd->l4proto);
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool extract_addr(FieldId id, const FilterEvent& event, const uint8_t*& out, size_t& size) {
+    const FdInfo* fd = event.fd_info;
+    if (!fd || !has_endpoints(*fd)) {
+        return false;
+    }
+    size = fd->type == FdType::IPv6Socket ? 16 : 4;
+    switch (id) {
+        case FieldId::FdSip: out = fd->sip.data(); return true;
+        case FieldId::FdDip: out = fd->dip.data(); return true;
+        default: return false;
+    }
+}
+
+} // namespace sinsp
+} // namespace deepsys
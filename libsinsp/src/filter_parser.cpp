@@ -0,0 +1,411 @@
+#include "sinsp/filter_ast.h"
+
+#include <core/logger.h>
+
+#include <cstring>
+#include <utility>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+// Nesting beyond this is rejected rather than risking the stack
+constexpr size_t MAX_DEPTH = 256;
+
+constexpr const char* SPECIAL_CHARS = "()<>=!,\"'";
+
+bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool is_word_char(char c) {
+    return !is_space(c) && std::strchr(SPECIAL_CHARS, c) == nullptr && c != '\0';
+}
+
+struct OpName {
+    const char* name;
+    CompareOp op;
+};
+
+// Keyword and symbol spellings; the first of each op is the canonical one
+constexpr OpName OP_NAMES[] = {
+    {"=", CompareOp::Eq},
+    {"==", CompareOp::Eq},
+    {"!=", CompareOp::Ne},
+    {"<", CompareOp::Lt},
+    {"<=", CompareOp::Le},
+    {">", CompareOp::Gt},
+    {">=", CompareOp::Ge},
+    {"contains", CompareOp::Contains},
+    {"icontains", CompareOp::IContains},
+    {"startswith", CompareOp::StartsWith},
+    {"endswith", CompareOp::EndsWith},
+    {"glob", CompareOp::Glob},
+    {"in", CompareOp::In},
+    {"pmatch", CompareOp::PMatch},
+    {"exists", CompareOp::Exists},
+};
+
+bool is_keyword(std::string_view word) {
+    if (word == "and" || word == "or" || word == "not") {
+        return true;
+    }
+    for (const OpName& name : OP_NAMES) {
+        if (word == name.name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+class Parser {
+public:
+    explicit Parser(std::string_view text) : text_(text) {}
+
+    core::Result<FilterNodePtr> parse() {
+        next();
+        FilterNodePtr root = parse_or(0);
+        if (root && token_.kind != TokenKind::End) {
+            fail("unexpected '" + token_.text + "'");
+        }
+        if (!error_.empty()) {
+            LOG_WARNING("Invalid filter \"" << text_ << "\": " << error_ << " at offset " << error_pos_);
+            return core::ErrorCode::InvalidArgument;
+        }
+        return root;
+    }
+
+private:
+    enum class TokenKind {
+        End,
+        LParen,
+        RParen,
+        Comma,
+        Symbol,     // = == != < <= > >=
+        Word,
+        String      // Quoted
+    };
+
+    struct Token {
+        TokenKind kind = TokenKind::End;
+        std::string text;
+        size_t pos = 0;
+    };
+
+    void fail(std::string message) {
+        if (error_.empty()) {
+            error_ = std::move(message);
+            error_pos_ = token_.pos;
+        }
+    }
+
+    bool is_word(const char* word) const { return token_.kind == TokenKind::Word && token_.text == word; }
+
+    void next() {
+        while (pos_ < text_.size() && is_space(text_[pos_])) {
+            ++pos_;
+        }
+        token_.pos = pos_;
+        token_.text.clear();
+        if (pos_ == text_.size()) {
+            token_.kind = TokenKind::End;
+            return;
+        }
+
+        char c = text_[pos_];
+        switch (c) {
+            case '(': token_.kind = TokenKind::LParen; token_.text = "("; ++pos_; return;
+            case ')': token_.kind = TokenKind::RParen; token_.text = ")"; ++pos_; return;
+            case ',': token_.kind = TokenKind::Comma; token_.text = ","; ++pos_; return;
+            case '"':
+            case '\'':
+                lex_string(c);
+                return;
+            default:
+                break;
+        }
+
+        if (std::strchr("<>=!", c)) {
+            token_.kind = TokenKind::Symbol;
+            token_.text = c;
+            ++pos_;
+            if (pos_ < text_.size() && text_[pos_] == '=') {
+                token_.text += '=';
+                ++pos_;
+            }
+            if (token_.text == "!") {
+                fail("'!' must be followed by '='");
+            }
+            return;
+        }
+
+        token_.kind = TokenKind::Word;
+        while (pos_ < text_.size() && is_word_char(text_[pos_])) {
+            token_.text += text_[pos_++];
+        }
+    }
+
+    void lex_string(char quote) {
+        token_.kind = TokenKind::String;
+        ++pos_;
+        while (pos_ < text_.size() && text_[pos_] != quote) {
+            char c = text_[pos_++];
+            if (c == '\\' && pos_ < text_.size()) {
+                c = text_[pos_++];
+                if (c == 'n') {
+                    c = '\n';
+                } else if (c == 't') {
+                    c = '\t';
+                } else if (c == '0') {
+                    c = '\0';
+                }
+            }
+            token_.text += c;
+        }
+        if (pos_ == text_.size()) {
+            fail("unterminated string");
+            return;
+        }
+        ++pos_;
+    }
+
+    // Appends child to parent, flattening a child of the same kind
+    static void adopt(FilterNode& parent, FilterNodePtr child) {
+        if (child->kind == parent.kind) {
+            for (FilterNodePtr& grandchild : child->children) {
+                parent.children.push_back(std::move(grandchild));
+            }
+        } else {
+            parent.children.push_back(std::move(child));
+        }
+    }
+
+    FilterNodePtr parse_binary(size_t depth, FilterNode::Kind kind, const char* keyword) {
+        FilterNodePtr first = kind == FilterNode::Kind::Or ? parse_and(depth) : parse_not(depth);
+        if (!first || !is_word(keyword)) {
+            return first;
+        }
+
+        auto node = std::make_unique<FilterNode>();
+        node->kind = kind;
+        adopt(*node, std::move(first));
+        while (is_word(keyword)) {
+            next();
+            FilterNodePtr operand = kind == FilterNode::Kind::Or ? parse_and(depth) : parse_not(depth);
+            if (!operand) {
+                return nullptr;
+            }
+            adopt(*node, std::move(operand));
+        }
+        return node;
+    }
+
+    FilterNodePtr parse_or(size_t depth) { return parse_binary(depth, FilterNode::Kind::Or, "or"); }
+    FilterNodePtr parse_and(size_t depth) { return parse_binary(depth, FilterNode::Kind::And, "and"); }
+
+    FilterNodePtr parse_not(size_t depth) {
+        if (++depth > MAX_DEPTH) {
+            fail("expression nested too deeply");
+            return nullptr;
+        }
+        if (is_word("not")) {
+            next();
+            FilterNodePtr child = parse_not(depth);
+            if (!child) {
+                return nullptr;
+            }
+            auto node = std::make_unique<FilterNode>();
+            node->kind = FilterNode::Kind::Not;
+            node->children.push_back(std::move(child));
+            return node;
+        }
+        if (token_.kind == TokenKind::LParen) {
+            next();
+            FilterNodePtr inner = parse_or(depth);
+            if (!inner) {
+                return nullptr;
+            }
+            if (token_.kind != TokenKind::RParen) {
+                fail("expected ')'");
+                return nullptr;
+            }
+            next();
+            return inner;
+        }
+        return parse_compare();
+    }
+
+    FilterNodePtr parse_compare() {
+        if (token_.kind != TokenKind::Word || is_keyword(token_.text)) {
+            fail(token_.kind == TokenKind::End ? "unexpected end of filter" : "expected a field name");
+            return nullptr;
+        }
+        const FieldInfo* field = find_field(token_.text);
+        if (!field) {
+            fail("unknown field '" + token_.text + "'");
+            return nullptr;
+        }
+        next();
+
+        auto node = std::make_unique<FilterNode>();
+        node->field = field->id;
+        if (!parse_op(node->op)) {
+            fail("expected an operator");
+            return nullptr;
+        }
+        next();
+
+        if (node->op == CompareOp::Exists) {
+            return node;
+        }
+        if (node->op != CompareOp::In && node->op != CompareOp::PMatch) {
+            if (!parse_value(node->values)) {
+                return nullptr;
+            }
+            return node;
+        }
+
+        if (token_.kind != TokenKind::LParen) {
+            fail(std::string("expected '(' after ") + compare_op_to_string(node->op));
+            return nullptr;
+        }
+        next();
+        do {
+            if (!node->values.empty()) {
+                next();
+            }
+            if (!parse_value(node->values)) {
+                return nullptr;
+            }
+        } while (token_.kind == TokenKind::Comma);
+        if (token_.kind != TokenKind::RParen) {
+            fail("expected ',' or ')'");
+            return nullptr;
+        }
+        next();
+        return node;
+    }
+
+    bool parse_op(CompareOp& op) const {
+        if (token_.kind != TokenKind::Symbol && token_.kind != TokenKind::Word) {
+            return false;
+        }
+        for (const OpName& name : OP_NAMES) {
+            if (token_.text == name.name) {
+                op = name.op;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool parse_value(std::vector<std::string>& values) {
+        if (token_.kind != TokenKind::Word && token_.kind != TokenKind::String) {
+            fail("expected a value");
+            return false;
+        }
+        values.push_back(token_.text);
+        next();
+        return true;
+    }
+
+    std::string_view text_;
+    size_t pos_ = 0;
+    Token token_;
+    std::string error_;
+    size_t error_pos_ = 0;
+};
+
+void append_value(std::string& out, const std::string& value) {
+    bool bare = !value.empty() && !is_keyword(value);
+    for (char c : value) {
+        bare = bare && is_word_char(c);
+    }
+    if (bare) {
+        out += value;
+        return;
+    }
+
+    out += '"';
+    for (char c : value) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            case '\0': out += "\\0"; break;
+            default: out += c; break;
+        }
+    }
+    out += '"';
+}
+
+void append_node(std::string& out, const FilterNode& node, bool nested) {
+    switch (node.kind) {
+        case FilterNode::Kind::And:
+        case FilterNode::Kind::Or: {
+            if (nested) {
+                out += '(';
+            }
+            const char* separator = node.kind == FilterNode::Kind::And ? " and " : " or ";
+            for (size_t i = 0; i < node.children.size(); ++i) {
+                if (i > 0) {
+                    out += separator;
+                }
+                append_node(out, *node.children[i], true);
+            }
+            if (nested) {
+                out += ')';
+            }
+            return;
+        }
+        case FilterNode::Kind::Not:
+            out += "not ";
+            append_node(out, *node.children[0], true);
+            return;
+        case FilterNode::Kind::Compare:
+            break;
+    }
+
+    out += field_info(node.field).name;
+    out += ' ';
+    out += compare_op_to_string(node.op);
+    if (node.op == CompareOp::In || node.op == CompareOp::PMatch) {
+        out += " (";
+        for (size_t i = 0; i < node.values.size(); ++i) {
+            if (i > 0) {
+                out += ", ";
+            }
+            append_value(out, node.values[i]);
+        }
+        out += ')';
+    } else if (node.op != CompareOp::Exists) {
+        out += ' ';
+        append_value(out, node.values[0]);
+    }
+}
+
+} // namespace
+
+const char* compare_op_to_string(CompareOp op) {
+    for (const OpName& name : OP_NAMES) {
+        if (name.op == op) {
+            return name.name;
+        }
+    }
+    return "?";
+}
+
+core::Result<FilterNodePtr> parse_filter(std::string_view text) {
+    return Parser(text).parse();
+}
+
+std::string to_string(const FilterNode& node) {
+    std::string out;
+    append_node(out, node, false);
+    return out;
+}
+
+} // namespace sinsp
+} // namespace deepsys
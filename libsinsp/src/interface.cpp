@@ -0,0 +1,98 @@
+#include "sinsp/interface.h"
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+core::Result<void> visit_copies(const IInspector& inspector, const std::vector<ProcessInfo>& processes,
+                                ProcessFields fields, const IInspector::ProcessVisitor& visitor) {
+    std::string env;
+    for (const ProcessInfo& info : processes) {
+        ProcessView view;
+        view.pid = info.pid;
+        view.tid = info.tid;
+        view.ppid = info.ppid;
+        view.start_time = info.start_time;
+        if (has_field(fields, ProcessField::Exe)) {
+            view.exe = info.exe;
+        }
+        if (has_field(fields, ProcessField::Args)) {
+            view.args = info.args;
+        }
+        if (has_field(fields, ProcessField::Cwd)) {
+            view.cwd = info.cwd;
+        }
+        if (has_field(fields, ProcessField::User)) {
+            view.user = info.user;
+        }
+        if (has_field(fields, ProcessField::Group)) {
+            view.group = info.group;
+        }
+        if (has_field(fields, ProcessField::Env)) {
+            env.clear();
+            for (const auto& entry : info.env) {
+                env.append(entry.first).append(1, '=').append(entry.second).append(1, '\0');
+            }
+            if (!env.empty()) {
+                env.pop_back();
+            }
+            view.env = env;
+        }
+        if (has_field(fields, ProcessField::Rss)) {
+            auto rss = inspector.get_process_memory_usage(info.pid);
+            view.rss_bytes = rss ? rss.value() : 0;
+        }
+        if (!visitor(view)) {
+            break;
+        }
+    }
+    return {};
+}
+
+} // namespace
+
+core::Result<void> IInspector::visit_processes(ProcessFields fields, const ProcessVisitor& visitor) const {
+    auto processes = get_all_processes();
+    if (!processes) {
+        return processes.error();
+    }
+    return visit_copies(*this, processes.value(), fields, visitor);
+}
+
+core::Result<void> IInspector::visit_threads(ProcessFields fields, const ProcessVisitor& visitor) const {
+    auto threads = get_all_threads();
+    if (!threads) {
+        return threads.error();
+    }
+    return visit_copies(*this, threads.value(), fields, visitor);
+}
+
+core::Result<void> IInspector::visit_process_fds(core::ProcessID, const FdVisitor&) const {
+    // The string queries can't be turned back into FdInfo
+    return core::ErrorCode::NotImplemented;
+}
+
+core::Result<void> IInspector::visit_network_connections(core::ProcessID pid, const FdVisitor& visitor) const {
+    return visit_process_fds(pid, [&](core::FileDescriptor fd, const FdInfo& info) {
+        return !info.is_socket() || visitor(fd, info);
+    });
+}
+
+core::Result<void> IInspector::matches_filter_batch(const std::vector<core::Event>& events,
+                                                    std::vector<uint64_t>& out) const {
+    out.assign((events.size() + 63) / 64, 0);
+    for (size_t i = 0; i < events.size(); ++i) {
+        auto match = matches_filter(events[i]);
+        if (!match) {
+            return match.error();
+        }
+        if (match.value()) {
+            out[i / 64] |= uint64_t(1) << (i % 64);
+        }
+    }
+    return {};
+}
+
+} // namespace sinsp
+} // namespace deepsys
@@ -0,0 +1,176 @@
+#include "sinsp/ip_match.h"
+
+#include <arpa/inet.h>
+
+#include <charconv>
+#include <cstring>
+#include <string>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+// ::ffff:0:0/96, the IPv4 mapped addresses
+const uint8_t V4_MAPPED[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+constexpr unsigned V4_MAPPED_BITS = 96;
+
+} // namespace
+
+bool parse_ip_network(std::string_view text, IpNetwork& out) {
+    std::memset(&out, 0, sizeof(out));
+    size_t slash = text.find('/');
+    std::string addr(text.substr(0, slash));
+    if (inet_pton(AF_INET, addr.c_str(), out.addr) == 1) {
+        out.v6 = false;
+    } else if (inet_pton(AF_INET6, addr.c_str(), out.addr) == 1) {
+        out.v6 = true;
+    } else {
+        return false;
+    }
+
+    unsigned max = out.v6 ? 128 : 32;
+    out.prefix = static_cast<uint8_t>(max);
+    if (slash != std::string_view::npos) {
+        std::string_view digits = text.substr(slash + 1);
+        unsigned prefix = 0;
+        auto result = std::from_chars(digits.data(), digits.data() + digits.size(), prefix);
+        if (digits.empty() || result.ec != std::errc() || result.ptr != digits.data() + digits.size() ||
+            prefix > max) {
+            return false;
+        }
+        out.prefix = static_cast<uint8_t>(prefix);
+    }
+    return true;
+}
+
+NetworkSet::NetworkSet(const std::vector<IpNetwork>& networks) : networks_(networks.size()) {
+    for (const IpNetwork& network : networks) {
+        // Mapped addresses are looked up as IPv4, so a network of them goes
+        // in as one too: ::ffff:10.0.0.0/104 is 10.0.0.0/8
+        if (network.v6 && network.prefix >= V4_MAPPED_BITS &&
+            std::memcmp(network.addr, V4_MAPPED, V4_MAPPED_BITS / 8) == 0) {
+            insert(root4_, make_key(network.addr + 12, 4), network.prefix - V4_MAPPED_BITS);
+            continue;
+        }
+        insert(network.v6 ? root6_ : root4_, make_key(network.addr, network.v6 ? 16 : 4), network.prefix);
+    }
+}
+
+bool NetworkSet::contains(const uint8_t* addr, size_t size) const {
+    if (size == 16 && std::memcmp(addr, V4_MAPPED, V4_MAPPED_BITS / 8) == 0) {
+        return lookup(root4_, make_key(addr + 12, 4));
+    }
+    return lookup(size == 16 ? root6_ : root4_, make_key(addr, size));
+}
+
+NetworkSet::Key NetworkSet::make_key(const uint8_t* addr, size_t size) {
+    uint8_t bytes[16] = {};
+    std::memcpy(bytes, addr, size);
+    Key key{0, 0};
+    for (size_t i = 0; i < 8; ++i) {
+        key.hi = (key.hi << 8) | bytes[i];
+        key.lo = (key.lo << 8) | bytes[i + 8];
+    }
+    return key;
+}
+
+NetworkSet::Key NetworkSet::mask(Key key, unsigned length) {
+    uint64_t hi = length == 0 ? 0 : length >= 64 ? ~uint64_t(0) : ~uint64_t(0) << (64 - length);
+    uint64_t lo = length <= 64 ? 0 : length >= 128 ? ~uint64_t(0) : ~uint64_t(0) << (128 - length);
+    return {key.hi & hi, key.lo & lo};
+}
+
+unsigned NetworkSet::common_bits(Key a, Key b, unsigned limit) {
+    unsigned common;
+    if (a.hi != b.hi) {
+        common = static_cast<unsigned>(__builtin_clzll(a.hi ^ b.hi));
+    } else if (a.lo != b.lo) {
+        common = 64 + static_cast<unsigned>(__builtin_clzll(a.lo ^ b.lo));
+    } else {
+        common = 128;
+    }
+    return common < limit ? common : limit;
+}
+
+unsigned NetworkSet::bit(Key key, unsigned index) {
+    return index < 64 ? (key.hi >> (63 - index)) & 1 : (key.lo >> (127 - index)) & 1;
+}
+
+uint32_t NetworkSet::add_node(Key key, unsigned length, bool terminal) {
+    nodes_.push_back({mask(key, length), {NONE, NONE}, static_cast<uint8_t>(length), terminal});
+    return static_cast<uint32_t>(nodes_.size() - 1);
+}
+
+void NetworkSet::insert(uint32_t& root, Key key, unsigned length) {
+    key = mask(key, length);
+    if (root == NONE) {
+        root = add_node(key, length, true);
+        return;
+    }
+
+    // The link to the current node, which a split replaces: the root, or a
+    // child slot of parent. Indices rather than pointers, as add_node()
+    // may move the nodes.
+    uint32_t parent = NONE;
+    unsigned side = 0;
+    uint32_t current = root;
+    for (;;) {
+        Node node = nodes_[current];
+        unsigned common = common_bits(node.key, key, node.length < length ? node.length : length);
+
+        uint32_t replacement = NONE;
+        if (common < node.length) {
+            // Diverges inside this node's prefix: a new node at the fork
+            // takes it and, unless the fork is the new network itself, a
+            // leaf for the new one
+            replacement = add_node(key, common, common == length);
+            nodes_[replacement].child[bit(node.key, common)] = current;
+            if (common < length) {
+                nodes_[replacement].child[bit(key, common)] = add_node(key, length, true);
+            }
+        } else if (node.terminal) {
+            return;                         // Covered already
+        } else if (node.length == length) {
+            nodes_[current].terminal = true;
+            return;
+        } else {
+            unsigned next = bit(key, node.length);
+            if (node.child[next] == NONE) {
+                uint32_t leaf = add_node(key, length, true);
+                nodes_[current].child[next] = leaf;
+                return;
+            }
+            parent = current;
+            side = next;
+            current = node.child[next];
+            continue;
+        }
+
+        if (parent == NONE) {
+            root = replacement;
+        } else {
+            nodes_[parent].child[side] = replacement;
+        }
+        return;
+    }
+}
+
+bool NetworkSet::lookup(uint32_t root, Key key) const {
+    const Node* nodes = nodes_.data();
+    for (uint32_t current = root; current != NONE;) {
+        const Node& node = nodes[current];
+        Key prefix = mask(key, node.length);
+        if (prefix.hi != node.key.hi || prefix.lo != node.key.lo) {
+            return false;
+        }
+        if (node.terminal) {
+            return true;
+        }
+        current = node.child[bit(key, node.length)];
+    }
+    return false;
+}
+
+} // namespace sinsp
+} // namespace deepsys
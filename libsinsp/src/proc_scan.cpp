@@ -0,0 +1,915 @@
+#include "sinsp/proc_scan.h"
+
+#include <core/logger.h>
+#include <core/string_pool.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t DIRENT_BUFFER = 64 * 1024;
+constexpr size_t WORK_BATCH = 8;
+
+uint64_t elapsed_ns(Clock::time_point since) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count());
+}
+
+// RAII for the many short-lived fds of a scan
+class ScopedFd {
+public:
+    explicit ScopedFd(int fd) : fd_(fd) {}
+    ~ScopedFd() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+    ScopedFd(const ScopedFd&) = delete;
+    ScopedFd& operator=(const ScopedFd&) = delete;
+
+    int get() const { return fd_; }
+    bool valid() const { return fd_ >= 0; }
+
+private:
+    int fd_;
+};
+
+int open_dir_at(int dirfd, const char* name) {
+    return openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+// Calls fn(name) for every entry of the directory but . and .., reading
+// entries in large getdents64 batches instead of one readdir() at a time
+template<typename F>
+bool list_dir(int dirfd, std::vector<char>& buf, F&& fn) {
+    // struct linux_dirent64: u64 d_ino, s64 d_off, u16 d_reclen, u8 d_type, name
+    constexpr size_t RECLEN_OFFSET = 16;
+    constexpr size_t NAME_OFFSET = 19;
+
+    for (;;) {
+        long n = syscall(SYS_getdents64, dirfd, buf.data(), buf.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (n == 0) {
+            return true;
+        }
+
+        for (long off = 0; off < n;) {
+            uint16_t reclen;
+            std::memcpy(&reclen, buf.data() + off + RECLEN_OFFSET, sizeof(reclen));
+            const char* name = buf.data() + off + NAME_OFFSET;
+            if (!(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))) {
+                fn(name);
+            }
+            off += reclen;
+        }
+    }
+}
+
+bool parse_decimal(std::string_view str, uint64_t& out) {
+    if (str.empty()) {
+        return false;
+    }
+    out = 0;
+    for (char c : str) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        out = out * 10 + static_cast<uint64_t>(c - '0');
+    }
+    return true;
+}
+
+bool parse_hex(std::string_view str, uint64_t& out) {
+    if (str.empty()) {
+        return false;
+    }
+    out = 0;
+    for (char c : str) {
+        uint64_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = static_cast<uint64_t>(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = static_cast<uint64_t>(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = static_cast<uint64_t>(c - 'A' + 10);
+        } else {
+            return false;
+        }
+        out = out * 16 + digit;
+    }
+    return true;
+}
+
+// Splits on blanks into at most max_fields views, returns the field count
+size_t split_fields(std::string_view line, std::string_view* fields, size_t max_fields) {
+    size_t count = 0;
+    size_t pos = 0;
+    while (count < max_fields) {
+        pos = line.find_first_not_of(" \t", pos);
+        if (pos == std::string_view::npos) {
+            break;
+        }
+        size_t end = line.find_first_of(" \t", pos);
+        fields[count++] = line.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos);
+        if (end == std::string_view::npos) {
+            break;
+        }
+        pos = end;
+    }
+    return count;
+}
+
+template<typename F>
+void for_each_line(std::string_view text, F&& fn) {
+    while (!text.empty()) {
+        size_t end = text.find('\n');
+        fn(text.substr(0, end));
+        if (end == std::string_view::npos) {
+            break;
+        }
+        text.remove_prefix(end + 1);
+    }
+}
+
+// Reads a whole file into out, reusing its storage across calls
+bool read_file_at(int dirfd, const char* name, std::string& out) {
+    ScopedFd fd(openat(dirfd, name, O_RDONLY | O_CLOEXEC));
+    if (!fd.valid()) {
+        return false;
+    }
+
+    size_t size = 0;
+    for (;;) {
+        if (out.size() < size + 4096) {
+            out.resize(std::max(out.size() * 2, size + 4096));
+        }
+        ssize_t n = read(fd.get(), &out[size], out.size() - size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        size += static_cast<size_t>(n);
+    }
+    out.resize(size);
+    return true;
+}
+
+bool readlink_at(int dirfd, const char* name, std::string& out) {
+    out.resize(PATH_MAX);
+    ssize_t n = readlinkat(dirfd, name, &out[0], out.size());
+    if (n < 0) {
+        out.clear();
+        return false;
+    }
+    out.resize(static_cast<size_t>(n));
+    return true;
+}
+
+std::string_view strip_trailing_nul(std::string_view str) {
+    while (!str.empty() && str.back() == '\0') {
+        str.remove_suffix(1);
+    }
+    return str;
+}
+
+// "0100007F:0016" for IPv4, 32 hex digits before the colon for IPv6. The
+// kernel prints each 32-bit word of the address in host order, so copying
+// the parsed word back out restores network order on any endianness.
+bool parse_socket_address(std::string_view str, size_t words, std::array<uint8_t, 16>& addr, uint16_t& port) {
+    if (str.size() != words * 8 + 5 || str[words * 8] != ':') {
+        return false;
+    }
+    for (size_t w = 0; w < words; ++w) {
+        uint64_t value;
+        if (!parse_hex(str.substr(w * 8, 8), value)) {
+            return false;
+        }
+        uint32_t word = static_cast<uint32_t>(value);
+        std::memcpy(addr.data() + w * 4, &word, sizeof(word));
+    }
+    uint64_t value;
+    if (!parse_hex(str.substr(words * 8 + 1), value)) {
+        return false;
+    }
+    port = static_cast<uint16_t>(value);
+    return true;
+}
+
+// Socket inode -> endpoints, shared read-only by the workers. Unix socket
+// names hold a pool reference, dropped by the destructor.
+class SocketMap {
+public:
+    SocketMap() = default;
+    SocketMap(const SocketMap&) = delete;
+    SocketMap& operator=(const SocketMap&) = delete;
+
+    ~SocketMap() {
+        for (const auto& entry : sockets_) {
+            core::StringPool::instance().release(entry.second.name);
+        }
+    }
+
+    void load(int proc_fd, std::string& buf) {
+        load_inet(proc_fd, "net/tcp", FdType::IPv4Socket, L4Proto::Tcp, buf);
+        load_inet(proc_fd, "net/udp", FdType::IPv4Socket, L4Proto::Udp, buf);
+        load_inet(proc_fd, "net/raw", FdType::IPv4Socket, L4Proto::Raw, buf);
+        load_inet(proc_fd, "net/tcp6", FdType::IPv6Socket, L4Proto::Tcp, buf);
+        load_inet(proc_fd, "net/udp6", FdType::IPv6Socket, L4Proto::Udp, buf);
+        load_inet(proc_fd, "net/raw6", FdType::IPv6Socket, L4Proto::Raw, buf);
+        load_unix(proc_fd, buf);
+        load_netlink(proc_fd, buf);
+    }
+
+    const FdInfo* find(uint64_t ino) const {
+        auto it = sockets_.find(ino);
+        return it == sockets_.end() ? nullptr : &it->second;
+    }
+
+    size_t size() const { return sockets_.size(); }
+
+private:
+    void load_inet(int proc_fd, const char* path, FdType type, L4Proto proto, std::string& buf) {
+        if (!read_file_at(proc_fd, path, buf)) {
+            return;
+        }
+
+        size_t words = type == FdType::IPv4Socket ? 1 : 4;
+        bool header = true;
+        for_each_line(buf, [&](std::string_view line) {
+            // sl local_address rem_address st tx:rx tr:when retrnsmt uid timeout inode
+            std::string_view fields[10];
+            if (std::exchange(header, false) || split_fields(line, fields, 10) < 10) {
+                return;
+            }
+
+            FdInfo info;
+            info.type = type;
+            info.l4proto = proto;
+            uint64_t ino;
+            if (!parse_decimal(fields[9], ino) || ino == 0 ||
+                !parse_socket_address(fields[1], words, info.sip, info.sport) ||
+                !parse_socket_address(fields[2], words, info.dip, info.dport)) {
+                return;
+            }
+            info.ino = ino;
+            sockets_.emplace(ino, info);
+        });
+    }
+
+    void load_unix(int proc_fd, std::string& buf) {
+        if (!read_file_at(proc_fd, "net/unix", buf)) {
+            return;
+        }
+
+        bool header = true;
+        for_each_line(buf, [&](std::string_view line) {
+            // Num RefCount Protocol Flags Type St Inode Path
+            std::string_view fields[8];
+            size_t count = split_fields(line, fields, 8);
+            if (std::exchange(header, false) || count < 7) {
+                return;
+            }
+
+            uint64_t ino;
+            if (!parse_decimal(fields[6], ino)) {
+                return;
+            }
+
+            FdInfo info;
+            info.type = FdType::UnixSocket;
+            info.ino = ino;
+            if (count == 8) {
+                info.name = core::StringPool::instance().intern(fields[7]);
+            }
+            if (!sockets_.emplace(ino, info).second) {
+                core::StringPool::instance().release(info.name);
+            }
+        });
+    }
+
+    void load_netlink(int proc_fd, std::string& buf) {
+        if (!read_file_at(proc_fd, "net/netlink", buf)) {
+            return;
+        }
+
+        bool header = true;
+        for_each_line(buf, [&](std::string_view line) {
+            // sk Eth Pid Groups Rmem Wmem Dump Locks Drops Inode
+            std::string_view fields[10];
+            uint64_t ino;
+            if (std::exchange(header, false) || split_fields(line, fields, 10) < 10 ||
+                !parse_decimal(fields[9], ino)) {
+                return;
+            }
+
+            FdInfo info;
+            info.type = FdType::NetlinkSocket;
+            info.ino = ino;
+            sockets_.emplace(ino, info);
+        });
+    }
+
+    std::unordered_map<uint64_t, FdInfo> sockets_;
+};
+
+struct ScannedFd {
+    core::FileDescriptor fd;
+    FdInfo info;                  // name holds a pool reference
+};
+
+struct ScannedProcess {
+    bool valid = false;
+    bool known = false;           // Already in the table, which keeps its ppid and known fds
+    core::ProcessID pid = 0;
+    core::ProcessID ppid = 0;
+    uint64_t start_time = 0;
+    uint32_t rss_kb = 0;
+    // One pool reference each, handed over to the threads by the merge
+    core::StringHandle exe = core::EMPTY_STRING_HANDLE;
+    core::StringHandle args = core::EMPTY_STRING_HANDLE;
+    core::StringHandle cwd = core::EMPTY_STRING_HANDLE;
+    core::StringHandle user = core::EMPTY_STRING_HANDLE;
+    core::StringHandle group = core::EMPTY_STRING_HANDLE;
+    core::StringHandle env = core::EMPTY_STRING_HANDLE;
+    std::vector<core::ThreadID> tids;
+    std::vector<ScannedFd> fds;
+    std::vector<core::FileDescriptor> kept_fds;   // Open and already in the table
+};
+
+// What reconciliation needs to know about a process already in the table.
+// Built before the workers start, they only read it.
+struct KnownProcess {
+    uint64_t start_time;
+    const FdTable* fds;
+};
+using KnownProcesses = std::unordered_map<core::ProcessID, KnownProcess>;
+
+// Per-worker scratch space, reused for every process
+struct WorkerBuffers {
+    std::vector<char> dirents = std::vector<char>(DIRENT_BUFFER);
+    std::string file;
+    std::string link;
+};
+
+class Scan {
+public:
+    Scan(const ProcScanConfig& config, int proc_fd, const SocketMap& sockets, const KnownProcesses& known,
+         uint64_t boot_time_ns)
+        : config_(config), proc_fd_(proc_fd), sockets_(sockets), known_(known), boot_time_ns_(boot_time_ns),
+          ns_per_tick_(1000000000ULL / static_cast<uint64_t>(std::max(sysconf(_SC_CLK_TCK), 1L))),
+          page_kb_(static_cast<uint64_t>(std::max(sysconf(_SC_PAGESIZE), 1024L)) / 1024) {}
+
+    mutable std::atomic<uint64_t> vanished{0};
+
+    void scan_process(core::ProcessID pid, WorkerBuffers& buffers, ScannedProcess& out) const {
+        char name[16];
+        std::snprintf(name, sizeof(name), "%d", pid);
+        ScopedFd pid_fd(open_dir_at(proc_fd_, name));
+        if (!pid_fd.valid() || !read_stat(pid_fd.get(), buffers.file, out)) {
+            vanished.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        out.valid = true;
+        out.pid = pid;
+
+        // Same pid and start time is the same process, but it may have
+        // exec'd, moved or changed credentials since, so the details are
+        // read again either way
+        const FdTable* known_fds = nullptr;
+        auto known = known_.find(pid);
+        if (known != known_.end() && known->second.start_time == out.start_time) {
+            out.known = true;
+            known_fds = known->second.fds;
+        }
+        read_details(pid_fd.get(), buffers, out);
+        if (config_.read_rss) {
+            read_statm(pid_fd.get(), buffers.file, out);
+        }
+
+        ScopedFd task_fd(open_dir_at(pid_fd.get(), "task"));
+        if (task_fd.valid()) {
+            list_dir(task_fd.get(), buffers.dirents, [&](const char* entry) {
+                uint64_t tid;
+                if (parse_decimal(entry, tid)) {
+                    out.tids.push_back(static_cast<core::ThreadID>(tid));
+                }
+            });
+        }
+        if (out.tids.empty()) {
+            out.tids.push_back(pid);
+        }
+
+        if (config_.scan_fds) {
+            scan_fds(pid_fd.get(), buffers, known_fds, out);
+        }
+    }
+
+private:
+    void read_details(int pid_fd, WorkerBuffers& buffers, ScannedProcess& out) const {
+        core::StringPool& pool = core::StringPool::instance();
+
+        if (read_file_at(pid_fd, "cmdline", buffers.file)) {
+            out.args = pool.intern(strip_trailing_nul(buffers.file));
+        }
+        if (readlink_at(pid_fd, "exe", buffers.link)) {
+            out.exe = pool.intern(buffers.link);
+        }
+        if (readlink_at(pid_fd, "cwd", buffers.link)) {
+            out.cwd = pool.intern(buffers.link);
+        }
+        if (config_.read_environ && read_file_at(pid_fd, "environ", buffers.file)) {
+            out.env = pool.intern(strip_trailing_nul(buffers.file));
+        }
+        read_status(pid_fd, buffers.file, out);
+    }
+
+    bool read_stat(int pid_fd, std::string& buf, ScannedProcess& out) const {
+        if (!read_file_at(pid_fd, "stat", buf)) {
+            return false;
+        }
+
+        // comm may contain anything, fields restart after its last ')'
+        size_t paren = buf.rfind(')');
+        if (paren == std::string::npos) {
+            return false;
+        }
+
+        // state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt
+        // cmajflt utime stime cutime cstime priority nice num_threads
+        // itrealvalue starttime
+        std::string_view fields[20];
+        if (split_fields(std::string_view(buf).substr(paren + 1), fields, 20) < 20) {
+            return false;
+        }
+
+        uint64_t ppid;
+        uint64_t start_ticks;
+        if (!parse_decimal(fields[1], ppid) || !parse_decimal(fields[19], start_ticks)) {
+            return false;
+        }
+        out.ppid = static_cast<core::ProcessID>(ppid);
+        out.start_time = boot_time_ns_ + start_ticks * ns_per_tick_;
+        return true;
+    }
+
+    void read_statm(int pid_fd, std::string& buf, ScannedProcess& out) const {
+        // size resident shared text lib data dt, in pages
+        std::string_view fields[2];
+        uint64_t pages;
+        if (read_file_at(pid_fd, "statm", buf) && split_fields(buf, fields, 2) == 2 &&
+            parse_decimal(fields[1], pages)) {
+            out.rss_kb = static_cast<uint32_t>(pages * page_kb_);
+        }
+    }
+
+    // Credentials are kept numeric, resolving names through NSS from every
+    // worker would cost more than the rest of the scan
+    void read_status(int pid_fd, std::string& buf, ScannedProcess& out) const {
+        if (!read_file_at(pid_fd, "status", buf)) {
+            return;
+        }
+
+        core::StringPool& pool = core::StringPool::instance();
+        for_each_line(buf, [&](std::string_view line) {
+            std::string_view fields[2];
+            if (split_fields(line, fields, 2) < 2) {
+                return;
+            }
+            if (fields[0] == "Uid:") {
+                pool.assign(out.user, fields[1]);
+            } else if (fields[0] == "Gid:") {
+                pool.assign(out.group, fields[1]);
+            }
+        });
+    }
+
+    // An fd the table already has keeps what events taught about it (open
+    // flags, endpoints) as long as its link still names the same file,
+    // socket or pipe; one closed and reopened as something else is read
+    // anew
+    void scan_fds(int pid_fd, WorkerBuffers& buffers, const FdTable* known_fds, ScannedProcess& out) const {
+        ScopedFd fd_dir(open_dir_at(pid_fd, "fd"));
+        if (!fd_dir.valid()) {
+            return;
+        }
+
+        list_dir(fd_dir.get(), buffers.dirents, [&](const char* entry) {
+            uint64_t fd;
+            if (!parse_decimal(entry, fd)) {
+                return;
+            }
+            if (!readlink_at(fd_dir.get(), entry, buffers.link)) {
+                return;
+            }
+            const FdInfo* known = known_fds ? known_fds->find(static_cast<core::FileDescriptor>(fd)) : nullptr;
+            if (known && same_fd(*known, buffers.link)) {
+                out.kept_fds.push_back(static_cast<core::FileDescriptor>(fd));
+                return;
+            }
+
+            ScannedFd scanned{static_cast<core::FileDescriptor>(fd), classify(buffers.link)};
+            out.fds.push_back(scanned);
+        });
+    }
+
+    bool same_fd(const FdInfo& known, std::string_view link) const {
+        uint64_t ino;
+        if (inode_of(link, "socket:[", ino) || inode_of(link, "pipe:[", ino)) {
+            return known.ino == ino;
+        }
+        if (known.name != core::EMPTY_STRING_HANDLE) {
+            return core::StringPool::instance().get(known.name) == link;
+        }
+        return known.type == classify_anon(link);
+    }
+
+    // Open flags would take one more read of fdinfo/<fd> per fd, so they're
+    // left for the live events to fill in
+    FdInfo classify(std::string_view link) const {
+        core::StringPool& pool = core::StringPool::instance();
+
+        FdInfo info;
+        if (!link.empty() && link[0] == '/') {
+            info.type = FdType::File;
+            info.name = pool.intern(link);
+            return info;
+        }
+
+        uint64_t ino;
+        if (inode_of(link, "socket:[", ino)) {
+            if (const FdInfo* socket = sockets_.find(ino)) {
+                info = *socket;
+                pool.retain(info.name);
+            } else {
+                // Lives in another network namespace
+                info.type = FdType::Unknown;
+                info.ino = ino;
+            }
+        } else if (inode_of(link, "pipe:[", ino)) {
+            info.type = FdType::Pipe;
+            info.ino = ino;
+        } else {
+            info.type = classify_anon(link);
+            if (info.type == FdType::Unknown) {
+                info.name = pool.intern(link);
+            }
+        }
+        return info;
+    }
+
+    static bool inode_of(std::string_view link, std::string_view prefix, uint64_t& ino) {
+        return link.size() > prefix.size() + 1 && link.compare(0, prefix.size(), prefix) == 0 && link.back() == ']' &&
+               parse_decimal(link.substr(prefix.size(), link.size() - prefix.size() - 1), ino);
+    }
+
+    static FdType classify_anon(std::string_view link) {
+        if (link == "anon_inode:[eventfd]") {
+            return FdType::EventFd;
+        } else if (link == "anon_inode:[signalfd]") {
+            return FdType::SignalFd;
+        } else if (link == "anon_inode:[eventpoll]") {
+            return FdType::EventPoll;
+        } else if (link == "anon_inode:inotify") {
+            return FdType::Inotify;
+        } else if (link == "anon_inode:[timerfd]") {
+            return FdType::TimerFd;
+        }
+        return FdType::Unknown;
+    }
+
+    const ProcScanConfig& config_;
+    int proc_fd_;
+    const SocketMap& sockets_;
+    const KnownProcesses& known_;
+    uint64_t boot_time_ns_;
+    uint64_t ns_per_tick_;
+    uint64_t page_kb_;
+};
+
+uint64_t read_boot_time_ns(int proc_fd, std::string& buf) {
+    uint64_t btime = 0;
+    if (read_file_at(proc_fd, "stat", buf)) {
+        for_each_line(buf, [&](std::string_view line) {
+            std::string_view fields[2];
+            if (split_fields(line, fields, 2) == 2 && fields[0] == "btime") {
+                parse_decimal(fields[1], btime);
+            }
+        });
+    }
+    return btime * 1000000000ULL;
+}
+
+void merge_threads(ThreadTable& table, const ScannedProcess& process) {
+    core::StringPool& pool = core::StringPool::instance();
+
+    auto set = [&](core::StringHandle& field, core::StringHandle value) {
+        pool.retain(value);
+        pool.release(field);
+        field = value;
+    };
+
+    for (core::ThreadID tid : process.tids) {
+        ThreadInfo* info = table.get_or_add(tid);
+        info->pid = process.pid;
+        info->ppid = process.ppid;
+        info->start_time = process.start_time;
+        set(info->exe, process.exe);
+        set(info->args, process.args);
+        set(info->cwd, process.cwd);
+        set(info->user, process.user);
+        set(info->group, process.group);
+        set(info->env, process.env);
+    }
+
+    for (core::StringHandle handle : {process.exe, process.args, process.cwd, process.user, process.group, process.env}) {
+        pool.release(handle);
+    }
+}
+
+// A known process keeps its ppid from the table: that's the history a
+// restart would otherwise lose. The details are the ones just read, or the
+// table's where /proc wouldn't tell. Threads started since are copied from
+// the main thread.
+void merge_known_threads(ThreadTable& table, const ScannedProcess& process) {
+    core::StringPool& pool = core::StringPool::instance();
+    constexpr core::StringHandle ThreadInfo::*FIELDS[] = {&ThreadInfo::exe,  &ThreadInfo::args,  &ThreadInfo::cwd,
+                                                         &ThreadInfo::user, &ThreadInfo::group, &ThreadInfo::env};
+    const core::StringHandle scanned[] = {process.exe,  process.args,  process.cwd,
+                                          process.user, process.group, process.env};
+
+    ThreadInfo main = *table.find(process.pid);
+    for (core::ThreadID tid : process.tids) {
+        bool added;
+        ThreadInfo* info = table.get_or_add(tid, &added);
+        if (added) {
+            info->pid = main.pid;
+            info->ppid = main.ppid;
+            info->start_time = main.start_time;
+        }
+        for (size_t i = 0; i < std::size(FIELDS); ++i) {
+            core::StringHandle value = scanned[i] != core::EMPTY_STRING_HANDLE ? scanned[i] : main.*FIELDS[i];
+            pool.retain(value);
+            if (!added) {
+                pool.release(info->*FIELDS[i]);
+            }
+            info->*FIELDS[i] = value;
+        }
+    }
+
+    for (core::StringHandle handle : scanned) {
+        pool.release(handle);
+    }
+}
+
+void merge(ThreadTable& table, ScannedProcess& process, bool scan_fds, ProcScanStats& stats) {
+    if (process.known) {
+        merge_known_threads(table, process);
+        ++stats.reused;
+    } else {
+        merge_threads(table, process);
+    }
+    if (ThreadInfo* main = table.find(process.pid)) {
+        main->rss_kb = process.rss_kb;
+    }
+    stats.threads += process.tids.size();
+    stats.fds += process.fds.size() + process.kept_fds.size();
+
+    const ThreadTable& const_table = table;
+    if (!scan_fds || (!process.known && process.fds.empty() && !const_table.fd_table(process.tids.front()))) {
+        return;
+    }
+
+    // The process' main thread comes first in task/ unless it already
+    // exited, the table is shared through it either way
+    FdTable* fds = table.fd_table(process.tids.front());
+    if (process.known) {
+        std::sort(process.kept_fds.begin(), process.kept_fds.end());
+        std::vector<core::FileDescriptor> closed;
+        fds->for_each([&](core::FileDescriptor fd, const FdInfo&) {
+            if (!std::binary_search(process.kept_fds.begin(), process.kept_fds.end(), fd)) {
+                closed.push_back(fd);
+            }
+        });
+        for (core::FileDescriptor fd : closed) {
+            fds->erase(fd);
+        }
+    } else {
+        fds->clear();
+    }
+
+    for (const ScannedFd& scanned : process.fds) {
+        *fds->add(scanned.fd, scanned.info.type) = scanned.info;
+    }
+}
+
+// Drops what the scan didn't see, except dead processes that are ancestors
+// of live ones
+void prune(ThreadTable& table, const std::vector<ScannedProcess>& results, ProcScanStats& stats) {
+    std::unordered_set<core::ThreadID> seen;
+    for (const ScannedProcess& process : results) {
+        if (process.valid) {
+            seen.insert(process.tids.begin(), process.tids.end());
+        }
+    }
+
+    std::unordered_set<core::ProcessID> ancestors;
+    for (const ScannedProcess& process : results) {
+        if (!process.valid) {
+            continue;
+        }
+        const ThreadInfo* info = table.find(process.pid);
+        core::ProcessID ppid = info ? info->ppid : process.ppid;
+        while (ppid > 0 && !seen.count(ppid) && ancestors.insert(ppid).second) {
+            const ThreadInfo* parent = table.find(ppid);
+            if (!parent) {
+                break;
+            }
+            ppid = parent->ppid;
+        }
+    }
+
+    std::vector<core::ThreadID> dead;
+    std::vector<core::ThreadID> history;
+    table.for_each([&](const ThreadInfo& info) {
+        if (seen.count(info.tid)) {
+            return;
+        }
+        if (info.is_main_thread() && ancestors.count(info.pid)) {
+            history.push_back(info.tid);
+        } else {
+            dead.push_back(info.tid);
+        }
+    });
+
+    for (core::ThreadID tid : dead) {
+        table.erase(tid);
+    }
+    for (core::ThreadID tid : history) {
+        if (table.find(tid)->fd_table != ThreadInfo::NO_FD_TABLE) {
+            table.fd_table(tid)->clear();
+        }
+    }
+    stats.pruned = dead.size();
+}
+
+} // namespace
+
+std::string ProcScanStats::to_string() const {
+    auto ms = [](uint64_t ns) { return static_cast<double>(ns) / 1e6; };
+
+    char buf[512];
+    std::snprintf(buf, sizeof(buf),
+                  "%llu processes, %llu threads, %llu fds, %llu sockets in %.1f ms with %u workers "
+                  "(list %.1f ms, sockets %.1f ms, processes %.1f ms, merge %.1f ms), %llu vanished, "
+                  "%llu reused, %llu pruned",
+                  static_cast<unsigned long long>(processes), static_cast<unsigned long long>(threads),
+                  static_cast<unsigned long long>(fds), static_cast<unsigned long long>(sockets), ms(total_ns),
+                  workers, ms(list_ns), ms(sockets_ns), ms(processes_ns), ms(merge_ns),
+                  static_cast<unsigned long long>(vanished), static_cast<unsigned long long>(reused),
+                  static_cast<unsigned long long>(pruned));
+    return buf;
+}
+
+ProcScanner::ProcScanner(ProcScanConfig config) : config_(std::move(config)) {}
+
+core::Result<ProcScanStats> ProcScanner::scan(ThreadTable& table) const {
+    Clock::time_point start = Clock::now();
+    ProcScanStats stats;
+
+    ScopedFd proc_fd(open_dir_at(AT_FDCWD, config_.proc_root.c_str()));
+    if (!proc_fd.valid()) {
+        LOG_ERROR("Cannot open " << config_.proc_root << ": " << std::strerror(errno));
+        return core::ErrorCode::SystemError;
+    }
+
+    // Phase 1: pids
+    Clock::time_point phase = Clock::now();
+    WorkerBuffers main_buffers;
+    std::vector<core::ProcessID> pids;
+    bool listed = list_dir(proc_fd.get(), main_buffers.dirents, [&](const char* entry) {
+        uint64_t pid;
+        if (parse_decimal(entry, pid)) {
+            pids.push_back(static_cast<core::ProcessID>(pid));
+        }
+    });
+    if (!listed) {
+        LOG_ERROR("Cannot list " << config_.proc_root << ": " << std::strerror(errno));
+        return core::ErrorCode::SystemError;
+    }
+    uint64_t boot_time_ns = read_boot_time_ns(proc_fd.get(), main_buffers.file);
+    stats.list_ns = elapsed_ns(phase);
+
+    // Phase 2: socket tables, needed to resolve socket fds
+    phase = Clock::now();
+    SocketMap sockets;
+    if (config_.scan_fds && config_.scan_sockets) {
+        sockets.load(proc_fd.get(), main_buffers.file);
+    }
+    stats.sockets = sockets.size();
+    stats.sockets_ns = elapsed_ns(phase);
+
+    // Phase 3: processes. Workers pull small batches off a shared cursor and
+    // write to their own slots of the results, nothing else is shared.
+    phase = Clock::now();
+    uint32_t workers = config_.workers ? config_.workers : std::max(1u, std::thread::hardware_concurrency());
+    workers = static_cast<uint32_t>(std::max<size_t>(1, std::min<size_t>(workers, pids.size() / WORK_BATCH + 1)));
+    stats.workers = workers;
+
+    KnownProcesses known;
+    if (config_.reconcile) {
+        table.for_each([&](const ThreadInfo& info) {
+            if (info.is_main_thread()) {
+                known.emplace(info.pid, KnownProcess{info.start_time, nullptr});
+            }
+        });
+        for (auto& [pid, process] : known) {
+            process.fds = static_cast<const ThreadTable&>(table).fd_table(pid);
+        }
+    }
+
+    Scan scan(config_, proc_fd.get(), sockets, known, boot_time_ns);
+    std::vector<ScannedProcess> results(pids.size());
+    std::atomic<size_t> cursor{0};
+
+    auto work = [&](WorkerBuffers& buffers) {
+        for (;;) {
+            size_t begin = cursor.fetch_add(WORK_BATCH, std::memory_order_relaxed);
+            if (begin >= pids.size()) {
+                return;
+            }
+            size_t end = std::min(begin + WORK_BATCH, pids.size());
+            for (size_t i = begin; i < end; ++i) {
+                scan.scan_process(pids[i], buffers, results[i]);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+    for (uint32_t i = 1; i < workers; ++i) {
+        threads.emplace_back([&] {
+            WorkerBuffers buffers;
+            work(buffers);
+        });
+    }
+    work(main_buffers);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    stats.vanished = scan.vanished.load();
+    stats.processes_ns = elapsed_ns(phase);
+
+    // Phase 4: merge
+    phase = Clock::now();
+    for (ScannedProcess& process : results) {
+        if (process.valid) {
+            ++stats.processes;
+            merge(table, process, config_.scan_fds, stats);
+        }
+    }
+    if (config_.reconcile) {
+        prune(table, results, stats);
+    }
+    // Parents and children come in pid order, which isn't creation order
+    table.rebuild_process_tree();
+    stats.merge_ns = elapsed_ns(phase);
+
+    stats.total_ns = elapsed_ns(start);
+    LOG_INFO("Scanned " << config_.proc_root << ": " << stats.to_string());
+    return stats;
+}
+
+} // namespace sinsp
+} // namespace deepsys
@@ -0,0 +1,683 @@
+#include "sinsp/ruleset.h"
+
+#include <core/logger.h>
+#include <sinsp/filter_cache.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Saved ruleset: a header, then the body it checksums. Integers are in the
+// writer's byte order, strings are a 32-bit length and the bytes.
+constexpr char RULESET_MAGIC[8] = {'D', 'S', 'Y', 'S', 'R', 'U', 'L', 'E'};
+constexpr uint32_t RULESET_VERSION = 2;
+constexpr uint32_t RULESET_BYTE_ORDER = 0x01020304;
+
+struct RulesetHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t body_size;
+    uint64_t event_table;       // event_table_hash() of the writer
+    uint64_t checksum;          // FNV-1a of the body
+};
+
+constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+
+uint64_t fnv1a(const char* data, size_t size, uint64_t hash = FNV_OFFSET) {
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Saved rules hold event type numbers, and their types come from the names
+// and flags, so a table that renumbered, renamed or reflagged a type can't
+// load them
+uint64_t event_table_hash() {
+    uint64_t hash = FNV_OFFSET;
+    for (size_t type = 0; type < event_type_count(); ++type) {
+        const char* name = event_name(static_cast<EventType>(type));
+        uint32_t flags = event_flags(static_cast<EventType>(type));
+        hash = fnv1a(name, std::strlen(name) + 1, hash);
+        hash = fnv1a(reinterpret_cast<const char*>(&flags), sizeof(flags), hash);
+    }
+    return hash;
+}
+
+class Writer {
+public:
+    template<typename T>
+    void put(T value) {
+        out_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void put_string(const std::string& text) {
+        put(static_cast<uint32_t>(text.size()));
+        out_ += text;
+    }
+
+    const std::string& data() const { return out_; }
+
+private:
+    std::string out_;
+};
+
+// Bounds checked; once a read fails every later one does
+class Reader {
+public:
+    Reader(const char* data, size_t size) : pos_(data), end_(data + size) {}
+
+    template<typename T>
+    bool get(T& value) {
+        if (!ok_ || static_cast<size_t>(end_ - pos_) < sizeof(value)) {
+            return ok_ = false;
+        }
+        std::memcpy(&value, pos_, sizeof(value));
+        pos_ += sizeof(value);
+        return true;
+    }
+
+    bool get_string(std::string& text) {
+        uint32_t size;
+        if (!get(size) || static_cast<size_t>(end_ - pos_) < size) {
+            return ok_ = false;
+        }
+        text.assign(pos_, size);
+        pos_ += size;
+        return true;
+    }
+
+    bool ok() const { return ok_; }
+    bool done() const { return pos_ == end_; }
+
+private:
+    const char* pos_;
+    const char* end_;
+    bool ok_ = true;
+};
+
+// Gets the program of every comparison under node from FilterCache. Those
+// are all that can fail to compile, not the and/or/not around them.
+core::Result<void> get_predicates(const FilterNode& node, std::vector<std::shared_ptr<const CompiledFilter>>& out) {
+    if (node.kind != FilterNode::Kind::Compare) {
+        for (const FilterNodePtr& child : node.children) {
+            auto result = get_predicates(*child, out);
+            if (!result) {
+                return result;
+            }
+        }
+        return {};
+    }
+    auto compiled = FilterCache::instance().get(node);
+    if (!compiled) {
+        return compiled.error();
+    }
+    out.push_back(std::move(compiled.value()));
+    return {};
+}
+
+bool read_file(const std::string& path, std::string& out) {
+    FILE* file = std::fopen(path.c_str(), "re");
+    if (!file) {
+        return false;
+    }
+    char buf[65536];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), file)) > 0) {
+        out.append(buf, n);
+    }
+    bool ok = !std::ferror(file);
+    std::fclose(file);
+    return ok;
+}
+
+} // namespace
+
+Ruleset::Ruleset() : by_type_(event_type_count()) {}
+
+core::Result<RuleId> Ruleset::add(std::string_view name, std::string_view expression) {
+    auto root = parse_filter(expression);
+    if (!root) {
+        return root.error();
+    }
+    // Checks the rule before any node is added, and holds the programs so
+    // that intern() finds them in the cache
+    std::vector<std::shared_ptr<const CompiledFilter>> programs;
+    auto checked = get_predicates(*root.value(), programs);
+    if (!checked) {
+        return checked.error();
+    }
+
+    RuleId id = static_cast<RuleId>(rules_.size());
+    Rule rule;
+    rule.name = std::string(name);
+    rule.expression = std::string(expression);
+    rule.root = intern(*root.value());
+    rule.types = filter_event_types(*root.value());
+    rules_.push_back(std::move(rule));
+    index_rule(id);
+    return id;
+}
+
+void Ruleset::index_rule(RuleId id) {
+    const EventTypeSet& types = rules_[id].types;
+    for (EventType type : types.types()) {
+        by_type_[type].push_back(id);
+    }
+    if (types == EventTypeSet::all()) {
+        any_type_.push_back(id);
+    }
+}
+
+core::Result<void> Ruleset::save(const std::string& path) const {
+    Writer body;
+    body.put(static_cast<uint32_t>(event_type_count()));
+
+    // Keys of the nodes, so rules added after a load still share them
+    std::vector<const std::string*> keys(nodes_.size());
+    for (const auto& entry : index_) {
+        keys[entry.second] = &entry.first;
+    }
+    body.put(static_cast<uint32_t>(nodes_.size()));
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        body.put(static_cast<uint8_t>(nodes_[i].kind));
+        body.put(nodes_[i].first);
+        body.put(nodes_[i].count);
+        body.put_string(*keys[i]);
+    }
+    body.put(static_cast<uint32_t>(children_.size()));
+    for (uint32_t child : children_) {
+        body.put(child);
+    }
+    body.put(static_cast<uint32_t>(predicates_.size()));
+    for (const auto& predicate : predicates_) {
+        body.put_string(predicate->normalized);
+    }
+    body.put(static_cast<uint32_t>(rules_.size()));
+    for (const Rule& rule : rules_) {
+        body.put_string(rule.name);
+        body.put_string(rule.expression);
+        body.put(rule.root);
+        std::vector<EventType> types = rule.types.types();
+        body.put(static_cast<uint32_t>(types.size()));
+        for (EventType type : types) {
+            body.put(type);
+        }
+    }
+
+    RulesetHeader header;
+    std::memcpy(header.magic, RULESET_MAGIC, sizeof(header.magic));
+    header.version = RULESET_VERSION;
+    header.byte_order = RULESET_BYTE_ORDER;
+    header.body_size = body.data().size();
+    header.event_table = event_table_hash();
+    header.checksum = fnv1a(body.data().data(), body.data().size());
+
+    std::string temp = path + ".tmp";
+    FILE* file = std::fopen(temp.c_str(), "we");
+    if (!file) {
+        LOG_WARNING("Can't write ruleset " << temp);
+        return core::ErrorCode::SystemError;
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(body.data().data(), 1, body.data().size(), file) == body.data().size();
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+        LOG_WARNING("Can't write ruleset " << path);
+        std::remove(temp.c_str());
+        return core::ErrorCode::SystemError;
+    }
+    return {};
+}
+
+core::Result<void> Ruleset::load(const std::string& path) {
+    if (!rules_.empty() || !nodes_.empty()) {
+        return core::ErrorCode::InvalidArgument;
+    }
+    std::string data;
+    if (!read_file(path, data)) {
+        return core::ErrorCode::SystemError;
+    }
+
+    RulesetHeader header;
+    if (data.size() < sizeof(header)) {
+        LOG_WARNING("Ruleset " << path << " is truncated");
+        return core::ErrorCode::InvalidArgument;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, RULESET_MAGIC, sizeof(header.magic)) != 0 || header.version != RULESET_VERSION ||
+        header.byte_order != RULESET_BYTE_ORDER) {
+        LOG_WARNING("Ruleset " << path << " has an unsupported format");
+        return core::ErrorCode::InvalidArgument;
+    }
+    if (header.event_table != event_table_hash()) {
+        LOG_WARNING("Ruleset " << path << " was saved against another event table");
+        return core::ErrorCode::InvalidArgument;
+    }
+    const char* body = data.data() + sizeof(header);
+    if (header.body_size != data.size() - sizeof(header) || fnv1a(body, header.body_size) != header.checksum) {
+        LOG_WARNING("Ruleset " << path << " is corrupted");
+        return core::ErrorCode::InvalidArgument;
+    }
+
+    // Read into locals and check every index before any of it is kept
+    Reader in(body, header.body_size);
+    uint32_t type_count = 0;
+    in.get(type_count);
+    if (in.ok() && type_count != event_type_count()) {
+        LOG_WARNING("Ruleset " << path << " was saved against another event table");
+        return core::ErrorCode::InvalidArgument;
+    }
+
+    uint32_t count = 0;
+    std::vector<Node> nodes;
+    std::vector<std::string> keys;
+    in.get(count);
+    for (uint32_t i = 0; i < count && in.ok(); ++i) {
+        uint8_t kind = 0;
+        Node node{};
+        std::string key;
+        in.get(kind);
+        in.get(node.first);
+        in.get(node.count);
+        in.get_string(key);
+        node.kind = static_cast<FilterNode::Kind>(kind);
+        nodes.push_back(node);
+        keys.push_back(std::move(key));
+    }
+    std::vector<uint32_t> children;
+    in.get(count);
+    for (uint32_t i = 0; i < count && in.ok(); ++i) {
+        uint32_t child = 0;
+        in.get(child);
+        children.push_back(child);
+    }
+    std::vector<std::string> predicates;
+    in.get(count);
+    for (uint32_t i = 0; i < count && in.ok(); ++i) {
+        std::string text;
+        in.get_string(text);
+        predicates.push_back(std::move(text));
+    }
+    std::vector<Rule> rules;
+    in.get(count);
+    for (uint32_t i = 0; i < count && in.ok(); ++i) {
+        Rule rule;
+        uint32_t types = 0;
+        in.get_string(rule.name);
+        in.get_string(rule.expression);
+        in.get(rule.root);
+        in.get(types);
+        for (uint32_t t = 0; t < types && in.ok(); ++t) {
+            EventType type = 0;
+            in.get(type);
+            if (type < type_count) {
+                rule.types.set(type);
+            }
+        }
+        rules.push_back(std::move(rule));
+    }
+
+    // The shapes intern() makes, with every child before its parent, so
+    // eval() stays in bounds and can't recurse forever
+    bool valid = in.ok() && in.done();
+    for (size_t i = 0; valid && i < nodes.size(); ++i) {
+        const Node& node = nodes[i];
+        switch (node.kind) {
+            case FilterNode::Kind::Compare:
+                valid = node.first < predicates.size();
+                continue;
+            case FilterNode::Kind::Not:
+                valid = node.count == 1;
+                break;
+            case FilterNode::Kind::And:
+            case FilterNode::Kind::Or:
+                valid = node.count >= 2;
+                break;
+            default:
+                valid = false;
+                continue;
+        }
+        valid = valid && uint64_t(node.first) + node.count <= children.size();
+        for (uint32_t c = 0; valid && c < node.count; ++c) {
+            valid = children[node.first + c] < i;
+        }
+    }
+    for (size_t i = 0; valid && i < rules.size(); ++i) {
+        valid = rules[i].root < nodes.size();
+    }
+    if (!valid) {
+        LOG_WARNING("Ruleset " << path << " is inconsistent");
+        return core::ErrorCode::InvalidArgument;
+    }
+
+    std::vector<std::shared_ptr<const CompiledFilter>> programs;
+    for (const std::string& text : predicates) {
+        auto compiled = FilterCache::instance().get(text);
+        if (!compiled) {
+            return compiled.error();
+        }
+        programs.push_back(std::move(compiled.value()));
+    }
+
+    predicates_ = std::move(programs);
+    children_ = std::move(children);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        add_node(std::move(keys[i]), nodes[i]);
+    }
+    rules_ = std::move(rules);
+    for (RuleId id = 0; id < rules_.size(); ++id) {
+        index_rule(id);
+    }
+    return {};
+}
+
+uint32_t Ruleset::intern(const FilterNode& node) {
+    switch (node.kind) {
+        case FilterNode::Kind::Compare: {
+            std::string key = "c " + to_string(node);
+            auto it = index_.find(key);
+            if (it != index_.end()) {
+                ++shared_;
+                return it->second;
+            }
+            // Checked by add() already
+            predicates_.push_back(FilterCache::instance().get(node).value());
+            return add_node(std::move(key), {node.kind, static_cast<uint32_t>(predicates_.size() - 1), 0});
+        }
+        case FilterNode::Kind::Not: {
+            uint32_t child = intern(*node.children[0]);
+            std::string key = "n " + std::to_string(child);
+            auto it = index_.find(key);
+            if (it != index_.end()) {
+                ++shared_;
+                return it->second;
+            }
+            children_.push_back(child);
+            return add_node(std::move(key), {node.kind, static_cast<uint32_t>(children_.size() - 1), 1});
+        }
+        case FilterNode::Kind::And:
+        case FilterNode::Kind::Or:
+            break;
+    }
+
+    // Operands in node order, duplicates dropped: "b and a and b" is "a and b"
+    std::vector<uint32_t> operands;
+    std::vector<std::vector<const FilterNode*>> groups;
+    if (node.kind == FilterNode::Kind::Or) {
+        groups = match_groups(node);
+    }
+    for (const FilterNodePtr& child : node.children) {
+        bool grouped = std::any_of(groups.begin(), groups.end(), [&](const auto& group) {
+            return std::find(group.begin(), group.end(), child.get()) != group.end();
+        });
+        if (!grouped) {
+            operands.push_back(intern(*child));
+        }
+    }
+    for (const auto& group : groups) {
+        operands.push_back(intern_group(group));
+    }
+    std::sort(operands.begin(), operands.end());
+    operands.erase(std::unique(operands.begin(), operands.end()), operands.end());
+    if (operands.size() == 1) {
+        return operands[0];
+    }
+
+    std::string key = node.kind == FilterNode::Kind::And ? "a" : "o";
+    for (uint32_t operand : operands) {
+        key += ' ';
+        key += std::to_string(operand);
+    }
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        ++shared_;
+        return it->second;
+    }
+    uint32_t first = static_cast<uint32_t>(children_.size());
+    children_.insert(children_.end(), operands.begin(), operands.end());
+    return add_node(std::move(key), {node.kind, first, static_cast<uint32_t>(operands.size())});
+}
+
+std::vector<std::vector<const FilterNode*>> Ruleset::match_groups(const FilterNode& node) {
+    std::vector<std::vector<const FilterNode*>> groups;
+    for (const FilterNodePtr& child : node.children) {
+        if (child->kind != FilterNode::Kind::Compare || field_info(child->field).type != FieldType::String ||
+            (child->op != CompareOp::Contains && child->op != CompareOp::StartsWith)) {
+            continue;
+        }
+        auto it = std::find_if(groups.begin(), groups.end(), [&](const auto& group) {
+            return group[0]->field == child->field && group[0]->op == child->op;
+        });
+        if (it == groups.end()) {
+            groups.push_back({child.get()});
+        } else {
+            it->push_back(child.get());
+        }
+    }
+    groups.erase(std::remove_if(groups.begin(), groups.end(),
+                                [](const auto& group) { return group.size() < FilterCompiler::CONTAINS_ANY_MIN; }),
+                 groups.end());
+    return groups;
+}
+
+uint32_t Ruleset::intern_group(const std::vector<const FilterNode*>& group) {
+    // Canonical like any other operand list: sorted, duplicates dropped
+    std::vector<std::string> texts;
+    for (const FilterNode* leaf : group) {
+        texts.push_back(to_string(*leaf));
+    }
+    std::vector<size_t> order(group.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return texts[a] < texts[b]; });
+    order.erase(std::unique(order.begin(), order.end(), [&](size_t a, size_t b) { return texts[a] == texts[b]; }),
+                order.end());
+
+    FilterNode any;
+    any.kind = FilterNode::Kind::Or;
+    for (size_t i : order) {
+        auto leaf = std::make_unique<FilterNode>();
+        leaf->field = group[i]->field;
+        leaf->op = group[i]->op;
+        leaf->values = group[i]->values;
+        any.children.push_back(std::move(leaf));
+    }
+    if (any.children.size() == 1) {
+        return intern(*any.children[0]);
+    }
+
+    std::string key = "c " + to_string(any);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        ++shared_;
+        return it->second;
+    }
+    predicates_.push_back(FilterCache::instance().get(any).value());
+    return add_node(std::move(key), {FilterNode::Kind::Compare, static_cast<uint32_t>(predicates_.size() - 1), 0});
+}
+
+uint32_t Ruleset::add_node(std::string key, Node node) {
+    uint32_t id = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(node);
+    index_.emplace(std::move(key), id);
+    memo_epoch_.push_back(0);
+    memo_value_.push_back(0);
+    node_stats_.emplace_back();
+    return id;
+}
+
+void Ruleset::evaluate(FieldCache& fields, std::vector<RuleId>& matches) {
+    const FilterEvent& event = fields.event();
+    ++events_;
+    if (++epoch_ == 0) {
+        std::fill(memo_epoch_.begin(), memo_epoch_.end(), 0);
+        epoch_ = 1;
+    }
+
+    const std::vector<RuleId>& candidates = event.event.id < by_type_.size() ? by_type_[event.event.id] : any_type_;
+    for (RuleId id : candidates) {
+        Rule& rule = rules_[id];
+        ++rule.stats.evaluations;
+        bool timed = start_sample(rule.sample_in);
+        Clock::time_point start;
+        if (timed) {
+            start = Clock::now();
+        }
+
+        bool hit = eval(rule.root, fields);
+
+        if (timed) {
+            rule.stats.cost_ns += static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+            ++rule.stats.cost_samples;
+            timing_ = false;
+        }
+        if (hit) {
+            ++rule.stats.hits;
+            matches.push_back(id);
+        }
+    }
+
+    if (reorder_interval_ && events_ % reorder_interval_ == 0) {
+        reorder();
+    }
+}
+
+bool Ruleset::eval(uint32_t index, FieldCache& fields) {
+    if (memo_epoch_[index] == epoch_) {
+        return memo_value_[index];
+    }
+    ++node_evaluations_;
+
+    // Timing includes the children: what matters for ordering is what
+    // evaluating the node costs its parent
+    NodeStats& stats = node_stats_[index];
+    ++stats.evaluations;
+    bool timed = start_sample(stats.sample_in);
+    Clock::time_point start;
+    if (timed) {
+        start = Clock::now();
+    }
+
+    const Node& node = nodes_[index];
+    bool value = false;
+    switch (node.kind) {
+        case FilterNode::Kind::Compare:
+            value = predicates_[node.first]->program.run(fields);
+            break;
+        case FilterNode::Kind::Not:
+            value = !eval(children_[node.first], fields);
+            break;
+        case FilterNode::Kind::And:
+            value = true;
+            for (uint32_t i = 0; i < node.count && value; ++i) {
+                value = eval(children_[node.first + i], fields);
+            }
+            break;
+        case FilterNode::Kind::Or:
+            for (uint32_t i = 0; i < node.count && !value; ++i) {
+                value = eval(children_[node.first + i], fields);
+            }
+            break;
+    }
+
+    if (timed) {
+        stats.cost_ns += static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        ++stats.cost_samples;
+        timing_ = false;
+    }
+    stats.hits += value;
+
+    memo_epoch_[index] = epoch_;
+    memo_value_[index] = value;
+    return value;
+}
+
+// One clock runs at a time, so no sample pays for another's clock reads.
+// A node evaluated under a running clock is timed on its next evaluation
+// instead, which also keeps a node from falling in step with its parent.
+bool Ruleset::start_sample(uint32_t& sample_in) {
+    if (sample_in) {
+        --sample_in;
+        return false;
+    }
+    if (timing_) {
+        return false;
+    }
+    sample_in = COST_SAMPLE - 1;
+    timing_ = true;
+    return true;
+}
+
+void Ruleset::reorder() {
+    std::vector<std::pair<double, uint32_t>> ranked;
+    for (const Node& node : nodes_) {
+        if (node.kind != FilterNode::Kind::And && node.kind != FilterNode::Kind::Or) {
+            continue;
+        }
+        // Operands that never got timed leave the order as it is
+        ranked.clear();
+        for (uint32_t i = 0; i < node.count; ++i) {
+            uint32_t child = children_[node.first + i];
+            const NodeStats& stats = node_stats_[child];
+            if (!stats.cost_samples) {
+                break;
+            }
+            double truth = (double(stats.hits) + 1.0) / (double(stats.evaluations) + 2.0);
+            double decisive = node.kind == FilterNode::Kind::And ? 1.0 - truth : truth;
+            double cost = std::max(double(stats.cost_ns) / double(stats.cost_samples), 1.0);
+            ranked.emplace_back(cost / decisive, child);
+        }
+        if (ranked.size() != node.count) {
+            continue;
+        }
+
+        std::stable_sort(ranked.begin(), ranked.end(),
+                         [](const auto& a, const auto& b) { return a.first < b.first; });
+        bool changed = false;
+        for (uint32_t i = 0; i < node.count; ++i) {
+            uint32_t& slot = children_[node.first + i];
+            changed = changed || slot != ranked[i].second;
+            slot = ranked[i].second;
+        }
+        reorders_ += changed;
+    }
+
+    for (NodeStats& stats : node_stats_) {
+        stats.evaluations /= 2;
+        stats.hits /= 2;
+        stats.cost_samples /= 2;
+        stats.cost_ns /= 2;
+    }
+}
+
+Ruleset::Stats Ruleset::get_stats() const {
+    Stats stats;
+    stats.rules = rules_.size();
+    stats.nodes = nodes_.size();
+    stats.predicates = predicates_.size();
+    stats.shared = shared_;
+    stats.events = events_;
+    for (const Rule& rule : rules_) {
+        stats.rule_evaluations += rule.stats.evaluations;
+    }
+    stats.node_evaluations = node_evaluations_;
+    stats.reorders = reorders_;
+    return stats;
+}
+
+} // namespace sinsp
+} // namespace deepsys
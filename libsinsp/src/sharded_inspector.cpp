@@ -0,0 +1,534 @@
+#include "sinsp/sharded_inspector.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+constexpr size_t MAX_SHARDS = 64;
+
+// Spins briefly, then yields, then sleeps, so an idle shard costs little
+// but a busy one reacts within a few hundred nanoseconds
+void backoff(uint32_t& idle) {
+    ++idle;
+    if (idle < 64) {
+        return;
+    }
+    if (idle < 1024) {
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+void copy_strings(const ThreadInfo& from, ThreadInfo& to) {
+    core::StringPool& pool = core::StringPool::instance();
+    for (core::StringHandle handle : {from.exe, from.args, from.cwd, from.user, from.group, from.env}) {
+        pool.retain(handle);
+    }
+    to.exe = from.exe;
+    to.args = from.args;
+    to.cwd = from.cwd;
+    to.user = from.user;
+    to.group = from.group;
+    to.env = from.env;
+}
+
+void copy_fds(const FdTable& from, FdTable& to) {
+    from.for_each([&](core::FileDescriptor fd, const FdInfo& info) {
+        core::StringPool::instance().retain(info.name);
+        *to.add(fd, info.type) = info;
+    });
+}
+
+uint64_t shard_bit(size_t shard) {
+    return uint64_t(1) << shard;
+}
+
+} // namespace
+
+// A parent's state on its way to the shard of a child forked elsewhere.
+// The strings and fd names hold references that move into the child.
+struct ShardedInspector::Handoff {
+    std::atomic<bool> ready{false};
+    bool found = false;
+    ThreadInfo parent;
+    std::vector<std::pair<core::FileDescriptor, FdInfo>> fds;
+};
+
+ShardedInspector::ShardedInspector(ShardedInspectorConfig config, Handler handler)
+    : config_(std::move(config)), handler_(std::move(handler)) {
+    size_t count = config_.shards;
+    if (count == 0) {
+        unsigned cores = std::thread::hardware_concurrency();
+        count = cores > 1 ? cores - 1 : 1;
+    }
+    count = std::min(count, MAX_SHARDS);
+
+    ThreadTableLimits limits = config_.limits;
+    limits.memory_budget /= count;
+
+    for (size_t i = 0; i < count; ++i) {
+        shards_.push_back(std::make_unique<Shard>(config_.queue_capacity));
+        shards_.back()->index = i;
+        shards_.back()->table.set_limits(limits);
+    }
+    for (auto& shard : shards_) {
+        Shard* current = shard.get();
+        shard->worker = std::thread([this, current] { run(*current); });
+    }
+}
+
+ShardedInspector::~ShardedInspector() {
+    // Outputs nobody is going to poll anymore are dropped
+    stopping_.store(true, std::memory_order_relaxed);
+    Entry stop;
+    stop.role = Role::Stop;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        push(i, stop, {});
+    }
+    for (auto& shard : shards_) {
+        shard->worker.join();
+    }
+}
+
+void ShardedInspector::load(const ThreadTable& table) {
+    table.for_each([&](const ThreadInfo& info) {
+        if (info.has_exited()) {
+            return;
+        }
+        ThreadTable& target = shards_[shard_of(info.pid)]->table;
+        ThreadInfo* copy = target.get_or_add(info.tid);
+        copy->pid = info.pid;
+        copy->ppid = info.ppid;
+        copy->start_time = info.start_time;
+        copy_strings(info, *copy);
+        if (info.is_main_thread()) {
+            if (const FdTable* fds = table.fd_table(info.tid)) {
+                copy_fds(*fds, *target.fd_table(info.tid));
+            }
+        }
+    });
+
+    // Parents now exist wherever they're local; the rest are remembered on
+    // both sides for exits
+    for (auto& shard : shards_) {
+        shard->table.rebuild_process_tree();
+    }
+    table.for_each([&](const ThreadInfo& info) {
+        size_t shard = shard_of(info.pid);
+        if (info.is_main_thread() && !info.has_exited() && info.ppid > 0 && shard_of(info.ppid) != shard) {
+            shards_[shard]->foreign_children[info.ppid].insert(info.pid);
+            child_shards_[info.ppid] |= shard_bit(shard);
+        }
+    });
+}
+
+void ShardedInspector::push(size_t shard, const Entry& entry, const Sink& sink) {
+    Shard& target = *shards_[shard];
+    uint32_t idle = 0;
+    while (!target.input.try_push(entry)) {
+        if (idle == 0) {
+            ++input_stalls_;
+        }
+        // The shard may be waiting for room in its output queue
+        if (sink) {
+            poll(sink);
+        }
+        backoff(idle);
+    }
+    if (entry.role != Role::Stop) {
+        target.dispatched.store(entry.event.sequence, std::memory_order_release);
+    }
+}
+
+core::Result<void> ShardedInspector::inspect_event(const ShardedEvent& event, const Sink& sink) {
+    if (stopping_.load(std::memory_order_relaxed)) {
+        return core::ErrorCode::InvalidOperation;
+    }
+    // No thread to put them in, e.g. a failed clone's -errno as child
+    if (event.event.pid <= 0 || (event.kind == EventKind::Clone && (event.child_tid <= 0 || event.child_pid <= 0))) {
+        return core::ErrorCode::InvalidArgument;
+    }
+
+    Entry entry;
+    entry.event = event;
+    entry.event.sequence = ++sequence_;
+    core::ProcessID pid = event.event.pid;
+    size_t own = shard_of(pid);
+
+    if (event.kind == EventKind::Clone && event.child_pid != pid && shard_of(event.child_pid) != own) {
+        size_t target = shard_of(event.child_pid);
+        entry.role = Role::CloneSource;
+        entry.handoff = new Handoff;
+        push(own, entry, sink);
+
+        entry.role = Role::CloneTarget;
+        push(target, entry, sink);
+        child_shards_[pid] |= shard_bit(target);
+        return {};
+    }
+
+    push(own, entry, sink);
+
+    if (event.kind == EventKind::Exit && event.event.tid == pid) {
+        core::ProcessID reaper = event.child_pid > 0 ? event.child_pid : 1;
+        uint64_t shards = 0;
+        auto it = child_shards_.find(pid);
+        if (it != child_shards_.end()) {
+            shards = it->second;
+            child_shards_.erase(it);
+        }
+
+        entry.role = Role::ExitNotice;
+        entry.event.exe = core::EMPTY_STRING_HANDLE;
+        entry.event.args = core::EMPTY_STRING_HANDLE;
+        for (uint64_t bits = shards & ~shard_bit(own); bits; bits &= bits - 1) {
+            push(static_cast<size_t>(__builtin_ctzll(bits)), entry, sink);
+        }
+
+        // Whichever shards held children of pid now hold children of the
+        // reaper, and so may this one
+        uint64_t adopted = (shards | shard_bit(own)) & ~shard_bit(shard_of(reaper));
+        if (adopted) {
+            child_shards_[reaper] |= adopted;
+        }
+    }
+    return {};
+}
+
+void ShardedInspector::run(Shard& shard) {
+    uint32_t idle = 0;
+    for (;;) {
+        Entry* entry = shard.input.front();
+        if (!entry) {
+            backoff(idle);
+            continue;
+        }
+        idle = 0;
+        if (entry->role == Role::Stop) {
+            shard.input.pop();
+            return;
+        }
+
+        handle(shard, *entry);
+        uint64_t sequence = entry->event.sequence;
+        shard.input.pop();
+        shard.done.store(sequence, std::memory_order_release);
+        shard.horizon.store(sequence, std::memory_order_release);
+    }
+}
+
+void ShardedInspector::handle(Shard& shard, Entry& entry) {
+    ThreadTable& table = shard.table;
+    const ShardedEvent& event = entry.event;
+    core::StringPool& pool = core::StringPool::instance();
+    table.set_time(event.event.timestamp);
+
+    switch (entry.role) {
+    case Role::CloneSource: {
+        Handoff& handoff = *entry.handoff;
+        const ThreadInfo* parent = table.find(event.event.tid);
+        if (!parent) {
+            parent = table.find(event.event.pid);
+        }
+        if (parent) {
+            handoff.found = true;
+            copy_strings(*parent, handoff.parent);
+            if (const FdTable* fds = static_cast<const ThreadTable&>(table).fd_table(event.event.pid)) {
+                handoff.fds.reserve(fds->size());
+                fds->for_each([&](core::FileDescriptor fd, const FdInfo& info) {
+                    pool.retain(info.name);
+                    handoff.fds.emplace_back(fd, info);
+                });
+            }
+        }
+        handoff.ready.store(true, std::memory_order_release);
+        break;
+    }
+
+    case Role::CloneTarget: {
+        Handoff* handoff = entry.handoff;
+        if (!handoff->ready.load(std::memory_order_acquire)) {
+            // The parent's shard may itself be stuck on a full output queue
+            // that the ordered merge can only drain once it knows this shard
+            // has nothing earlier to output; it doesn't, this entry outputs
+            // nothing
+            shard.horizon.store(event.sequence, std::memory_order_release);
+            shard.handoff_waits.fetch_add(1, std::memory_order_relaxed);
+            uint32_t idle = 0;
+            while (!handoff->ready.load(std::memory_order_acquire)) {
+                backoff(idle);
+            }
+        }
+
+        // A leftover of an earlier thread with this tid goes first
+        table.erase(event.child_tid);
+        ThreadInfo* child = table.get_or_add(event.child_tid);
+        child->pid = event.child_pid;
+        child->start_time = event.event.timestamp;
+        if (handoff->found) {
+            // The references move over, no retain
+            child->exe = handoff->parent.exe;
+            child->args = handoff->parent.args;
+            child->cwd = handoff->parent.cwd;
+            child->user = handoff->parent.user;
+            child->group = handoff->parent.group;
+            child->env = handoff->parent.env;
+            if (!handoff->fds.empty()) {
+                FdTable* fds = table.fd_table(event.child_tid);
+                for (const auto& fd : handoff->fds) {
+                    *fds->add(fd.first, fd.second.type) = fd.second;
+                }
+            }
+        }
+        table.set_parent(event.child_tid, event.event.pid);
+        shard.foreign_children[event.event.pid].insert(event.child_pid);
+
+        delete handoff;
+        shard.handoffs.fetch_add(1, std::memory_order_relaxed);
+        shard.ghosts.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    case Role::ExitNotice:
+        reparent_children(shard, event.event.pid, event.child_pid > 0 ? event.child_pid : 1);
+        shard.ghosts.fetch_add(1, std::memory_order_relaxed);
+        return;
+
+    case Role::Own:
+        switch (event.kind) {
+        case EventKind::Clone:
+            clone_local(shard, event);
+            break;
+
+        case EventKind::Exec: {
+            // The exec'ing thread becomes the leader, the image is the
+            // process's
+            ThreadInfo* info = table.get_or_add(event.event.pid);
+            info->pid = event.event.pid;
+            pool.release(info->exe);
+            pool.release(info->args);
+            info->exe = event.exe;
+            info->args = event.args;
+            break;
+        }
+
+        case EventKind::Exit: {
+            core::ProcessID pid = event.event.pid;
+            table.mark_exited(event.event.tid);
+            if (event.event.tid == pid) {
+                reparent_children(shard, pid, event.child_pid > 0 ? event.child_pid : 1);
+
+                // Its own parent may be keeping track of it from here
+                const ThreadInfo* info = table.find(pid);
+                if (info && shard_of(info->ppid) != shard.index) {
+                    auto it = shard.foreign_children.find(info->ppid);
+                    if (it != shard.foreign_children.end()) {
+                        it->second.erase(pid);
+                        if (it->second.empty()) {
+                            shard.foreign_children.erase(it);
+                        }
+                    }
+                }
+            }
+            break;
+        }
+
+        case EventKind::Other:
+            break;
+        }
+        break;
+
+    case Role::Stop:
+        return;
+    }
+
+    shard.events.fetch_add(1, std::memory_order_relaxed);
+    if (handler_ && handler_(event, table)) {
+        emit(shard, event);
+    }
+}
+
+void ShardedInspector::clone_local(Shard& shard, const ShardedEvent& event) {
+    ThreadTable& table = shard.table;
+
+    // Copy what the child inherits before the table changes
+    ThreadInfo parent;
+    bool found = false;
+    if (const ThreadInfo* info = table.find(event.event.tid)) {
+        parent = *info;
+        found = true;
+    } else if (const ThreadInfo* main = table.find(event.event.pid)) {
+        parent = *main;
+        found = true;
+    }
+
+    table.erase(event.child_tid);
+    ThreadInfo* child = table.get_or_add(event.child_tid);
+    child->pid = event.child_pid;
+    child->start_time = event.event.timestamp;
+    if (found) {
+        copy_strings(parent, *child);
+    }
+
+    if (event.child_pid == event.event.pid) {
+        // A new thread shares its process's fds through the main thread
+        child->ppid = found ? parent.ppid : 0;
+        return;
+    }
+
+    table.set_parent(event.child_tid, event.event.pid);
+    const FdTable* parent_fds = static_cast<const ThreadTable&>(table).fd_table(event.event.pid);
+    if (parent_fds && !parent_fds->empty()) {
+        copy_fds(*parent_fds, *table.fd_table(event.child_tid));
+    }
+}
+
+void ShardedInspector::reparent_children(Shard& shard, core::ProcessID pid, core::ProcessID reaper) {
+    ThreadTable& table = shard.table;
+
+    std::vector<core::ProcessID> children;
+    table.for_each_child(pid, [&](const ThreadInfo& child) { children.push_back(child.pid); });
+    auto it = shard.foreign_children.find(pid);
+    if (it != shard.foreign_children.end()) {
+        for (core::ProcessID child : it->second) {
+            const ThreadInfo* info = table.find(child);
+            if (info && info->ppid == pid) {
+                children.push_back(child);
+            }
+        }
+        shard.foreign_children.erase(it);
+    }
+
+    bool foreign_reaper = shard_of(reaper) != shard.index;
+    for (core::ProcessID child : children) {
+        table.set_parent(child, reaper);
+        if (foreign_reaper) {
+            shard.foreign_children[reaper].insert(child);
+        }
+    }
+}
+
+void ShardedInspector::emit(Shard& shard, const ShardedEvent& event) {
+    uint32_t idle = 0;
+    while (!shard.output.try_push(event)) {
+        if (stopping_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        if (idle == 0) {
+            shard.output_stalls.fetch_add(1, std::memory_order_relaxed);
+        }
+        backoff(idle);
+    }
+    shard.outputs.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t ShardedInspector::poll(const Sink& fn, size_t max) {
+    if (config_.ordered_output) {
+        return poll_ordered(fn, max);
+    }
+
+    size_t count = 0;
+    for (size_t n = 0; n < shards_.size() && count < max; ++n) {
+        SpscQueue<ShardedEvent>& output = shards_[next_poll_]->output;
+        next_poll_ = (next_poll_ + 1) % shards_.size();
+        while (count < max) {
+            ShardedEvent* event = output.front();
+            if (!event) {
+                break;
+            }
+            fn(*event);
+            output.pop();
+            ++count;
+        }
+    }
+    return count;
+}
+
+size_t ShardedInspector::poll_ordered(const Sink& fn, size_t max) {
+    size_t count = 0;
+    while (count < max) {
+        // The earliest output at the head of a queue...
+        size_t best = shards_.size();
+        uint64_t candidate = UINT64_MAX;
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            const ShardedEvent* head = shards_[i]->output.front();
+            if (head && head->sequence < candidate) {
+                candidate = head->sequence;
+                best = i;
+            }
+        }
+        if (best == shards_.size()) {
+            break;
+        }
+
+        // ...goes out once every other shard is past it. A shard that has
+        // handled all it was given can only output later events; otherwise
+        // its next output is past its horizon. The horizon is loaded before
+        // looking at the queue, so an output pushed before it moved is seen.
+        bool safe = true;
+        bool retry = false;
+        for (size_t i = 0; i < shards_.size() && safe && !retry; ++i) {
+            if (i == best) {
+                continue;
+            }
+            Shard& shard = *shards_[i];
+            uint64_t dispatched = shard.dispatched.load(std::memory_order_acquire);
+            uint64_t horizon = shard.horizon.load(std::memory_order_acquire);
+            if (const ShardedEvent* head = shard.output.front()) {
+                retry = head->sequence < candidate;
+            } else if (horizon < dispatched && candidate > horizon) {
+                safe = false;
+            }
+        }
+        if (retry) {
+            continue;
+        }
+        if (!safe) {
+            break;
+        }
+
+        SpscQueue<ShardedEvent>& output = shards_[best]->output;
+        fn(*output.front());
+        output.pop();
+        ++count;
+    }
+    return count;
+}
+
+void ShardedInspector::flush(const Sink& sink) {
+    for (auto& shard : shards_) {
+        uint32_t idle = 0;
+        while (shard->done.load(std::memory_order_acquire) < shard->dispatched.load(std::memory_order_acquire)) {
+            if (sink) {
+                poll(sink);
+            }
+            backoff(idle);
+        }
+    }
+}
+
+ShardedInspector::Stats ShardedInspector::get_stats() const {
+    Stats stats;
+    stats.dispatched = sequence_;
+    stats.input_stalls = input_stalls_;
+    for (const auto& shard : shards_) {
+        ShardStats out;
+        out.events = shard->events.load(std::memory_order_relaxed);
+        out.ghosts = shard->ghosts.load(std::memory_order_relaxed);
+        out.handoffs = shard->handoffs.load(std::memory_order_relaxed);
+        out.handoff_waits = shard->handoff_waits.load(std::memory_order_relaxed);
+        out.outputs = shard->outputs.load(std::memory_order_relaxed);
+        out.output_stalls = shard->output_stalls.load(std::memory_order_relaxed);
+        stats.shards.push_back(out);
+    }
+    return stats;
+}
+
+} // namespace sinsp
+} // namespace deepsys
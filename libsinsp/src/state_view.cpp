@@ -0,0 +1,402 @@
+#include "sinsp/state_view.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+constexpr core::FileDescriptor PAGE_MASK = ~static_cast<core::FileDescriptor>(FdPage::SIZE - 1);
+
+ThreadRecord* make_record(const ThreadInfo& info) {
+    core::StringPool& pool = core::StringPool::instance();
+    for (core::StringHandle handle : {info.exe, info.args, info.cwd, info.user, info.group, info.env}) {
+        pool.retain(handle);
+    }
+    return new ThreadRecord{info.tid,  info.pid,  info.ppid, info.start_time, info.exe, info.args,
+                            info.cwd,  info.user, info.group, info.env,       info.rss_kb};
+}
+
+// Builds the page starting at base from the live table, or returns nullptr
+// when none of its fds are open
+FdPage* make_page(const FdTable& fds, core::FileDescriptor base) {
+    FdPage* page = nullptr;
+    for (uint32_t i = 0; i < FdPage::SIZE; ++i) {
+        const FdInfo* info = fds.find(base + static_cast<core::FileDescriptor>(i));
+        if (!info) {
+            continue;
+        }
+        if (!page) {
+            page = new FdPage();
+            page->base = base;
+            page->present = 0;
+        }
+        page->fds[i] = *info;
+        page->present |= uint64_t(1) << i;
+        core::StringPool::instance().retain(info->name);
+    }
+    return page;
+}
+
+// The pool goes first so that it's destroyed after the domain, which frees
+// what's still retired at exit
+core::EpochDomain& default_epochs() {
+    core::StringPool::instance();
+    return core::EpochDomain::instance();
+}
+
+} // namespace
+
+StateView::StateView() : StateView(default_epochs()) {}
+
+StateView::StateView(core::EpochDomain& epochs) : epochs_(epochs) {
+    for (size_t i = 0; i < SHARDS; ++i) {
+        threads_[i].store(nullptr, std::memory_order_relaxed);
+        fds_[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+StateView::~StateView() {
+    // Readers must be gone by now; what was retired already is the domain's
+    for (auto& shard : threads_) {
+        const ThreadShard* current = shard.load(std::memory_order_relaxed);
+        if (current) {
+            for (const ThreadRecord* record : current->records) {
+                destroy_record(const_cast<ThreadRecord*>(record));
+            }
+            delete current;
+        }
+    }
+    for (auto& shard : fds_) {
+        const FdShard* current = shard.load(std::memory_order_relaxed);
+        if (current) {
+            for (const FdSnapshot* fds : current->processes) {
+                for (const FdPage* page : fds->pages) {
+                    destroy_page(const_cast<FdPage*>(page));
+                }
+                delete fds;
+            }
+            delete current;
+        }
+    }
+    epochs_.collect();
+}
+
+void StateView::destroy_record(void* record) {
+    auto* info = static_cast<ThreadRecord*>(record);
+    core::StringPool& pool = core::StringPool::instance();
+    for (core::StringHandle handle : {info->exe, info->args, info->cwd, info->user, info->group, info->env}) {
+        pool.release(handle);
+    }
+    delete info;
+}
+
+void StateView::destroy_page(void* page) {
+    auto* fds = static_cast<FdPage*>(page);
+    for (uint64_t bits = fds->present; bits; bits &= bits - 1) {
+        core::StringPool::instance().release(fds->fds[__builtin_ctzll(bits)].name);
+    }
+    delete fds;
+}
+
+void StateView::touch(core::ThreadID tid) {
+    dirty_threads_.push_back(tid);
+}
+
+void StateView::touch_fd(core::ProcessID pid, core::FileDescriptor fd) {
+    if (fd >= 0) {
+        dirty_pages_[pid].push_back(fd & PAGE_MASK);
+    }
+}
+
+void StateView::publish(const ThreadTable& table) {
+    publish_threads(table);
+    publish_fds(table);
+    stats_.freed += epochs_.collect();
+    ++stats_.publishes;
+}
+
+void StateView::publish_all(const ThreadTable& table) {
+    table.for_each([&](const ThreadInfo& info) {
+        touch(info.tid);
+        if (info.is_main_thread()) {
+            if (const FdTable* fds = table.fd_table(info.tid)) {
+                fds->for_each([&](core::FileDescriptor fd, const FdInfo&) { touch_fd(info.pid, fd); });
+            }
+        }
+    });
+
+    // And whatever is published but no longer in the table
+    for (auto& shard : threads_) {
+        if (const ThreadShard* current = shard.load(std::memory_order_relaxed)) {
+            for (const ThreadRecord* record : current->records) {
+                touch(record->tid);
+            }
+        }
+    }
+    for (auto& shard : fds_) {
+        if (const FdShard* current = shard.load(std::memory_order_relaxed)) {
+            for (const FdSnapshot* fds : current->processes) {
+                for (const FdPage* page : fds->pages) {
+                    touch_fd(fds->pid, page->base);
+                }
+            }
+        }
+    }
+
+    publish(table);
+}
+
+void StateView::publish_threads(const ThreadTable& table) {
+    std::vector<core::ThreadID>& dirty = dirty_threads_;
+    auto by_shard = [](core::ThreadID a, core::ThreadID b) {
+        return std::make_pair(shard_of(a), a) < std::make_pair(shard_of(b), b);
+    };
+    std::sort(dirty.begin(), dirty.end(), by_shard);
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+    for (size_t begin = 0; begin < dirty.size();) {
+        size_t s = shard_of(dirty[begin]);
+        size_t end = begin;
+        while (end < dirty.size() && shard_of(dirty[end]) == s) {
+            ++end;
+        }
+
+        // Merge the shard's records with the changed tids, both sorted
+        const ThreadShard* old = threads_[s].load(std::memory_order_relaxed);
+        static const std::vector<const ThreadRecord*> none;
+        const std::vector<const ThreadRecord*>& records = old ? old->records : none;
+
+        auto next = std::make_unique<ThreadShard>();
+        next->records.reserve(records.size() + (end - begin));
+        size_t o = 0;
+        for (size_t i = begin; i < end; ++i) {
+            core::ThreadID tid = dirty[i];
+            while (o < records.size() && records[o]->tid < tid) {
+                next->records.push_back(records[o++]);
+            }
+            const ThreadRecord* previous = nullptr;
+            if (o < records.size() && records[o]->tid == tid) {
+                previous = records[o++];
+            }
+
+            const ThreadInfo* info = table.find(tid);
+            if (info) {
+                next->records.push_back(make_record(*info));
+                ++stats_.threads_copied;
+                if (!previous) {
+                    size_.fetch_add(1, std::memory_order_relaxed);
+                }
+            } else if (previous) {
+                size_.fetch_sub(1, std::memory_order_relaxed);
+            }
+            if (previous) {
+                epochs_.retire(const_cast<ThreadRecord*>(previous), destroy_record);
+            }
+        }
+        next->records.insert(next->records.end(), records.begin() + static_cast<std::ptrdiff_t>(o), records.end());
+
+        threads_[s].store(next->records.empty() ? nullptr : next.release(), std::memory_order_release);
+        if (old) {
+            epochs_.retire(old);
+        }
+        ++stats_.shards_replaced;
+        begin = end;
+    }
+    dirty.clear();
+}
+
+const StateView::FdSnapshot* StateView::copy_fds(const ThreadTable& table, const FdSnapshot* old,
+                                                 core::ProcessID pid,
+                                                 const std::vector<core::FileDescriptor>& bases) {
+    static const std::vector<const FdPage*> none;
+    const std::vector<const FdPage*>& pages = old ? old->pages : none;
+
+    // The process's table is reached through its main thread; when that's
+    // gone, so are the fds
+    const FdTable* fds = table.fd_table(pid);
+    if (!fds) {
+        for (const FdPage* page : pages) {
+            epochs_.retire(const_cast<FdPage*>(page), destroy_page);
+        }
+        return nullptr;
+    }
+
+    auto next = std::make_unique<FdSnapshot>();
+    next->pid = pid;
+    next->pages.reserve(pages.size() + bases.size());
+    size_t o = 0;
+    for (core::FileDescriptor base : bases) {
+        while (o < pages.size() && pages[o]->base < base) {
+            next->pages.push_back(pages[o++]);
+        }
+        const FdPage* previous = nullptr;
+        if (o < pages.size() && pages[o]->base == base) {
+            previous = pages[o++];
+        }
+
+        if (FdPage* page = make_page(*fds, base)) {
+            next->pages.push_back(page);
+            ++stats_.pages_copied;
+        }
+        if (previous) {
+            epochs_.retire(const_cast<FdPage*>(previous), destroy_page);
+        }
+    }
+    next->pages.insert(next->pages.end(), pages.begin() + static_cast<std::ptrdiff_t>(o), pages.end());
+
+    return next->pages.empty() ? nullptr : next.release();
+}
+
+void StateView::publish_fds(const ThreadTable& table) {
+    std::vector<core::ProcessID> pids;
+    pids.reserve(dirty_pages_.size());
+    for (auto& entry : dirty_pages_) {
+        std::vector<core::FileDescriptor>& bases = entry.second;
+        std::sort(bases.begin(), bases.end());
+        bases.erase(std::unique(bases.begin(), bases.end()), bases.end());
+        pids.push_back(entry.first);
+    }
+    std::sort(pids.begin(), pids.end(), [](core::ProcessID a, core::ProcessID b) {
+        return std::make_pair(shard_of(a), a) < std::make_pair(shard_of(b), b);
+    });
+
+    for (size_t begin = 0; begin < pids.size();) {
+        size_t s = shard_of(pids[begin]);
+        size_t end = begin;
+        while (end < pids.size() && shard_of(pids[end]) == s) {
+            ++end;
+        }
+
+        const FdShard* old = fds_[s].load(std::memory_order_relaxed);
+        static const std::vector<const FdSnapshot*> none;
+        const std::vector<const FdSnapshot*>& processes = old ? old->processes : none;
+
+        auto next = std::make_unique<FdShard>();
+        next->processes.reserve(processes.size() + (end - begin));
+        size_t o = 0;
+        for (size_t i = begin; i < end; ++i) {
+            core::ProcessID pid = pids[i];
+            while (o < processes.size() && processes[o]->pid < pid) {
+                next->processes.push_back(processes[o++]);
+            }
+            const FdSnapshot* previous = nullptr;
+            if (o < processes.size() && processes[o]->pid == pid) {
+                previous = processes[o++];
+            }
+
+            if (const FdSnapshot* fds = copy_fds(table, previous, pid, dirty_pages_[pid])) {
+                next->processes.push_back(fds);
+            }
+            if (previous) {
+                epochs_.retire(previous);
+            }
+        }
+        next->processes.insert(next->processes.end(), processes.begin() + static_cast<std::ptrdiff_t>(o),
+                               processes.end());
+
+        fds_[s].store(next->processes.empty() ? nullptr : next.release(), std::memory_order_release);
+        if (old) {
+            epochs_.retire(old);
+        }
+        ++stats_.shards_replaced;
+        begin = end;
+    }
+    dirty_pages_.clear();
+}
+
+const ThreadRecord* StateView::find(const Guard&, core::ThreadID tid) const {
+    const ThreadShard* shard = threads_[shard_of(tid)].load(std::memory_order_acquire);
+    if (!shard) {
+        return nullptr;
+    }
+    auto it = std::lower_bound(shard->records.begin(), shard->records.end(), tid,
+                               [](const ThreadRecord* record, core::ThreadID key) { return record->tid < key; });
+    return it != shard->records.end() && (*it)->tid == tid ? *it : nullptr;
+}
+
+const StateView::FdSnapshot* StateView::find_fds(core::ProcessID pid) const {
+    const FdShard* shard = fds_[shard_of(pid)].load(std::memory_order_acquire);
+    if (!shard) {
+        return nullptr;
+    }
+    auto it = std::lower_bound(shard->processes.begin(), shard->processes.end(), pid,
+                               [](const FdSnapshot* fds, core::ProcessID key) { return fds->pid < key; });
+    return it != shard->processes.end() && (*it)->pid == pid ? *it : nullptr;
+}
+
+const FdInfo* StateView::find_fd(const Guard&, core::ProcessID pid, core::FileDescriptor fd) const {
+    const FdSnapshot* fds = find_fds(pid);
+    if (!fds || fd < 0) {
+        return nullptr;
+    }
+    core::FileDescriptor base = fd & PAGE_MASK;
+    auto it = std::lower_bound(fds->pages.begin(), fds->pages.end(), base,
+                               [](const FdPage* page, core::FileDescriptor key) { return page->base < key; });
+    if (it == fds->pages.end() || (*it)->base != base) {
+        return nullptr;
+    }
+    uint32_t i = static_cast<uint32_t>(fd - base);
+    return ((*it)->present >> i) & 1 ? &(*it)->fds[i] : nullptr;
+}
+
+ProcessView StateView::view(const Guard& guard, const ThreadRecord& record, ProcessFields fields) const {
+    const core::StringPool& pool = core::StringPool::instance();
+
+    ProcessView out;
+    out.pid = record.pid;
+    out.tid = record.tid;
+    out.ppid = record.ppid;
+    out.start_time = record.start_time;
+    if (has_field(fields, ProcessField::Exe)) {
+        out.exe = pool.get(record.exe);
+    }
+    if (has_field(fields, ProcessField::Args)) {
+        out.args = pool.get(record.args);
+    }
+    if (has_field(fields, ProcessField::Cwd)) {
+        out.cwd = pool.get(record.cwd);
+    }
+    if (has_field(fields, ProcessField::User)) {
+        out.user = pool.get(record.user);
+    }
+    if (has_field(fields, ProcessField::Group)) {
+        out.group = pool.get(record.group);
+    }
+    if (has_field(fields, ProcessField::Env)) {
+        out.env = pool.get(record.env);
+    }
+    if (has_field(fields, ProcessField::Rss)) {
+        const ThreadRecord* main = record.tid == record.pid ? &record : find(guard, record.pid);
+        out.rss_bytes = main ? uint64_t(main->rss_kb) * 1024 : 0;
+    }
+    return out;
+}
+
+ProcessInfo StateView::to_process_info(const Guard& guard, const ThreadRecord& record) const {
+    const core::StringPool& pool = core::StringPool::instance();
+
+    ProcessInfo out;
+    out.pid = record.pid;
+    out.tid = record.tid;
+    out.ppid = record.ppid;
+    out.exe = std::string(pool.get(record.exe));
+    out.args = std::string(pool.get(record.args));
+    out.cwd = std::string(pool.get(record.cwd));
+    out.start_time = record.start_time;
+    out.user = std::string(pool.get(record.user));
+    out.group = std::string(pool.get(record.group));
+    parse_environ(pool.get(record.env), out.env);
+
+    for_each_fd(guard, record.pid, [&](core::FileDescriptor fd, const FdInfo& info) {
+        out.open_fds.push_back(std::to_string(fd) + " " + format_fd(info));
+    });
+    return out;
+}
+
+} // namespace sinsp
+} // namespace deepsys
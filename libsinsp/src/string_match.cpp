@@ -0,0 +1,449 @@
+#include "sinsp/string_match.h"
+
+#include "cpu_features.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+#ifdef DEEPSYS_X86
+#include <immintrin.h>
+#endif
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+char to_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+char to_upper(char c) {
+    return (c >= 'a' && c <= 'z') ? static_cast<char>(c - ('a' - 'A')) : c;
+}
+
+bool equal_folded(const char* text, const char* lower, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (to_lower(text[i]) != lower[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Exact candidates are verified with memcmp, folded ones with equal_folded;
+// the first and last byte are already known to match either way
+struct ExactVerify {
+    bool operator()(const char* at, const char* needle, size_t size) const {
+        return size <= 2 || std::memcmp(at + 1, needle + 1, size - 2) == 0;
+    }
+};
+
+struct FoldedVerify {
+    bool operator()(const char* at, const char* needle, size_t size) const {
+        return size <= 2 || equal_folded(at + 1, needle + 1, size - 2);
+    }
+};
+
+// Scalar search from position start; first and last bytes are given in
+// both cases, which are the same for exact search
+template<typename Verify>
+size_t search_scalar(const char* text, size_t size, size_t start, const char* needle, size_t needle_size,
+                     char first_a, char first_b, char last_a, char last_b, Verify verify) {
+    for (size_t i = start; i + needle_size <= size; ++i) {
+        char first = text[i];
+        char last = text[i + needle_size - 1];
+        if ((first == first_a || first == first_b) && (last == last_a || last == last_b) &&
+            verify(text + i, needle, needle_size)) {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+#ifdef DEEPSYS_X86
+
+// W. Muła's generic SIMD substring search: compare the needle's first byte
+// against a block and its last byte against the block shifted by the
+// needle size, and verify only the positions where both match
+template<typename Verify>
+__attribute__((target("avx2")))
+size_t search_avx2(const char* text, size_t size, const char* needle, size_t needle_size,
+                   char first_a, char first_b, char last_a, char last_b, Verify verify) {
+    const __m256i fa = _mm256_set1_epi8(first_a);
+    const __m256i fb = _mm256_set1_epi8(first_b);
+    const __m256i la = _mm256_set1_epi8(last_a);
+    const __m256i lb = _mm256_set1_epi8(last_b);
+    size_t i = 0;
+    for (; i + needle_size + 31 <= size; i += 32) {
+        __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i + needle_size - 1));
+        __m256i first = _mm256_or_si256(_mm256_cmpeq_epi8(head, fa), _mm256_cmpeq_epi8(head, fb));
+        __m256i last = _mm256_or_si256(_mm256_cmpeq_epi8(tail, la), _mm256_cmpeq_epi8(tail, lb));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(first, last)));
+        for (; mask; mask &= mask - 1) {
+            size_t at = i + static_cast<size_t>(__builtin_ctz(mask));
+            if (verify(text + at, needle, needle_size)) {
+                return at;
+            }
+        }
+    }
+    return search_scalar(text, size, i, needle, needle_size, first_a, first_b, last_a, last_b, verify);
+}
+
+// Same with SSE2, which every x86-64 has
+template<typename Verify>
+size_t search_sse2(const char* text, size_t size, const char* needle, size_t needle_size,
+                   char first_a, char first_b, char last_a, char last_b, Verify verify) {
+    const __m128i fa = _mm_set1_epi8(first_a);
+    const __m128i fb = _mm_set1_epi8(first_b);
+    const __m128i la = _mm_set1_epi8(last_a);
+    const __m128i lb = _mm_set1_epi8(last_b);
+    size_t i = 0;
+    for (; i + needle_size + 15 <= size; i += 16) {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i + needle_size - 1));
+        __m128i first = _mm_or_si128(_mm_cmpeq_epi8(head, fa), _mm_cmpeq_epi8(head, fb));
+        __m128i last = _mm_or_si128(_mm_cmpeq_epi8(tail, la), _mm_cmpeq_epi8(tail, lb));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(first, last)));
+        for (; mask; mask &= mask - 1) {
+            size_t at = i + static_cast<size_t>(__builtin_ctz(mask));
+            if (verify(text + at, needle, needle_size)) {
+                return at;
+            }
+        }
+    }
+    return search_scalar(text, size, i, needle, needle_size, first_a, first_b, last_a, last_b, verify);
+}
+
+// Resolved once at load, so the hot path tests a constant
+const bool HAS_AVX2 = cpu_has_avx2();
+
+#endif
+
+template<typename Verify>
+size_t search(const char* text, size_t size, const char* needle, size_t needle_size,
+              char first_a, char first_b, char last_a, char last_b, Verify verify) {
+#ifdef DEEPSYS_X86
+    if (HAS_AVX2) {
+        return search_avx2(text, size, needle, needle_size, first_a, first_b, last_a, last_b, verify);
+    }
+    return search_sse2(text, size, needle, needle_size, first_a, first_b, last_a, last_b, verify);
+#else
+    return search_scalar(text, size, 0, needle, needle_size, first_a, first_b, last_a, last_b, verify);
+#endif
+}
+
+uint64_t hash_bytes(std::string_view value) {
+    uint64_t hash = 0xCBF29CE484222325ULL ^ value.size();
+    const char* p = value.data();
+    size_t left = value.size();
+    for (; left >= 8; p += 8, left -= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    if (left) {
+        uint64_t word = 0;
+        std::memcpy(&word, p, left);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    return hash * 0xBF58476D1CE4E5B9ULL;
+}
+
+// Backtracking match of * and ?, for patterns with ?
+bool glob_match(std::string_view pattern, std::string_view text) {
+    size_t p = 0, t = 0;
+    size_t star = std::string_view::npos, mark = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+            ++p;
+            ++t;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            mark = t;
+        } else if (star != std::string_view::npos) {
+            p = star + 1;
+            t = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+} // namespace
+
+size_t find_substring(std::string_view haystack, std::string_view needle) {
+    if (needle.empty()) {
+        return 0;
+    }
+    if (needle.size() > haystack.size()) {
+        return std::string_view::npos;
+    }
+    if (needle.size() == 1) {
+        const void* at = std::memchr(haystack.data(), needle[0], haystack.size());
+        return at ? static_cast<size_t>(static_cast<const char*>(at) - haystack.data()) : std::string_view::npos;
+    }
+    char first = needle.front();
+    char last = needle.back();
+    return search(haystack.data(), haystack.size(), needle.data(), needle.size(), first, first, last, last,
+                  ExactVerify{});
+}
+
+bool icontains(std::string_view haystack, std::string_view needle) {
+    if (needle.empty()) {
+        return true;
+    }
+    if (needle.size() > haystack.size()) {
+        return false;
+    }
+    char first = needle.front();
+    char last = needle.back();
+    if (needle.size() == 1) {
+        return search_scalar(haystack.data(), haystack.size(), 0, needle.data(), 1, first, to_upper(first),
+                             first, to_upper(first), FoldedVerify{}) != std::string_view::npos;
+    }
+    return search(haystack.data(), haystack.size(), needle.data(), needle.size(), first, to_upper(first),
+                  last, to_upper(last), FoldedVerify{}) != std::string_view::npos;
+}
+
+const char* string_match_isa() {
+#ifdef DEEPSYS_X86
+    return HAS_AVX2 ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+GlobMatcher::GlobMatcher(std::string_view pattern)
+    : pattern_(pattern),
+      simple_(pattern.find('?') == std::string_view::npos),
+      anchored_start_(pattern.empty() || pattern.front() != '*'),
+      anchored_end_(pattern.empty() || pattern.back() != '*') {
+    if (!simple_) {
+        return;
+    }
+    size_t start = 0;
+    while (start <= pattern.size()) {
+        size_t star = pattern.find('*', start);
+        size_t end = star == std::string_view::npos ? pattern.size() : star;
+        // Keep the anchored ends even when empty, so indices line up
+        if (end > start || (start == 0 && anchored_start_) || (star == std::string_view::npos && anchored_end_)) {
+            segments_.emplace_back(pattern.substr(start, end - start));
+        }
+        if (star == std::string_view::npos) {
+            break;
+        }
+        start = star + 1;
+    }
+}
+
+bool GlobMatcher::match(std::string_view text) const {
+    if (!simple_) {
+        return glob_match(pattern_, text);
+    }
+    if (pattern_.find('*') == std::string::npos) {
+        return text == pattern_;
+    }
+
+    size_t first = 0;
+    size_t count = segments_.size();
+    if (anchored_start_) {
+        const std::string& prefix = segments_.front();
+        if (text.substr(0, prefix.size()) != prefix) {
+            return false;
+        }
+        text.remove_prefix(prefix.size());
+        ++first;
+    }
+    if (anchored_end_) {
+        const std::string& suffix = segments_.back();
+        if (text.size() < suffix.size() || text.substr(text.size() - suffix.size()) != suffix) {
+            return false;
+        }
+        text.remove_suffix(suffix.size());
+        --count;
+    }
+    // Leftmost match of each middle segment in turn is enough with only *
+    for (size_t i = first; i < count; ++i) {
+        size_t at = find_substring(text, segments_[i]);
+        if (at == std::string_view::npos) {
+            return false;
+        }
+        text.remove_prefix(at + segments_[i].size());
+    }
+    return true;
+}
+
+StringSet::StringSet(const std::vector<std::string>& values) {
+    size_t capacity = 8;
+    while (capacity < values.size() * 2) {
+        capacity *= 2;
+    }
+    slots_.assign(capacity, Slot{0, 0});
+    mask_ = capacity - 1;
+
+    for (const auto& v : values) {
+        if (contains(v)) {
+            continue;
+        }
+        uint64_t hash = hash_bytes(v);
+        offsets_.push_back(static_cast<uint32_t>(data_.size()));
+        sizes_.push_back(static_cast<uint32_t>(v.size()));
+        data_ += v;
+
+        size_t slot = static_cast<size_t>(hash) & mask_;
+        while (slots_[slot].index) {
+            slot = (slot + 1) & mask_;
+        }
+        slots_[slot] = Slot{static_cast<uint32_t>(hash >> 32), static_cast<uint32_t>(offsets_.size())};
+    }
+}
+
+bool StringSet::contains(std::string_view value) const {
+    uint64_t hash = hash_bytes(value);
+    uint32_t tag = static_cast<uint32_t>(hash >> 32);
+    for (size_t slot = static_cast<size_t>(hash) & mask_; slots_[slot].index; slot = (slot + 1) & mask_) {
+        if (slots_[slot].hash == tag && this->value(slots_[slot].index - 1) == value) {
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace {
+
+std::vector<std::string> normalize_prefixes(const std::vector<std::string>& prefixes) {
+    std::vector<std::string> out;
+    out.reserve(prefixes.size());
+    for (std::string prefix : prefixes) {
+        while (prefix.size() > 1 && prefix.back() == '/') {
+            prefix.pop_back();
+        }
+        out.push_back(std::move(prefix));
+    }
+    return out;
+}
+
+} // namespace
+
+PathPrefixSet::PathPrefixSet(const std::vector<std::string>& prefixes)
+    : prefixes_(normalize_prefixes(prefixes)) {
+    for (const auto& prefix : normalize_prefixes(prefixes)) {
+        if (prefix == "/") {
+            root_ = true;
+        }
+        min_size_ = std::min(min_size_, prefix.size());
+        max_size_ = std::max(max_size_, prefix.size());
+    }
+}
+
+bool PathPrefixSet::match(std::string_view path) const {
+    if (root_ && !path.empty() && path.front() == '/') {
+        return true;
+    }
+    if (path.size() < min_size_) {
+        return false;
+    }
+    if (path.size() <= max_size_ && prefixes_.contains(path)) {
+        return true;
+    }
+    // Every directory boundary within the prefix lengths
+    size_t end = std::min(path.size(), max_size_ + 1);
+    for (size_t i = std::max<size_t>(min_size_, 1); i < end; ++i) {
+        if (path[i] == '/' && prefixes_.contains(path.substr(0, i))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+MultiMatcher::MultiMatcher(const std::vector<std::string>& needles) : needles_(needles.size()) {
+    // Bytes that occur in no needle share class 0
+    std::fill(std::begin(classes_), std::end(classes_), 0);
+    for (const auto& needle : needles) {
+        if (needle.empty()) {
+            empty_needle_ = true;
+        }
+        for (char c : needle) {
+            uint8_t byte = static_cast<uint8_t>(c);
+            if (!classes_[byte]) {
+                classes_[byte] = static_cast<uint16_t>(class_count_++);
+            }
+        }
+    }
+
+    // Trie, then failure links breadth first, folding them into the table
+    // so every state has a transition for every class
+    const uint32_t NONE = UINT32_MAX;
+    next_.assign(class_count_, NONE);
+    matched_.assign(1, 0);
+    for (const auto& needle : needles) {
+        uint32_t state = 0;
+        for (char c : needle) {
+            size_t edge = state * class_count_ + classes_[static_cast<uint8_t>(c)];
+            if (next_[edge] == NONE) {
+                next_[edge] = static_cast<uint32_t>(matched_.size());
+                matched_.push_back(0);
+                next_.resize(next_.size() + class_count_, NONE);
+            }
+            state = next_[edge];
+        }
+        matched_[state] = 1;
+    }
+
+    std::vector<uint32_t> fail(matched_.size(), 0);
+    std::deque<uint32_t> queue;
+    for (uint32_t c = 0; c < class_count_; ++c) {
+        uint32_t& target = next_[c];
+        if (target == NONE) {
+            target = 0;
+        } else {
+            queue.push_back(target);
+        }
+    }
+    while (!queue.empty()) {
+        uint32_t state = queue.front();
+        queue.pop_front();
+        matched_[state] |= matched_[fail[state]];
+        for (uint32_t c = 0; c < class_count_; ++c) {
+            uint32_t& target = next_[state * class_count_ + c];
+            uint32_t fallback = next_[fail[state] * class_count_ + c];
+            if (target == NONE) {
+                target = fallback;
+            } else {
+                fail[target] = fallback;
+                queue.push_back(target);
+            }
+        }
+    }
+}
+
+bool MultiMatcher::search(std::string_view haystack) const {
+    if (empty_needle_) {
+        return true;
+    }
+    if (!needles_) {
+        return false;
+    }
+    const uint32_t* next = next_.data();
+    const uint8_t* matched = matched_.data();
+    uint32_t state = 0;
+    for (char c : haystack) {
+        state = next[state * class_count_ + classes_[static_cast<uint8_t>(c)]];
+        if (matched[state]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace sinsp
+} // namespace deepsys
@@ -0,0 +1,581 @@
+#include "sinsp/thread_table.h"
+
+#include <algorithm>
+
+namespace deepsys {
+namespace sinsp {
+
+namespace {
+
+constexpr size_t MIN_CAPACITY = 16;
+
+// Keeps probe sequences short, linear probing degrades quickly past ~0.7
+bool over_load_factor(size_t size, size_t capacity) {
+    return size * 10 >= capacity * 7;
+}
+
+constexpr uint64_t TRIM_INTERVAL_NS = 1000000000ULL;
+
+// Coarse clock for exit and fd use stamps, never 0 so that 0 can mean unset
+uint32_t to_seconds(uint64_t ns) {
+    return std::max<uint32_t>(1, static_cast<uint32_t>(ns / 1000000000ULL));
+}
+
+} // namespace
+
+ThreadTable::ThreadTable(size_t expected_threads) {
+    size_t capacity = MIN_CAPACITY;
+    while (over_load_factor(expected_threads, capacity)) {
+        capacity *= 2;
+    }
+
+    slots_.assign(capacity, Slot{EMPTY_TID, 0});
+    mask_ = capacity - 1;
+    shift_ = 64 - static_cast<uint32_t>(__builtin_ctzll(capacity));
+}
+
+size_t ThreadTable::home(core::ThreadID tid) const {
+    // Fibonacci hashing: tids are mostly dense and sequential, multiplying
+    // by 2^64/phi and keeping the top bits spreads them over the table
+    return static_cast<size_t>((static_cast<uint64_t>(tid) * 0x9e3779b97f4a7c15ULL) >> shift_);
+}
+
+size_t ThreadTable::find_slot(core::ThreadID tid) const {
+    for (size_t i = home(tid);; i = (i + 1) & mask_) {
+        const Slot& slot = slots_[i];
+        if (slot.tid == tid || slot.tid == EMPTY_TID) {
+            return i;
+        }
+    }
+}
+
+ThreadInfo* ThreadTable::find(core::ThreadID tid) {
+    if (tid == last_tid_) {
+        return last_info_;
+    }
+
+    if (tid == EMPTY_TID) {
+        return nullptr;
+    }
+
+    const Slot& slot = slots_[find_slot(tid)];
+    if (slot.tid == EMPTY_TID) {
+        return nullptr;
+    }
+
+    last_tid_ = tid;
+    last_info_ = &arena_[slot.index];
+    return last_info_;
+}
+
+const ThreadInfo* ThreadTable::find(core::ThreadID tid) const {
+    return const_cast<ThreadTable*>(this)->find(tid);
+}
+
+ThreadInfo* ThreadTable::get_or_add(core::ThreadID tid, bool* added) {
+    if (added) {
+        *added = false;
+    }
+
+    if (tid == EMPTY_TID) {
+        return nullptr;
+    }
+
+    if (ThreadInfo* info = find(tid)) {
+        return info;
+    }
+
+    if (over_load_factor(size_ + 1, slots_.size())) {
+        grow();
+    }
+
+    size_t i = find_slot(tid);
+    uint32_t index = arena_.allocate();
+    slots_[i] = Slot{tid, index};
+    ++size_;
+
+    ThreadInfo& info = arena_[index];
+    info.tid = tid;
+
+    if (added) {
+        *added = true;
+    }
+
+    last_tid_ = tid;
+    last_info_ = &info;
+    return &info;
+}
+
+bool ThreadTable::erase(core::ThreadID tid) {
+    if (tid == EMPTY_TID) {
+        return false;
+    }
+
+    size_t i = find_slot(tid);
+    if (slots_[i].tid == EMPTY_TID) {
+        return false;
+    }
+
+    if (arena_[slots_[i].index].has_exited()) {
+        --exited_count_;
+    }
+    unlink(slots_[i].index);
+    detach_children(slots_[i].index);
+    release_strings(arena_[slots_[i].index]);
+    release_fd_table(arena_[slots_[i].index]);
+    arena_.release(slots_[i].index);
+    --size_;
+
+    if (tid == last_tid_) {
+        last_tid_ = EMPTY_TID;
+        last_info_ = nullptr;
+    }
+
+    // Backward shift: pull later entries of the cluster into the hole when
+    // the hole lies on their probe path, so lookups never need tombstones
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask_; slots_[j].tid != EMPTY_TID; j = (j + 1) & mask_) {
+        size_t h = home(slots_[j].tid);
+        if (((j - h) & mask_) >= ((j - hole) & mask_)) {
+            slots_[hole] = slots_[j];
+            hole = j;
+        }
+    }
+    slots_[hole].tid = EMPTY_TID;
+
+    return true;
+}
+
+void ThreadTable::clear() {
+    for_each(release_strings);
+    std::fill(slots_.begin(), slots_.end(), Slot{EMPTY_TID, 0});
+    arena_.clear();
+    fd_tables_.clear();
+    size_ = 0;
+    last_tid_ = EMPTY_TID;
+    last_info_ = nullptr;
+    exited_.clear();
+    exited_count_ = 0;
+}
+
+bool ThreadTable::mark_exited(core::ThreadID tid) {
+    ThreadInfo* info = find(tid);
+    if (!info || info->has_exited()) {
+        return false;
+    }
+    info->exited_at = to_seconds(now_ns_);
+    exited_.push_back(ExitedThread{tid, now_ns_});
+    ++exited_count_;
+    return true;
+}
+
+void ThreadTable::trim() {
+    next_trim_ns_ = now_ns_ + TRIM_INTERVAL_NS;
+
+    // Entries whose thread was erased, or exited again after tid reuse,
+    // don't match the thread's stamp and are just dropped
+    auto erase_front = [&]() {
+        ExitedThread front = exited_.front();
+        exited_.pop_front();
+        const ThreadInfo* info = find(front.tid);
+        return info && info->exited_at == to_seconds(front.exited_ns) && erase(front.tid);
+    };
+
+    // Grace windows end in exit order
+    while (!exited_.empty() && exited_.front().exited_ns + limits_.exit_grace_ns <= now_ns_) {
+        expired_threads_ += erase_front();
+    }
+
+    size_t budget = limits_.memory_budget;
+    if (budget == 0) {
+        return;
+    }
+    size_t used = used_bytes();
+    if (used <= budget) {
+        return;
+    }
+
+    // Exited threads only linger for stragglers, they go first
+    size_t target = budget - budget / 10;
+    while (used > target && !exited_.empty()) {
+        size_t batch = std::max<size_t>(1, (used - target) / sizeof(ThreadInfo));
+        for (; batch > 0 && !exited_.empty(); --batch) {
+            evicted_threads_ += erase_front();
+        }
+        used = used_bytes();
+    }
+
+    if (used > target) {
+        evicted_fds_ += evict_fds(used - target);
+    }
+}
+
+size_t ThreadTable::used_bytes(size_t* fd_count) const {
+    size_t fds = 0;
+    size_t tables = 0;
+    for (uint32_t i = 0; i < fd_tables_.capacity(); ++i) {
+        if (fd_tables_[i].refs > 0) {
+            fds += fd_tables_[i].table.size();
+            ++tables;
+        }
+    }
+    if (fd_count) {
+        *fd_count = fds;
+    }
+    return slots_.capacity() * sizeof(Slot) + size_ * sizeof(ThreadInfo) + tables * sizeof(SharedFdTable) +
+           fds * sizeof(FdInfo);
+}
+
+size_t ThreadTable::evict_fds(size_t bytes) {
+    // Finds the use stamp below which enough fds are older, and evicts
+    // those; ties at the cutoff go in table order
+    std::vector<uint32_t> stamps;
+    for (uint32_t i = 0; i < fd_tables_.capacity(); ++i) {
+        if (fd_tables_[i].refs > 0) {
+            fd_tables_[i].table.for_each(
+                [&](core::FileDescriptor, const FdInfo& info) { stamps.push_back(info.last_used); });
+        }
+    }
+    if (stamps.empty()) {
+        return 0;
+    }
+
+    size_t count = std::min(stamps.size(), (bytes + sizeof(FdInfo) - 1) / sizeof(FdInfo));
+    std::nth_element(stamps.begin(), stamps.begin() + static_cast<std::ptrdiff_t>(count - 1), stamps.end());
+    uint32_t cutoff = stamps[count - 1];
+    size_t at_cutoff = count;
+    for (size_t i = 0; i < count; ++i) {
+        at_cutoff -= stamps[i] < cutoff;
+    }
+
+    size_t evicted = 0;
+    std::vector<core::FileDescriptor> victims;
+    for (uint32_t i = 0; i < fd_tables_.capacity(); ++i) {
+        SharedFdTable& shared = fd_tables_[i];
+        if (shared.refs == 0) {
+            continue;
+        }
+        victims.clear();
+        shared.table.for_each([&](core::FileDescriptor fd, const FdInfo& info) {
+            if (info.last_used < cutoff || (info.last_used == cutoff && at_cutoff > 0 && at_cutoff--)) {
+                victims.push_back(fd);
+            }
+        });
+        for (core::FileDescriptor fd : victims) {
+            shared.table.erase(fd);
+        }
+        if (!victims.empty()) {
+            shared.table.shrink_to_fit();
+            evicted += victims.size();
+        }
+    }
+    return evicted;
+}
+
+void ThreadTable::grow() {
+    std::vector<Slot> old;
+    old.swap(slots_);
+
+    size_t capacity = old.size() * 2;
+    slots_.assign(capacity, Slot{EMPTY_TID, 0});
+    mask_ = capacity - 1;
+    --shift_;
+
+    for (const Slot& slot : old) {
+        if (slot.tid != EMPTY_TID) {
+            slots_[find_slot(slot.tid)] = slot;
+        }
+    }
+}
+
+void ThreadTable::release_strings(const ThreadInfo& info) {
+    core::StringPool& pool = core::StringPool::instance();
+    pool.release(info.exe);
+    pool.release(info.args);
+    pool.release(info.cwd);
+    pool.release(info.user);
+    pool.release(info.group);
+    pool.release(info.env);
+}
+
+uint32_t ThreadTable::index_of(core::ThreadID tid) const {
+    if (tid == EMPTY_TID) {
+        return ThreadInfo::NO_LINK;
+    }
+    const Slot& slot = slots_[find_slot(tid)];
+    return slot.tid == EMPTY_TID ? ThreadInfo::NO_LINK : slot.index;
+}
+
+void ThreadTable::link(uint32_t child, uint32_t parent) {
+    ThreadInfo& info = arena_[child];
+    ThreadInfo& parent_info = arena_[parent];
+
+    info.parent = parent;
+    info.prev_sibling = ThreadInfo::NO_LINK;
+    info.next_sibling = parent_info.first_child;
+    if (info.next_sibling != ThreadInfo::NO_LINK) {
+        arena_[info.next_sibling].prev_sibling = child;
+    }
+    parent_info.first_child = child;
+}
+
+void ThreadTable::unlink(uint32_t child) {
+    ThreadInfo& info = arena_[child];
+    if (info.parent == ThreadInfo::NO_LINK) {
+        return;
+    }
+
+    if (info.prev_sibling != ThreadInfo::NO_LINK) {
+        arena_[info.prev_sibling].next_sibling = info.next_sibling;
+    } else {
+        arena_[info.parent].first_child = info.next_sibling;
+    }
+    if (info.next_sibling != ThreadInfo::NO_LINK) {
+        arena_[info.next_sibling].prev_sibling = info.prev_sibling;
+    }
+
+    info.parent = ThreadInfo::NO_LINK;
+    info.prev_sibling = ThreadInfo::NO_LINK;
+    info.next_sibling = ThreadInfo::NO_LINK;
+}
+
+void ThreadTable::detach_children(uint32_t parent) {
+    uint32_t i = arena_[parent].first_child;
+    while (i != ThreadInfo::NO_LINK) {
+        ThreadInfo& child = arena_[i];
+        i = child.next_sibling;
+        child.parent = ThreadInfo::NO_LINK;
+        child.prev_sibling = ThreadInfo::NO_LINK;
+        child.next_sibling = ThreadInfo::NO_LINK;
+    }
+    arena_[parent].first_child = ThreadInfo::NO_LINK;
+}
+
+bool ThreadTable::set_parent(core::ThreadID tid, core::ProcessID ppid) {
+    uint32_t child = index_of(tid);
+    if (child == ThreadInfo::NO_LINK) {
+        return false;
+    }
+
+    ThreadInfo& info = arena_[child];
+    info.ppid = ppid;
+    if (!info.is_main_thread()) {
+        return true;
+    }
+
+    unlink(child);
+
+    uint32_t parent = index_of(ppid);
+    if (parent == ThreadInfo::NO_LINK || !arena_[parent].is_main_thread()) {
+        return true;
+    }
+
+    // With pid reuse the new parent can be one of our own descendants
+    for (uint32_t i = parent; i != ThreadInfo::NO_LINK; i = arena_[i].parent) {
+        if (i == child) {
+            return true;
+        }
+    }
+
+    link(child, parent);
+    return true;
+}
+
+void ThreadTable::rebuild_process_tree() {
+    for (const Slot& slot : slots_) {
+        if (slot.tid != EMPTY_TID) {
+            ThreadInfo& info = arena_[slot.index];
+            info.parent = ThreadInfo::NO_LINK;
+            info.first_child = ThreadInfo::NO_LINK;
+            info.next_sibling = ThreadInfo::NO_LINK;
+            info.prev_sibling = ThreadInfo::NO_LINK;
+        }
+    }
+
+    for (const Slot& slot : slots_) {
+        if (slot.tid != EMPTY_TID && arena_[slot.index].is_main_thread()) {
+            set_parent(slot.tid, arena_[slot.index].ppid);
+        }
+    }
+}
+
+bool ThreadTable::is_descendant_of(core::ThreadID tid, core::ProcessID ancestor) const {
+    uint32_t i = index_of(tid);
+    if (i == ThreadInfo::NO_LINK) {
+        return false;
+    }
+
+    if (!arena_[i].is_main_thread()) {
+        if (arena_[i].pid == ancestor) {
+            return true;
+        }
+        i = index_of(arena_[i].pid);
+    }
+
+    for (; i != ThreadInfo::NO_LINK; i = arena_[i].parent) {
+        if (arena_[i].pid == ancestor) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadTable::release_fd_table(const ThreadInfo& info) {
+    if (info.fd_table == ThreadInfo::NO_FD_TABLE) {
+        return;
+    }
+
+    SharedFdTable& shared = fd_tables_[info.fd_table];
+    if (--shared.refs == 0) {
+        shared.table = FdTable();
+        fd_tables_.release(info.fd_table);
+    }
+}
+
+FdTable* ThreadTable::fd_table(core::ThreadID tid) {
+    ThreadInfo* info = find(tid);
+    if (!info) {
+        return nullptr;
+    }
+
+    if (info->fd_table == ThreadInfo::NO_FD_TABLE) {
+        ThreadInfo* main = info->is_main_thread() ? nullptr : find(info->pid);
+        if (main && main->fd_table != ThreadInfo::NO_FD_TABLE) {
+            info->fd_table = main->fd_table;
+            ++fd_tables_[info->fd_table].refs;
+        } else {
+            info->fd_table = fd_tables_.allocate();
+            fd_tables_[info->fd_table].refs = 1;
+            if (main) {
+                main->fd_table = info->fd_table;
+                ++fd_tables_[info->fd_table].refs;
+            }
+        }
+    }
+
+    return &fd_tables_[info->fd_table].table;
+}
+
+const FdTable* ThreadTable::fd_table(core::ThreadID tid) const {
+    const ThreadInfo* info = find(tid);
+    if (!info || info->fd_table == ThreadInfo::NO_FD_TABLE) {
+        return nullptr;
+    }
+    return &fd_tables_[info->fd_table].table;
+}
+
+FdInfo* ThreadTable::find_fd(core::ThreadID tid, core::FileDescriptor fd) {
+    const FdTable* fds = static_cast<const ThreadTable*>(this)->fd_table(tid);
+    FdInfo* info = fds ? const_cast<FdTable*>(fds)->find(fd) : nullptr;
+    if (info) {
+        info->last_used = to_seconds(now_ns_);
+    }
+    return info;
+}
+
+FdInfo* ThreadTable::add_fd(core::ThreadID tid, core::FileDescriptor fd, FdType type) {
+    FdTable* fds = fd_table(tid);
+    FdInfo* info = fds ? fds->add(fd, type) : nullptr;
+    if (info) {
+        info->last_used = to_seconds(now_ns_);
+    }
+    return info;
+}
+
+size_t ThreadTable::memory_usage() const {
+    // Strings live in the process-wide pool and are accounted for there.
+    // Freed fd tables give their storage back, so only live ones count.
+    size_t bytes = slots_.capacity() * sizeof(Slot) + arena_.memory_usage() + fd_tables_.memory_usage();
+    for (uint32_t i = 0; i < fd_tables_.capacity(); ++i) {
+        if (fd_tables_[i].refs > 0) {
+            bytes += fd_tables_[i].table.memory_usage();
+        }
+    }
+    return bytes;
+}
+
+ThreadTable::Stats ThreadTable::get_stats() const {
+    Stats stats;
+    stats.threads = size_;
+    stats.exited_threads = exited_count_;
+    stats.fd_tables = fd_tables_.size();
+    stats.used_bytes = used_bytes(&stats.fds);
+    stats.index_bytes = slots_.capacity() * sizeof(Slot);
+    stats.thread_bytes = size_ * sizeof(ThreadInfo);
+    stats.fd_bytes = stats.used_bytes - stats.index_bytes - stats.thread_bytes;
+    stats.reserved_bytes = memory_usage();
+    stats.memory_budget = limits_.memory_budget;
+    stats.expired_threads = expired_threads_;
+    stats.evicted_threads = evicted_threads_;
+    stats.evicted_fds = evicted_fds_;
+    return stats;
+}
+
+void parse_environ(std::string_view block, std::unordered_map<std::string, std::string>& env) {
+    for_each_environ(block, [&](std::string_view key, std::string_view value) {
+        env.emplace(std::string(key), std::string(value));
+    });
+}
+
+ProcessView ThreadTable::view(const ThreadInfo& info, ProcessFields fields) const {
+    const core::StringPool& pool = core::StringPool::instance();
+
+    ProcessView out;
+    out.pid = info.pid;
+    out.tid = info.tid;
+    out.ppid = info.ppid;
+    out.start_time = info.start_time;
+    if (has_field(fields, ProcessField::Exe)) {
+        out.exe = pool.get(info.exe);
+    }
+    if (has_field(fields, ProcessField::Args)) {
+        out.args = pool.get(info.args);
+    }
+    if (has_field(fields, ProcessField::Cwd)) {
+        out.cwd = pool.get(info.cwd);
+    }
+    if (has_field(fields, ProcessField::User)) {
+        out.user = pool.get(info.user);
+    }
+    if (has_field(fields, ProcessField::Group)) {
+        out.group = pool.get(info.group);
+    }
+    if (has_field(fields, ProcessField::Env)) {
+        out.env = pool.get(info.env);
+    }
+    if (has_field(fields, ProcessField::Rss)) {
+        const ThreadInfo* main = info.is_main_thread() ? &info : find(info.pid);
+        out.rss_bytes = main ? uint64_t(main->rss_kb) * 1024 : 0;
+    }
+    return out;
+}
+
+ProcessInfo ThreadTable::to_process_info(const ThreadInfo& info) const {
+    const core::StringPool& pool = core::StringPool::instance();
+
+    ProcessInfo out;
+    out.pid = info.pid;
+    out.tid = info.tid;
+    out.ppid = info.ppid;
+    out.exe = std::string(pool.get(info.exe));
+    out.args = std::string(pool.get(info.args));
+    out.cwd = std::string(pool.get(info.cwd));
+    out.start_time = info.start_time;
+    out.user = std::string(pool.get(info.user));
+    out.group = std::string(pool.get(info.group));
+
+    parse_environ(pool.get(info.env), out.env);
+
+    if (info.fd_table != ThreadInfo::NO_FD_TABLE) {
+        const FdTable& fds = fd_tables_[info.fd_table].table;
+        out.open_fds.reserve(fds.size());
+        fds.for_each([&](core::FileDescriptor fd, const FdInfo& fdinfo) {
+            out.open_fds.push_back(std::to_string(fd) + " " + format_fd(fdinfo));
+        });
+    }
+
+    return out;
+}
+
+} // namespace sinsp
+} // namespace deepsys
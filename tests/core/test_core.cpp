@@ -26,4 +26,8 @@ TEST(CoreTest, ResultTest) {
     Result<int> error_result(ErrorCode::NotFound);
     EXPECT_FALSE(error_result);
     EXPECT_EQ(error_result.error(), ErrorCode::NotFound);
+
+    Result<void> void_result;
+    EXPECT_TRUE(void_result);
+    EXPECT_FALSE(Result<void>(ErrorCode::SystemError));
 }
@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <core/epoch.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace deepsys::core;
+
+namespace {
+
+struct Tracked {
+    explicit Tracked(std::atomic<int>& live) : live(live), value(42) { ++live; }
+    ~Tracked() {
+        value = 0;
+        --live;
+    }
+
+    std::atomic<int>& live;
+    int value;
+};
+
+} // namespace
+
+TEST(EpochTest, PinnedReaderDelaysFree) {
+    EpochDomain domain;
+    std::atomic<int> live{0};
+
+    auto* object = new Tracked(live);
+    {
+        EpochDomain::Guard guard = domain.pin();
+        domain.retire(object);
+        EXPECT_EQ(domain.collect(), 0u);
+        EXPECT_EQ(object->value, 42);
+    }
+    EXPECT_EQ(domain.collect(), 1u);
+    EXPECT_EQ(live, 0);
+
+    // Readers pinned after the retire don't hold anything back
+    domain.retire(new Tracked(live));
+    domain.collect();
+    EpochDomain::Guard late = domain.pin();
+    domain.retire(new Tracked(live));
+    EXPECT_EQ(domain.pending(), 1u);
+    EXPECT_EQ(domain.collect(), 0u);
+}
+
+TEST(EpochTest, ConcurrentReaders) {
+    EpochDomain domain;
+    std::atomic<int> live{0};
+    std::atomic<Tracked*> current{new Tracked(live)};
+    std::atomic<bool> stop{false};
+    std::atomic<int> bad{0};
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&] {
+            while (!stop.load(std::memory_order_relaxed)) {
+                EpochDomain::Guard guard = domain.pin();
+                if (current.load(std::memory_order_acquire)->value != 42) {
+                    ++bad;
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < 20000; ++i) {
+        Tracked* old = current.exchange(new Tracked(live), std::memory_order_acq_rel);
+        domain.retire(old);
+        if (i % 16 == 0) {
+            domain.collect();
+        }
+    }
+    stop = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+
+    domain.collect();
+    EXPECT_EQ(bad, 0);
+    EXPECT_EQ(live, 1);
+    delete current.load();
+}
@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+#include <core/string_pool.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace deepsys::core;
+
+TEST(StringPoolTest, InternDeduplicates) {
+    StringPool pool;
+
+    StringHandle a = pool.intern("/usr/bin/bash");
+    StringHandle b = pool.intern(std::string("/usr/bin/") + "bash");
+    StringHandle c = pool.intern("/usr/bin/zsh");
+
+    EXPECT_EQ(a, b);
+    EXPECT_NE(a, c);
+    EXPECT_EQ(pool.ref_count(a), 2u);
+    EXPECT_EQ(pool.get(a), "/usr/bin/bash");
+    EXPECT_EQ(pool.get(c), "/usr/bin/zsh");
+
+    EXPECT_EQ(pool.intern(""), EMPTY_STRING_HANDLE);
+    EXPECT_EQ(pool.get(EMPTY_STRING_HANDLE), "");
+    EXPECT_EQ(pool.get_stats().strings, 2u);
+}
+
+TEST(StringPoolTest, ReleaseReclaims) {
+    StringPool pool;
+
+    StringHandle a = pool.intern("/tmp/a");
+    pool.retain(a);
+    pool.release(a);
+    EXPECT_EQ(pool.get(a), "/tmp/a");
+
+    pool.release(a);
+    EXPECT_EQ(pool.ref_count(a), 0u);
+    EXPECT_EQ(pool.get_stats().strings, 0u);
+    EXPECT_EQ(pool.get_stats().reclaimed, 1u);
+
+    // Reclaimed slots are reused, and the old string can't be found anymore
+    StringHandle slot = EMPTY_STRING_HANDLE;
+    pool.assign(slot, "/tmp/a");
+    EXPECT_EQ(pool.get(slot), "/tmp/a");
+    pool.assign(slot, "/tmp/b");
+    EXPECT_EQ(pool.get(slot), "/tmp/b");
+    EXPECT_EQ(pool.get_stats().strings, 1u);
+    pool.assign(slot, "");
+    EXPECT_EQ(slot, EMPTY_STRING_HANDLE);
+    EXPECT_EQ(pool.get_stats().strings, 0u);
+}
+
+TEST(StringPoolTest, ConcurrentIntern) {
+    // Threads intern and release an overlapping set of strings, so entries
+    // are revived and reclaimed concurrently
+    StringPool pool;
+    constexpr int THREADS = 8;
+    constexpr int STRINGS = 5000;
+
+    std::vector<std::thread> threads;
+    std::vector<std::vector<StringHandle>> handles(THREADS);
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&, t] {
+            for (int round = 0; round < 4; ++round) {
+                for (int i = 0; i < STRINGS; ++i) {
+                    handles[t].push_back(pool.intern("/proc/" + std::to_string(i)));
+                }
+                for (int i = 0; i < STRINGS; ++i) {
+                    EXPECT_EQ(pool.get(handles[t][i]), "/proc/" + std::to_string(i));
+                }
+                for (StringHandle h : handles[t]) {
+                    pool.release(h);
+                }
+                handles[t].clear();
+            }
+            for (int i = 0; i < STRINGS; ++i) {
+                handles[t].push_back(pool.intern("/proc/" + std::to_string(i)));
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for (int t = 1; t < THREADS; ++t) {
+        EXPECT_EQ(handles[t], handles[0]);
+    }
+    EXPECT_EQ(pool.get_stats().strings, static_cast<uint64_t>(STRINGS));
+    EXPECT_EQ(pool.ref_count(handles[0][0]), static_cast<uint32_t>(THREADS));
+}
@@ -0,0 +1,195 @@
+#include <gtest/gtest.h>
+#include <sinsp/checkpoint.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+using namespace deepsys::sinsp;
+using deepsys::core::StringPool;
+
+namespace {
+
+class TempDir {
+public:
+    TempDir() {
+        char tmpl[] = "/tmp/deepsys_ckpt_XXXXXX";
+        path_ = mkdtemp(tmpl);
+    }
+    ~TempDir() { std::system(("rm -rf " + path_).c_str()); }
+
+    const std::string& path() const { return path_; }
+
+private:
+    std::string path_;
+};
+
+void write_file(const std::string& path, const std::string& content) {
+    std::ofstream(path, std::ios::binary) << content;
+}
+
+ThreadInfo* add_process(ThreadTable& table, int64_t pid, int32_t ppid, uint64_t start_time, const char* exe) {
+    ThreadInfo* info = table.get_or_add(pid);
+    info->pid = static_cast<int32_t>(pid);
+    info->start_time = start_time;
+    StringPool::instance().assign(info->exe, exe);
+    table.set_parent(pid, ppid);
+    return info;
+}
+
+void add_fd(ThreadTable& table, int64_t tid, int32_t fd, const char* name) {
+    FdInfo* info = table.fd_table(tid)->add(fd, FdType::File);
+    StringPool::instance().assign(info->name, name);
+}
+
+std::string fd_name(const ThreadTable& table, int64_t tid, int32_t fd) {
+    const FdTable* fds = table.fd_table(tid);
+    const FdInfo* info = fds ? fds->find(fd) : nullptr;
+    return info ? std::string(StringPool::instance().get(info->name)) : "<none>";
+}
+
+} // namespace
+
+TEST(CheckpointTest, RoundTrip) {
+    TempDir dir;
+    std::string path = dir.path() + "/state.ckpt";
+
+    ThreadTable table;
+    add_process(table, 1, 0, 100, "/sbin/init");
+    add_process(table, 50, 1, 200, "/usr/bin/app");
+    table.get_or_add(51)->pid = 50;
+    table.set_parent(51, 1);
+    add_fd(table, 50, 3, "/var/log/app.log");
+    add_fd(table, 50, 5000, "/tmp/big");
+
+    CheckpointWriter writer(path);
+    writer.checkpoint(table);
+    ASSERT_TRUE(writer.flush());
+
+    // A second checkpoint only adds the new strings to the dictionary
+    add_process(table, 60, 50, 300, "/bin/sh");
+    add_fd(table, 60, 0, "/dev/null");
+    writer.checkpoint(table);
+    ASSERT_TRUE(writer.flush());
+    EXPECT_EQ(writer.get_stats().written, 2u);
+
+    auto loaded = Checkpoint::open(path);
+    ASSERT_TRUE(loaded);
+    EXPECT_EQ(loaded.value()->thread_count(), 4u);
+
+    ThreadTable restored;
+    loaded.value()->restore(restored);
+    ASSERT_EQ(restored.size(), 4u);
+    EXPECT_EQ(StringPool::instance().get(restored.find(60)->exe), "/bin/sh");
+    EXPECT_EQ(restored.find(51)->pid, 50);
+    EXPECT_EQ(restored.find(50)->start_time, 200u);
+    EXPECT_TRUE(restored.is_descendant_of(60, 1));
+    EXPECT_EQ(fd_name(restored, 50, 3), "/var/log/app.log");
+    EXPECT_EQ(fd_name(restored, 50, 5000), "/tmp/big");
+    EXPECT_EQ(fd_name(restored, 60, 0), "/dev/null");
+    EXPECT_EQ(restored.fd_table(51), restored.fd_table(50));
+}
+
+TEST(CheckpointTest, RejectsCorruption) {
+    TempDir dir;
+    std::string path = dir.path() + "/state.ckpt";
+
+    EXPECT_EQ(Checkpoint::open(path).error(), deepsys::core::ErrorCode::NotFound);
+
+    ThreadTable table;
+    add_process(table, 1, 0, 100, "/sbin/init");
+    {
+        CheckpointWriter writer(path);
+        writer.checkpoint(table);
+    }
+    ASSERT_TRUE(Checkpoint::open(path));
+
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(sizeof(CheckpointHeader) + 4);
+    file.put('\x7f');
+    file.close();
+    EXPECT_EQ(Checkpoint::open(path).error(), deepsys::core::ErrorCode::InvalidArgument);
+}
+
+TEST(CheckpointTest, WarmStartReconciles) {
+    TempDir dir;
+    std::string root = dir.path() + "/proc";
+    std::string path = dir.path() + "/state.ckpt";
+
+    for (const char* sub : {"", "/sys", "/sys/kernel", "/sys/kernel/random", "/42", "/42/task", "/42/task/42",
+                            "/42/task/43", "/42/fd"}) {
+        ASSERT_EQ(mkdir((root + sub).c_str(), 0755), 0);
+    }
+    write_file(root + "/sys/kernel/random/boot_id", "0b1d4e4f-0000-4000-8000-000000000001\n");
+    write_file(root + "/stat", "btime 1000\n");
+    write_file(root + "/42/stat", "42 (app) S 1 42 42 0 -1 0 0 0 0 0 0 0 0 0 20 0 2 0 250 0 0\n");
+    ASSERT_EQ(symlink("/var/log/app.log", (root + "/42/fd/1").c_str()), 0);
+    ASSERT_EQ(symlink("/tmp/new", (root + "/42/fd/2").c_str()), 0);
+    ASSERT_EQ(symlink("/tmp/reopened", (root + "/42/fd/3").c_str()), 0);
+    ASSERT_EQ(symlink("/usr/bin/app2", (root + "/42/exe").c_str()), 0);
+
+    uint64_t start_time = 1000000000000ULL + 250 * (1000000000ULL / sysconf(_SC_CLK_TCK));
+
+    // Before the restart 42 was the child of 7, which has exited since, and
+    // 99 was running too
+    {
+        ThreadTable table;
+        add_process(table, 7, 1, 50, "/bin/launcher");
+        add_process(table, 42, 7, start_time, "/usr/bin/app");
+        add_process(table, 99, 1, 60, "/bin/gone");
+        add_fd(table, 42, 1, "/var/log/app.log");
+        add_fd(table, 42, 3, "/tmp/old");
+        add_fd(table, 42, 5, "/tmp/closed");
+        table.fd_table(42)->find(1)->flags = 0x401;
+
+        CheckpointWriter writer(path, root);
+        writer.checkpoint(table);
+        ASSERT_TRUE(writer.flush());
+    }
+
+    ProcScanConfig config;
+    config.proc_root = root;
+    config.scan_sockets = false;
+
+    ThreadTable table;
+    auto stats = warm_start(path, table, config);
+    ASSERT_TRUE(stats);
+    EXPECT_EQ(stats.value().reused, 1u);
+    EXPECT_EQ(stats.value().pruned, 1u);
+
+    // 42 keeps its parent from the checkpoint, picks up the exec it did
+    // while nobody was watching, and gains the thread started meanwhile
+    ASSERT_NE(table.find(42), nullptr);
+    EXPECT_EQ(StringPool::instance().get(table.find(42)->exe), "/usr/bin/app2");
+    EXPECT_EQ(table.find(42)->ppid, 7);
+    ASSERT_NE(table.find(43), nullptr);
+    EXPECT_EQ(StringPool::instance().get(table.find(43)->exe), "/usr/bin/app2");
+    EXPECT_TRUE(table.is_descendant_of(43, 7));
+    EXPECT_NE(table.find(7), nullptr);
+    EXPECT_EQ(table.find(99), nullptr);
+
+    EXPECT_EQ(fd_name(table, 42, 1), "/var/log/app.log");
+    EXPECT_EQ(fd_name(table, 42, 2), "/tmp/new");
+    EXPECT_EQ(fd_name(table, 42, 3), "/tmp/reopened");
+    EXPECT_EQ(fd_name(table, 42, 5), "<none>");
+    // Unchanged fds keep what events taught about them
+    EXPECT_EQ(table.fd_table(42)->find(1)->flags, 0x401u);
+
+    // Without a boot id there's no telling the checkpoint is from this boot
+    write_file(root + "/sys/kernel/random/boot_id", "");
+    {
+        ThreadTable saved;
+        add_process(saved, 42, 7, start_time, "/usr/bin/app");
+        CheckpointWriter writer(path, root);
+        writer.checkpoint(saved);
+        ASSERT_TRUE(writer.flush());
+    }
+    ThreadTable cold;
+    stats = warm_start(path, cold, config);
+    ASSERT_TRUE(stats);
+    EXPECT_EQ(stats.value().reused, 0u);
+    EXPECT_EQ(cold.find(42)->ppid, 1);
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include <sinsp/fd_table.h>
+#include <sinsp/thread_table.h>
+
+#include <random>
+#include <unordered_map>
+
+using namespace deepsys::sinsp;
+using deepsys::core::StringPool;
+
+TEST(FdTableTest, AddFindErase) {
+    FdTable fds;
+    StringPool& pool = StringPool::instance();
+
+    FdInfo* info = fds.add(3, FdType::File);
+    ASSERT_NE(info, nullptr);
+    pool.assign(info->name, "/etc/passwd");
+
+    info = fds.add(70000, FdType::Pipe);
+    ASSERT_NE(info, nullptr);
+    info->ino = 1234;
+
+    EXPECT_EQ(fds.size(), 2u);
+    EXPECT_EQ(format_fd(*fds.find(3)), "/etc/passwd");
+    EXPECT_EQ(format_fd(*fds.find(70000)), "pipe:[1234]");
+    EXPECT_EQ(fds.find(4), nullptr);
+    EXPECT_EQ(fds.find(-1), nullptr);
+    EXPECT_EQ(fds.add(-1, FdType::File), nullptr);
+
+    // dup2 onto an open fd replaces it and drops the old name
+    deepsys::core::StringHandle name = fds.find(3)->name;
+    pool.retain(name);
+    fds.add(3, FdType::IPv4Socket);
+    EXPECT_EQ(fds.size(), 2u);
+    EXPECT_EQ(pool.ref_count(name), 1u);
+    pool.release(name);
+
+    EXPECT_TRUE(fds.erase(3));
+    EXPECT_FALSE(fds.erase(3));
+    EXPECT_TRUE(fds.erase(70000));
+    EXPECT_TRUE(fds.empty());
+}
+
+TEST(FdTableTest, ChurnMatchesReference) {
+    // Mostly small fds with some large ones, so both the array and the hash
+    // see growth and erasure
+    FdTable fds;
+    std::unordered_map<int32_t, uint64_t> reference;
+    std::mt19937 rng(7);
+
+    for (int i = 0; i < 100000; ++i) {
+        int32_t fd = rng() % 4 == 0 ? static_cast<int32_t>(1000 + rng() % 5000) : static_cast<int32_t>(rng() % 256);
+        if (rng() % 2 == 0) {
+            EXPECT_EQ(fds.erase(fd), reference.erase(fd) == 1);
+        } else {
+            fds.add(fd, FdType::File)->ino = static_cast<uint64_t>(i);
+            reference[fd] = static_cast<uint64_t>(i);
+        }
+    }
+
+    ASSERT_EQ(fds.size(), reference.size());
+    size_t visited = 0;
+    fds.for_each([&](int32_t fd, const FdInfo& info) {
+        auto it = reference.find(fd);
+        ASSERT_NE(it, reference.end());
+        EXPECT_EQ(info.ino, it->second);
+        ++visited;
+    });
+    EXPECT_EQ(visited, reference.size());
+}
+
+TEST(FdTableTest, SharedByThreads) {
+    ThreadTable table;
+    table.get_or_add(10)->pid = 10;
+    table.get_or_add(11)->pid = 10;
+
+    FdTable* fds = table.fd_table(11);
+    ASSERT_NE(fds, nullptr);
+    EXPECT_EQ(table.fd_table(10), fds);
+
+    FdInfo* info = fds->add(5, FdType::IPv4Socket);
+    info->sip = {127, 0, 0, 1};
+    info->dip = {10, 0, 0, 2};
+    info->sport = 40000;
+    info->dport = 443;
+
+    ProcessInfo pi = table.to_process_info(*table.find(10));
+    ASSERT_EQ(pi.open_fds.size(), 1u);
+    EXPECT_EQ(pi.open_fds[0], "5 127.0.0.1:40000->10.0.0.2:443");
+
+    // The table outlives the main thread while another thread uses it
+    table.erase(10);
+    ASSERT_EQ(table.fd_table(11), fds);
+    EXPECT_EQ(fds->size(), 1u);
+    table.erase(11);
+    EXPECT_EQ(table.fd_table(11), nullptr);
+}
@@ -0,0 +1,307 @@
+#include <gtest/gtest.h>
+#include <sinsp/event_table.h>
+#include <sinsp/filter.h>
+#include <sinsp/filter_cache.h>
+
+#include <string>
+#include <vector>
+
+using namespace deepsys::sinsp;
+using deepsys::core::Event;
+using deepsys::core::StringPool;
+
+namespace {
+
+EventType first_type(const char* name) {
+    std::vector<EventType> types;
+    EXPECT_TRUE(find_event_types(name, types)) << name;
+    return types.empty() ? 0 : types[0];
+}
+
+bool matches(const char* expression, const FilterEvent& event) {
+    auto filter = Filter::compile(expression);
+    EXPECT_TRUE(filter) << expression;
+    return filter && filter.value().matches(event);
+}
+
+} // namespace
+
+TEST(FilterTest, ParsesToCanonicalText) {
+    auto root = parse_filter("proc.name contains firefox and (evt.res<0 or not fd.name startswith '/etc')"
+                             " and (proc.pid = 1 and fd.name in (\"/a b\", /c))");
+    ASSERT_TRUE(root);
+    std::string text = to_string(*root.value());
+    EXPECT_EQ(text, "proc.name contains firefox and (evt.res < 0 or not fd.name startswith /etc) and "
+                    "proc.pid = 1 and fd.name in (\"/a b\", /c)");
+
+    auto again = parse_filter(text);
+    ASSERT_TRUE(again);
+    EXPECT_EQ(to_string(*again.value()), text);
+
+    for (const char* bad : {"", "proc.name", "proc.nope = 1", "proc.name = ", "(proc.pid = 1", "proc.pid = 1)",
+                            "proc.pid ! 1", "fd.name in /a", "fd.name = 'open", "proc.pid = 1 or"}) {
+        EXPECT_FALSE(parse_filter(bad)) << bad;
+    }
+    for (const char* bad : {"proc.name < a", "proc.pid contains 1", "proc.pid = abc", "evt.type = nosuchcall",
+                            "evt.type > open", "proc.pid = 18446744073709551615", "evt.res > 9223372036854775808",
+                            "evt.res < -9223372036854775809", "proc.pid = 0x10000000000000000"}) {
+        EXPECT_FALSE(Filter::compile(bad)) << bad;
+    }
+    EXPECT_TRUE(Filter::compile("evt.res >= -9223372036854775808 and evt.res <= 9223372036854775807"));
+}
+
+TEST(FilterTest, MatchesEvents) {
+    ThreadTable table;
+    ThreadInfo* thread = table.get_or_add(101);
+    thread->pid = 100;
+    thread->ppid = 1;
+    StringPool::instance().assign(thread->exe, "/usr/lib/firefox/firefox");
+    StringPool::instance().assign(thread->args, std::string("firefox\0--private", 17));
+    StringPool::instance().assign(table.fd_table(101)->add(3, FdType::File)->name, "/etc/passwd");
+
+    Event event;
+    event.id = first_type("open");
+    event.pid = 100;
+    event.tid = 101;
+    FilterEvent open = make_filter_event(event, table, 3, 3);
+    ASSERT_NE(open.fd_info, nullptr);
+
+    EXPECT_TRUE(matches("proc.name contains firefox", open));
+    EXPECT_TRUE(matches("evt.type = open and fd.name startswith /etc", open));
+    EXPECT_TRUE(matches("evt.type in (execve, open) and proc.ppid = 1", open));
+    EXPECT_TRUE(matches("evt.type != execve", open));
+    EXPECT_TRUE(matches("proc.name icontains FIRE and proc.cmdline contains --private", open));
+    EXPECT_TRUE(matches("fd.name glob '/etc/*wd' and fd.name endswith passwd and fd.type = file", open));
+    EXPECT_TRUE(matches("fd.name in (/etc/shadow, /etc/passwd) and fd.num in (3, 4)", open));
+    EXPECT_TRUE(matches("not (evt.res < 0 or proc.pid = 7)", open));
+    EXPECT_TRUE(matches("", open));
+    EXPECT_FALSE(matches("proc.name = firefox and evt.res < 0", open));
+    EXPECT_FALSE(matches("fd.name glob '/etc/?' or fd.name in (/etc/shadow)", open));
+    EXPECT_FALSE(matches("evt.type = execve", open));
+
+    // Absent fields fail every comparison, negative ones included
+    FilterEvent bare = make_filter_event(event, table);
+    bare.thread = nullptr;
+    EXPECT_FALSE(matches("fd.name != /tmp", bare));
+    EXPECT_FALSE(matches("proc.name exists", bare));
+    EXPECT_TRUE(matches("not fd.name exists and proc.pid exists", bare));
+}
+
+TEST(FilterTest, ShortCircuitJumpsAreThreaded) {
+    auto filter = Filter::compile("(proc.pid = 1 and proc.ppid = 2) or (proc.pid = 3 and proc.ppid = 4) or "
+                                  "proc.pid = 5");
+    ASSERT_TRUE(filter);
+    const FilterProgram& program = filter.value().program();
+    EXPECT_EQ(program.registers(), 2u);
+
+    // No jump lands on another jump
+    const std::vector<FilterInstr>& code = program.code();
+    for (const FilterInstr& instr : code) {
+        if (instr.op == FilterOp::JumpIfFalse || instr.op == FilterOp::JumpIfTrue) {
+            ASSERT_LT(instr.arg, code.size());
+            EXPECT_NE(code[instr.arg].op, FilterOp::JumpIfFalse) << program.disassemble();
+            EXPECT_NE(code[instr.arg].op, FilterOp::JumpIfTrue) << program.disassemble();
+        }
+    }
+
+    ThreadTable table;
+    table.get_or_add(9)->ppid = 4;
+    for (int32_t pid : {1, 3, 5, 6}) {
+        Event event;
+        event.pid = pid;
+        event.tid = 9;
+        EXPECT_EQ(filter.value().matches(make_filter_event(event, table)), pid == 3 || pid == 5) << pid;
+    }
+}
+
+TEST(FilterTest, CompilesListsToMatchers) {
+    ThreadTable table;
+    StringPool::instance().assign(table.get_or_add(5)->exe, "/usr/bin/curl");
+    StringPool::instance().assign(table.fd_table(5)->add(3, FdType::File)->name, "/etc/ssl/certs/ca.pem");
+    Event event;
+    event.id = first_type("open");
+    event.pid = 5;
+    event.tid = 5;
+    FilterEvent open = make_filter_event(event, table, 3, 3);
+
+    std::string list;
+    for (int i = 0; i < 500; ++i) {
+        list += (i ? ", /data/file" : "fd.name in (/data/file") + std::to_string(i);
+    }
+    EXPECT_FALSE(matches((list + ")").c_str(), open));
+    EXPECT_TRUE(matches((list + ", /etc/ssl/certs/ca.pem)").c_str(), open));
+
+    EXPECT_TRUE(matches("fd.name pmatch (/var, /etc/ssl)", open));
+    EXPECT_FALSE(matches("fd.name pmatch (/etc/ss, /usr)", open));
+    EXPECT_FALSE(Filter::compile("proc.pid pmatch (/etc)"));
+
+    // Enough contains on one field in an "or" become a single automaton
+    auto filter = Filter::compile("proc.name contains wget or evt.res < 0 or proc.name contains curl or "
+                                  "proc.name contains nc");
+    ASSERT_TRUE(filter);
+    size_t any = 0;
+    for (const FilterInstr& instr : filter.value().program().code()) {
+        any += instr.op == FilterOp::StrContainsAny;
+        EXPECT_NE(instr.op, FilterOp::StrContains) << filter.value().program().disassemble();
+    }
+    EXPECT_EQ(any, 1u);
+    EXPECT_TRUE(filter.value().matches(open));
+    EXPECT_FALSE(matches("proc.name contains wget or proc.name contains nc or proc.name contains ssh", open));
+}
+
+TEST(FilterTest, MatchesNetworks) {
+    ThreadTable table;
+    table.get_or_add(5);
+    FdInfo* socket = table.fd_table(5)->add(4, FdType::IPv4Socket);
+    socket->sip = {10, 1, 2, 3};
+    socket->dip = {93, 184, 216, 34};
+    table.fd_table(5)->add(5, FdType::File);
+    Event event;
+    event.id = first_type("connect");
+    event.pid = 5;
+    event.tid = 5;
+    FilterEvent connect = make_filter_event(event, table, 0, 4);
+    FilterEvent file = make_filter_event(event, table, 0, 5);
+
+    EXPECT_TRUE(matches("fd.sip in (192.168.0.0/16, 10.0.0.0/8)", connect));
+    EXPECT_TRUE(matches("fd.dip = 93.184.216.34 and fd.sip != 10.1.2.4", connect));
+    EXPECT_TRUE(matches("fd.net in (93.184.0.0/16)", connect));
+    EXPECT_TRUE(matches("fd.net = 10.0.0.0/8", connect));
+    EXPECT_FALSE(matches("fd.net != 10.0.0.0/8", connect));
+    EXPECT_TRUE(matches("fd.net != 172.16.0.0/12", connect));
+    EXPECT_FALSE(matches("fd.net in (::/0, 172.16.0.0/12)", connect));
+    EXPECT_FALSE(matches("fd.net in (0.0.0.0/0)", file));
+    EXPECT_FALSE(matches("fd.net != 0.0.0.0/0", file));
+    EXPECT_TRUE(matches("not fd.net exists", file));
+    EXPECT_TRUE(matches("fd.net in (::ffff:10.0.0.0/104)", connect));
+
+    // fd.net tests both addresses against one set
+    auto net = Filter::compile("fd.net in (10.0.0.0/8, 192.168.0.0/16)");
+    ASSERT_TRUE(net);
+    std::vector<uint32_t> sets;
+    for (const FilterInstr& instr : net.value().program().code()) {
+        if (instr.op == FilterOp::AddrIn) {
+            sets.push_back(instr.arg);
+        }
+    }
+    EXPECT_EQ(sets, (std::vector<uint32_t>{0, 0}));
+
+    for (const char* bad : {"fd.sip = example.com", "fd.sip contains 10", "fd.dip < 10.0.0.1"}) {
+        EXPECT_FALSE(Filter::compile(bad)) << bad;
+    }
+}
+
+TEST(FilterTest, BatchAgreesWithSingleEvents) {
+    ThreadTable table;
+    const char* exes[] = {"/bin/bash", "/usr/bin/curl", "/usr/sbin/sshd"};
+    for (int32_t tid = 1; tid <= 30; ++tid) {
+        ThreadInfo* thread = table.get_or_add(tid);
+        thread->pid = tid;
+        thread->ppid = tid % 4;
+        StringPool::instance().assign(thread->exe, exes[tid % 3]);
+        FdInfo* fd = table.fd_table(tid)->add(3, tid % 2 ? FdType::IPv4Socket : FdType::File);
+        fd->sip = {10, 0, 0, static_cast<uint8_t>(tid)};
+        StringPool::instance().assign(fd->name, tid % 5 ? "/etc/passwd" : "/tmp/x");
+    }
+
+    // 150 events, so the last block is partial; every fifth tid has no
+    // thread at all
+    std::vector<FilterEvent> events;
+    for (int i = 0; i < 150; ++i) {
+        Event event;
+        event.id = first_type(i % 3 ? "open" : "execve");
+        event.tid = i % 35 + 1;
+        event.pid = event.tid;
+        events.push_back(make_filter_event(event, table, i % 7 - 3, i % 2 ? 3 : -1));
+    }
+
+    for (const char* expression :
+         {"", "evt.res < 0", "evt.res >= 1 and proc.ppid in (0, 2)", "proc.pid in (1, 2, 3, 4, 5, 6, 7, 8, 9, 11)",
+          "proc.name = bash or (fd.name startswith /etc and not evt.type = execve)",
+          "not (proc.name contains ssh or evt.res = 0) and fd.num exists",
+          "fd.net in (10.0.0.0/29) or proc.exe endswith curl", "fd.sip != 10.0.0.3 and evt.res != 2",
+          "proc.name in (bash, sshd) and (evt.res > 0 or proc.ppid = 1 or fd.name glob '/tmp/*')"}) {
+        auto filter = Filter::compile(expression);
+        ASSERT_TRUE(filter) << expression;
+        std::vector<uint64_t> bits;
+        filter.value().matches_batch(events, bits);
+        ASSERT_EQ(bits.size(), 3u);
+        EXPECT_EQ(bits[2] >> (150 - 128), 0u) << expression;
+        for (size_t i = 0; i < events.size(); ++i) {
+            EXPECT_EQ(((bits[i / 64] >> (i % 64)) & 1) != 0, filter.value().matches(events[i]))
+                << expression << " event " << i;
+        }
+    }
+}
+
+TEST(FilterTest, SharesCompiledPrograms) {
+    FilterCache& cache = FilterCache::instance();
+    FilterCache::Stats before = cache.get_stats();
+    {
+        auto a = Filter::compile("proc.pid=4242 and (proc.name = cached)");
+        auto b = Filter::compile("proc.pid = 4242 and proc.name = cached");
+        auto c = Filter::compile("proc.pid = 4242 and proc.name = cached");
+        ASSERT_TRUE(a && b && c);
+        EXPECT_EQ(a.value().compiled(), b.value().compiled());
+        EXPECT_EQ(b.value().compiled(), c.value().compiled());
+
+        // b by its canonical form, c as written
+        FilterCache::Stats stats = cache.get_stats();
+        EXPECT_EQ(stats.misses, before.misses + 1);
+        EXPECT_EQ(stats.hits, before.hits + 2);
+        EXPECT_EQ(stats.live, before.live + 1);
+
+        // Copies share it too
+        Filter copy = a.value();
+        EXPECT_EQ(copy.compiled(), a.value().compiled());
+    }
+    // Gone with its last holder
+    EXPECT_EQ(cache.get_stats().live, before.live);
+    ASSERT_TRUE(Filter::compile("proc.pid = 4242 and proc.name = cached"));
+    EXPECT_EQ(cache.get_stats().misses, before.misses + 2);
+}
+
+TEST(FilterTest, DerivesEventTypes) {
+    auto types_of = [](const char* expression) {
+        auto filter = Filter::compile(expression);
+        EXPECT_TRUE(filter) << expression;
+        return filter ? filter.value().event_types() : EventTypeSet();
+    };
+    auto named = [](std::initializer_list<const char*> names) {
+        EventTypeSet set;
+        for (const char* name : names) {
+            std::vector<EventType> types;
+            EXPECT_TRUE(find_event_types(name, types)) << name;
+            for (EventType type : types) {
+                set.set(type);
+            }
+        }
+        return set;
+    };
+
+    EXPECT_EQ(types_of("evt.type = execve"), named({"execve"}));
+    EXPECT_EQ(types_of("evt.type in (open, openat) and proc.name = cat"), named({"open", "openat"}));
+    EXPECT_EQ(types_of("evt.type != open"), named({"open"}).complement());
+    EXPECT_EQ(types_of("not (evt.type = open or evt.type = openat)"), named({"open", "openat"}).complement());
+    EXPECT_EQ(types_of("proc.name = cat"), EventTypeSet::all());
+    EXPECT_EQ(types_of(""), EventTypeSet::all());
+    EXPECT_TRUE(types_of("evt.type = open and evt.type = close").empty());
+
+    // fd fields only exist on fd events
+    EventTypeSet either = types_of("evt.type = execve or fd.name startswith /etc");
+    EventTypeSet expected = named({"execve"});
+    expected |= EventTypeSet::with_flags(EVENT_HAS_FD);
+    EXPECT_EQ(either, expected);
+    EXPECT_TRUE(either.test(named({"open"}).types()[0]));
+    EXPECT_FALSE(either.test(named({"getcwd"}).types()[0]));
+
+    // The capture keeps what state tracking needs
+    auto filter = Filter::compile("evt.type = getcwd");
+    ASSERT_TRUE(filter);
+    EventTypeSet capture = filter.value().capture_event_types();
+    EXPECT_TRUE(capture.test(named({"getcwd"}).types()[0]));
+    for (EventType type : named({"clone", "execve"}).types()) {
+        EXPECT_TRUE(capture.test(type)) << type;
+    }
+    EXPECT_FALSE(capture.test(named({"nanosleep"}).types()[0]));
+}
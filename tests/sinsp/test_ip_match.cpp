@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include <sinsp/ip_match.h>
+
+#include <arpa/inet.h>
+
+#include <random>
+#include <vector>
+
+using namespace deepsys::sinsp;
+
+namespace {
+
+IpNetwork network(const char* text) {
+    IpNetwork out;
+    EXPECT_TRUE(parse_ip_network(text, out)) << text;
+    return out;
+}
+
+bool contains(const NetworkSet& set, const char* addr) {
+    uint8_t bytes[16];
+    if (inet_pton(AF_INET, addr, bytes) == 1) {
+        return set.contains(bytes, 4);
+    }
+    EXPECT_EQ(inet_pton(AF_INET6, addr, bytes), 1) << addr;
+    return set.contains(bytes, 16);
+}
+
+} // namespace
+
+TEST(IpMatchTest, ParsesNetworks) {
+    IpNetwork out;
+    EXPECT_TRUE(parse_ip_network("10.0.0.0/8", out));
+    EXPECT_FALSE(out.v6);
+    EXPECT_EQ(out.prefix, 8);
+    EXPECT_TRUE(parse_ip_network("192.168.1.7", out));
+    EXPECT_EQ(out.prefix, 32);
+    EXPECT_TRUE(parse_ip_network("fe80::/10", out));
+    EXPECT_TRUE(out.v6);
+    EXPECT_EQ(out.prefix, 10);
+    for (const char* bad : {"", "10.0.0/8", "10.0.0.0/33", "10.0.0.0/", "10.0.0.0/8x", "::/129", "host"}) {
+        EXPECT_FALSE(parse_ip_network(bad, out)) << bad;
+    }
+}
+
+TEST(IpMatchTest, MatchesNetworks) {
+    NetworkSet set({network("10.0.0.0/8"), network("192.168.1.7"), network("172.16.0.0/12"),
+                    network("10.1.0.0/16"), network("fe80::/10"), network("2001:db8::1")});
+    EXPECT_EQ(set.size(), 6u);
+    EXPECT_TRUE(contains(set, "10.255.0.1"));
+    EXPECT_TRUE(contains(set, "10.1.2.3"));
+    EXPECT_TRUE(contains(set, "192.168.1.7"));
+    EXPECT_FALSE(contains(set, "192.168.1.8"));
+    EXPECT_TRUE(contains(set, "172.31.255.255"));
+    EXPECT_FALSE(contains(set, "172.32.0.0"));
+    EXPECT_FALSE(contains(set, "11.0.0.0"));
+    EXPECT_TRUE(contains(set, "fe80::1"));
+    EXPECT_TRUE(contains(set, "febf::1"));
+    EXPECT_FALSE(contains(set, "fec0::1"));
+    EXPECT_TRUE(contains(set, "2001:db8::1"));
+    EXPECT_FALSE(contains(set, "2001:db8::2"));
+    EXPECT_TRUE(contains(set, "::ffff:10.3.3.3"));
+
+    // A network of mapped addresses matches them whichever way they come
+    EXPECT_TRUE(contains(NetworkSet({network("::ffff:192.168.0.0/112")}), "192.168.4.4"));
+    EXPECT_TRUE(contains(NetworkSet({network("::ffff:192.168.0.0/112")}), "::ffff:192.168.4.4"));
+    EXPECT_FALSE(contains(NetworkSet({network("::ffff:192.168.0.0/112")}), "192.169.0.1"));
+    EXPECT_TRUE(contains(NetworkSet({network("::ffff:0:0/96")}), "8.8.8.8"));
+    EXPECT_FALSE(contains(NetworkSet({network("::ffff:0:0/96")}), "::1"));
+
+    EXPECT_TRUE(contains(NetworkSet({network("0.0.0.0/0")}), "8.8.8.8"));
+    EXPECT_FALSE(contains(NetworkSet({network("0.0.0.0/0")}), "::1"));
+    EXPECT_FALSE(contains(NetworkSet({}), "8.8.8.8"));
+}
+
+TEST(IpMatchTest, AgreesWithLinearScan) {
+    std::mt19937 rng(7);
+    std::vector<IpNetwork> networks;
+    for (int i = 0; i < 3000; ++i) {
+        IpNetwork net{};
+        uint32_t addr = rng() & 0x0fffffff;     // Dense enough to nest
+        for (int b = 0; b < 4; ++b) {
+            net.addr[b] = static_cast<uint8_t>(addr >> (24 - 8 * b));
+        }
+        net.prefix = static_cast<uint8_t>(8 + rng() % 25);
+        networks.push_back(net);
+    }
+    NetworkSet set(networks);
+
+    for (int i = 0; i < 20000; ++i) {
+        uint32_t addr = rng() & 0x0fffffff;
+        bool expected = false;
+        for (const IpNetwork& net : networks) {
+            uint32_t base = uint32_t(net.addr[0]) << 24 | uint32_t(net.addr[1]) << 16 |
+                            uint32_t(net.addr[2]) << 8 | net.addr[3];
+            uint32_t mask = ~uint32_t(0) << (32 - net.prefix);
+            expected = expected || ((addr ^ base) & mask) == 0;
+        }
+        uint8_t bytes[4] = {uint8_t(addr >> 24), uint8_t(addr >> 16), uint8_t(addr >> 8), uint8_t(addr)};
+        ASSERT_EQ(set.contains(bytes, 4), expected) << addr;
+    }
+}
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include <sinsp/proc_scan.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+using namespace deepsys::sinsp;
+using deepsys::core::StringPool;
+
+namespace {
+
+void write_file(const std::string& path, const std::string& content) {
+    std::ofstream(path, std::ios::binary) << content;
+}
+
+std::string find_fd(const ProcessInfo& pi, int fd) {
+    std::string prefix = std::to_string(fd) + " ";
+    for (const std::string& entry : pi.open_fds) {
+        if (entry.compare(0, prefix.size(), prefix) == 0) {
+            return entry.substr(prefix.size());
+        }
+    }
+    return "";
+}
+
+} // namespace
+
+TEST(ProcScanTest, FakeProcTree) {
+    // A minimal /proc with one two-threaded process; fd links are plain
+    // symlinks, readlink doesn't care what they point to
+    char tmpl[] = "/tmp/deepsys_proc_XXXXXX";
+    ASSERT_NE(mkdtemp(tmpl), nullptr);
+    std::string root = tmpl;
+
+    for (const char* dir : {"/42", "/42/task", "/42/task/42", "/42/task/43", "/42/fd", "/net", "/self"}) {
+        ASSERT_EQ(mkdir((root + dir).c_str(), 0755), 0);
+    }
+    write_file(root + "/stat", "cpu 1 2 3\nbtime 1000\n");
+    write_file(root + "/42/stat",
+               "42 (my (odd) comm) S 1 42 42 0 -1 4194560 0 0 0 0 0 0 0 0 20 0 2 0 250 0 0\n");
+    write_file(root + "/42/cmdline", std::string("/bin/app\0--flag\0", 16));
+    write_file(root + "/42/environ", std::string("HOME=/root\0", 11));
+    write_file(root + "/42/statm", "2000 300 100 10 0 500 0\n");
+    write_file(root + "/42/status", "Name:\tapp\nUid:\t1000\t1000\t1000\t1000\nGid:\t100\t100\t100\t100\n");
+    ASSERT_EQ(symlink("/bin/app", (root + "/42/exe").c_str()), 0);
+    ASSERT_EQ(symlink("/srv", (root + "/42/cwd").c_str()), 0);
+    ASSERT_EQ(symlink("/var/log/app.log", (root + "/42/fd/1").c_str()), 0);
+    ASSERT_EQ(symlink("pipe:[777]", (root + "/42/fd/2").c_str()), 0);
+    ASSERT_EQ(symlink("socket:[555]", (root + "/42/fd/3").c_str()), 0);
+    ASSERT_EQ(symlink("anon_inode:[eventfd]", (root + "/42/fd/4096").c_str()), 0);
+    write_file(root + "/net/tcp",
+               "  sl  local_address rem_address   st tx_queue rx_queue tr tm->when retrnsmt   uid  timeout inode\n"
+               "   0: 0100007F:1F90 0200000A:01BB 01 00000000:00000000 00:00000000 00000000  1000        0 555 1\n");
+
+    ProcScanConfig config;
+    config.proc_root = root;
+    config.workers = 2;
+
+    ThreadTable table;
+    auto result = ProcScanner(config).scan(table);
+    ASSERT_TRUE(result);
+    const ProcScanStats& stats = result.value();
+    EXPECT_EQ(stats.processes, 1u);
+    EXPECT_EQ(stats.threads, 2u);
+    EXPECT_EQ(stats.fds, 4u);
+    EXPECT_EQ(stats.sockets, 1u);
+
+    ASSERT_EQ(table.size(), 2u);
+    const ThreadInfo* thread = table.find(43);
+    ASSERT_NE(thread, nullptr);
+    EXPECT_EQ(thread->pid, 42);
+    EXPECT_EQ(thread->ppid, 1);
+    EXPECT_EQ(thread->start_time, 1000000000000ULL + 250 * (1000000000ULL / sysconf(_SC_CLK_TCK)));
+
+    ProcessInfo pi = table.to_process_info(*table.find(42));
+    EXPECT_EQ(pi.exe, "/bin/app");
+    EXPECT_EQ(pi.args, std::string("/bin/app\0--flag", 15));
+    EXPECT_EQ(pi.cwd, "/srv");
+    EXPECT_EQ(pi.user, "1000");
+    EXPECT_EQ(pi.env["HOME"], "/root");
+    EXPECT_EQ(find_fd(pi, 1), "/var/log/app.log");
+    EXPECT_EQ(find_fd(pi, 2), "pipe:[777]");
+    EXPECT_EQ(find_fd(pi, 3), "127.0.0.1:8080->10.0.0.2:443");
+    EXPECT_EQ(find_fd(pi, 4096), "eventfd:[0]");
+    EXPECT_EQ(table.fd_table(43), table.fd_table(42));
+    EXPECT_EQ(table.view(*thread, ProcessField::Rss).rss_bytes, 300ULL * sysconf(_SC_PAGESIZE));
+
+    std::system(("rm -rf " + root).c_str());
+}
+
+TEST(ProcScanTest, FindsSelf) {
+    int pipefd[2];
+    ASSERT_EQ(pipe(pipefd), 0);
+
+    ThreadTable table;
+    auto result = ProcScanner().scan(table);
+    ASSERT_TRUE(result);
+    EXPECT_GE(result.value().processes, 1u);
+
+    const ThreadInfo* self = table.find(getpid());
+    ASSERT_NE(self, nullptr);
+    EXPECT_EQ(self->pid, getpid());
+    EXPECT_EQ(self->ppid, getppid());
+
+    char exe[4096];
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe));
+    ASSERT_GT(n, 0);
+    EXPECT_EQ(StringPool::instance().get(self->exe), std::string(exe, static_cast<size_t>(n)));
+
+    const FdTable* fds = table.fd_table(getpid());
+    ASSERT_NE(fds, nullptr);
+    const FdInfo* info = fds->find(pipefd[0]);
+    ASSERT_NE(info, nullptr);
+    EXPECT_EQ(info->type, FdType::Pipe);
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+}
@@ -0,0 +1,290 @@
+#include <gtest/gtest.h>
+#include <sinsp/filter_cache.h>
+#include <sinsp/ruleset.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace deepsys::sinsp;
+using deepsys::core::Event;
+using deepsys::core::StringPool;
+
+namespace {
+
+// Rewrites a 32-bit value in the body of a saved ruleset and fixes up the
+// checksum, as someone editing the file on purpose would
+void patch_ruleset(const std::string& path, size_t offset, uint32_t value) {
+    constexpr size_t HEADER = 40;
+    std::ifstream in(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    ASSERT_GT(data.size(), HEADER + offset + sizeof(value));
+    std::memcpy(&data[HEADER + offset], &value, sizeof(value));
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = HEADER; i < data.size(); ++i) {
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * 0x100000001b3ULL;
+    }
+    std::memcpy(&data[HEADER - sizeof(hash)], &hash, sizeof(hash));
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << data;
+}
+
+EventType type_of(const char* name) {
+    std::vector<EventType> types;
+    EXPECT_TRUE(find_event_types(name, types)) << name;
+    return types.empty() ? 0 : types[0];
+}
+
+} // namespace
+
+TEST(RulesetTest, SharesPredicatesAndIndexesByType) {
+    Ruleset rules;
+    ASSERT_TRUE(rules.add("shell", "evt.type = execve and proc.name = bash"));
+    ASSERT_TRUE(rules.add("shell_reversed", "proc.name = bash and evt.type = execve"));
+    ASSERT_TRUE(rules.add("etc", "evt.type = open and fd.name startswith /etc and proc.name = bash"));
+    ASSERT_TRUE(rules.add("any_bash", "proc.name = bash or proc.name = bash"));
+    ASSERT_TRUE(rules.add("not_bash", "not proc.name = bash"));
+    EXPECT_FALSE(rules.add("broken", "proc.name <"));
+    ASSERT_EQ(rules.size(), 5u);
+
+    // Four comparisons; shell and shell_reversed are one and node, any_bash
+    // is the bash comparison itself
+    Ruleset::Stats stats = rules.get_stats();
+    EXPECT_EQ(stats.predicates, 4u);
+    EXPECT_EQ(stats.nodes, 7u);
+    EXPECT_GT(stats.shared, 0u);
+
+    ThreadTable table;
+    ThreadInfo* thread = table.get_or_add(10);
+    thread->pid = 10;
+    StringPool::instance().assign(thread->exe, "/bin/bash");
+    StringPool::instance().assign(table.fd_table(10)->add(3, FdType::File)->name, "/etc/hosts");
+
+    Event event;
+    event.id = type_of("open");
+    event.pid = 10;
+    event.tid = 10;
+    std::vector<RuleId> matches;
+    rules.evaluate(make_filter_event(event, table, 3, 3), matches);
+    EXPECT_EQ(matches, (std::vector<RuleId>{2, 3}));
+
+    // The execve rules never saw the open
+    EXPECT_EQ(rules.rule_stats(0).evaluations, 0u);
+    EXPECT_EQ(rules.rule_stats(2).hits, 1u);
+
+    event.id = type_of("execve");
+    matches.clear();
+    rules.evaluate(make_filter_event(event, table), matches);
+    EXPECT_EQ(matches, (std::vector<RuleId>{0, 1, 3}));
+
+    // proc.name = bash was evaluated once per event, whichever rule needed it
+    stats = rules.get_stats();
+    EXPECT_EQ(stats.events, 2u);
+    EXPECT_EQ(stats.rule_evaluations, 3u + 4u);
+    EXPECT_EQ(stats.node_evaluations, 5u + 4u);
+    EXPECT_EQ(rules.rule_stats(4).cost_samples, 1u);
+}
+
+TEST(RulesetTest, ExtractsEachFieldOncePerEvent) {
+    Ruleset rules;
+    ASSERT_TRUE(rules.add("a", "proc.name = bash and evt.res < 0"));
+    ASSERT_TRUE(rules.add("b", "proc.name startswith ba and evt.res = -13"));
+    ASSERT_TRUE(rules.add("c", "proc.exe endswith /bash or proc.name contains sh"));
+
+    ThreadTable table;
+    StringPool::instance().assign(table.get_or_add(10)->exe, "/bin/bash");
+    Event event;
+    event.pid = 10;
+    event.tid = 10;
+    FilterEvent filter_event = make_filter_event(event, table, -13);
+
+    FieldCache fields(filter_event);
+    std::vector<RuleId> matches;
+    rules.evaluate(fields, matches);
+    EXPECT_EQ(matches, (std::vector<RuleId>{0, 1, 2}));
+    EXPECT_EQ(fields.extractions(), 3u);    // proc.name, evt.res, proc.exe
+
+    // Whoever formats the output gets them from the cache too
+    std::string_view name;
+    ASSERT_TRUE(fields.get_string(FieldId::ProcName, name));
+    EXPECT_EQ(name, "bash");
+    EXPECT_EQ(fields.extractions(), 3u);
+
+    // Next event: nothing carries over
+    event.tid = 11;
+    FilterEvent other = make_filter_event(event, table, 0);
+    fields.reset(other);
+    EXPECT_FALSE(fields.get_string(FieldId::ProcName, name));
+    EXPECT_EQ(fields.extractions(), 4u);
+}
+
+TEST(RulesetTest, GroupsContainsTestsOnOneField) {
+    Ruleset rules;
+    ASSERT_TRUE(rules.add("shells", "proc.name contains zsh or proc.name contains bash or proc.name contains fish"));
+    ASSERT_TRUE(rules.add("shells_reversed",
+                          "proc.name contains fish or evt.res = 0 or proc.name contains bash or proc.name contains zsh"));
+    ASSERT_TRUE(rules.add("dirs", "proc.exe startswith /usr or proc.exe startswith /opt or proc.exe startswith /bin"));
+
+    // One comparison for the three contains, shared by both rules, one for
+    // evt.res and one for the startswith tests
+    Ruleset::Stats stats = rules.get_stats();
+    EXPECT_EQ(stats.predicates, 3u);
+    EXPECT_EQ(stats.nodes, 4u);
+
+    ThreadTable table;
+    StringPool::instance().assign(table.get_or_add(10)->exe, "/bin/bash");
+    Event event;
+    event.pid = 10;
+    event.tid = 10;
+    std::vector<RuleId> matches;
+    rules.evaluate(make_filter_event(event, table, -1), matches);
+    EXPECT_EQ(matches, (std::vector<RuleId>{0, 1, 2}));
+    EXPECT_EQ(rules.get_stats().node_evaluations, 3u);
+
+    StringPool::instance().assign(table.get_or_add(11)->exe, "/sbin/init");
+    event.pid = 11;
+    event.tid = 11;
+    matches.clear();
+    rules.evaluate(make_filter_event(event, table, 0), matches);
+    EXPECT_EQ(matches, (std::vector<RuleId>{1}));
+}
+
+TEST(RulesetTest, ReordersOperandsBySelectivity) {
+    Ruleset rules;
+    rules.set_reorder_interval(64);
+    // Written in the worst order: the first test is always true, the last
+    // always false
+    ASSERT_TRUE(rules.add("late_reject", "proc.exe startswith /bin and proc.name contains sh and proc.pid = 99"));
+
+    ThreadTable table;
+    StringPool::instance().assign(table.get_or_add(10)->exe, "/bin/bash");
+    Event event;
+    event.pid = 10;
+    event.tid = 10;
+    FilterEvent filter_event = make_filter_event(event, table);
+
+    std::vector<RuleId> matches;
+    auto run = [&](int events) {
+        uint64_t before = rules.get_stats().node_evaluations;
+        for (int i = 0; i < events; ++i) {
+            rules.evaluate(filter_event, matches);
+        }
+        return rules.get_stats().node_evaluations - before;
+    };
+
+    EXPECT_EQ(run(64), 64u * 4);            // The chain and its three operands
+    EXPECT_GT(rules.get_stats().reorders, 0u);
+    EXPECT_EQ(run(64), 64u * 2);            // proc.pid = 99 first decides it
+    EXPECT_TRUE(matches.empty());
+}
+
+TEST(RulesetTest, LoadsSavedRuleset) {
+    Ruleset rules;
+    ASSERT_TRUE(rules.add("shell", "evt.type = execve and proc.name in (bash, sh)"));
+    ASSERT_TRUE(rules.add("etc", "evt.type = open and fd.name startswith /etc and proc.name in (bash, sh)"));
+    ASSERT_TRUE(rules.add("not_root", "not proc.pid = 1 and proc.exe contains bin"));
+
+    std::string path = "/tmp/deepsys_rules_" + std::to_string(getpid());
+    ASSERT_TRUE(rules.save(path));
+
+    uint64_t misses = FilterCache::instance().get_stats().misses;
+    Ruleset loaded;
+    ASSERT_TRUE(loaded.load(path));
+    ASSERT_EQ(loaded.size(), 3u);
+    EXPECT_EQ(loaded.name(1), "etc");
+    EXPECT_EQ(loaded.get_stats().predicates, rules.get_stats().predicates);
+    EXPECT_EQ(loaded.get_stats().nodes, rules.get_stats().nodes);
+    // Every comparison came from the cache, still held by rules
+    EXPECT_EQ(FilterCache::instance().get_stats().misses, misses);
+
+    // Rules added afterwards share what was loaded
+    size_t nodes = loaded.get_stats().nodes;
+    ASSERT_TRUE(loaded.add("bash_etc", "proc.name in (bash, sh) and evt.type = open and fd.name startswith /etc"));
+    EXPECT_EQ(loaded.get_stats().nodes, nodes);
+
+    ThreadTable table;
+    ThreadInfo* thread = table.get_or_add(10);
+    thread->pid = 10;
+    StringPool::instance().assign(thread->exe, "/bin/sh");
+    StringPool::instance().assign(table.fd_table(10)->add(3, FdType::File)->name, "/etc/shadow");
+
+    Event event;
+    event.pid = 10;
+    event.tid = 10;
+    for (const char* type : {"open", "execve", "close"}) {
+        event.id = type_of(type);
+        FilterEvent filter_event = make_filter_event(event, table, 3, 3);
+        std::vector<RuleId> expected;
+        std::vector<RuleId> matches;
+        rules.evaluate(filter_event, expected);
+        loaded.evaluate(filter_event, matches);
+        matches.erase(std::remove(matches.begin(), matches.end(), 3u), matches.end());
+        EXPECT_EQ(matches, expected) << type;
+    }
+
+    // Only into an empty ruleset, and only a whole file
+    EXPECT_FALSE(loaded.load(path));
+    FILE* file = std::fopen(path.c_str(), "r+");
+    ASSERT_NE(file, nullptr);
+    std::fseek(file, -1, SEEK_END);
+    std::fputc(0x5a, file);
+    std::fclose(file);
+    Ruleset corrupted;
+    EXPECT_FALSE(corrupted.load(path));
+    EXPECT_EQ(corrupted.size(), 0u);
+    std::remove(path.c_str());
+    EXPECT_FALSE(corrupted.load(path));
+}
+
+TEST(RulesetTest, RejectsMalformedSavedRuleset) {
+    Ruleset rules;
+    ASSERT_TRUE(rules.add("not_init", "not proc.pid = 1"));
+    std::string path = "/tmp/deepsys_bad_rules_" + std::to_string(getpid());
+    ASSERT_TRUE(rules.save(path));
+
+    // Body: event type count, node count, then per node kind, first, count
+    // and key; the children follow. Node 0 is the comparison, 1 the not.
+    std::ifstream in(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    size_t offset = 8;
+    size_t not_node = 0;
+    for (int node = 0; node < 2; ++node) {
+        not_node = offset;
+        uint32_t key_size;
+        std::memcpy(&key_size, &data[40 + offset + 9], sizeof(key_size));
+        offset += 9 + 4 + key_size;
+    }
+    size_t children = offset + 4;
+    std::string saved = data;
+
+    auto rejected = [&](size_t at, uint32_t value) {
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << saved;
+        patch_ruleset(path, at, value);
+        Ruleset loaded;
+        return !loaded.load(path) && loaded.size() == 0;
+    };
+    EXPECT_TRUE(rejected(children, 1));         // The not is its own child
+    EXPECT_TRUE(rejected(not_node + 1, 1));     // Its child past the end...
+    EXPECT_TRUE(rejected(not_node + 5, 0));     // ...or none at all
+    EXPECT_TRUE(rejected(not_node + 5, 2));
+
+    // Saved against a table whose names or flags differ
+    std::string other = saved;
+    other[24] ^= 1;
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << other;
+    Ruleset other_table;
+    EXPECT_FALSE(other_table.load(path));
+
+    // Unchanged it still loads
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << saved;
+    Ruleset loaded;
+    EXPECT_TRUE(loaded.load(path));
+    std::remove(path.c_str());
+}
@@ -0,0 +1,216 @@
+#include <gtest/gtest.h>
+#include <sinsp/sharded_inspector.h>
+
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace deepsys::sinsp;
+using deepsys::core::StringPool;
+
+namespace {
+
+ShardedEvent make_event(int32_t pid, int64_t tid, uint64_t ts, EventKind kind = EventKind::Other) {
+    ShardedEvent event;
+    event.event.id = 1;
+    event.event.pid = pid;
+    event.event.tid = tid;
+    event.event.timestamp = ts;
+    event.kind = kind;
+    return event;
+}
+
+// A pid in the given shard, above start
+int32_t pid_in_shard(const ShardedInspector& inspector, size_t shard, int32_t start) {
+    int32_t pid = start;
+    while (inspector.shard_of(pid) != shard) {
+        ++pid;
+    }
+    return pid;
+}
+
+} // namespace
+
+TEST(ShardedInspectorTest, SpscQueueKeepsOrder) {
+    SpscQueue<uint64_t> queue(64);
+    EXPECT_EQ(queue.capacity(), 64u);
+
+    constexpr uint64_t COUNT = 200000;
+    std::thread producer([&] {
+        for (uint64_t i = 0; i < COUNT; ++i) {
+            while (!queue.try_push(i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint64_t expected = 0;
+    while (expected < COUNT) {
+        uint64_t value;
+        if (queue.try_pop(value)) {
+            ASSERT_EQ(value, expected);
+            ++expected;
+        }
+    }
+    producer.join();
+    EXPECT_EQ(queue.front(), nullptr);
+}
+
+TEST(ShardedInspectorTest, CloneAndExitCrossShards) {
+    ShardedInspectorConfig config;
+    config.shards = 4;
+    ShardedInspector inspector(config);
+    StringPool& pool = StringPool::instance();
+
+    int32_t parent = pid_in_shard(inspector, 0, 100);
+    int32_t child = pid_in_shard(inspector, 1, parent + 1);
+    int32_t grandchild = pid_in_shard(inspector, 2, child + 1);
+    ASSERT_NE(inspector.shard_of(1), inspector.shard_of(parent));
+
+    ThreadTable scanned;
+    scanned.get_or_add(1)->pid = 1;
+    ThreadInfo* info = scanned.get_or_add(parent);
+    info->pid = parent;
+    pool.assign(info->exe, "/bin/bash");
+    scanned.set_parent(parent, 1);
+    pool.assign(scanned.fd_table(parent)->add(3, FdType::File)->name, "/tmp/inherited");
+    inspector.load(scanned);
+
+    // bash forks, the child execs and forks again, then bash exits
+    ShardedEvent clone = make_event(parent, parent, 10, EventKind::Clone);
+    clone.child_tid = child;
+    clone.child_pid = child;
+    ASSERT_TRUE(inspector.inspect_event(clone));
+
+    ShardedEvent exec = make_event(child, child, 11, EventKind::Exec);
+    exec.exe = pool.intern("/usr/bin/make");
+    ASSERT_TRUE(inspector.inspect_event(exec));
+
+    clone = make_event(child, child, 12, EventKind::Clone);
+    clone.child_tid = grandchild;
+    clone.child_pid = grandchild;
+    ASSERT_TRUE(inspector.inspect_event(clone));
+
+    ASSERT_TRUE(inspector.inspect_event(make_event(parent, parent, 13, EventKind::Exit)));
+    inspector.flush();
+
+    const ThreadTable& child_shard = inspector.table(inspector.shard_of(child));
+    ASSERT_NE(child_shard.find(child), nullptr);
+    EXPECT_EQ(pool.get(child_shard.find(child)->exe), "/usr/bin/make");
+    EXPECT_EQ(child_shard.find(child)->ppid, 1);
+    ASSERT_NE(child_shard.fd_table(child), nullptr);
+    EXPECT_EQ(pool.get(child_shard.fd_table(child)->find(3)->name), "/tmp/inherited");
+
+    const ThreadTable& grandchild_shard = inspector.table(inspector.shard_of(grandchild));
+    ASSERT_NE(grandchild_shard.find(grandchild), nullptr);
+    EXPECT_EQ(pool.get(grandchild_shard.find(grandchild)->exe), "/usr/bin/make");
+    EXPECT_EQ(grandchild_shard.find(grandchild)->ppid, child);
+
+    EXPECT_TRUE(inspector.table(0).find(parent)->has_exited());
+
+    ShardedInspector::Stats stats = inspector.get_stats();
+    EXPECT_EQ(stats.dispatched, 4u);
+    uint64_t handoffs = 0;
+    for (const auto& shard : stats.shards) {
+        handoffs += shard.handoffs;
+    }
+    EXPECT_EQ(handoffs, 2u);
+}
+
+TEST(ShardedInspectorTest, OrderedOutput) {
+    ShardedInspectorConfig config;
+    config.shards = 3;
+    config.queue_capacity = 256;
+    config.ordered_output = true;
+
+    // Every third event is dropped by the handler
+    ShardedInspector inspector(config, [](const ShardedEvent& event, ThreadTable&) {
+        return event.event.timestamp % 3 != 0;
+    });
+
+    std::vector<uint64_t> seen;
+    std::unordered_map<int32_t, uint64_t> last_per_process;
+    bool in_order = true;
+    auto collect = [&](const ShardedEvent& event) {
+        if (!seen.empty() && event.sequence <= seen.back()) {
+            in_order = false;
+        }
+        uint64_t& last = last_per_process[event.event.pid];
+        if (event.event.timestamp <= last) {
+            in_order = false;
+        }
+        last = event.event.timestamp;
+        seen.push_back(event.sequence);
+    };
+
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int32_t> pids(1, 50);
+    constexpr uint64_t COUNT = 20000;
+    for (uint64_t ts = 1; ts <= COUNT; ++ts) {
+        int32_t pid = pids(rng);
+        ShardedEvent event = make_event(pid, pid, ts);
+        if (ts % 10 == 0) {
+            // Forks, mostly into other shards
+            event.kind = EventKind::Clone;
+            event.child_tid = static_cast<int64_t>(1000 + ts);
+            event.child_pid = static_cast<int32_t>(1000 + ts);
+        }
+        ASSERT_TRUE(inspector.inspect_event(event));
+        inspector.poll(collect, 64);
+    }
+    inspector.flush();
+    while (inspector.poll(collect) > 0) {
+    }
+
+    EXPECT_TRUE(in_order);
+    EXPECT_EQ(seen.size(), COUNT - COUNT / 3);
+
+    size_t threads = 0;
+    for (size_t i = 0; i < inspector.shard_count(); ++i) {
+        threads += inspector.table(i).size();
+    }
+    EXPECT_EQ(threads, COUNT / 10);
+}
+
+TEST(ShardedInspectorTest, DispatcherThatPollsDoesNotStall) {
+    ShardedInspectorConfig config;
+    config.shards = 2;
+    config.queue_capacity = 256;
+    ShardedInspector inspector(config, [](const ShardedEvent&, ThreadTable&) { return true; });
+
+    // One process fills its shard's output queue and then its input queue,
+    // all before the first poll()
+    uint64_t outputs = 0;
+    auto count = [&](const ShardedEvent&) { ++outputs; };
+    constexpr uint64_t COUNT = 4 * 256;
+    for (uint64_t ts = 1; ts <= COUNT; ++ts) {
+        ASSERT_TRUE(inspector.inspect_event(make_event(42, 42, ts), count));
+    }
+    inspector.flush(count);
+    while (inspector.poll(count) > 0) {
+    }
+    EXPECT_EQ(outputs, COUNT);
+    EXPECT_GT(inspector.get_stats().input_stalls, 0u);
+}
+
+TEST(ShardedInspectorTest, RejectsEventsWithoutThreads) {
+    ShardedInspectorConfig config;
+    config.shards = 2;
+    ShardedInspector inspector(config);
+
+    ShardedEvent failed_clone = make_event(42, 42, 1, EventKind::Clone);
+    failed_clone.child_tid = -1;        // -EPERM
+    failed_clone.child_pid = -1;
+    EXPECT_FALSE(inspector.inspect_event(failed_clone));
+    failed_clone.child_tid = 43;
+    failed_clone.child_pid = 0;
+    EXPECT_FALSE(inspector.inspect_event(failed_clone));
+    EXPECT_FALSE(inspector.inspect_event(make_event(0, 0, 2)));
+    EXPECT_FALSE(inspector.inspect_event(make_event(-1, 5, 3, EventKind::Exec)));
+
+    ASSERT_TRUE(inspector.inspect_event(make_event(42, 42, 4, EventKind::Exec)));
+    inspector.flush();
+    EXPECT_EQ(inspector.get_stats().dispatched, 1u);
+    EXPECT_NE(inspector.table(inspector.shard_of(42)).find(42), nullptr);
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+#include <sinsp/state_view.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace deepsys::sinsp;
+using deepsys::core::StringPool;
+
+TEST(StateViewTest, PublishesChanges) {
+    ThreadTable table;
+    StateView view;
+
+    ThreadInfo* info = table.get_or_add(100);
+    info->pid = 100;
+    StringPool::instance().assign(info->exe, "/usr/bin/app");
+    table.get_or_add(101)->pid = 100;
+    StringPool::instance().assign(table.fd_table(100)->add(3, FdType::File)->name, "/var/log/app.log");
+    table.fd_table(100)->add(5000, FdType::Pipe)->ino = 77;
+    view.publish_all(table);
+
+    auto guard = view.read();
+    ASSERT_EQ(view.size(), 2u);
+    const ThreadRecord* record = view.find(guard, 101);
+    ASSERT_NE(record, nullptr);
+    EXPECT_EQ(record->pid, 100);
+    EXPECT_EQ(view.find(guard, 102), nullptr);
+    ASSERT_NE(view.find_fd(guard, 100, 5000), nullptr);
+    EXPECT_EQ(view.find_fd(guard, 100, 5000)->ino, 77u);
+    EXPECT_EQ(view.find_fd(guard, 100, 4), nullptr);
+
+    const ThreadRecord* main = view.find(guard, 100);
+    ASSERT_NE(main, nullptr);
+    ProcessInfo process = view.to_process_info(guard, *main);
+    EXPECT_EQ(process.exe, "/usr/bin/app");
+    ASSERT_EQ(process.open_fds.size(), 2u);
+    EXPECT_EQ(process.open_fds[0], "3 /var/log/app.log");
+
+    size_t processes = 0;
+    view.visit_processes(guard, ProcessField::Exe, [&](const ProcessView& projected) {
+        EXPECT_EQ(projected.exe, "/usr/bin/app");
+        EXPECT_TRUE(projected.cwd.empty());
+        return ++processes > 0;
+    });
+    EXPECT_EQ(processes, 1u);
+
+    // Unpublished changes stay invisible, and what readers already hold
+    // stays valid across the publish
+    table.fd_table(100)->erase(3);
+    StringPool::instance().assign(info->exe, "/usr/bin/other");
+    EXPECT_NE(view.find_fd(guard, 100, 3), nullptr);
+
+    view.touch(100);
+    view.touch_fd(100, 3);
+    table.erase(101);
+    view.touch(101);
+    view.publish(table);
+
+    EXPECT_EQ(record->pid, 100);
+    EXPECT_EQ(StringPool::instance().get(main->exe), "/usr/bin/app");
+    EXPECT_EQ(view.size(), 1u);
+    EXPECT_EQ(view.find(guard, 101), nullptr);
+    EXPECT_EQ(StringPool::instance().get(view.find(guard, 100)->exe), "/usr/bin/other");
+    EXPECT_EQ(view.find_fd(guard, 100, 3), nullptr);
+    EXPECT_NE(view.find_fd(guard, 100, 5000), nullptr);
+
+    // Only the changed page was copied
+    EXPECT_EQ(view.get_stats().pages_copied, 2u);
+}
+
+TEST(StateViewTest, ReadersDuringChurn) {
+    ThreadTable table;
+    StateView view;
+    std::atomic<bool> stop{false};
+    std::atomic<int> bad{0};
+    std::atomic<uint64_t> reads{0};
+
+    // Readers check invariants the writer keeps at every publish: each
+    // thread's pid and start time derive from its tid, and fd 1 of process p
+    // has inode p
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; ++t) {
+        readers.emplace_back([&] {
+            while (!stop.load(std::memory_order_relaxed)) {
+                auto guard = view.read();
+                view.for_each(guard, [&](const ThreadRecord& record) {
+                    if (record.pid != record.tid / 4 * 4 || record.start_time != static_cast<uint64_t>(record.tid)) {
+                        ++bad;
+                    }
+                    const FdInfo* fd = view.find_fd(guard, record.pid, 1);
+                    if (fd && fd->ino != static_cast<uint64_t>(record.pid)) {
+                        ++bad;
+                    }
+                });
+                ++reads;
+            }
+        });
+    }
+
+    for (int round = 0; round < 2000; ++round) {
+        for (int k = 0; k < 8; ++k) {
+            deepsys::core::ThreadID tid = (round * 8 + k) % 512;
+            if (table.find(tid)) {
+                table.erase(tid);
+            } else {
+                ThreadInfo* info = table.get_or_add(tid);
+                info->pid = static_cast<int32_t>(tid / 4 * 4);
+                info->start_time = static_cast<uint64_t>(tid);
+                if (table.find(info->pid)) {
+                    table.fd_table(info->pid)->add(1, FdType::Pipe)->ino = static_cast<uint64_t>(info->pid);
+                    view.touch_fd(info->pid, 1);
+                }
+            }
+            view.touch(tid);
+            view.touch_fd(static_cast<int32_t>(tid / 4 * 4), 1);
+        }
+        view.publish(table);
+    }
+    while (reads.load() < 100) {
+        std::this_thread::yield();
+    }
+    stop = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_EQ(bad, 0);
+    EXPECT_EQ(view.size(), table.size());
+}
@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include <sinsp/string_match.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace deepsys::sinsp;
+
+namespace {
+
+std::string lower(std::string text) {
+    for (char& c : text) {
+        if (c >= 'A' && c <= 'Z') {
+            c = static_cast<char>(c - 'A' + 'a');
+        }
+    }
+    return text;
+}
+
+} // namespace
+
+TEST(StringMatchTest, SubstringSearchAgreesWithFind) {
+    // A small alphabet makes near misses common, and the lengths cover both
+    // the vector loop and the scalar tail
+    std::mt19937 rng(42);
+    auto random_text = [&](size_t size) {
+        std::string text(size, 'a');
+        for (char& c : text) {
+            c = "abAB/"[rng() % 5];
+        }
+        return text;
+    };
+    for (int i = 0; i < 20000; ++i) {
+        std::string haystack = random_text(rng() % 100);
+        std::string needle = random_text(rng() % 6);
+        EXPECT_EQ(find_substring(haystack, needle), haystack.find(needle)) << haystack << " / " << needle;
+
+        std::string folded = lower(needle);
+        EXPECT_EQ(icontains(haystack, folded), lower(haystack).find(folded) != std::string::npos)
+            << haystack << " / " << needle;
+    }
+    EXPECT_NE(std::string(string_match_isa()), "");
+}
+
+TEST(StringMatchTest, MatchesLists) {
+    std::vector<std::string> values;
+    for (int i = 0; i < 500; ++i) {
+        values.push_back("/usr/lib/file" + std::to_string(i));
+    }
+    StringSet set(values);
+    EXPECT_EQ(set.size(), 500u);
+    EXPECT_TRUE(set.contains("/usr/lib/file0"));
+    EXPECT_TRUE(set.contains("/usr/lib/file499"));
+    EXPECT_FALSE(set.contains("/usr/lib/file500"));
+    EXPECT_FALSE(set.contains(""));
+
+    PathPrefixSet prefixes({"/etc", "/usr/lib/", "/var/run/docker.sock"});
+    EXPECT_TRUE(prefixes.match("/etc"));
+    EXPECT_TRUE(prefixes.match("/etc/passwd"));
+    EXPECT_TRUE(prefixes.match("/usr/lib/x86_64/libc.so"));
+    EXPECT_TRUE(prefixes.match("/var/run/docker.sock"));
+    EXPECT_FALSE(prefixes.match("/etcd/conf"));
+    EXPECT_FALSE(prefixes.match("/usr/libexec"));
+    EXPECT_FALSE(prefixes.match("/var/run"));
+    EXPECT_TRUE(PathPrefixSet({"/"}).match("/tmp/x"));
+
+    MultiMatcher automaton({"he", "she", "hers", "his"});
+    EXPECT_TRUE(automaton.search("ushers"));
+    EXPECT_TRUE(automaton.search("ahishe"));
+    EXPECT_FALSE(automaton.search("hxs hr"));
+    EXPECT_FALSE(automaton.search(""));
+    EXPECT_TRUE(MultiMatcher({"x", ""}).search("abc"));
+    EXPECT_FALSE(MultiMatcher({}).search("abc"));
+
+    // Failure links: "bcd" is found after "abce" fails at the e
+    EXPECT_TRUE(MultiMatcher({"abce", "bcd"}).search("abcd"));
+
+    // Needles using every byte value need a class past 255
+    std::string every_byte;
+    for (int c = 0; c < 256; ++c) {
+        every_byte += static_cast<char>(c);
+    }
+    MultiMatcher binary({every_byte, std::string("\xff\xff")});
+    EXPECT_TRUE(binary.search(std::string("a\xff\xff")));
+    EXPECT_TRUE(binary.search("x" + every_byte));
+    EXPECT_FALSE(binary.search(std::string(2, '\0')));
+}
+
+TEST(StringMatchTest, GlobsMatchBySegments) {
+    struct Case {
+        const char* pattern;
+        const char* text;
+        bool match;
+    };
+    for (const Case& c : std::vector<Case>{{"/etc/*wd", "/etc/passwd", true},
+                                           {"/etc/*wd", "/etc/passwd.bak", false},
+                                           {"*.so*", "/lib/libc.so.6", true},
+                                           {"a*b*c", "abc", true},
+                                           {"a*b*c", "acb", false},
+                                           {"ab*ba", "aba", false},
+                                           {"*", "", true},
+                                           {"exact", "exact", true},
+                                           {"exact", "exactly", false},
+                                           {"/tmp/?", "/tmp/a", true},
+                                           {"/tmp/?*", "/tmp/", false}}) {
+        EXPECT_EQ(GlobMatcher(c.pattern).match(c.text), c.match) << c.pattern << " / " << c.text;
+    }
+}
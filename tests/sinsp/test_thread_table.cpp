@@ -0,0 +1,304 @@
+#include <gtest/gtest.h>
+#include <sinsp/thread_table.h>
+
+#include <algorithm>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+using namespace deepsys::sinsp;
+using deepsys::core::StringPool;
+
+TEST(ThreadTableTest, AddFindErase) {
+    ThreadTable table(4);
+
+    bool added = false;
+    ThreadInfo* info = table.get_or_add(100, &added);
+    ASSERT_NE(info, nullptr);
+    EXPECT_TRUE(added);
+    info->pid = 100;
+    StringPool::instance().assign(info->exe, "/usr/bin/bash");
+
+    EXPECT_EQ(table.get_or_add(100, &added), info);
+    EXPECT_FALSE(added);
+    EXPECT_EQ(table.find(100), info);
+    EXPECT_EQ(table.find(101), nullptr);
+    EXPECT_EQ(StringPool::instance().get(table.find(100)->exe), "/usr/bin/bash");
+
+    // Other tables may hold the same string, so only the difference counts
+    deepsys::core::StringHandle exe = info->exe;
+    StringPool::instance().retain(exe);
+    uint32_t refs = StringPool::instance().ref_count(exe);
+    EXPECT_TRUE(table.erase(100));
+    EXPECT_EQ(StringPool::instance().ref_count(exe), refs - 1);
+    StringPool::instance().release(exe);
+
+    EXPECT_FALSE(table.erase(100));
+    EXPECT_EQ(table.find(100), nullptr);
+    EXPECT_TRUE(table.empty());
+}
+
+TEST(ThreadTableTest, ChurnMatchesReference) {
+    // Sequential tids with heavy churn, checked against a std::unordered_map,
+    // exercises growth and backward shift deletion
+    ThreadTable table(16);
+    std::unordered_map<int64_t, int32_t> reference;
+    std::mt19937_64 rng(42);
+
+    for (int i = 0; i < 200000; ++i) {
+        int64_t tid = static_cast<int64_t>(rng() % 50000);
+        if (rng() % 3 == 0) {
+            EXPECT_EQ(table.erase(tid), reference.erase(tid) == 1);
+        } else {
+            table.get_or_add(tid)->pid = static_cast<int32_t>(tid / 4);
+            reference[tid] = static_cast<int32_t>(tid / 4);
+        }
+    }
+
+    ASSERT_EQ(table.size(), reference.size());
+    for (const auto& [tid, pid] : reference) {
+        const ThreadInfo* info = table.find(tid);
+        ASSERT_NE(info, nullptr);
+        EXPECT_EQ(info->pid, pid);
+    }
+
+    size_t visited = 0;
+    table.for_each([&](const ThreadInfo& info) {
+        EXPECT_EQ(reference.count(info.tid), 1u);
+        ++visited;
+    });
+    EXPECT_EQ(visited, reference.size());
+}
+
+TEST(ThreadTableTest, ToProcessInfo) {
+    ThreadTable table;
+    ThreadInfo* info = table.get_or_add(7);
+    info->pid = 7;
+    info->ppid = 3;
+    StringPool::instance().assign(info->cwd, "/root");
+    StringPool::instance().assign(info->env, std::string("HOME=/root\0TERM=xterm=256", 25));
+
+    ProcessInfo pi = table.to_process_info(*info);
+    EXPECT_EQ(pi.tid, 7);
+    EXPECT_EQ(pi.ppid, 3);
+    EXPECT_EQ(pi.cwd, "/root");
+    EXPECT_EQ(pi.exe, "");
+    ASSERT_EQ(pi.env.size(), 2u);
+    EXPECT_EQ(pi.env["HOME"], "/root");
+    EXPECT_EQ(pi.env["TERM"], "xterm=256");
+}
+
+namespace {
+
+ThreadInfo* add_process(ThreadTable& table, int64_t pid, int32_t ppid) {
+    ThreadInfo* info = table.get_or_add(pid);
+    info->pid = static_cast<int32_t>(pid);
+    table.set_parent(pid, ppid);
+    return info;
+}
+
+std::vector<int64_t> children(const ThreadTable& table, int32_t pid) {
+    std::vector<int64_t> out;
+    table.for_each_child(pid, [&](const ThreadInfo& info) { out.push_back(info.tid); });
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+} // namespace
+
+TEST(ThreadTableTest, ProcessTree) {
+    ThreadTable table;
+    add_process(table, 1, 0);
+    add_process(table, 10, 1);
+    add_process(table, 20, 10);
+    add_process(table, 21, 10);
+    add_process(table, 30, 20);
+    table.get_or_add(31)->pid = 30;
+    table.set_parent(31, 20);
+
+    EXPECT_EQ(children(table, 10), (std::vector<int64_t>{20, 21}));
+    EXPECT_TRUE(table.is_descendant_of(31, 10));
+    EXPECT_TRUE(table.is_descendant_of(31, 30));
+    EXPECT_FALSE(table.is_descendant_of(31, 21));
+    EXPECT_FALSE(table.is_descendant_of(10, 20));
+
+    std::vector<int64_t> subtree;
+    table.for_each_descendant(1, [&](const ThreadInfo& info) { subtree.push_back(info.tid); });
+    std::sort(subtree.begin(), subtree.end());
+    EXPECT_EQ(subtree, (std::vector<int64_t>{10, 20, 21, 30}));
+
+    // Reparenting moves the whole subtree
+    table.set_parent(20, 1);
+    EXPECT_EQ(children(table, 1), (std::vector<int64_t>{10, 20}));
+    EXPECT_FALSE(table.is_descendant_of(30, 10));
+
+    // A pid reused under its own descendant isn't linked into a cycle
+    table.set_parent(1, 30);
+    EXPECT_TRUE(table.is_descendant_of(30, 1));
+    EXPECT_FALSE(table.is_descendant_of(1, 30));
+
+    // Exiting detaches the children until they're reparented
+    table.erase(10);
+    EXPECT_FALSE(table.is_descendant_of(21, 1));
+    table.set_parent(21, 1);
+    EXPECT_EQ(children(table, 1), (std::vector<int64_t>{20, 21}));
+}
+
+TEST(ThreadTableTest, ProcessTreeMatchesPpid) {
+    // Random forest with churn, ancestry checked against walking ppids
+    ThreadTable table;
+    std::mt19937 rng(3);
+    std::vector<int32_t> live = {1};
+    add_process(table, 1, 0);
+
+    for (int i = 0; i < 5000; ++i) {
+        if (rng() % 4 == 0 && live.size() > 1) {
+            size_t victim = 1 + rng() % (live.size() - 1);
+            int32_t pid = live[victim];
+            // Children of an exiting process get reparented to init
+            std::vector<int64_t> orphans = children(table, pid);
+            table.erase(pid);
+            for (int64_t orphan : orphans) {
+                table.set_parent(orphan, 1);
+            }
+            live.erase(live.begin() + static_cast<long>(victim));
+        } else {
+            int32_t pid = 2 + i;
+            add_process(table, pid, live[rng() % live.size()]);
+            live.push_back(pid);
+        }
+    }
+
+    table.rebuild_process_tree();
+    for (int check = 0; check < 2000; ++check) {
+        int32_t pid = live[rng() % live.size()];
+        int32_t ancestor = live[rng() % live.size()];
+
+        bool expected = false;
+        for (const ThreadInfo* info = table.find(pid); info; info = table.find(info->ppid)) {
+            if (info->pid == ancestor) {
+                expected = true;
+                break;
+            }
+        }
+        EXPECT_EQ(table.is_descendant_of(pid, ancestor), expected);
+    }
+
+    size_t descendants = 0;
+    table.for_each_descendant(1, [&](const ThreadInfo&) { ++descendants; });
+    EXPECT_EQ(descendants, live.size() - 1);
+}
+
+TEST(ThreadTableTest, ExitedThreadsExpire) {
+    constexpr uint64_t SECOND = 1000000000ULL;
+    ThreadTable table;
+    table.set_time(10 * SECOND);
+
+    for (int64_t tid : {100, 101, 102}) {
+        table.get_or_add(tid)->pid = 100;
+    }
+    EXPECT_TRUE(table.mark_exited(101));
+    EXPECT_FALSE(table.mark_exited(101));
+    EXPECT_FALSE(table.mark_exited(999));
+
+    // Late events still find the thread during its grace window
+    table.set_time(14 * SECOND);
+    ASSERT_NE(table.find(101), nullptr);
+    EXPECT_TRUE(table.find(101)->has_exited());
+    EXPECT_EQ(table.get_stats().exited_threads, 1u);
+
+    // An exited thread erased directly leaves nothing behind
+    table.mark_exited(102);
+    table.erase(102);
+
+    table.set_time(16 * SECOND);
+    EXPECT_EQ(table.find(101), nullptr);
+    EXPECT_NE(table.find(100), nullptr);
+
+    ThreadTable::Stats stats = table.get_stats();
+    EXPECT_EQ(stats.threads, 1u);
+    EXPECT_EQ(stats.exited_threads, 0u);
+    EXPECT_EQ(stats.expired_threads, 1u);
+}
+
+TEST(ThreadTableTest, BudgetEvictsExitedThenLruFds) {
+    constexpr uint64_t SECOND = 1000000000ULL;
+    ThreadTable table(16);
+    table.set_time(1 * SECOND);
+
+    table.get_or_add(100)->pid = 100;
+    for (int32_t fd = 0; fd < 512; ++fd) {
+        table.add_fd(100, fd, FdType::File);
+    }
+    for (int64_t tid = 200; tid < 210; ++tid) {
+        table.get_or_add(tid)->pid = static_cast<int32_t>(tid);
+        table.mark_exited(tid);
+    }
+
+    // The low fds stay busy
+    table.set_time(2 * SECOND);
+    for (int32_t fd = 0; fd < 128; ++fd) {
+        ASSERT_NE(table.find_fd(100, fd), nullptr);
+    }
+
+    ThreadTable::Stats before = table.get_stats();
+    EXPECT_EQ(before.fds, 512u);
+    EXPECT_EQ(before.used_bytes, before.index_bytes + before.thread_bytes + before.fd_bytes);
+    EXPECT_GE(before.reserved_bytes, before.used_bytes);
+
+    ThreadTableLimits limits;
+    limits.memory_budget = before.used_bytes - 300 * sizeof(FdInfo);
+    table.set_limits(limits);
+    table.trim();
+
+    ThreadTable::Stats after = table.get_stats();
+    EXPECT_EQ(after.evicted_threads, 10u);
+    EXPECT_EQ(after.exited_threads, 0u);
+    EXPECT_GT(after.evicted_fds, 0u);
+    EXPECT_LE(after.used_bytes, limits.memory_budget - limits.memory_budget / 10);
+    for (int32_t fd = 0; fd < 128; ++fd) {
+        EXPECT_NE(table.find_fd(100, fd), nullptr) << fd;
+    }
+    EXPECT_EQ(table.find_fd(100, 128), nullptr);
+
+    // Within budget nothing else goes
+    table.trim();
+    EXPECT_EQ(table.get_stats().evicted_fds, after.evicted_fds);
+}
+
+TEST(ThreadTableTest, VisitorsProjectFields) {
+    ThreadTable table;
+    for (int64_t tid : {100, 101, 200}) {
+        ThreadInfo* info = table.get_or_add(tid);
+        info->pid = tid == 101 ? 100 : static_cast<int32_t>(tid);
+        StringPool::instance().assign(info->exe, tid == 200 ? "/bin/b" : "/bin/a");
+        StringPool::instance().assign(info->cwd, "/tmp");
+    }
+    table.find(100)->rss_kb = 8;
+
+    std::vector<int64_t> tids;
+    for (const ThreadInfo& info : table) {
+        tids.push_back(info.tid);
+    }
+    std::sort(tids.begin(), tids.end());
+    EXPECT_EQ(tids, (std::vector<int64_t>{100, 101, 200}));
+
+    // Only what was asked for is filled in; rss comes from the main thread
+    ProcessView view = table.view(*table.find(101), ProcessField::Exe | ProcessField::Rss);
+    EXPECT_EQ(view.pid, 100);
+    EXPECT_EQ(view.exe, "/bin/a");
+    EXPECT_TRUE(view.cwd.empty());
+    EXPECT_EQ(view.rss_bytes, 8192u);
+
+    std::vector<int32_t> pids;
+    table.visit_processes(ProcessField::Exe, [&](const ProcessView& process) {
+        pids.push_back(process.pid);
+        return true;
+    });
+    std::sort(pids.begin(), pids.end());
+    EXPECT_EQ(pids, (std::vector<int32_t>{100, 200}));
+
+    size_t visited = 0;
+    table.visit_threads(ProcessFields(), [&](const ProcessView&) { return ++visited < 2; });
+    EXPECT_EQ(visited, 2u);
+}